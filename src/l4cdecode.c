@@ -0,0 +1,872 @@
+#include <assert.h>
+#include <err.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <mnl4c.h>
+
+#include "config.h"
+#include "l4cfmt.h"
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#define FAIL(s) do {perror(s); abort(); } while (0)
+
+#define L4CDECODE_BUFSZ (128 * 1024)
+#define L4CDECODE_FOLLOW_USEC 200000
+#define L4CDECODE_ZSTD_MAGIC "\x28\xb5\x2f\xfd"
+
+/*
+ * An input file, plain or a sequence of zstd frames (MNL4C_OPEN_ZSTD).
+ */
+typedef struct _l4cdecode_src {
+    FILE *fp;
+    const char *fname;
+    bool follow;
+    char *in;
+    size_t inpos;
+    size_t inend;
+#ifdef HAVE_ZSTD
+    ZSTD_DCtx *dctx;
+    char *out;
+    size_t outsz;
+    size_t outpos;
+    size_t outend;
+    /* the last frame is not complete */
+    bool partial;
+#endif
+    bool zstd;
+} l4cdecode_src_t;
+
+typedef struct _l4cdecode_msg {
+    char *mid;
+    char *sig;
+    char *name;
+    char *fmt;
+} l4cdecode_msg_t;
+
+static l4cdecode_msg_t *catalog;
+static size_t ncatalog;
+
+
+static struct option optinfo[] = {
+#define L4CDECODE_OPT_HELP      0
+    {"help", no_argument, NULL, 'h'},
+#define L4CDECODE_OPT_VERSION   1
+    {"version", no_argument, NULL, 'V'},
+#define L4CDECODE_OPT_CATALOG   2
+    {"catalog", required_argument, NULL, 'c'},
+#define L4CDECODE_OPT_VERBOSE   3
+    {"verbose", no_argument, NULL, 'v'},
+#define L4CDECODE_OPT_FOLLOW    4
+    {"follow", no_argument, NULL, 'f'},
+#define L4CDECODE_OPT_TEXT      5
+    {"text", no_argument, NULL, 't'},
+#define L4CDECODE_OPT_SIDECAR   6
+    {"sidecar", no_argument, NULL, 's'},
+    {NULL, 0, NULL, 0},
+};
+
+
+static int verbose;
+static char *catpath;
+static bool follow;
+static bool text;
+static bool sidecar;
+
+static void
+usage(char *p)
+{
+    printf("Usage: %s OPTIONS [FILE ...]\n"
+"\n"
+"Render MNL4C_OPEN_BINARY logs as text.  Reads standard input if no\n"
+"FILE is given.  Logs written with MNL4C_OPEN_ZSTD are decompressed.\n"
+"\n"
+"Options:\n"
+"  --help|-h                    Show this message and exit.\n"
+"  --version|-V                 Print version and exit.\n"
+"  --catalog=PATH|-cPATH        Message catalog generated by l4cdefgen.\n"
+"                               Required unless --text is given.\n"
+"  --follow|-f                  Keep reading the last FILE as it grows.\n"
+"  --text|-t                    Copy the (decompressed) log as is, for\n"
+"                               text logs.\n"
+"  --sidecar|-s                 FILE is a crash sidecar, see\n"
+"                               mnl4c_set_crash_flush().  Output of text\n"
+"                               loggers is copied, that of binary ones\n"
+"                               is decoded if --catalog is given.\n"
+"  --verbose|-v                 Increase verbosity.\n"
+,
+        basename(p));
+}
+
+
+static void
+load_catalog(const char *fname)
+{
+    FILE *fp;
+    char *line;
+    size_t linesz;
+    ssize_t nread;
+
+    if ((fp = fopen(fname, "r")) == NULL) {
+        err(1, "Cannot open %s", fname);
+    }
+
+    line = NULL;
+    linesz = 0;
+    while ((nread = getline(&line, &linesz, fp)) > 0) {
+        char *a[5];
+        char *p;
+        int i;
+        long id;
+        l4cdecode_msg_t *msg;
+
+        if (line[nread - 1] == '\n') {
+            line[nread - 1] = '\0';
+        }
+        /* the format literal is the rest of the line */
+        for (i = 0, p = line; i < 5; ++i) {
+            a[i] = p;
+            if (i < 4) {
+                if ((p = strchr(p, '\t')) == NULL) {
+                    break;
+                }
+                *p++ = '\0';
+            }
+        }
+        if (i < 5) {
+            if (verbose) {
+                fprintf(stderr, "skipping invalid line: \"%s\"\n", line);
+            }
+            continue;
+        }
+
+        if ((id = strtol(a[0], NULL, 10)) < 0 || id >= MNL4C_BIN_ID_TEXT) {
+            continue;
+        }
+        if ((size_t)id >= ncatalog) {
+            size_t sz;
+
+            sz = id + 1;
+            if ((catalog = realloc(catalog, sz * sizeof(*catalog))) == NULL) {
+                FAIL("realloc");
+            }
+            memset(catalog + ncatalog,
+                   '\0',
+                   (sz - ncatalog) * sizeof(*catalog));
+            ncatalog = sz;
+        }
+        msg = catalog + id;
+        free(msg->mid);
+        free(msg->sig);
+        free(msg->name);
+        free(msg->fmt);
+        msg->mid = strdup(a[1]);
+        msg->sig = strdup(strcmp(a[2], "-") == 0 ? "" : a[2]);
+        if ((msg->name = l4cfmt_unquote(a[3])) == NULL) {
+            FAIL("l4cfmt_unquote");
+        }
+        if ((msg->fmt = l4cfmt_unquote(a[4])) == NULL) {
+            FAIL("l4cfmt_unquote");
+        }
+    }
+
+    free(line);
+    fclose(fp);
+}
+
+
+#define DECODE_GET(p, end, ty, v)      \
+    do {                               \
+        if ((p) + sizeof(ty) > (end)) {\
+            return -1;                 \
+        }                              \
+        memcpy(&(v), (p), sizeof(ty)); \
+        (p) += sizeof(ty);             \
+    } while (0)                        \
+
+
+#define DECODE_PRINTF(out, spec, fmt, star, v)                 \
+    ((spec)->nstar == 0 ? fprintf(out, fmt, v) :               \
+     (spec)->nstar == 1 ? fprintf(out, fmt, (star)[0], v) :    \
+     fprintf(out, fmt, (star)[0], (star)[1], v))               \
+
+
+/*
+ * Renders fmt taking the arguments from the record payload [p, end), one
+ * conversion at a time.
+ */
+static int
+render_msg(FILE *out, const char *fmt, const char *p, const char *end)
+{
+    l4cfmt_spec_t spec;
+    const char *next;
+
+    while ((next = l4cfmt_next(fmt, &spec)) != NULL) {
+        char sub[64];
+        int32_t star[2];
+        int i;
+
+        (void)fwrite(fmt, 1, spec.start - fmt, out);
+        fmt = next;
+
+        if (spec.sig == L4CFMT_SIG_NONE) {
+            if (spec.conv == '%') {
+                (void)fputc('%', out);
+            } else {
+                /* %m was meaningful only at the log site */
+                (void)fwrite(spec.start, 1, spec.sz, out);
+            }
+            continue;
+        }
+
+        if (spec.sig == L4CFMT_SIG_UNSUPPORTED || spec.sz >= sizeof(sub)) {
+            return -1;
+        }
+        memcpy(sub, spec.start, spec.sz);
+        sub[spec.sz] = '\0';
+
+        for (i = 0; i < spec.nstar; ++i) {
+            DECODE_GET(p, end, int32_t, star[i]);
+        }
+
+        switch (spec.sig) {
+        case L4CFMT_SIG_INT:
+            {
+                int32_t v;
+
+                DECODE_GET(p, end, int32_t, v);
+                (void)DECODE_PRINTF(out, &spec, sub, star, (int)v);
+            }
+            break;
+
+        case L4CFMT_SIG_LONG:
+        case L4CFMT_SIG_LLONG:
+        case L4CFMT_SIG_INTMAX:
+        case L4CFMT_SIG_SIZE:
+        case L4CFMT_SIG_PTRDIFF:
+            {
+                int64_t v;
+
+                DECODE_GET(p, end, int64_t, v);
+                switch (spec.sig) {
+                case L4CFMT_SIG_LONG:
+                    (void)DECODE_PRINTF(out, &spec, sub, star, (long)v);
+                    break;
+
+                case L4CFMT_SIG_LLONG:
+                    (void)DECODE_PRINTF(out,
+                                        &spec,
+                                        sub,
+                                        star,
+                                        (long long)v);
+                    break;
+
+                case L4CFMT_SIG_INTMAX:
+                    (void)DECODE_PRINTF(out, &spec, sub, star, (intmax_t)v);
+                    break;
+
+                case L4CFMT_SIG_SIZE:
+                    (void)DECODE_PRINTF(out, &spec, sub, star, (size_t)v);
+                    break;
+
+                default:
+                    (void)DECODE_PRINTF(out, &spec, sub, star, (ptrdiff_t)v);
+                    break;
+                }
+            }
+            break;
+
+        case L4CFMT_SIG_DOUBLE:
+            {
+                double v;
+
+                DECODE_GET(p, end, double, v);
+                (void)DECODE_PRINTF(out, &spec, sub, star, v);
+            }
+            break;
+
+        case L4CFMT_SIG_LDOUBLE:
+            {
+                long double v;
+
+                DECODE_GET(p, end, long double, v);
+                (void)DECODE_PRINTF(out, &spec, sub, star, v);
+            }
+            break;
+
+        case L4CFMT_SIG_PTR:
+            {
+                uint64_t v;
+
+                DECODE_GET(p, end, uint64_t, v);
+                (void)DECODE_PRINTF(out,
+                                    &spec,
+                                    sub,
+                                    star,
+                                    (void *)(uintptr_t)v);
+            }
+            break;
+
+        case L4CFMT_SIG_STR:
+            {
+                uint32_t sz;
+                char *s;
+
+                DECODE_GET(p, end, uint32_t, sz);
+                if (sz == UINT32_MAX) {
+                    (void)DECODE_PRINTF(out, &spec, sub, star, "(null)");
+                    break;
+                }
+                if (p + sz > end) {
+                    return -1;
+                }
+                if ((s = strndup(p, sz)) == NULL) {
+                    FAIL("strndup");
+                }
+                (void)DECODE_PRINTF(out, &spec, sub, star, s);
+                free(s);
+                p += sz;
+            }
+            break;
+
+        default:
+            return -1;
+        }
+    }
+
+    (void)fputs(fmt, out);
+    return 0;
+}
+
+
+static void
+render_record(FILE *out, mnl4c_bin_hdr_t *hdr, const char *payload)
+{
+    l4cdecode_msg_t *msg;
+    double curtm;
+    const char *level;
+    const char *end;
+    char tag[16];
+
+    if (hdr->id == MNL4C_BIN_ID_TEXT) {
+        (void)fwrite(payload, 1, hdr->len, out);
+        return;
+    }
+
+    if (hdr->id >= ncatalog || catalog[hdr->id].fmt == NULL) {
+        fprintf(out, "<unknown message %d>\n", hdr->id);
+        return;
+    }
+    msg = catalog + hdr->id;
+    end = payload + hdr->len;
+
+    tag[0] = '\0';
+    if (hdr->flags & MNL4C_BIN_FSAMPLED) {
+        uint32_t n;
+
+        if (hdr->len < sizeof(n)) {
+            fprintf(out, "<cannot decode %s>\n", msg->mid);
+            return;
+        }
+        memcpy(&n, payload, sizeof(n));
+        payload += sizeof(n);
+        (void)snprintf(tag, sizeof(tag), "@%u", n);
+    }
+
+    curtm = (double)hdr->ts / 1000000000.0;
+    level = hdr->level < countof(level_names) ?
+        level_names[hdr->level] : "<unknown>";
+
+    if (hdr->flags & (MNL4C_BIN_FTS_LT | MNL4C_BIN_FTS_LT2)) {
+        time_t now;
+        struct tm tm;
+        char now_str[32];
+
+        now = (time_t)curtm;
+        (void)localtime_r(&now, &tm);
+        (void)strftime(now_str, sizeof(now_str), "%Y-%m-%d %H:%M:%S", &tm);
+        if (hdr->flags & MNL4C_BIN_FTS_LT) {
+            fprintf(out,
+                    "%s [%d] %s %s%s: ",
+                    now_str,
+                    hdr->pid,
+                    msg->name,
+                    level,
+                    tag);
+        } else {
+            fprintf(out,
+                    "%lf %s [%d] %s %s%s: ",
+                    curtm,
+                    now_str,
+                    hdr->pid,
+                    msg->name,
+                    level,
+                    tag);
+        }
+    } else if (hdr->flags & MNL4C_BIN_FTHROTTLED) {
+        fprintf(out,
+                "%.06lf [%d] %s %s[%d]%s: ",
+                curtm,
+                hdr->pid,
+                msg->name,
+                level,
+                (int)hdr->nthrottled,
+                tag);
+    } else {
+        fprintf(out,
+                "%.06lf [%d] %s %s%s: ",
+                curtm,
+                hdr->pid,
+                msg->name,
+                level,
+                tag);
+    }
+
+    if (render_msg(out, msg->fmt, payload, end) != 0) {
+        fprintf(out, "<cannot decode %s>", msg->mid);
+    }
+    (void)fputc('\n', out);
+}
+
+
+/*
+ * Reads more of the file into src->in, waiting for it to grow when
+ * following.  Returns 0 at the end of the file.
+ */
+static size_t
+src_fill(l4cdecode_src_t *src)
+{
+    size_t nread;
+
+    if (src->inpos == src->inend) {
+        src->inpos = 0;
+        src->inend = 0;
+    }
+    while ((nread = fread(src->in + src->inend,
+                          1,
+                          L4CDECODE_BUFSZ - src->inend,
+                          src->fp)) == 0 && src->follow) {
+        (void)fflush(stdout);
+        clearerr(src->fp);
+        (void)usleep(L4CDECODE_FOLLOW_USEC);
+    }
+    src->inend += nread;
+    return nread;
+}
+
+
+static int
+src_init(l4cdecode_src_t *src, FILE *fp, const char *fname, bool follow)
+{
+    src->fp = fp;
+    src->fname = fname;
+    src->follow = follow;
+    if ((src->in = malloc(L4CDECODE_BUFSZ)) == NULL) {
+        FAIL("malloc");
+    }
+    src->inpos = 0;
+    src->inend = 0;
+    src->zstd = false;
+
+    /* enough to tell a zstd frame */
+    while (src->inend < sizeof(L4CDECODE_ZSTD_MAGIC) - 1) {
+        if (src_fill(src) == 0) {
+            break;
+        }
+    }
+    if (src->inend >= sizeof(L4CDECODE_ZSTD_MAGIC) - 1 &&
+        memcmp(src->in,
+               L4CDECODE_ZSTD_MAGIC,
+               sizeof(L4CDECODE_ZSTD_MAGIC) - 1) == 0) {
+#ifdef HAVE_ZSTD
+        src->zstd = true;
+        if ((src->dctx = ZSTD_createDCtx()) == NULL) {
+            FAIL("ZSTD_createDCtx");
+        }
+        src->outsz = ZSTD_DStreamOutSize();
+        if ((src->out = malloc(src->outsz)) == NULL) {
+            FAIL("malloc");
+        }
+        src->outpos = 0;
+        src->outend = 0;
+        src->partial = false;
+#else
+        warnx("%s: zstd compressed, not supported by this build", fname);
+        free(src->in);
+        return -1;
+#endif
+    }
+    return 0;
+}
+
+
+static void
+src_fini(l4cdecode_src_t *src)
+{
+#ifdef HAVE_ZSTD
+    if (src->zstd) {
+        if (src->partial) {
+            warnx("%s: truncated zstd frame", src->fname);
+        }
+        (void)ZSTD_freeDCtx(src->dctx);
+        free(src->out);
+    }
+#endif
+    free(src->in);
+}
+
+
+/*
+ * Reads up to sz bytes, less only at the end of the file, or -1.  With
+ * some, returns whatever is there rather than wait for more.
+ */
+static ssize_t
+src_read(l4cdecode_src_t *src, void *buf, size_t sz, bool some)
+{
+    size_t nread;
+
+    nread = 0;
+    while (nread < sz) {
+        size_t n;
+
+#ifdef HAVE_ZSTD
+        if (src->zstd) {
+            if (src->outpos == src->outend) {
+                ZSTD_inBuffer ib;
+                ZSTD_outBuffer ob;
+                size_t rem;
+
+                if (src->inpos == src->inend &&
+                    ((some && nread > 0) || src_fill(src) == 0)) {
+                    break;
+                }
+                ib.src = src->in;
+                ib.size = src->inend;
+                ib.pos = src->inpos;
+                ob.dst = src->out;
+                ob.size = src->outsz;
+                ob.pos = 0;
+                rem = ZSTD_decompressStream(src->dctx, &ob, &ib);
+                if (ZSTD_isError(rem)) {
+                    warnx("%s: %s", src->fname, ZSTD_getErrorName(rem));
+                    return -1;
+                }
+                src->partial = (rem != 0);
+                src->inpos = ib.pos;
+                src->outpos = 0;
+                src->outend = ob.pos;
+                continue;
+            }
+            n = MIN(sz - nread, src->outend - src->outpos);
+            memcpy((char *)buf + nread, src->out + src->outpos, n);
+            src->outpos += n;
+            nread += n;
+            continue;
+        }
+#endif
+        if (src->inpos == src->inend &&
+            ((some && nread > 0) || src_fill(src) == 0)) {
+            break;
+        }
+        n = MIN(sz - nread, src->inend - src->inpos);
+        memcpy((char *)buf + nread, src->in + src->inpos, n);
+        src->inpos += n;
+        nread += n;
+    }
+    return (ssize_t)nread;
+}
+
+
+static int
+copy_file(l4cdecode_src_t *src)
+{
+    char buf[4096];
+    ssize_t nread;
+
+    while ((nread = src_read(src, buf, sizeof(buf), true)) > 0) {
+        (void)fwrite(buf, 1, (size_t)nread, stdout);
+    }
+    return nread < 0 ? 1 : 0;
+}
+
+
+static int
+decode_file(l4cdecode_src_t *src)
+{
+    char *payload;
+    size_t payloadsz;
+    off_t off;
+    int res;
+
+    payload = NULL;
+    payloadsz = 0;
+    off = 0;
+    res = 0;
+    while (true) {
+        mnl4c_bin_hdr_t hdr;
+        ssize_t nread;
+
+        if ((nread = src_read(src, &hdr, sizeof(hdr), false)) !=
+                (ssize_t)sizeof(hdr)) {
+            if (nread < 0) {
+                res = 1;
+            } else if (nread != 0) {
+                warnx("%s: truncated record at %jd",
+                      src->fname,
+                      (intmax_t)off);
+            }
+            break;
+        }
+        if ((hdr.flags & MNL4C_BIN_FMAGIC_MASK) != MNL4C_BIN_FMAGIC) {
+            warnx("%s: invalid record at %jd", src->fname, (intmax_t)off);
+            res = 1;
+            break;
+        }
+        if (hdr.len > payloadsz) {
+            payloadsz = hdr.len;
+            if ((payload = realloc(payload, payloadsz)) == NULL) {
+                FAIL("realloc");
+            }
+        }
+        if (src_read(src, payload, hdr.len, false) != (ssize_t)hdr.len) {
+            warnx("%s: truncated record at %jd", src->fname, (intmax_t)off);
+            break;
+        }
+        render_record(stdout, &hdr, payload);
+        off += sizeof(hdr) + hdr.len;
+    }
+
+    free(payload);
+    return res;
+}
+
+
+static int
+process_file(FILE *fp, const char *fname, bool follow)
+{
+    l4cdecode_src_t src;
+    int res;
+
+    if (src_init(&src, fp, fname, follow) != 0) {
+        return 1;
+    }
+    res = text ? copy_file(&src) : decode_file(&src);
+    src_fini(&src);
+    return res;
+}
+
+
+/*
+ * Copies n bytes at the absolute position pos out of the sidecar ring.
+ */
+static void
+sidecar_copy(const char *ring, size_t sz, uint64_t pos, void *buf, size_t n)
+{
+    while (n > 0) {
+        size_t off, m;
+
+        off = pos % sz;
+        m = MIN(n, sz - off);
+        memcpy(buf, ring + off, m);
+        buf = (char *)buf + m;
+        pos += m;
+        n -= m;
+    }
+}
+
+
+/*
+ * The chunks are walked back from head, as long as they are retained in
+ * full, and are then rendered oldest first.
+ */
+static int
+process_sidecar(FILE *fp, const char *fname)
+{
+    mnl4c_sidecar_hdr_t hdr;
+    char *ring;
+    struct {
+        uint64_t start;
+        mnl4c_sidecar_trl_t trl;
+    } *chunks;
+    size_t nchunks;
+    uint64_t lo, pos;
+    int res;
+
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        memcmp(hdr.magic, MNL4C_SIDECAR_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.sz == 0) {
+        warnx("%s: not a sidecar", fname);
+        return 1;
+    }
+    if ((ring = malloc(hdr.sz)) == NULL) {
+        FAIL("malloc");
+    }
+    if (fread(ring, 1, hdr.sz, fp) != hdr.sz) {
+        warnx("%s: truncated sidecar", fname);
+        free(ring);
+        return 1;
+    }
+    if (verbose) {
+        fprintf(stderr,
+                "%s: pid %d signal %d at %.06lf, %ju bytes\n",
+                fname,
+                hdr.pid,
+                hdr.sig,
+                (double)hdr.ts / 1000000000.0,
+                (uintmax_t)hdr.head);
+    }
+
+    chunks = NULL;
+    nchunks = 0;
+    lo = hdr.head > hdr.sz ? hdr.head - hdr.sz : 0;
+    for (pos = hdr.head; pos >= lo + sizeof(mnl4c_sidecar_trl_t);) {
+        mnl4c_sidecar_trl_t trl;
+
+        sidecar_copy(ring, hdr.sz, pos - sizeof(trl), &trl, sizeof(trl));
+        if (trl.magic != MNL4C_SIDECAR_TMAGIC) {
+            warnx("%s: invalid chunk at %ju", fname, (uintmax_t)pos);
+            break;
+        }
+        if (pos - sizeof(trl) - lo < trl.len) {
+            warnx("%s: older chunks overwritten", fname);
+            break;
+        }
+        if ((chunks = realloc(chunks,
+                              (nchunks + 1) * sizeof(*chunks))) == NULL) {
+            FAIL("realloc");
+        }
+        chunks[nchunks].start = pos - sizeof(trl) - trl.len;
+        chunks[nchunks].trl = trl;
+        ++nchunks;
+        pos = chunks[nchunks - 1].start;
+    }
+
+    res = 0;
+    while (nchunks-- > 0) {
+        l4cdecode_src_t src;
+        FILE *cfp;
+        char *buf;
+        size_t len;
+
+        len = chunks[nchunks].trl.len;
+        if ((chunks[nchunks].trl.ty & MNL4C_OPEN_BINARY) && catpath == NULL) {
+            warnx("%s: skipping binary logger %d, no --catalog",
+                  fname,
+                  chunks[nchunks].trl.ld);
+            continue;
+        }
+        if ((buf = malloc(len)) == NULL) {
+            FAIL("malloc");
+        }
+        sidecar_copy(ring, hdr.sz, chunks[nchunks].start, buf, len);
+        if ((cfp = fmemopen(buf, len, "r")) == NULL) {
+            FAIL("fmemopen");
+        }
+        if (src_init(&src, cfp, fname, false) == 0) {
+            res |= (chunks[nchunks].trl.ty & MNL4C_OPEN_BINARY) ?
+                decode_file(&src) :
+                copy_file(&src);
+            src_fini(&src);
+        } else {
+            res = 1;
+        }
+        fclose(cfp);
+        free(buf);
+    }
+
+    free(chunks);
+    free(ring);
+    return res;
+}
+
+
+int
+main(int argc, char *argv[static argc])
+{
+    int i, ch, optidx, res;
+
+    while ((ch = getopt_long(argc, argv, "c:fhstvV", optinfo, &optidx)) != -1) {
+        switch (ch) {
+        case 'c':
+            catpath = strdup(optarg);
+            break;
+
+        case 'f':
+            follow = true;
+            break;
+
+        case 'h':
+            usage(argv[0]);
+            exit(0);
+            break;
+
+        case 's':
+            sidecar = true;
+            break;
+
+        case 't':
+            text = true;
+            break;
+
+        case 'v':
+            verbose++;
+            break;
+
+        case 'V':
+            printf("%s\n", PACKAGE_STRING);
+            exit(0);
+            break;
+
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+
+    if (!text && !sidecar) {
+        if (catpath == NULL) {
+            errx(1, "--catalog cannot be empty. See %s --help",
+                 basename(argv[0]));
+        }
+        load_catalog(catpath);
+    } else if (catpath != NULL) {
+        load_catalog(catpath);
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    res = 0;
+    if (argc == 0) {
+        res = sidecar ?
+            process_sidecar(stdin, "<stdin>") :
+            process_file(stdin, "<stdin>", follow);
+    }
+    for (i = 0; i < argc; ++i) {
+        FILE *fp;
+
+        if ((fp = fopen(argv[i], "r")) == NULL) {
+            warn("Cannot open %s", argv[i]);
+            res = 1;
+            continue;
+        }
+        if (sidecar) {
+            res |= process_sidecar(fp, argv[i]);
+        } else {
+            res |= process_file(fp, argv[i], follow && i == argc - 1);
+        }
+        fclose(fp);
+    }
+
+    return res;
+}
@@ -8,6 +8,7 @@
 #include <ctype.h>
 #include <getopt.h>
 #include <libgen.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -18,6 +19,7 @@
 #include <mncommon/util.h>
 
 #include "config.h"
+#include "l4cfmt.h"
 
 #ifdef HAVE_MALLOC_H
 #   include <malloc.h>
@@ -28,6 +30,8 @@
 typedef struct _l4cgen_module {
     mnbytes_t *mid;
     mnbytes_t *name;
+    /* #compile-min-level */
+    mnbytes_t *min_level;
     mnarray_t messages;
 } l4cgen_module_t;
 
@@ -35,8 +39,18 @@ typedef struct _l4cgen_message {
     mnbytes_t *level;
     mnbytes_t *mid;
     mnbytes_t *value;
+    /* argument names after the format, if any */
+    mnbytes_t *fields;
+    /* <lib>_<MOD>_<MSG>_nprintf() is generated */
+    bool ser;
 } l4cgen_message_t;
 
+typedef struct _l4cgen_buf {
+    char *data;
+    size_t sz;
+    size_t len;
+} l4cgen_buf_t;
+
 static mnhash_t modules;
 
 
@@ -58,12 +72,16 @@ static struct option optinfo[] = {
     {"lib", required_argument, NULL, 'L'},
 #define L4CDEFGEN_OPT_VERBOSE    5
     {"verbose", no_argument, NULL, 'v'},
+#define L4CDEFGEN_OPT_CATOUT    6
+    {"catout", required_argument, NULL, 'K'},
+    {NULL, 0, NULL, 0},
 };
 
 
 static int verbose;
 static char *cout;
 static char *hout;
+static char *catout;
 static char *lib;
 
 static void
@@ -77,7 +95,17 @@ usage(char *p)
 "  --lib=NAME|-LNAME            Library name. Required.\n"
 "  --hout=PATH|-HPATH           Output header. Default <libname>-logdef.h.\n"
 "  --cout=PATH|-CPATH           Output source. Default <libname>-logdef.c.\n"
+"  --catout=PATH|-KPATH         Output message catalog for l4cdecode.\n"
+"                               Default <libname>-logdef.cat.\n"
 "  --verbose|-v                 Increase verbosity.\n"
+"\n"
+"A \"#compile-min-level LOG_*\" line in a module section overrides\n"
+"MNL4C_COMPILE_MIN_LEVEL for the module.\n"
+"\n"
+"A message format may be followed by names for its arguments, one per\n"
+"conversion, which become the keys of MNL4C_OPEN_JSON and\n"
+"MNL4C_OPEN_LOGFMT records:\n"
+"    LOG_INFO QWE \"Number %%d, price %%f\" number price\n"
 ,
         basename(p));
 }
@@ -111,6 +139,9 @@ render_head(FILE *fhout, FILE *fcout, const char *hout, const char *lib)
     hout_macroname = bytes_new_from_str(hout);
 
     macroname_translate(hout_macroname);
+    fprintf(fcout, "#include <stdarg.h>\n");
+    fprintf(fcout, "#include <stddef.h>\n");
+    fprintf(fcout, "#include <stdint.h>\n");
     fprintf(fcout, "#include <mnl4c.h>\n");
     fprintf(fcout, "#include \"%s\"\n", hout);
     fprintf(fcout,
@@ -122,6 +153,7 @@ render_head(FILE *fhout, FILE *fcout, const char *hout, const char *lib)
     fprintf(fhout,
         "#ifndef %s\n"
         "#define %s\n"
+        "#include <mnl4c.h>\n"
         "#ifdef __cplusplus\n"
         "extern \"C\" {\n"
         "#endif\n",
@@ -138,6 +170,8 @@ l4cgen_message_init(l4cgen_message_t *msg)
     msg->level = NULL;
     msg->mid = NULL;
     msg->value = NULL;
+    msg->fields = NULL;
+    msg->ser = false;
     return 0;
 }
 
@@ -148,6 +182,7 @@ l4cgen_message_fini(l4cgen_message_t *msg)
     BYTES_DECREF(&msg->level);
     BYTES_DECREF(&msg->mid);
     BYTES_DECREF(&msg->value);
+    BYTES_DECREF(&msg->fields);
     return 0;
 }
 
@@ -157,6 +192,7 @@ l4cgen_module_init(l4cgen_module_t *mod)
 {
     mod->mid = NULL;
     mod->name = NULL;
+    mod->min_level = NULL;
     if (array_init(&mod->messages, sizeof(l4cgen_message_t), 0,
             (array_initializer_t)l4cgen_message_init,
             (array_finalizer_t)l4cgen_message_fini) != 0) {
@@ -171,6 +207,7 @@ l4cgen_module_fini(l4cgen_module_t *mod)
 {
     BYTES_DECREF(&mod->mid);
     BYTES_DECREF(&mod->name);
+    BYTES_DECREF(&mod->min_level);
     (void)array_fini(&mod->messages);
     return 0;
 }
@@ -226,6 +263,41 @@ l4cgen_module_cmp(l4cgen_module_t *a, l4cgen_module_t *b)
 }
 
 
+/*
+ * Cuts the argument names off the format string literal(s) of a message
+ * line, and returns them, or NULL.
+ */
+static char *
+split_fields(char *s)
+{
+    char *end;
+
+    end = NULL;
+    while (true) {
+        while (*s == ' ' || *s == '\t') {
+            ++s;
+        }
+        if (*s != '"') {
+            break;
+        }
+        for (++s; *s != '\0' && *s != '"'; ++s) {
+            if (*s == '\\' && s[1] != '\0') {
+                ++s;
+            }
+        }
+        if (*s == '\0') {
+            return NULL;
+        }
+        end = ++s;
+    }
+    if (end == NULL || *s == '\0') {
+        return NULL;
+    }
+    *end = '\0';
+    return s;
+}
+
+
 #define PROCESS_LOGDEF_STATE_MODULE 0
 #define PROCESS_LOGDEF_STATE_MESSAGE 1
 #define PROCESS_LOGDEF_STATE_STR(st)                                           \
@@ -323,12 +395,18 @@ process_logdef(const char *fname)
             }
         } else {
             l4cgen_message_t *msg;
+            char *fields;
+
             if (MNUNLIKELY((msg = array_incr(&current_mod->messages)) == NULL)) {
                 FAIL("array_incr");
             }
+            fields = split_fields(c);
             msg->level = bytes_new_from_str(a);
             msg->mid = bytes_new_from_str(b);
             msg->value = bytes_new_from_str(c);
+            if (fields != NULL) {
+                msg->fields = bytes_new_from_str(fields);
+            }
         }
         continue;
 miss2:
@@ -346,6 +424,19 @@ miss3:
             fprintf(stderr, "a=%s\n", a);
             fprintf(stderr, "b=%s\n", b);
         }
+        if (strcmp(a, "#compile-min-level") == 0) {
+            if (current_mod == NULL) {
+                if (verbose) {
+                    fprintf(stderr,
+                            "No module context, ignoring line: %s\n",
+                            line);
+                }
+            } else {
+                BYTES_DECREF(&current_mod->min_level);
+                current_mod->min_level = bytes_new_from_str(b);
+            }
+            continue;
+        }
         if (*a == '#') {
             /* comment */
             continue;
@@ -382,16 +473,492 @@ end:
 
 
 
+static void
+buf_put(l4cgen_buf_t *buf, const char *s, size_t sz)
+{
+    if (buf->len + sz > buf->sz) {
+        buf->sz = (buf->len + sz) * 2;
+        if ((buf->data = realloc(buf->data, buf->sz)) == NULL) {
+            FAIL("realloc");
+        }
+    }
+    memcpy(buf->data + buf->len, s, sz);
+    buf->len += sz;
+}
+
+
+static void
+buf_puts(l4cgen_buf_t *buf, const char *s)
+{
+    buf_put(buf, s, strlen(s) + 1);
+    /* without the NUL */
+    --buf->len;
+}
+
+
+/*
+ * s as the inside of a JSON string
+ */
+static void
+buf_put_json(l4cgen_buf_t *buf, const char *s)
+{
+    for (; *s != '\0'; ++s) {
+        char esc[8];
+
+        if (*s == '"' || *s == '\\') {
+            esc[0] = '\\';
+            esc[1] = *s;
+            buf_put(buf, esc, 2);
+        } else if ((unsigned char)*s < 0x20) {
+            (void)snprintf(esc, sizeof(esc), "\\u%04x", (unsigned char)*s);
+            buf_puts(buf, esc);
+        } else {
+            buf_put(buf, s, 1);
+        }
+    }
+}
+
+
+/*
+ * s as a logfmt value, quoted if it has to be
+ */
+static void
+buf_put_logfmt(l4cgen_buf_t *buf, const char *s)
+{
+    const char *p;
+
+    for (p = s; *p != '\0'; ++p) {
+        if ((unsigned char)*p <= ' ' || strchr("=\"\\", *p) != NULL) {
+            break;
+        }
+    }
+    if (*s != '\0' && *p == '\0') {
+        buf_puts(buf, s);
+    } else {
+        buf_puts(buf, "\"");
+        buf_put_json(buf, s);
+        buf_puts(buf, "\"");
+    }
+}
+
+
+/*
+ * s as a logfmt key, what cannot be in one becomes '_'
+ */
+static void
+buf_put_logfmt_key(l4cgen_buf_t *buf, const char *s)
+{
+    for (; *s != '\0'; ++s) {
+        if ((unsigned char)*s <= ' ' || strchr("=\"\\", *s) != NULL) {
+            buf_put(buf, "_", 1);
+        } else {
+            buf_put(buf, s, 1);
+        }
+    }
+}
+
+
+/*
+ * The conversion a structured value of spec is rendered with: just the
+ * precision of a floating point one, and %g in place of the hexadecimal
+ * %a, which JSON cannot take.
+ */
+static void
+buf_put_spec(l4cgen_buf_t *buf, const l4cfmt_spec_t *spec)
+{
+    const char *p, *end;
+    char c;
+
+    buf_put(buf, "%", 1);
+    if (spec->sig != L4CFMT_SIG_DOUBLE && spec->sig != L4CFMT_SIG_LDOUBLE) {
+        buf_put(buf, &spec->conv, 1);
+        return;
+    }
+    if (spec->conv == 'a' || spec->conv == 'A') {
+        buf_puts(buf,
+                 spec->sig == L4CFMT_SIG_LDOUBLE ? ".21L" : ".17");
+        c = 'g';
+    } else {
+        end = spec->start + spec->sz;
+        if ((p = memchr(spec->start, '.', spec->sz)) != NULL) {
+            for (buf_put(buf, p++, 1); p < end && isdigit(*p); ++p) {
+                buf_put(buf, p, 1);
+            }
+        }
+        if (spec->sig == L4CFMT_SIG_LDOUBLE) {
+            buf_put(buf, "L", 1);
+        }
+        c = spec->conv;
+    }
+    buf_put(buf, &c, 1);
+}
+
+
+/*
+ * Renders the _JSON and _LOGFMT tables of a message, see
+ * MNL4C_STRUCT_KEYS().  Returns the number of fields, 0 unless the
+ * message has a name for each of its arguments and no %s of it has a
+ * precision.
+ */
+static int
+render_fields(l4cgen_module_t *mod,
+              l4cgen_message_t *msg,
+              const char *fmt,
+              int bin,
+              l4cgen_buf_t *json,
+              l4cgen_buf_t *logfmt)
+{
+    char *modname, *names, *name, *last;
+    char id[256];
+    l4cfmt_spec_t spec;
+    size_t json_prefix, logfmt_prefix;
+    int n;
+
+    if ((modname = l4cfmt_unquote(BCDATA(mod->name))) == NULL) {
+        FAIL("l4cfmt_unquote");
+    }
+    (void)snprintf(id, sizeof(id), "%s_%s", BDATA(mod->mid), BDATA(msg->mid));
+
+    json->len = 0;
+    buf_puts(json, ",\"mod\":\"");
+    buf_put_json(json, modname);
+    buf_puts(json, "\",\"id\":\"");
+    buf_put_json(json, id);
+    buf_put(json, "\"", 2);
+    json_prefix = json->len;
+
+    logfmt->len = 0;
+    buf_puts(logfmt, " mod=");
+    buf_put_logfmt(logfmt, modname);
+    buf_puts(logfmt, " id=");
+    buf_put_logfmt(logfmt, id);
+    buf_put(logfmt, "", 1);
+    logfmt_prefix = logfmt->len;
+    free(modname);
+
+    if (msg->fields == NULL) {
+        return 0;
+    }
+    if (!bin) {
+        fprintf(stderr,
+                "%s: format cannot be deferred, argument names ignored\n",
+                id);
+        return 0;
+    }
+
+    if ((names = strdup(BCDATA(msg->fields))) == NULL) {
+        FAIL("strdup");
+    }
+    n = 0;
+    name = strtok_r(names, " \t", &last);
+    while ((fmt = l4cfmt_next(fmt, &spec)) != NULL) {
+        if (spec.sig == L4CFMT_SIG_NONE) {
+            continue;
+        }
+        /*
+         * a %s with a precision need not be zero-terminated, its field
+         * would be read past it
+         */
+        if (spec.nstar > 0 ||
+            (spec.sig == L4CFMT_SIG_STR && spec.prec != -1) ||
+            name == NULL) {
+            n = -1;
+            break;
+        }
+        buf_put_spec(json, &spec);
+        buf_put(json, "", 1);
+        buf_puts(json, ",\"");
+        buf_put_json(json, name);
+        buf_put(json, "\":", 3);
+
+        buf_put_spec(logfmt, &spec);
+        buf_put(logfmt, "", 1);
+        buf_puts(logfmt, " ");
+        buf_put_logfmt_key(logfmt, name);
+        buf_put(logfmt, "=", 2);
+
+        ++n;
+        name = strtok_r(NULL, " \t", &last);
+    }
+    if (n < 0 || name != NULL) {
+        fprintf(stderr,
+                "%s: argument names do not match the format, ignored\n",
+                id);
+        json->len = json_prefix;
+        logfmt->len = logfmt_prefix;
+        n = 0;
+    }
+    free(names);
+    return n;
+}
+
+
+static void
+render_literal(FILE *fp, const char *s, size_t sz)
+{
+    size_t i;
+
+    fputc('"', fp);
+    for (i = 0; i < sz; ++i) {
+        unsigned char c;
+
+        c = (unsigned char)s[i];
+        if (c == '"' || c == '\\' || c == '?') {
+            /* '?' for trigraphs */
+            fprintf(fp, "\\%c", c);
+        } else if (isprint(c)) {
+            fputc(c, fp);
+        } else {
+            fprintf(fp, "\\%03o", c);
+        }
+    }
+    fputc('"', fp);
+}
+
+
+/*
+ * Whether fmt can be rendered by a generated serializer: no '*' width or
+ * precision, no %m, nothing l4cfmt cannot tell the argument of.
+ */
+static bool
+ser_check(const char *fmt)
+{
+    l4cfmt_spec_t spec;
+
+    while ((fmt = l4cfmt_next(fmt, &spec)) != NULL) {
+        if (spec.sig == L4CFMT_SIG_UNSUPPORTED ||
+                spec.nstar > 0 ||
+                spec.conv == 'm') {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/*
+ * The va_arg() type of a conversion.
+ */
+static const char *
+ser_type(const l4cfmt_spec_t *spec)
+{
+    bool u;
+
+    u = strchr("ouxX", spec->conv) != NULL;
+    switch (spec->sig) {
+    case L4CFMT_SIG_LONG:
+        return u ? "unsigned long" : "long";
+
+    case L4CFMT_SIG_LLONG:
+        return u ? "unsigned long long" : "long long";
+
+    case L4CFMT_SIG_INTMAX:
+        return u ? "uintmax_t" : "intmax_t";
+
+    case L4CFMT_SIG_SIZE:
+        return u ? "size_t" : "ssize_t";
+
+    case L4CFMT_SIG_PTRDIFF:
+        return u ? "size_t" : "ptrdiff_t";
+
+    case L4CFMT_SIG_DOUBLE:
+        return "double";
+
+    case L4CFMT_SIG_LDOUBLE:
+        return "long double";
+
+    case L4CFMT_SIG_STR:
+        return "const char *";
+
+    case L4CFMT_SIG_PTR:
+        return "void *";
+
+    default:
+        return u ? "unsigned" : "int";
+    }
+}
+
+
+/*
+ * Whether spec has no flags and no width, only a length modifier and a
+ * precision, which goes to *prec (-1 if there is none).  *hmod tells if
+ * the length modifier narrows the value to char or short.
+ */
+static bool
+ser_plain(const l4cfmt_spec_t *spec, int *prec, bool *hmod)
+{
+    const char *p, *end;
+
+    p = spec->start + 1;
+    end = spec->start + spec->sz - 1;
+    *prec = -1;
+    *hmod = false;
+    if (*p == '.') {
+        for (*prec = 0, ++p; p < end && isdigit(*p); ++p) {
+            *prec = *prec * 10 + (*p - '0');
+        }
+    }
+    for (; p < end; ++p) {
+        if (strchr("hlqjztL", *p) == NULL) {
+            return false;
+        }
+        *hmod = *hmod || *p == 'h';
+    }
+    return true;
+}
+
+
+static void
+ser_render_lit(FILE *fp, const char *s, size_t sz)
+{
+    if (sz > 0) {
+        fprintf(fp, "    MNL4C_SER_LIT(bs, ");
+        render_literal(fp, s, sz);
+        fprintf(fp, ");\n");
+    }
+}
+
+
+/*
+ * Plain integer, string, character and %f (up to 9 digits) conversions
+ * are rendered directly, anything else by printf() of the specification
+ * alone.
+ */
+static void
+ser_render_spec(FILE *fp, const l4cfmt_spec_t *spec)
+{
+    const char *type;
+    int prec;
+    bool plain, hmod;
+
+    type = ser_type(spec);
+    plain = ser_plain(spec, &prec, &hmod);
+    switch (spec->conv) {
+    case '%':
+        ser_render_lit(fp, "%", 1);
+        return;
+
+    case 'd':
+    case 'i':
+        if (plain && prec < 0 && !hmod) {
+            fprintf(fp,
+                    "    mnl4c_ser_i64(bs, (int64_t)va_arg(ap, %s));\n",
+                    type);
+            return;
+        }
+        break;
+
+    case 'u':
+        if (plain && prec < 0 && !hmod) {
+            fprintf(fp,
+                    "    mnl4c_ser_u64(bs, (uint64_t)va_arg(ap, %s));\n",
+                    type);
+            return;
+        }
+        break;
+
+    case 'x':
+    case 'X':
+        if (plain && prec < 0 && !hmod) {
+            fprintf(fp,
+                    "    mnl4c_ser_x64(bs, (uint64_t)va_arg(ap, %s), %s);\n",
+                    type,
+                    spec->conv == 'X' ? "true" : "false");
+            return;
+        }
+        break;
+
+    case 'f':
+        if (plain && prec <= 9 && spec->sig == L4CFMT_SIG_DOUBLE) {
+            fprintf(fp,
+                    "    mnl4c_ser_fixed(bs, va_arg(ap, double), %d);\n",
+                    prec < 0 ? 6 : prec);
+            return;
+        }
+        break;
+
+    case 's':
+        if (plain && prec < 0) {
+            fprintf(fp, "    mnl4c_ser_str(bs, va_arg(ap, const char *));\n");
+            return;
+        }
+        break;
+
+    case 'c':
+        if (plain && prec < 0) {
+            fprintf(fp, "    mnl4c_ser_chr(bs, va_arg(ap, int));\n");
+            return;
+        }
+        break;
+
+    default:
+        break;
+    }
+    fprintf(fp, "    MNL4C_SER_PRINTF(bs, sz, ");
+    render_literal(fp, spec->start, spec->sz);
+    fprintf(fp, ", va_arg(ap, %s));\n", type);
+}
+
+
+/*
+ * The serializer of a message.  It takes the arguments of
+ * bytestream_nprintf(), so that the format is still checked at the call
+ * site, but does not look at the format at run time.
+ */
+static void
+ser_render(FILE *fp, const char *lib, l4cgen_module_t *mod, l4cgen_message_t *msg)
+{
+    char *fmt;
+    const char *p, *next;
+    l4cfmt_spec_t spec;
+
+    if ((fmt = l4cfmt_unquote(BCDATA(msg->value))) == NULL) {
+        FAIL("l4cfmt_unquote");
+    }
+    fprintf(fp,
+        "\n"
+        "\n"
+        "ssize_t\n"
+        "%s_%s_%s_nprintf(mnbytestream_t *bs, size_t sz, const char *fmt, ...)\n"
+        "{\n"
+        "    va_list ap;\n"
+        "    off_t off;\n"
+        "\n"
+        "    off = SEOD(bs);\n"
+        "    va_start(ap, fmt);\n",
+        lib,
+        BDATA(mod->mid),
+        BDATA(msg->mid));
+    for (p = fmt; (next = l4cfmt_next(p, &spec)) != NULL; p = next) {
+        ser_render_lit(fp, p, spec.start - p);
+        ser_render_spec(fp, &spec);
+    }
+    ser_render_lit(fp, p, strlen(p));
+    fprintf(fp,
+        "    va_end(ap);\n"
+        "    return mnl4c_ser_end(bs, off, sz);\n"
+        "}\n");
+    free(fmt);
+}
+
+
 static int
 mycb2(l4cgen_message_t *msg, void *udata)
 {
     struct {
         FILE *fhout;
         FILE *fcout;
+        FILE *fkout;
         const char *lib;
         l4cgen_module_t *mod;
         int idx;
     } *params = udata;
+    char *fmt;
+    char sig[256];
+    int bin;
+    int nfields;
+    l4cgen_buf_t json = { NULL, 0, 0 };
+    l4cgen_buf_t logfmt = { NULL, 0, 0 };
 
     if (verbose > 2) {
         printf("  %s: %s %s\n",
@@ -400,15 +967,86 @@ mycb2(l4cgen_message_t *msg, void *udata)
                BDATASAFE(msg->value));
     }
 
+    if ((fmt = l4cfmt_unquote(BCDATA(msg->value))) == NULL) {
+        FAIL("l4cfmt_unquote");
+    }
+    if ((bin = (l4cfmt_sig(fmt, sig, sizeof(sig)) >= 0)) == 0) {
+        /* the message will be logged as text in binary mode */
+        sig[0] = '\0';
+        if (verbose) {
+            fprintf(stderr,
+                    "%s_%s: format cannot be deferred, "
+                    "will be rendered as text\n",
+                    BDATA(params->mod->mid),
+                    BDATA(msg->mid));
+        }
+    }
+    nfields = render_fields(params->mod, msg, fmt, bin, &json, &logfmt);
+    msg->ser = ser_check(fmt);
+    free(fmt);
+
     fprintf(params->fhout,
         "#define %s_%s_ID %d\n"
-        "#define %s_%s_FMT %s\n",
+        "#define %s_%s_FMT %s\n"
+        "#define %s_%s_SIG \"%s\"\n"
+        "#define %s_%s_BIN %d\n",
         BDATA(params->mod->mid),
         BDATA(msg->mid),
         params->idx,
         BDATA(params->mod->mid),
         BDATA(msg->mid),
-        BDATA(msg->value));
+        BDATA(msg->value),
+        BDATA(params->mod->mid),
+        BDATA(msg->mid),
+        sig,
+        BDATA(params->mod->mid),
+        BDATA(msg->mid),
+        bin);
+
+    fprintf(params->fhout,
+        "#define %s_%s_FIELDS %d\n"
+        "#define %s_%s_JSON ",
+        BDATA(params->mod->mid),
+        BDATA(msg->mid),
+        nfields,
+        BDATA(params->mod->mid),
+        BDATA(msg->mid));
+    render_literal(params->fhout, json.data, json.len);
+    fprintf(params->fhout,
+        "\n"
+        "#define %s_%s_LOGFMT ",
+        BDATA(params->mod->mid),
+        BDATA(msg->mid));
+    render_literal(params->fhout, logfmt.data, logfmt.len);
+    fprintf(params->fhout, "\n");
+    free(json.data);
+    free(logfmt.data);
+
+    if (msg->ser) {
+        fprintf(params->fhout,
+            "#define %s_%s_NPRINTF %s_%s_%s_nprintf\n",
+            BDATA(params->mod->mid),
+            BDATA(msg->mid),
+            params->lib,
+            BDATA(params->mod->mid),
+            BDATA(msg->mid));
+    } else {
+        fprintf(params->fhout,
+            "#define %s_%s_NPRINTF bytestream_nprintf\n",
+            BDATA(params->mod->mid),
+            BDATA(msg->mid));
+    }
+
+    if (bin) {
+        fprintf(params->fkout,
+            "%d\t%s_%s\t%s\t%s\t%s\n",
+            params->idx,
+            BDATA(params->mod->mid),
+            BDATA(msg->mid),
+            sig[0] != '\0' ? sig : "-",
+            BDATA(params->mod->name),
+            BDATA(msg->value));
+    }
 
     fprintf(params->fcout,
         "    %s_LREG(logger, %s, %s);\n",
@@ -427,10 +1065,22 @@ mycb1(l4cgen_module_t *mod, UNUSED void *value, void *udata)
     struct {
         FILE *fhout;
         FILE *fcout;
+        FILE *fkout;
         const char *lib;
         l4cgen_module_t *mod;
         int idx;
     } *params = udata;
+    static struct {
+        const char *name;
+        const char *level;
+        const char *target;
+    } shortcuts[] = {
+        {"LERROR", "LOG_ERR", "LOG_LT"},
+        {"LWARNING", "LOG_WARNING", "LOG_LT"},
+        {"LINFO", "LOG_INFO", "LOG_LT"},
+        {"LDEBUG", "LOG_DEBUG", "LOG"},
+    };
+    size_t i;
 
     //assert(mod->mid != NULL);
     //assert(mod->name != NULL);
@@ -457,15 +1107,7 @@ mycb1(l4cgen_module_t *mod, UNUSED void *value, void *udata)
         "#define %s_LOG_STOP(logger, level, msg, ...) MNL4C_WRITE_STOP_PRINTFLIKE(logger, level, %s, msg, ##__VA_ARGS__)\n"
         "#define %s_LOG_CONTEXT_STOP(logger, level, context, msg, ...) MNL4C_WRITE_STOP_PRINTFLIKE_CONTEXT(logger, level, context, %s, msg, ##__VA_ARGS__)\n"
         "#define %s_DO_AT(logger, level, msg, __a1) MNL4C_DO_AT(logger, level, %s, msg, __a1)\n"
-        "#define %s_LERROR(logger, msg, ...) %s_LOG_LT(logger, LOG_ERR, msg, ##__VA_ARGS__)\n"
-        "#define %s_CONTEXT_LERROR(logger, context, msg, ...) %s_CONTEXT_LOG_LT(logger, LOG_ERR, context, msg, ##__VA_ARGS__)\n"
-        "#define %s_LWARNING(logger, msg, ...) %s_LOG_LT(logger, LOG_WARNING, msg, ##__VA_ARGS__)\n"
-        "#define %s_CONTEXT_LWARNING(logger, context, msg, ...) %s_CONTEXT_LOG_LT(logger, LOG_WARNING, context, msg, ##__VA_ARGS__)\n"
-        "#define %s_LINFO(logger, msg, ...) %s_LOG_LT(logger, LOG_INFO, msg, ##__VA_ARGS__)\n"
-        "#define %s_CONTEXT_LINFO(logger, context, msg, ...) %s_CONTEXT_LOG_LT(logger, LOG_INFO, context, msg, ##__VA_ARGS__)\n"
-        "#define %s_LDEBUG(logger, msg, ...) %s_LOG(logger, LOG_DEBUG, msg, ##__VA_ARGS__)\n"
-        "#define %s_CONTEXT_LDEBUG(logger, context, msg, ...) %s_CONTEXT_LOG(logger, LOG_DEBUG, context, msg, ##__VA_ARGS__)\n"
-        "#define %s_LREG(logger, level, msg) mnl4c_register_msg(logger, level, %s_ ## msg ## _ID, \"%s_\" #msg)\n"
+        "#define %s_LREG(logger, level, msg) mnl4c_register_msg_mod(logger, level, %s_ ## msg ## _ID, \"%s_\" #msg, %s_NAME)\n"
         "#define %s_NAME %s\n"
         "#define %s_PREFIX _MNL4C_TSPIDMOD_FMT\n"
         "#define %s_ARGS _MNL4C_TSPIDMOD_ARGS(%s)\n",
@@ -504,40 +1146,103 @@ mycb1(l4cgen_module_t *mod, UNUSED void *value, void *udata)
         BDATA(mod->mid),
         BDATA(mod->mid),
         BDATA(mod->mid),
-        BDATA(mod->mid),
-        BDATA(mod->mid),
-        BDATA(mod->mid),
-        BDATA(mod->mid),
-        BDATA(mod->mid),
-        BDATA(mod->mid),
-        BDATA(mod->mid),
-        BDATA(mod->mid),
-        BDATA(mod->mid),
-        BDATA(mod->mid),
-        BDATA(mod->mid),
-        BDATA(mod->mid),
-        BDATA(mod->mid),
-        BDATA(mod->mid),
-        BDATA(mod->mid),
         BDATA(mod->name),
         BDATA(mod->mid),
         BDATA(mod->mid),
         BDATA(mod->mid));
+
+    fprintf(params->fhout,
+        "#ifndef %s_COMPILE_MIN_LEVEL\n"
+        "#define %s_COMPILE_MIN_LEVEL %s\n"
+        "#endif\n",
+        BDATA(mod->mid),
+        BDATA(mod->mid),
+        mod->min_level != NULL ?
+            BCDATA(mod->min_level) : "MNL4C_COMPILE_MIN_LEVEL");
+    for (i = 0; i < countof(shortcuts); ++i) {
+        fprintf(params->fhout,
+            "#if %s <= %s_COMPILE_MIN_LEVEL\n"
+            "#define %s_%s(logger, msg, ...) %s_%s(logger, %s, msg, ##__VA_ARGS__)\n"
+            "#define %s_CONTEXT_%s(logger, context, msg, ...) %s_CONTEXT_%s(logger, %s, context, msg, ##__VA_ARGS__)\n"
+            "#else\n"
+            "#define %s_%s(logger, msg, ...) MNL4C_WRITE_ELIDED_PRINTFLIKE(logger, %s, msg, ##__VA_ARGS__)\n"
+            "#define %s_CONTEXT_%s(logger, context, msg, ...) MNL4C_WRITE_ELIDED_PRINTFLIKE_CONTEXT(logger, context, %s, msg, ##__VA_ARGS__)\n"
+            "#endif\n",
+            shortcuts[i].level,
+            BDATA(mod->mid),
+            BDATA(mod->mid),
+            shortcuts[i].name,
+            BDATA(mod->mid),
+            shortcuts[i].target,
+            shortcuts[i].level,
+            BDATA(mod->mid),
+            shortcuts[i].name,
+            BDATA(mod->mid),
+            shortcuts[i].target,
+            shortcuts[i].level,
+            BDATA(mod->mid),
+            shortcuts[i].name,
+            BDATA(mod->mid),
+            BDATA(mod->mid),
+            shortcuts[i].name,
+            BDATA(mod->mid));
+    }
+
     (void)array_traverse(&mod->messages, (array_traverser_t)mycb2, udata);
     return 0;
 }
 
 
+static int
+mycb4(l4cgen_message_t *msg, void *udata)
+{
+    struct {
+        FILE *fhout;
+        FILE *fcout;
+        const char *lib;
+        l4cgen_module_t *mod;
+    } *params = udata;
+
+    if (msg->ser) {
+        ser_render(params->fcout, params->lib, params->mod, msg);
+        fprintf(params->fhout,
+            "ssize_t %s_%s_%s_nprintf(mnbytestream_t *, size_t, const char *, ...)"
+            " __attribute__((format(printf, 3, 4)));\n",
+            params->lib,
+            BDATA(params->mod->mid),
+            BDATA(msg->mid));
+    }
+    return 0;
+}
+
+
+static int
+mycb3(l4cgen_module_t *mod, UNUSED void *value, void *udata)
+{
+    struct {
+        FILE *fhout;
+        FILE *fcout;
+        const char *lib;
+        l4cgen_module_t *mod;
+    } *params = udata;
+
+    params->mod = mod;
+    (void)array_traverse(&mod->messages, (array_traverser_t)mycb4, udata);
+    return 0;
+}
+
+
 static void
-render_body(FILE *fhout, FILE *fcout, const char *lib)
+render_body(FILE *fhout, FILE *fcout, FILE *fkout, const char *lib)
 {
     struct {
         FILE *fhout;
         FILE *fcout;
+        FILE *fkout;
         const char *lib;
         l4cgen_module_t *mod;
         int idx;
-    } params = { fhout, fcout, lib, NULL, 0 };
+    } params = { fhout, fcout, fkout, lib, NULL, 0 };
 
     (void)hash_traverse(&modules, (hash_traverser_t)mycb1, &params);
 }
@@ -546,8 +1251,17 @@ render_body(FILE *fhout, FILE *fcout, const char *lib)
 static void
 render_tail(FILE *fhout, FILE *fcout, const char *lib)
 {
+    struct {
+        FILE *fhout;
+        FILE *fcout;
+        const char *lib;
+        l4cgen_module_t *mod;
+    } params = { fhout, fcout, lib, NULL };
+
     fprintf(fcout, "}\n");
     fprintf(fhout, "void %s_init_logdef(mnl4c_logger_t);\n", lib);
+    /* the serializers go after the init function */
+    (void)hash_traverse(&modules, (hash_traverser_t)mycb3, &params);
     fprintf(fhout,
         "#ifdef __cplusplus\n"
         "}\n"
@@ -560,7 +1274,7 @@ int
 main(int argc, char *argv[static argc])
 {
     int i, ch, optidx;
-    FILE *fhout, *fcout;
+    FILE *fhout, *fcout, *fkout;
 
 #ifdef HAVE_MALLOC_H
 #   ifndef NDEBUG
@@ -576,7 +1290,7 @@ main(int argc, char *argv[static argc])
 #   endif
 #endif
 
-    while ((ch = getopt_long(argc, argv, "C:hH:L:vV", optinfo, &optidx)) != -1) {
+    while ((ch = getopt_long(argc, argv, "C:hH:K:L:vV", optinfo, &optidx)) != -1) {
         switch (ch) {
         case 'C':
             cout = strdup(optarg);
@@ -591,6 +1305,10 @@ main(int argc, char *argv[static argc])
             hout = strdup(optarg);
             break;
 
+        case 'K':
+            catout = strdup(optarg);
+            break;
+
         case 'L':
             lib = strdup(optarg);
             break;
@@ -634,6 +1352,16 @@ main(int argc, char *argv[static argc])
         (void)snprintf(hout, sz, "%s-logdef.h", lib);
     }
 
+    if (catout == NULL) {
+        size_t sz;
+
+        sz = strlen(lib) + 32;
+        if ((catout = malloc(sz)) == NULL) {
+            FAIL("malloc");
+        }
+        (void)snprintf(catout, sz, "%s-logdef.cat", lib);
+    }
+
     argc -= optind;
     argv += optind;
 
@@ -643,6 +1371,9 @@ main(int argc, char *argv[static argc])
     if ((fcout = fopen(cout, "w")) == NULL) {
         errx(1, "Cannot open %s\n", cout);
     }
+    if ((fkout = fopen(catout, "w")) == NULL) {
+        errx(1, "Cannot open %s\n", catout);
+    }
 
     hash_init(&modules, 127,
         (hash_hashfn_t)l4cgen_module_hash,
@@ -656,11 +1387,12 @@ main(int argc, char *argv[static argc])
         }
         process_logdef(argv[i]);
     }
-    render_body(fhout, fcout, lib);
+    render_body(fhout, fcout, fkout, lib);
     render_tail(fhout, fcout, lib);
     hash_fini(&modules);
     fclose(fhout);
     fclose(fcout);
+    fclose(fkout);
 
     return 0;
 }
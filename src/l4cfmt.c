@@ -0,0 +1,309 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "l4cfmt.h"
+
+
+/*
+ * Finds the next conversion specification in fmt, and returns the
+ * position right past it, or NULL if there are no more of them.  The
+ * literal text before the specification is [fmt, spec->start).
+ */
+const char *
+l4cfmt_next(const char *fmt, l4cfmt_spec_t *spec)
+{
+    const char *p;
+    int lmod;
+
+    if ((p = strchr(fmt, '%')) == NULL) {
+        return NULL;
+    }
+    spec->start = p++;
+    spec->nstar = 0;
+    spec->prec = -1;
+
+    if (*p == '%') {
+        spec->conv = '%';
+        spec->sig = L4CFMT_SIG_NONE;
+        spec->sz = 2;
+        return p + 1;
+    }
+
+    /* flags */
+    while (*p != '\0' && strchr("-+ #0'", *p) != NULL) {
+        ++p;
+    }
+    /* width */
+    if (*p == '*') {
+        ++spec->nstar;
+        ++p;
+    } else {
+        while (*p >= '0' && *p <= '9') {
+            ++p;
+        }
+    }
+    /* precision */
+    if (*p == '.') {
+        ++p;
+        if (*p == '*') {
+            ++spec->nstar;
+            spec->prec = -2;
+            ++p;
+        } else {
+            for (spec->prec = 0; *p >= '0' && *p <= '9'; ++p) {
+                spec->prec = spec->prec * 10 + (*p - '0');
+            }
+        }
+    }
+
+    /* length modifier */
+    lmod = 0;
+    switch (*p) {
+    case 'h':
+        lmod = (p[1] == 'h') ? 'H' : 'h';
+        p += (lmod == 'H') ? 2 : 1;
+        break;
+
+    case 'l':
+        lmod = (p[1] == 'l') ? 'q' : 'l';
+        p += (lmod == 'q') ? 2 : 1;
+        break;
+
+    case 'q':
+    case 'j':
+    case 'z':
+    case 't':
+    case 'L':
+        lmod = *p++;
+        break;
+
+    default:
+        break;
+    }
+
+    spec->conv = *p;
+    switch (*p) {
+    case 'd':
+    case 'i':
+    case 'o':
+    case 'u':
+    case 'x':
+    case 'X':
+        switch (lmod) {
+        case 'l':
+            spec->sig = L4CFMT_SIG_LONG;
+            break;
+
+        case 'q':
+        case 'L':
+            spec->sig = L4CFMT_SIG_LLONG;
+            break;
+
+        case 'j':
+            spec->sig = L4CFMT_SIG_INTMAX;
+            break;
+
+        case 'z':
+            spec->sig = L4CFMT_SIG_SIZE;
+            break;
+
+        case 't':
+            spec->sig = L4CFMT_SIG_PTRDIFF;
+            break;
+
+        default:
+            /* char and short are promoted */
+            spec->sig = L4CFMT_SIG_INT;
+            break;
+        }
+        break;
+
+    case 'c':
+        spec->sig = (lmod == 0) ? L4CFMT_SIG_INT : L4CFMT_SIG_UNSUPPORTED;
+        break;
+
+    case 'e':
+    case 'E':
+    case 'f':
+    case 'F':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+        spec->sig = (lmod == 'L') ? L4CFMT_SIG_LDOUBLE : L4CFMT_SIG_DOUBLE;
+        break;
+
+    case 's':
+        spec->sig = (lmod == 0) ? L4CFMT_SIG_STR : L4CFMT_SIG_UNSUPPORTED;
+        break;
+
+    case 'p':
+        spec->sig = L4CFMT_SIG_PTR;
+        break;
+
+    case 'm':
+        spec->sig = L4CFMT_SIG_NONE;
+        break;
+
+    case '\0':
+        spec->sig = L4CFMT_SIG_UNSUPPORTED;
+        spec->sz = p - spec->start;
+        return p;
+
+    default:
+        /* %n and friends */
+        spec->sig = L4CFMT_SIG_UNSUPPORTED;
+        break;
+    }
+
+    ++p;
+    spec->sz = p - spec->start;
+    return p;
+}
+
+
+/*
+ * Renders the argument signature of fmt into buf.  Returns the number of
+ * arguments, or -1 if fmt has a specification that cannot be passed
+ * through a binary record, or buf is too small.  A string with a
+ * precision is one of those: it need not be zero-terminated, while a
+ * binary record stores what strlen() counts.
+ */
+int
+l4cfmt_sig(const char *fmt, char *buf, size_t sz)
+{
+    l4cfmt_spec_t spec;
+    size_t n;
+
+    n = 0;
+    while ((fmt = l4cfmt_next(fmt, &spec)) != NULL) {
+        int i;
+
+        if (spec.sig == L4CFMT_SIG_UNSUPPORTED ||
+                (spec.sig == L4CFMT_SIG_STR && spec.prec != -1)) {
+            return -1;
+        }
+        if (n + spec.nstar + 1 >= sz) {
+            return -1;
+        }
+        for (i = 0; i < spec.nstar; ++i) {
+            buf[n++] = L4CFMT_SIG_INT;
+        }
+        if (spec.sig != L4CFMT_SIG_NONE) {
+            buf[n++] = spec.sig;
+        }
+    }
+    buf[n] = '\0';
+    return (int)n;
+}
+
+
+/*
+ * Converts a C string literal, or several adjacent ones, as found in
+ * logdef.txt into the string it denotes.  The result is malloc'ed.
+ */
+char *
+l4cfmt_unquote(const char *s)
+{
+    char *res, *d;
+    int inside;
+
+    if ((res = malloc(strlen(s) + 1)) == NULL) {
+        return NULL;
+    }
+
+    inside = 0;
+    for (d = res; *s != '\0'; ++s) {
+        if (!inside) {
+            if (*s == '"') {
+                inside = 1;
+            }
+            continue;
+        }
+        if (*s == '"') {
+            inside = 0;
+            continue;
+        }
+        if (*s != '\\') {
+            *d++ = *s;
+            continue;
+        }
+
+        ++s;
+        switch (*s) {
+        case 'a':
+            *d++ = '\a';
+            break;
+
+        case 'b':
+            *d++ = '\b';
+            break;
+
+        case 'f':
+            *d++ = '\f';
+            break;
+
+        case 'n':
+            *d++ = '\n';
+            break;
+
+        case 'r':
+            *d++ = '\r';
+            break;
+
+        case 't':
+            *d++ = '\t';
+            break;
+
+        case 'v':
+            *d++ = '\v';
+            break;
+
+        case 'x':
+            {
+                int c = 0;
+
+                while (s[1] != '\0' &&
+                       strchr("0123456789abcdefABCDEF", s[1]) != NULL) {
+                    ++s;
+                    c = c * 16 + ((*s <= '9') ?
+                                  *s - '0' :
+                                  ((*s | 0x20) - 'a' + 10));
+                }
+                *d++ = (char)c;
+            }
+            break;
+
+        case '0':
+        case '1':
+        case '2':
+        case '3':
+        case '4':
+        case '5':
+        case '6':
+        case '7':
+            {
+                int c, i;
+
+                c = *s - '0';
+                for (i = 0; i < 2 && s[1] >= '0' && s[1] <= '7'; ++i) {
+                    ++s;
+                    c = c * 8 + (*s - '0');
+                }
+                *d++ = (char)c;
+            }
+            break;
+
+        case '\0':
+            --s;
+            break;
+
+        default:
+            /* \\ \" \' \? */
+            *d++ = *s;
+            break;
+        }
+    }
+    *d = '\0';
+    return res;
+}
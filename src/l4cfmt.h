@@ -0,0 +1,48 @@
+#ifndef L4CFMT_H_DEFINED
+#define L4CFMT_H_DEFINED
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Argument signatures, one character per va_arg() a format consumes.
+ * These are also the codes of the argument encoding in binary records.
+ */
+#define L4CFMT_SIG_INT          'i'
+#define L4CFMT_SIG_LONG         'l'
+#define L4CFMT_SIG_LLONG        'q'
+#define L4CFMT_SIG_INTMAX       'j'
+#define L4CFMT_SIG_SIZE         'z'
+#define L4CFMT_SIG_PTRDIFF      't'
+#define L4CFMT_SIG_DOUBLE       'd'
+#define L4CFMT_SIG_LDOUBLE      'D'
+#define L4CFMT_SIG_STR          's'
+#define L4CFMT_SIG_PTR          'p'
+/* the spec takes no argument: %% or %m */
+#define L4CFMT_SIG_NONE         0
+/* %n, wide characters and anything we cannot pass through */
+#define L4CFMT_SIG_UNSUPPORTED  (-1)
+
+typedef struct _l4cfmt_spec {
+    /* points to the '%' */
+    const char *start;
+    size_t sz;
+    char conv;
+    /* number of '*' width/precision arguments before the value */
+    int nstar;
+    /* the precision, -1 if there is none, -2 if it is '*' */
+    int prec;
+    int sig;
+} l4cfmt_spec_t;
+
+const char *l4cfmt_next(const char *, l4cfmt_spec_t *);
+int l4cfmt_sig(const char *, char *, size_t);
+char *l4cfmt_unquote(const char *);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* L4CFMT_H_DEFINED */
@@ -1,9 +1,14 @@
+#include <errno.h>
 #include <stdarg.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sched.h>
 #include <fcntl.h>
 #include <fnmatch.h>
-#include <libgen.h> //basename
 #include <limits.h> //PATH_MAX
+#include <poll.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/file.h>
 #include <sys/stat.h>
@@ -13,11 +18,11 @@
 #include <mncommon/bytestream.h>
 #define TRRET_DEBUG
 #include <mncommon/dumpm.h>
-#include <mncommon/traversedir.h>
 #include <mncommon/util.h>
 
 #define SYSLOG_NAMES
 #include <mnl4c.h>
+#include "mnl4c_private.h"
 
 #include "diag.h"
 
@@ -26,6 +31,9 @@
 
 static mnarray_t ctxes;
 
+__thread uint64_t mnl4c_sample_state;
+static uint64_t sample_seq;
+
 double
 mnl4c_now_posix(void){
     struct timeval tv;
@@ -35,155 +43,422 @@ mnl4c_now_posix(void){
 }
 
 
-static void
-mnl4c_write_stdout(mnl4c_ctx_t *ctx)
+/*
+ * Seeds mnl4c_sample_rand() of the calling thread: splitmix64 of a
+ * sequence number, so that no two threads start alike.
+ */
+uint64_t
+mnl4c_sample_seed(void)
 {
-    (void)bytestream_cat(&ctx->bs, 1, "");
-    fprintf(stdout, "%s", SDATA(&ctx->bs, 0));
-    bytestream_rewind(&ctx->bs);
+    uint64_t x;
+
+    x = __atomic_add_fetch(&sample_seq, 1, __ATOMIC_RELAXED);
+    x = x * 0x9e3779b97f4a7c15ull ^
+        (uint64_t)(uintptr_t)&mnl4c_sample_state;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    if (x == 0) {
+        x = 0x9e3779b97f4a7c15ull;
+    }
+    mnl4c_sample_state = x;
+    return x;
 }
 
 
-static void
-mnl4c_write_stderr(mnl4c_ctx_t *ctx)
+/*
+ * Writes iov to fd, resuming short writes.  When fd would block, waits
+ * up to timeout msec for it to become writable, as poll(2) does.
+ * Returns the number of bytes written, errno tells why it stopped
+ * short.
+ */
+static size_t
+std_writev(int fd, const struct iovec *iov, int iovcnt, int timeout)
 {
-    (void)bytestream_cat(&ctx->bs, 1, "");
-    fprintf(stderr, "%s", SDATA(&ctx->bs, 0));
-    bytestream_rewind(&ctx->bs);
+    size_t total, off;
+    int i;
+
+    total = 0;
+    off = 0;
+    i = 0;
+    while (true) {
+        ssize_t n;
+
+        while (i < iovcnt && off >= iov[i].iov_len) {
+            off -= iov[i].iov_len;
+            ++i;
+        }
+        if (i == iovcnt) {
+            break;
+        }
+        if (off > 0) {
+            n = write(fd,
+                      (char *)iov[i].iov_base + off,
+                      iov[i].iov_len - off);
+        } else {
+            n = writev(fd, iov + i, iovcnt - i);
+        }
+        if (n > 0) {
+            total += n;
+            off += n;
+
+        } else if (n < 0 && errno == EINTR) {
+            /* continue */
+
+        } else if (n < 0 &&
+                   (errno == EAGAIN || errno == EWOULDBLOCK) &&
+                   timeout != 0) {
+            struct pollfd pfd;
+
+            pfd.fd = fd;
+            pfd.events = POLLOUT;
+            if (poll(&pfd, 1, timeout) <= 0) {
+                errno = EAGAIN;
+                break;
+            }
+
+        } else {
+            if (n == 0) {
+                errno = EIO;
+            }
+            break;
+        }
+    }
+    return total;
 }
 
 
+/*
+ * Appends iov past its first skip bytes to the overflow queue.  Unless
+ * partial, what does not fit under MNL4C_OVERFLOW_MAX is dropped.  The
+ * tail of a partially written flush is always queued, so that no record
+ * is ever cut.
+ */
 static void
-writer_init(mnl4c_writer_t *writer)
+writer_std_queue(mnl4c_writer_t *writer,
+                 const struct iovec *iov,
+                 int iovcnt,
+                 size_t skip,
+                 bool partial)
 {
-    writer->write = NULL;
-    writer->data.file.path = NULL;
-    writer->data.file.shadow_path = NULL;
-    writer->data.file.cursz = 0;
-    writer->data.file.maxsz = 0;
-    writer->data.file.maxtm = 0.0;
-    writer->data.file.starttm = 0.0;
-    writer->data.file.curtm = 0.0;
-    writer->data.file.maxfiles = 0;
-    writer->data.file.fd = -1;
-    writer->data.file.flags = 0;
+    size_t sz;
+    char *p;
+    int i;
+
+    for (i = 0, sz = 0; i < iovcnt; ++i) {
+        sz += iov[i].iov_len;
+    }
+    sz -= skip;
+    if (!partial &&
+        writer->data.file.ovlen + sz > MNL4C_OVERFLOW_MAX) {
+        (void)__atomic_fetch_add(&writer->data.file.ndropped,
+                                 sz,
+                                 __ATOMIC_RELAXED);
+        return;
+    }
+    if (writer->data.file.ovoff + writer->data.file.ovlen + sz >
+            writer->data.file.ovsz) {
+        memmove(writer->data.file.ovbuf,
+                writer->data.file.ovbuf + writer->data.file.ovoff,
+                writer->data.file.ovlen);
+        writer->data.file.ovoff = 0;
+    }
+    if (writer->data.file.ovlen + sz > writer->data.file.ovsz) {
+        writer->data.file.ovsz = writer->data.file.ovlen + sz;
+        if ((writer->data.file.ovbuf = realloc(writer->data.file.ovbuf,
+                                               writer->data.file.ovsz)) ==
+                NULL) {
+            FAIL("realloc");
+        }
+    }
+    p = writer->data.file.ovbuf +
+        writer->data.file.ovoff +
+        writer->data.file.ovlen;
+    for (i = 0; i < iovcnt; ++i) {
+        if (skip >= iov[i].iov_len) {
+            skip -= iov[i].iov_len;
+            continue;
+        }
+        memcpy(p, (char *)iov[i].iov_base + skip, iov[i].iov_len - skip);
+        p += iov[i].iov_len - skip;
+        skip = 0;
+    }
+    writer->data.file.ovlen += sz;
 }
 
 
-static int
-_writer_file_cleanup_shadows_cb(const char *path,
-                                struct dirent *de,
-                                void *udata)
+/*
+ * Returns true once the overflow queue is empty.  Gives the queue up if
+ * the descriptor fails for another reason than being full.
+ */
+static bool
+writer_std_drain(mnl4c_writer_t *writer, int timeout)
 {
-    struct {
-        char pat[PATH_MAX];
-        mnarray_t files;
-    } *params = udata;
+    struct iovec iov;
+    size_t n;
 
-    if (de != NULL) {
-        char *probe;
+    if (writer->data.file.ovlen == 0) {
+        return true;
+    }
+    iov.iov_base = writer->data.file.ovbuf + writer->data.file.ovoff;
+    iov.iov_len = writer->data.file.ovlen;
+    n = std_writev(writer->data.file.stdfd, &iov, 1, timeout);
+    writer->data.file.ovoff += n;
+    writer->data.file.ovlen -= n;
+    if (writer->data.file.ovlen > 0 &&
+        errno != EAGAIN && errno != EWOULDBLOCK) {
+        (void)__atomic_fetch_add(&writer->data.file.ndropped,
+                                 writer->data.file.ovlen,
+                                 __ATOMIC_RELAXED);
+        writer->data.file.ovlen = 0;
+    }
+    if (writer->data.file.ovlen == 0) {
+        writer->data.file.ovoff = 0;
+        return true;
+    }
+    return false;
+}
 
-        if ((probe = path_join(path, de->d_name)) == NULL) {
-            return 1;
-        }
-        if (fnmatch(params->pat, probe, FNM_PATHNAME | FNM_PERIOD) == 0) {
-            char **p;
 
-            if ((p = array_incr(&params->files)) == NULL) {
-                FAIL("array_incr");
-            }
-            //TRACE("found: %s against %s", probe, params->pat);
-            *p = probe;
-        } else {
-            //TRACE("not found: %s against %s", probe, pat);
-            free(probe);
-        }
+/*
+ * stdout/stderr go straight to the descriptor, records are never copied
+ * into stdio.  Whatever was printed through stdio before is flushed
+ * first to keep the order.
+ */
+static void
+writer_std_flushv(mnl4c_writer_t *writer,
+                  const struct iovec *iov,
+                  int iovcnt)
+{
+    size_t sz, n;
+    int i;
 
+    (void)fflush(writer->data.file.stdfd == STDOUT_FILENO ?
+                 stdout : stderr);
+
+    if (!(writer->data.file.flags & MNL4C_OPEN_NONBLOCK)) {
+        (void)std_writev(writer->data.file.stdfd, iov, iovcnt, -1);
+        return;
+    }
+
+    if (!writer_std_drain(writer, 0)) {
+        /* keep the order, line up behind the queue */
+        writer_std_queue(writer, iov, iovcnt, 0, false);
+        return;
+    }
+    for (i = 0, sz = 0; i < iovcnt; ++i) {
+        sz += iov[i].iov_len;
+    }
+    n = std_writev(writer->data.file.stdfd, iov, iovcnt, 0);
+    if (n < sz && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        writer_std_queue(writer, iov, iovcnt, n, n > 0);
     }
-    return 0;
 }
 
 
-static int
-_writer_file_cleanup_shadows_fini_item(char **s)
+static void
+writer_std_flush(mnl4c_writer_t *writer, const char *buf, size_t sz)
+{
+    struct iovec iov;
+
+    iov.iov_base = (void *)buf;
+    iov.iov_len = sz;
+    writer_std_flushv(writer, &iov, 1);
+}
+
+
+/*
+ * MNL4C_OPEN_SYSLOG without marks, a message per line
+ */
+static void
+writer_syslog_flush(mnl4c_writer_t *writer, const char *buf, size_t sz)
 {
-    if (*s != NULL) {
-        //TRACE("freeing %s", *s);
-        free(*s);
-        *s = NULL;
+    mnl4c_syslog_send(writer->data.file.syslog, buf, sz, NULL, 0, LOG_DEBUG);
+}
+
+
+static void
+writer_syslog_flushv(mnl4c_writer_t *writer,
+                     const struct iovec *iov,
+                     int iovcnt)
+{
+    int i;
+
+    for (i = 0; i < iovcnt; ++i) {
+        writer_syslog_flush(writer, iov[i].iov_base, iov[i].iov_len);
     }
-    return 0;
 }
 
 
-static int
-_writer_file_cleanup_shadows_cmp(char **a, char **b)
+static void
+sink_put(mnl4c_sink_t *sink, const struct iovec *iov, int iovcnt)
 {
-    if (*a == NULL) {
-        if (*b == NULL) {
-            return 0;
-        } else {
-            return -1;
+    mnl4c_ctx_t *ctx;
+
+    ctx = sink->ctx;
+    if (ctx->async != NULL) {
+        int i;
+
+        for (i = 0; i < iovcnt; ++i) {
+            mnl4c_async_put(ctx->async, iov[i].iov_base, iov[i].iov_len);
         }
     } else {
-        if (*b == NULL) {
-            return 1;
-        } else {
-            return strcmp(*a, *b);
+        (void)pthread_mutex_lock(&ctx->mtx);
+        ctx->writer.flushv(&ctx->writer, iov, iovcnt);
+        (void)pthread_mutex_unlock(&ctx->mtx);
+    }
+}
+
+
+/*
+ * Hands each sink the records of bs up to its level, as they were
+ * formatted into bs.  Adjacent records go in one piece.
+ */
+static void
+mnl4c_ctx_fanout(mnl4c_ctx_t *ctx, mnbytestream_t *bs)
+{
+    mnl4c_tls_t *tls;
+    int i;
+
+    /* bs comes first */
+    tls = (mnl4c_tls_t *)bs;
+    for (i = 0; i < ctx->nsinks; ++i) {
+        mnl4c_sink_t *sink;
+        struct iovec iov[MNL4C_SINK_IOV];
+        int iovcnt;
+        size_t j;
+
+        sink = &ctx->sinks[i];
+        mnl4c_ctx_set_curtm(sink->ctx, mnl4c_ctx_curtm(ctx));
+        if (sink->ctx->writer.data.file.syslog != NULL) {
+            /* a message per record */
+            (void)pthread_mutex_lock(&sink->ctx->mtx);
+            mnl4c_syslog_send(sink->ctx->writer.data.file.syslog,
+                              SDATA(bs, 0),
+                              SEOD(bs),
+                              tls->marks,
+                              tls->nmarks,
+                              sink->level);
+            (void)pthread_mutex_unlock(&sink->ctx->mtx);
+            continue;
+        }
+        iovcnt = 0;
+        for (j = 0; j < tls->nmarks; ++j) {
+            off_t start, end;
+
+            start = tls->marks[j].off;
+            end = j + 1 < tls->nmarks ? tls->marks[j + 1].off : SEOD(bs);
+            end = MIN(end, SEOD(bs));
+            if (tls->marks[j].level > sink->level || start >= end) {
+                continue;
+            }
+            if (iovcnt > 0 &&
+                (char *)iov[iovcnt - 1].iov_base +
+                    iov[iovcnt - 1].iov_len == SDATA(bs, start)) {
+                iov[iovcnt - 1].iov_len += end - start;
+                continue;
+            }
+            if (iovcnt == MNL4C_SINK_IOV) {
+                sink_put(sink, iov, iovcnt);
+                iovcnt = 0;
+            }
+            iov[iovcnt].iov_base = SDATA(bs, start);
+            iov[iovcnt].iov_len = end - start;
+            ++iovcnt;
+        }
+        if (iovcnt > 0) {
+            sink_put(sink, iov, iovcnt);
         }
     }
-    return 0;
+    tls->nmarks = 0;
 }
 
+
+/*
+ * bs holds whole records only, so that concurrent writers never
+ * interleave within a record.
+ */
 static void
-writer_file_cleanup_shadows(mnl4c_writer_t *writer)
+mnl4c_write_sync(mnl4c_ctx_t *ctx, mnbytestream_t *bs)
 {
-    mnbytes_t *tmp;
-    struct {
-        char pat[PATH_MAX];
-        mnarray_t files;
-    } params;
-    char **fname;
-    mnarray_iter_t it;
+    if (ctx->nsinks > 0) {
+        mnl4c_ctx_fanout(ctx, bs);
+    }
+    (void)pthread_mutex_lock(&ctx->mtx);
+    ctx->writer.flush(&ctx->writer, SDATA(bs, 0), SEOD(bs));
+    (void)pthread_mutex_unlock(&ctx->mtx);
+    bytestream_rewind(bs);
+}
 
-    if (writer->data.file.maxfiles <= 0) {
-        return;
+
+/*
+ * MNL4C_OPEN_SYSLOG, the records of bs go by their marks
+ */
+static void
+mnl4c_write_syslog(mnl4c_ctx_t *ctx, mnbytestream_t *bs)
+{
+    mnl4c_tls_t *tls;
+
+    /* bs comes first */
+    tls = (mnl4c_tls_t *)bs;
+    (void)pthread_mutex_lock(&ctx->mtx);
+    mnl4c_syslog_send(ctx->writer.data.file.syslog,
+                      SDATA(bs, 0),
+                      SEOD(bs),
+                      tls->marks,
+                      tls->nmarks,
+                      LOG_DEBUG);
+    (void)pthread_mutex_unlock(&ctx->mtx);
+    if (ctx->nsinks > 0) {
+        mnl4c_ctx_fanout(ctx, bs);
     }
+    tls->nmarks = 0;
+    bytestream_rewind(bs);
+}
 
-    tmp = bytes_new_from_bytes(writer->data.file.path);
-    snprintf(params.pat, sizeof(params.pat), "%s.[0-9][0-9]*", BDATA(tmp));
-    array_init(&params.files,
-               sizeof(char *),
-               0,
-               NULL,
-               (array_finalizer_t)_writer_file_cleanup_shadows_fini_item);
-    if (traverse_dir(dirname(BCDATA(tmp)),
-                     _writer_file_cleanup_shadows_cb,
-                     &params) != 0) {
-        TRACE("traverse_dir() failed, could not cleanup shadows");
-    }
-
-    if (ARRAY_ELNUM(&params.files) > writer->data.file.maxfiles) {
-        array_sort(&params.files,
-                   (array_compar_t)_writer_file_cleanup_shadows_cmp);
-
-        for (fname = array_first(&params.files, &it);
-             fname != NULL;
-             fname = array_next(&params.files, &it)) {
-            if (it.iter < ARRAY_ELNUM(&params.files) - writer->data.file.maxfiles) {
-                //TRACE("unlink: %s", *fname);
-                if (unlink(*fname) != 0) {
-                    TRACE("Failed to unlink %s while cleaninng up shadwos",
-                          *fname);
-                }
-            } else {
-                //TRACE("keep: %s", *fname);
-            }
-        }
+
+static void
+mnl4c_write_async(mnl4c_ctx_t *ctx, mnbytestream_t *bs)
+{
+    if (ctx->nsinks > 0) {
+        mnl4c_ctx_fanout(ctx, bs);
     }
+    mnl4c_async_put(ctx->async, SDATA(bs, 0), SEOD(bs));
+    bytestream_rewind(bs);
+}
+
 
-    array_fini(&params.files);
-    BYTES_DECREF(&tmp);
+static void
+writer_init(mnl4c_writer_t *writer)
+{
+    writer->write = NULL;
+    writer->flush = NULL;
+    writer->flushv = NULL;
+    writer->data.file.path = NULL;
+    writer->data.file.shadow_path = NULL;
+    writer->data.file.cursz = 0;
+    writer->data.file.maxsz = 0;
+    writer->data.file.maxtm = 0.0;
+    writer->data.file.starttm = 0.0;
+    writer->data.file.curtm = 0;
+    writer->data.file.maxfiles = 0;
+    writer->data.file.fd = -1;
+    writer->data.file.flags = 0;
+    writer->data.file.map = NULL;
+    writer->data.file.mapsz = 0;
+    writer->data.file.uring = NULL;
+    writer->data.file.direct = NULL;
+    writer->data.file.compress = MNL4C_COMPRESS_NONE;
+    writer->data.file.compress_level = 0;
+    writer->data.file.manifest = NULL;
+    writer->data.file.zframe = NULL;
+    writer->data.file.syslog = NULL;
+    writer->data.file.stdfd = -1;
+    writer->data.file.ovbuf = NULL;
+    writer->data.file.ovsz = 0;
+    writer->data.file.ovoff = 0;
+    writer->data.file.ovlen = 0;
+    writer->data.file.ndropped = 0;
 }
 
 
@@ -228,22 +503,113 @@ writer_file_new_shadow(mnl4c_writer_t *writer)
     writer->data.file.starttm = writer->data.file.sb.st_ctime;
 #endif
 
-    writer_file_cleanup_shadows(writer);
+    mnl4c_manifest_add(writer->data.file.manifest,
+                       BCDATA(writer->data.file.shadow_path));
+
+    return 0;
+}
 
+
+/*
+ * Only a file whose blocks are all allocated is mapped: a store into a
+ * page the file system cannot back raises SIGBUS.  Otherwise the file is
+ * left as it was, and records are appended with pwrite(), see
+ * writer_file_mmap_append().
+ */
+static int
+writer_file_map(mnl4c_writer_t *writer)
+{
+    size_t pgsz;
+
+    pgsz = (size_t)sysconf(_SC_PAGESIZE);
+    writer->data.file.mapsz =
+        (writer->data.file.maxsz + pgsz - 1) & ~(pgsz - 1);
+    if (posix_fallocate(writer->data.file.fd,
+                        0,
+                        (off_t)writer->data.file.mapsz) != 0 ||
+        (writer->data.file.map = mmap(NULL,
+                                      writer->data.file.mapsz,
+                                      PROT_READ | PROT_WRITE,
+                                      MAP_SHARED,
+                                      writer->data.file.fd,
+                                      0)) == MAP_FAILED) {
+        writer->data.file.map = NULL;
+        writer->data.file.mapsz = 0;
+        /* what has been allocated past the last record */
+        (void)ftruncate(writer->data.file.fd,
+                        (off_t)writer->data.file.cursz);
+        return -1;
+    }
+    (void)madvise(writer->data.file.map,
+                  writer->data.file.mapsz,
+                  MADV_SEQUENTIAL);
     return 0;
 }
 
 
+/*
+ * Gives the preallocated tail back, so that the file ends at the last
+ * record.
+ */
+static void
+writer_file_close(mnl4c_writer_t *writer)
+{
+    if (writer->data.file.map != NULL) {
+        (void)msync(writer->data.file.map,
+                    writer->data.file.mapsz,
+                    MS_ASYNC);
+        (void)munmap(writer->data.file.map, writer->data.file.mapsz);
+        writer->data.file.map = NULL;
+        writer->data.file.mapsz = 0;
+        if (ftruncate(writer->data.file.fd,
+                      (off_t)writer->data.file.cursz) != 0) {
+            TRACE("ftruncate failed");
+        }
+    }
+    if (writer->data.file.uring != NULL) {
+        /* waits for the writes in flight */
+        mnl4c_uring_set_fd(writer->data.file.uring, -1);
+    }
+    if (writer->data.file.direct != NULL) {
+        /* the tail, and the padding cut off */
+        (void)mnl4c_direct_set_fd(writer->data.file.direct, -1, 0);
+    }
+    (void)close(writer->data.file.fd);
+    writer->data.file.fd = -1;
+}
+
+
 static int _writer_file_open(mnl4c_writer_t *writer)
 {
     int oflags;
 
     oflags = MNL4C_FWRITER_DEFAULT_OPEN_FLAGS;
+    if (writer->data.file.flags & MNL4C_OPEN_MMAP) {
+        /* a writable shared mapping needs O_RDWR, and O_APPEND is moot */
+        oflags = O_RDWR | O_CREAT;
+    } else if (writer->data.file.uring != NULL) {
+        /* writes go at explicit offsets, O_APPEND would override them */
+        oflags = O_WRONLY | O_CREAT;
+    } else if (writer->data.file.flags & MNL4C_OPEN_DIRECT) {
+        /* same, block aligned, and the tail block is read back */
+        oflags = O_RDWR | O_CREAT | O_DIRECT;
+    }
     if ((writer->data.file.fd =
                 open(BCDATA(writer->data.file.path),
                      oflags,
                      MNL4C_FWRITER_DEFAULT_OPEN_MODE)) < 0) {
-        TRRET(_WRITER_FILE_OPEN + 1);
+        if (!((oflags & O_DIRECT) && errno == EINVAL)) {
+            TRRET(_WRITER_FILE_OPEN + 1);
+        }
+        /* not supported by the file system, go through the page cache */
+        TRACE("O_DIRECT is not supported for %s",
+              BCDATA(writer->data.file.path));
+        if ((writer->data.file.fd =
+                    open(BCDATA(writer->data.file.path),
+                         oflags & ~O_DIRECT,
+                         MNL4C_FWRITER_DEFAULT_OPEN_MODE)) < 0) {
+            TRRET(_WRITER_FILE_OPEN + 1);
+        }
     }
     if (writer->data.file.flags & MNL4C_OPEN_FLOCK) {
         if (flock(writer->data.file.fd, LOCK_EX|LOCK_NB) == -1) {
@@ -252,11 +618,33 @@ static int _writer_file_open(mnl4c_writer_t *writer)
             TRRET(_WRITER_FILE_OPEN + 2);
         }
     }
+    if (writer->data.file.flags & MNL4C_OPEN_MMAP) {
+        if (writer_file_map(writer) != 0) {
+            TRACE("cannot preallocate %s, falling back to pwrite()",
+                  BCDATA(writer->data.file.path));
+        }
+    }
+    if (writer->data.file.direct != NULL) {
+        if (mnl4c_direct_set_fd(writer->data.file.direct,
+                                writer->data.file.fd,
+                                writer->data.file.cursz) != 0) {
+            close(writer->data.file.fd);
+            writer->data.file.fd = -1;
+            TRRET(_WRITER_FILE_OPEN + 4);
+        }
+    }
+    if (writer->data.file.uring != NULL) {
+        mnl4c_uring_set_fd(writer->data.file.uring, writer->data.file.fd);
+    }
     return 0;
 }
 
+/*
+ * now is the time of the last message, or the current time when rolling
+ * an idle logger over
+ */
 static int
-writer_file_check_rollover(mnl4c_writer_t *writer)
+writer_file_check_rollover_at(mnl4c_writer_t *writer, int64_t now)
 {
     int res;
 
@@ -269,21 +657,39 @@ writer_file_check_rollover(mnl4c_writer_t *writer)
 
     res = 0;
     if (((writer->data.file.maxtm > 0.0) &&
-         (writer->data.file.curtm - writer->data.file.starttm) >
-        writer->data.file.maxtm) ||
+         (MNL4C_NSEC2SEC(now) -
+          writer->data.file.starttm) > writer->data.file.maxtm) ||
         ((writer->data.file.maxsz > 0) &&
          (writer->data.file.cursz > writer->data.file.maxsz))) {
 
         if (writer->data.file.fd >= 0) {
-            close(writer->data.file.fd);
-            writer->data.file.fd = -1;
+            mnbytes_t *closed;
+            size_t closedsz;
+
+            writer_file_close(writer);
             if (unlink(BCDATA(writer->data.file.path)) != 0) {
                 TRRET(WRITER_FILE_OPEN + 2);
             }
-            BYTES_DECREF(&writer->data.file.shadow_path);
+            closed = writer->data.file.shadow_path;
+            closedsz = writer->data.file.cursz;
+            writer->data.file.shadow_path = NULL;
             if (writer_file_new_shadow(writer) != 0) {
+                BYTES_DECREF(&closed);
                 TRRET(WRITER_FILE_OPEN + 3);
             }
+            /*
+             * within the same second the shadow is reopened, it is
+             * compressed when it is finally left
+             */
+            if (strcmp(BCDATA(closed),
+                       BCDATA(writer->data.file.shadow_path)) != 0) {
+                mnl4c_shadow_submit(writer->data.file.manifest,
+                                    BCDATA(closed),
+                                    closedsz,
+                                    writer->data.file.compress,
+                                    writer->data.file.compress_level);
+            }
+            BYTES_DECREF(&closed);
         }
     }
 
@@ -295,6 +701,15 @@ writer_file_check_rollover(mnl4c_writer_t *writer)
 }
 
 
+static int
+writer_file_check_rollover(mnl4c_writer_t *writer)
+{
+    return writer_file_check_rollover_at(
+        writer,
+        __atomic_load_n(&writer->data.file.curtm, __ATOMIC_RELAXED));
+}
+
+
 static int
 writer_file_open(mnl4c_writer_t *writer)
 {
@@ -310,6 +725,12 @@ writer_file_open(mnl4c_writer_t *writer)
      */
     memset(&sb, '\0', sizeof(struct stat));
 
+    if (writer->data.file.manifest == NULL) {
+        writer->data.file.manifest =
+            mnl4c_manifest_new(BCDATA(writer->data.file.path),
+                               writer->data.file.maxfiles);
+    }
+
     if (lstat(BCDATA(writer->data.file.path), &sb) != 0) {
         if (writer_file_new_shadow(writer) != 0) {
             TRRET(WRITER_FILE_OPEN + 1);
@@ -361,7 +782,15 @@ writer_file_open(mnl4c_writer_t *writer)
 #else
         writer->data.file.starttm = writer->data.file.sb.st_ctime;
 #endif
+        mnl4c_manifest_add(writer->data.file.manifest,
+                           BCDATA(writer->data.file.shadow_path));
     }
+    /* writes the manifest out, and applies retention */
+    mnl4c_shadow_submit(writer->data.file.manifest,
+                        NULL,
+                        0,
+                        MNL4C_COMPRESS_NONE,
+                        0);
 
     /*
      * At this point, shadow_path, path, and sb are consistent.
@@ -371,220 +800,1448 @@ writer_file_open(mnl4c_writer_t *writer)
 
 
 static void
-mnl4c_write_file(mnl4c_ctx_t *ctx)
+writer_file_flush(mnl4c_writer_t *writer, const char *buf, size_t sz)
 {
     ssize_t nwritten;
 
     //TRACE("cursz=%ld starttm=%lf curtm=%lf",
-    //      ctx->writer.data.file.cursz,
-    //      ctx->writer.data.file.starttm,
-    //      ctx->writer.data.file.curtm);
+    //      writer->data.file.cursz,
+    //      writer->data.file.starttm,
+    //      writer->data.file.curtm);
 
-    //assert(ctx->writer.data.file.fd >= 0);
+    //assert(writer->data.file.fd >= 0);
     if (MNUNLIKELY(
-        (nwritten = write(ctx->writer.data.file.fd,
-                          SDATA(&ctx->bs, 0),
-                          SEOD(&ctx->bs))) <= 0)) {
+        (nwritten = write(writer->data.file.fd, buf, sz)) <= 0)) {
         TRACE("write failed");
 
     } else {
-        ctx->writer.data.file.cursz += nwritten;
+        writer->data.file.cursz += nwritten;
     }
 
-    bytestream_rewind(&ctx->bs);
-
-    if (writer_file_check_rollover(&ctx->writer) != 0) {
+    if (writer_file_check_rollover(writer) != 0) {
         TRACE("failed to roll over");
     }
 }
 
 
+/*
+ * Whatever does not fit into the mapping goes past its end with pwrite(),
+ * the file is then over maxsz and is rolled over right away.
+ */
 static void
-cache_init(mnl4c_cache_t *cache)
+writer_file_mmap_append(mnl4c_writer_t *writer, const char *buf, size_t sz)
 {
-    cache->pid = getpid();
+    if (MNLIKELY(writer->data.file.cursz + sz <= writer->data.file.mapsz)) {
+        memcpy(writer->data.file.map + writer->data.file.cursz, buf, sz);
+        writer->data.file.cursz += sz;
+
+    } else {
+        ssize_t nwritten;
+
+        if (MNUNLIKELY((nwritten = pwrite(writer->data.file.fd,
+                                          buf,
+                                          sz,
+                                          writer->data.file.cursz)) <= 0)) {
+            TRACE("pwrite failed");
+
+        } else {
+            writer->data.file.cursz += nwritten;
+        }
+    }
 }
 
 
 static void
-writer_fini(mnl4c_writer_t *writer)
+writer_file_mmap_flush(mnl4c_writer_t *writer, const char *buf, size_t sz)
 {
-    BYTES_DECREF(&writer->data.file.path);
-    BYTES_DECREF(&writer->data.file.shadow_path);
+    writer_file_mmap_append(writer, buf, sz);
+
+    if (writer_file_check_rollover(writer) != 0) {
+        TRACE("failed to roll over");
+    }
 }
 
 
-static int
-minfo_init(mnl4c_minfo_t *minfo)
+/*
+ * All of a flush goes to the ring with one submission, see
+ * mnl4c_uring_writev().
+ */
+static void
+writer_file_uring_flushv(mnl4c_writer_t *writer,
+                         const struct iovec *iov,
+                         int iovcnt)
 {
-    minfo->name = NULL;
-    minfo->throttle_threshold = -1.0l;
-    minfo->nthrottled = 0;
-    return 0;
-}
+    ssize_t nwritten;
 
+    if (MNUNLIKELY((nwritten = mnl4c_uring_writev(
+                        writer->data.file.uring,
+                        iov,
+                        iovcnt,
+                        (off_t)writer->data.file.cursz)) <= 0)) {
+        TRACE("write failed");
 
-static int
-minfo_fini(mnl4c_minfo_t *minfo)
-{
-    BYTES_DECREF(&minfo->name);
-    return 0;
+    } else {
+        writer->data.file.cursz += nwritten;
+    }
+
+    if (writer_file_check_rollover(writer) != 0) {
+        TRACE("failed to roll over");
+    }
 }
 
 
-static mnl4c_ctx_t *
-mnl4c_ctx_new(ssize_t bsbufsz)
+static void
+writer_file_uring_flush(mnl4c_writer_t *writer, const char *buf, size_t sz)
 {
-    mnl4c_ctx_t *res;
+    struct iovec iov;
 
-    if ((res = malloc(sizeof(mnl4c_ctx_t))) == NULL) {
-        FAIL("malloc");
-    }
-    res->nref = 0;
-    res->bsbufsz = bsbufsz;
-    bytestream_init(&res->bs, bsbufsz);
-    writer_init(&res->writer);
-    cache_init(&res->cache);
-    array_init(&res->minfos,
-               sizeof(mnl4c_minfo_t),
-               0,
-               (array_initializer_t)minfo_init,
-               (array_finalizer_t)minfo_fini);
-    res->ty = 0;
-    return res;
+    iov.iov_base = (void *)buf;
+    iov.iov_len = sz;
+    writer_file_uring_flushv(writer, &iov, 1);
 }
 
 
 static void
-mnl4c_ctx_destroy(mnl4c_ctx_t **pctx)
+writer_file_direct_flush(mnl4c_writer_t *writer, const char *buf, size_t sz)
 {
-    if (*pctx != NULL) {
-        bytestream_fini(&(*pctx)->bs);
-        writer_fini(&(*pctx)->writer);
-        array_fini(&(*pctx)->minfos);
-        free(*pctx);
-        *pctx = NULL;
+    mnl4c_direct_append(writer->data.file.direct, buf, sz);
+    writer->data.file.cursz += sz;
+    mnl4c_direct_sync(writer->data.file.direct);
+
+    if (writer_file_check_rollover(writer) != 0) {
+        TRACE("failed to roll over");
     }
 }
 
 
-bool
-mnl4c_ctx_allowed(mnl4c_ctx_t *ctx, int level, int id)
+static void
+writer_file_direct_flushv(mnl4c_writer_t *writer,
+                          const struct iovec *iov,
+                          int iovcnt)
 {
-    mnl4c_minfo_t *minfo;
+    int i;
 
-    assert(id >= 0 && id < MNL4C_MAX_MINFOS);
-    if ((minfo = array_get(&ctx->minfos, id)) == NULL) {
-        FAIL("array_get");
+    for (i = 0; i < iovcnt; ++i) {
+        mnl4c_direct_append(writer->data.file.direct,
+                            iov[i].iov_base,
+                            iov[i].iov_len);
+        writer->data.file.cursz += iov[i].iov_len;
+    }
+    mnl4c_direct_sync(writer->data.file.direct);
+
+    if (writer_file_check_rollover(writer) != 0) {
+        TRACE("failed to roll over");
     }
-    assert(minfo->id == id);
-    assert(level >= 0 && (size_t)level < countof(level_names));
-    return minfo->elevel >= level;
 }
 
 
-int
-mnl4c_set_bufsz(mnl4c_logger_t ld, ssize_t sz)
+static void
+writer_file_mmap_flushv(mnl4c_writer_t *writer,
+                        const struct iovec *iov,
+                        int iovcnt)
 {
-    mnl4c_ctx_t **pctx;
+    int i;
 
-    if ((pctx = array_get(&ctxes, ld)) == NULL) {
-        return -1;
+    for (i = 0; i < iovcnt; ++i) {
+        writer_file_mmap_append(writer, iov[i].iov_base, iov[i].iov_len);
+    }
+
+    if (writer_file_check_rollover(writer) != 0) {
+        TRACE("failed to roll over");
     }
-    bytestream_fini(&(*pctx)->bs);
-    bytestream_init(&(*pctx)->bs, sz);
-    (*pctx)->bsbufsz = sz;
-    return 0;
 }
 
 
-void
-mnl4c_register_msg(mnl4c_logger_t ld, int level, int id, const char *name)
+/*
+ * One writev() per call, short writes are resumed where they stopped.
+ */
+static void
+writer_file_flushv(mnl4c_writer_t *writer, const struct iovec *iov, int iovcnt)
 {
-    mnl4c_ctx_t **pctx;
-    mnl4c_minfo_t *minfo;
+    struct iovec rest[MNL4C_IOV_MAX];
 
-    if ((pctx = array_get(&ctxes, ld)) == NULL) {
-        FAIL("array_get");
-    }
+    assert(iovcnt <= MNL4C_IOV_MAX);
+    while (iovcnt > 0) {
+        ssize_t nwritten;
+
+        if (MNUNLIKELY(
+            (nwritten = writev(writer->data.file.fd, iov, iovcnt)) <= 0)) {
+            TRACE("writev failed");
+            break;
+        }
+        writer->data.file.cursz += nwritten;
+
+        while (iovcnt > 0 && (size_t)nwritten >= iov->iov_len) {
+            nwritten -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if (iovcnt > 0) {
+            /* iov may be the caller's, do not touch it */
+            memcpy(rest, iov, sizeof(struct iovec) * iovcnt);
+            rest[0].iov_base = (char *)rest[0].iov_base + nwritten;
+            rest[0].iov_len -= nwritten;
+            iov = rest;
+        }
+    }
+
+    if (writer_file_check_rollover(writer) != 0) {
+        TRACE("failed to roll over");
+    }
+}
+
+
+/*
+ * The frame is written whole, cursz counts compressed bytes.
+ */
+static void
+writer_file_zframe_flushv(mnl4c_writer_t *writer,
+                          const struct iovec *iov,
+                          int iovcnt)
+{
+    struct iovec frame;
+    const char *buf;
+    ssize_t sz;
+
+    if (MNUNLIKELY((sz = mnl4c_zframe_encode(writer->data.file.zframe,
+                                             iov,
+                                             iovcnt,
+                                             &buf)) < 0)) {
+        TRACE("compression failed");
+        return;
+    }
+    frame.iov_base = (void *)buf;
+    frame.iov_len = (size_t)sz;
+    writer_file_flushv(writer, &frame, 1);
+}
+
+
+static void
+writer_file_zframe_flush(mnl4c_writer_t *writer, const char *buf, size_t sz)
+{
+    struct iovec iov;
+
+    iov.iov_base = (void *)buf;
+    iov.iov_len = sz;
+    writer_file_zframe_flushv(writer, &iov, 1);
+}
+
+
+/*
+ * Crash time, from a signal handler.  The writer's own state is not to be
+ * trusted any more than it has to be: no locks, no allocation, no
+ * compression, plain write(2) and pwrite(2).  What is pending in the
+ * queues of the writer is put out first.
+ */
+static void
+writer_crash_begin(mnl4c_writer_t *writer)
+{
+    if (writer->data.file.ovlen > 0) {
+        (void)mnl4c_crash_write(writer->data.file.stdfd,
+                                writer->data.file.ovbuf +
+                                    writer->data.file.ovoff,
+                                writer->data.file.ovlen,
+                                -1);
+    }
+    if (writer->data.file.direct != NULL && writer->data.file.fd >= 0) {
+        /* unaligned writes from here on */
+        mnl4c_direct_crash(writer->data.file.direct);
+    }
+}
+
+
+static void
+writer_crash_write(void *udata, const char *buf, size_t sz)
+{
+    mnl4c_writer_t *writer;
+
+    writer = udata;
+    mnl4c_crash_sidecar_put(buf, sz);
+    if (writer->data.file.stdfd >= 0) {
+        (void)mnl4c_crash_write(writer->data.file.stdfd, buf, sz, -1);
+
+    } else if (writer->data.file.syslog != NULL) {
+        mnl4c_syslog_crash(writer->data.file.syslog, buf, sz);
+
+    } else if (writer->data.file.fd < 0) {
+        /* rollover failed, the sidecar is all there is */
+
+    } else if (writer->data.file.zframe != NULL) {
+        mnl4c_zframe_crash(writer->data.file.fd, buf, sz);
+
+    } else if ((writer->data.file.flags & MNL4C_OPEN_MMAP) ||
+               writer->data.file.uring != NULL ||
+               writer->data.file.direct != NULL) {
+        /* these write at cursz, the file offset means nothing */
+        writer->data.file.cursz +=
+            (size_t)mnl4c_crash_write(writer->data.file.fd,
+                                      buf,
+                                      sz,
+                                      (off_t)writer->data.file.cursz);
+
+    } else {
+        (void)mnl4c_crash_write(writer->data.file.fd, buf, sz, -1);
+    }
+}
+
+
+static void
+writer_crash_end(mnl4c_writer_t *writer)
+{
+    if (writer->data.file.fd >= 0 &&
+        (writer->data.file.map != NULL ||
+         writer->data.file.direct != NULL)) {
+        /* cut off the preallocated tail */
+        (void)ftruncate(writer->data.file.fd,
+                        (off_t)writer->data.file.cursz);
+    }
+}
+
+
+static void
+cache_init(mnl4c_cache_t *cache)
+{
+    cache->pid = getpid();
+    cache->tsseq = 0;
+    cache->tssec = (time_t)-1;
+    memset(cache->tsstr, '\0', sizeof(cache->tsstr));
+}
+
+
+static char *
+fmt_uint(char *p, uint64_t v)
+{
+    char tmp[20], *q;
+
+    q = tmp + sizeof(tmp);
+    do {
+        *--q = '0' + (v % 10);
+        v /= 10;
+    } while (v != 0);
+    memcpy(p, q, tmp + sizeof(tmp) - q);
+    return p + (tmp + sizeof(tmp) - q);
+}
+
+
+/*
+ * Renders localtime of sec into buf, MNL4C_TS_LT_SZ bytes including the
+ * terminating zero.  localtime_r() and strftime() are only called when
+ * the second changes, all other calls copy out the cached string.
+ */
+static void
+cache_ts(mnl4c_cache_t *cache, time_t sec, char *buf)
+{
+    unsigned seq;
+    struct tm tm;
+
+    seq = __atomic_load_n(&cache->tsseq, __ATOMIC_ACQUIRE);
+    if (MNLIKELY(!(seq & 1)) &&
+        __atomic_load_n(&cache->tssec, __ATOMIC_RELAXED) == sec) {
+        memcpy(buf, cache->tsstr, MNL4C_TS_LT_SZ);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (MNLIKELY(__atomic_load_n(&cache->tsseq,
+                                     __ATOMIC_RELAXED) == seq)) {
+            return;
+        }
+    }
+
+    (void)localtime_r(&sec, &tm);
+    (void)strftime(buf, MNL4C_TS_LT_SZ, "%Y-%m-%d %H:%M:%S", &tm);
+
+    /* if someone else is updating the cache, just move on */
+    if (!(seq & 1) &&
+        __atomic_compare_exchange_n(&cache->tsseq,
+                                    &seq,
+                                    seq + 1,
+                                    false,
+                                    __ATOMIC_ACQUIRE,
+                                    __ATOMIC_RELAXED)) {
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        __atomic_store_n(&cache->tssec, sec, __ATOMIC_RELAXED);
+        memcpy(cache->tsstr, buf, MNL4C_TS_LT_SZ);
+        __atomic_store_n(&cache->tsseq, seq + 2, __ATOMIC_RELEASE);
+    }
+}
+
+
+/*
+ * "YYYY-MM-DD HH:MM:SS", as used by the _LT macros.  buf must hold
+ * MNL4C_TS_BUFSZ bytes.
+ */
+size_t
+mnl4c_cache_lt(mnl4c_cache_t *cache, int64_t curtm, char *buf)
+{
+    cache_ts(cache, (time_t)(curtm / 1000000000), buf);
+    return MNL4C_TS_LT_SZ - 1;
+}
+
+
+/*
+ * "<seconds>.<microseconds> YYYY-MM-DD HH:MM:SS", as used by the _LT2
+ * macros.
+ */
+size_t
+mnl4c_cache_lt2(mnl4c_cache_t *cache, int64_t curtm, char *buf)
+{
+    uint64_t usec;
+    unsigned frac;
+    char *p;
+    int i;
+
+    usec = (uint64_t)(curtm + 500) / 1000;
+    frac = usec % 1000000;
+    p = fmt_uint(buf, usec / 1000000);
+    *p++ = '.';
+    for (i = 5; i >= 0; --i) {
+        p[i] = '0' + (frac % 10);
+        frac /= 10;
+    }
+    p += 6;
+    *p++ = ' ';
+    cache_ts(cache, (time_t)(usec / 1000000), p);
+    return p - buf + MNL4C_TS_LT_SZ - 1;
+}
+
+
+static void
+writer_fini(mnl4c_writer_t *writer)
+{
+    if (writer->data.file.fd >= 0) {
+        writer_file_close(writer);
+    }
+    if (writer->data.file.ovlen > 0) {
+        (void)writer_std_drain(writer, MNL4C_OVERFLOW_DRAIN_TIMEOUT);
+    }
+    free(writer->data.file.ovbuf);
+    writer->data.file.ovbuf = NULL;
+    mnl4c_uring_destroy(&writer->data.file.uring);
+    mnl4c_zframe_destroy(&writer->data.file.zframe);
+    mnl4c_syslog_destroy(&writer->data.file.syslog);
+    mnl4c_manifest_decref(&writer->data.file.manifest);
+    mnl4c_direct_destroy(&writer->data.file.direct);
+    BYTES_DECREF(&writer->data.file.path);
+    BYTES_DECREF(&writer->data.file.shadow_path);
+}
+
+
+static int
+minfo_init(mnl4c_minfo_t *minfo)
+{
+    minfo->name = NULL;
+    minfo->throttle_interval = 0;
+    minfo->throttle_tolerance = 0;
+    minfo->throttle_tat = 0;
+    minfo->throttle_since = 0;
+    minfo->nthrottled = 0;
+    minfo->sample_n = 0;
+    minfo->sample_random = false;
+    minfo->sample_cnt = 0;
+    minfo->sample_tag[0] = '\0';
+    minfo->prefix = NULL;
+    return 0;
+}
+
+
+static int
+minfo_fini(mnl4c_minfo_t *minfo)
+{
+    BYTES_DECREF(&minfo->name);
+    if (minfo->prefix != NULL) {
+        free(minfo->prefix);
+        minfo->prefix = NULL;
+    }
+    return 0;
+}
+
+
+static void
+tls_unlink(mnl4c_tls_t *tls)
+{
+    if (tls->prev != NULL) {
+        tls->prev->next = tls->next;
+    } else {
+        tls->ctx->tls = tls->next;
+    }
+    if (tls->next != NULL) {
+        tls->next->prev = tls->prev;
+    }
+    tls->next = NULL;
+    tls->prev = NULL;
+}
+
+
+/*
+ * The owner holds its buffer for the length of a record, and takes it
+ * again when a record is logged from within the arguments of another.
+ * It only ever waits for a housekeeping flush in progress.
+ */
+static void
+tls_claim(mnl4c_tls_t *tls)
+{
+    unsigned busy;
+
+    busy = 0;
+    while (!__atomic_compare_exchange_n(&tls->busy,
+                                        &busy,
+                                        1,
+                                        false,
+                                        __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED)) {
+        if (busy != MNL4C_TLS_HK) {
+            /* already ours */
+            __atomic_store_n(&tls->busy, busy + 1, __ATOMIC_RELAXED);
+            return;
+        }
+        (void)sched_yield();
+        busy = 0;
+    }
+}
+
+
+static bool
+tls_tryclaim_hk(mnl4c_tls_t *tls)
+{
+    unsigned busy;
+
+    busy = 0;
+    return __atomic_compare_exchange_n(&tls->busy,
+                                       &busy,
+                                       MNL4C_TLS_HK,
+                                       false,
+                                       __ATOMIC_ACQUIRE,
+                                       __ATOMIC_RELAXED);
+}
+
+
+static void
+tls_init(mnl4c_tls_t *tls, mnl4c_ctx_t *ctx, ssize_t sz)
+{
+    bytestream_init(&tls->bs, sz);
+    tls->busy = 0;
+    tls->marks = NULL;
+    tls->nmarks = 0;
+    tls->szmarks = 0;
+    tls->ctx = ctx;
+    tls->next = NULL;
+    tls->prev = NULL;
+}
+
+
+static void
+tls_fini(mnl4c_tls_t *tls)
+{
+    bytestream_fini(&tls->bs);
+    free(tls->marks);
+    tls->marks = NULL;
+}
+
+
+static void
+tls_destroy(mnl4c_tls_t *tls)
+{
+    tls_fini(tls);
+    free(tls);
+}
+
+
+/*
+ * ctx->bskey destructor, runs on thread exit
+ */
+static void
+tls_thread_exit(mnl4c_tls_t *tls)
+{
+    mnl4c_ctx_t *ctx;
+
+    ctx = tls->ctx;
+    tls_claim(tls);
+    if (SEOD(&tls->bs) > 0) {
+        ctx->writer.write(ctx, &tls->bs);
+    }
+    (void)pthread_mutex_lock(&ctx->tlsmtx);
+    tls_unlink(tls);
+    (void)pthread_mutex_unlock(&ctx->tlsmtx);
+    tls_destroy(tls);
+}
+
+
+/*
+ * The calling thread's buffer, held until mnl4c_ctx_bs_release().
+ */
+mnbytestream_t *
+mnl4c_ctx_bs(mnl4c_ctx_t *ctx)
+{
+    mnl4c_tls_t *tls;
+
+    if (MNLIKELY((tls = pthread_getspecific(ctx->bskey)) != NULL)) {
+        tls_claim(tls);
+        return &tls->bs;
+    }
+
+    if ((tls = malloc(sizeof(mnl4c_tls_t))) == NULL) {
+        FAIL("malloc");
+    }
+    tls_init(tls, ctx, ctx->bsbufsz);
+    /* taken before anyone else can see it */
+    tls->busy = 1;
+    (void)pthread_mutex_lock(&ctx->tlsmtx);
+    if ((tls->next = ctx->tls) != NULL) {
+        tls->next->prev = tls;
+    }
+    ctx->tls = tls;
+    (void)pthread_mutex_unlock(&ctx->tlsmtx);
+    if (pthread_setspecific(ctx->bskey, tls) != 0) {
+        FAIL("pthread_setspecific");
+    }
+    return &tls->bs;
+}
+
+
+/*
+ * Ends the use of a buffer returned by mnl4c_ctx_bs().
+ */
+void
+mnl4c_ctx_bs_release(mnbytestream_t *bs)
+{
+    mnl4c_tls_t *tls;
+
+    /* bs comes first */
+    tls = (mnl4c_tls_t *)bs;
+    __atomic_store_n(&tls->busy, tls->busy - 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Notes the start of a record in a buffer returned by mnl4c_ctx_bs(), see
+ * mnl4c_ctx_mark().
+ */
+void
+mnl4c_tls_mark(mnbytestream_t *bs, int level)
+{
+    mnl4c_tls_t *tls;
+
+    /* bs comes first */
+    tls = (mnl4c_tls_t *)bs;
+    /* records that bs has been rewound past */
+    while (tls->nmarks > 0 &&
+           tls->marks[tls->nmarks - 1].off >= SEOD(bs)) {
+        --tls->nmarks;
+    }
+    if (tls->nmarks == tls->szmarks) {
+        size_t sz;
+
+        sz = tls->szmarks > 0 ? tls->szmarks * 2 : 64;
+        if ((tls->marks = realloc(tls->marks,
+                                  sizeof(mnl4c_mark_t) * sz)) == NULL) {
+            FAIL("realloc");
+        }
+        tls->szmarks = sz;
+    }
+    tls->marks[tls->nmarks].off = SEOD(bs);
+    tls->marks[tls->nmarks].level = level;
+    tls->marks[tls->nmarks].ts = mnl4c_ctx_curtm(tls->ctx);
+    ++tls->nmarks;
+}
+
+
+/*
+ * Writes out what is pending in all threads' buffers.  The threads are
+ * expected to have stopped logging to ctx.
+ */
+static void
+mnl4c_ctx_flush_all(mnl4c_ctx_t *ctx)
+{
+    mnl4c_tls_t *tls;
+
+    (void)pthread_mutex_lock(&ctx->tlsmtx);
+    for (tls = ctx->tls; tls != NULL; tls = tls->next) {
+        if (SEOD(&tls->bs) > 0) {
+            assert(ctx->writer.write != NULL);
+            ctx->writer.write(ctx, &tls->bs);
+        }
+    }
+    (void)pthread_mutex_unlock(&ctx->tlsmtx);
+}
+
+
+/*
+ * Runs on the housekeeping thread.  Writes out what threads left in their
+ * buffers, rolls an idle file over once maxtm is up, and puts out the
+ * summaries of suppression windows nothing else has closed.  Returns when
+ * to come back.
+ */
+static int64_t
+mnl4c_ctx_housekeep(mnl4c_timer_t *timer, int64_t now)
+{
+    mnl4c_ctx_t *ctx;
+    int64_t next;
+
+    ctx = timer->udata;
+    next = -1;
+
+    if (ctx->flush_latency > 0) {
+        mnl4c_tls_t *tls;
+
+        (void)pthread_mutex_lock(&ctx->tlsmtx);
+        for (tls = ctx->tls; tls != NULL; tls = tls->next) {
+            /* a thread in the middle of a record is left alone */
+            if (tls_tryclaim_hk(tls)) {
+                if (SEOD(&tls->bs) > 0) {
+                    ctx->writer.write(ctx, &tls->bs);
+                }
+                __atomic_store_n(&tls->busy, 0, __ATOMIC_RELEASE);
+            }
+        }
+        (void)pthread_mutex_unlock(&ctx->tlsmtx);
+        next = now + ctx->flush_latency;
+    }
+
+    if (ctx->writer.data.file.path != NULL &&
+        ctx->writer.data.file.maxtm > 0.0) {
+        mnl4c_writer_t *writer;
+        int64_t due;
+
+        writer = &ctx->writer;
+        (void)pthread_mutex_lock(&ctx->mtx);
+        due = (int64_t)((writer->data.file.starttm +
+                         writer->data.file.maxtm) * 1000000000.0);
+        if (due < now && writer->data.file.cursz > 0) {
+            if (writer_file_check_rollover_at(writer, now) != 0) {
+                TRACE("failed to roll over");
+            }
+            due = (int64_t)((writer->data.file.starttm +
+                             writer->data.file.maxtm) * 1000000000.0);
+        }
+        if (due < now) {
+            /* nothing to roll over yet */
+            due = now + (int64_t)(writer->data.file.maxtm * 1000000000.0);
+        }
+        (void)pthread_mutex_unlock(&ctx->mtx);
+        next = next < 0 ? due : MIN(next, due);
+    }
+
+    /*
+     * Windows opened since the last run are only flagged, the minfos are
+     * looked at while that or a window left open asks for it.
+     */
+    if (__atomic_exchange_n(&ctx->throttle_pending, false, __ATOMIC_ACQUIRE) ||
+        ctx->throttle_open) {
+        mnl4c_minfo_t *minfo;
+        mnarray_iter_t it;
+        /* only for its bs, and the marks that go with it */
+        mnl4c_tls_t hk;
+
+        ctx->throttle_open = false;
+        tls_init(&hk, ctx, 256);
+        for (minfo = array_first(&ctx->minfos, &it);
+             minfo != NULL;
+             minfo = array_next(&ctx->minfos, &it)) {
+            int64_t due;
+
+            if (__atomic_load_n(&minfo->nthrottled, __ATOMIC_RELAXED) == 0) {
+                continue;
+            }
+            /* the window closes when a record would be let through */
+            due = __atomic_load_n(&minfo->throttle_tat, __ATOMIC_RELAXED) -
+                minfo->throttle_tolerance;
+            if (due <= now) {
+                mnl4c_minfo_summary(ctx, &hk.bs, minfo, now);
+            } else {
+                ctx->throttle_open = true;
+                next = next < 0 ? due : MIN(next, due);
+            }
+        }
+        if (SEOD(&hk.bs) > 0) {
+            ctx->writer.write(ctx, &hk.bs);
+        }
+        tls_fini(&hk);
+    }
+    if (__atomic_load_n(&ctx->throttling, __ATOMIC_RELAXED)) {
+        int64_t due;
+
+        /* to pick up the windows that open meanwhile */
+        due = now + MNL4C_THROTTLE_POLL_NSEC;
+        next = next < 0 ? due : MIN(next, due);
+    }
+
+    return next;
+}
+
+
+static void
+mnl4c_ctx_timer_init(mnl4c_ctx_t *ctx)
+{
+    if (ctx->timer == NULL) {
+        if ((ctx->timer = malloc(sizeof(mnl4c_timer_t))) == NULL) {
+            FAIL("malloc");
+        }
+        ctx->timer->next = NULL;
+        ctx->timer->prev = NULL;
+        ctx->timer->armed = false;
+        ctx->timer->fire = mnl4c_ctx_housekeep;
+        ctx->timer->udata = ctx;
+    }
+}
+
+
+/*
+ * Reschedules housekeeping of ctx after a change of its settings.
+ */
+static void
+mnl4c_ctx_housekeep_arm(mnl4c_ctx_t *ctx)
+{
+    mnl4c_ctx_timer_init(ctx);
+    /* first run works out the deadline */
+    mnl4c_timer_arm(ctx->timer, mnl4c_clock_realtime());
+}
+
+
+/*
+ * The first record of minfo has just been suppressed.  Runs on the
+ * logging thread, so it only leaves a flag for the periodic housekeeping,
+ * which puts out the summary if no other record comes to close the window.
+ */
+void
+mnl4c_minfo_window_open(mnl4c_ctx_t *ctx, mnl4c_minfo_t *minfo, int64_t now)
+{
+    __atomic_store_n(&minfo->throttle_since, now, __ATOMIC_RELAXED);
+    if (!__atomic_load_n(&ctx->throttle_pending, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&ctx->throttle_pending, true, __ATOMIC_RELEASE);
+    }
+}
+
+
+/*
+ * "<name> <LEVEL>: suppressed N in S", a record of its own.
+ */
+void
+mnl4c_minfo_summary(mnl4c_ctx_t *ctx,
+                    mnbytestream_t *bs,
+                    mnl4c_minfo_t *minfo,
+                    int64_t now)
+{
+    int64_t since;
+    int n;
+    off_t off;
+
+    since = __atomic_load_n(&minfo->throttle_since, __ATOMIC_RELAXED);
+    if ((n = __atomic_exchange_n(&minfo->nthrottled,
+                                 0,
+                                 __ATOMIC_RELAXED)) == 0) {
+        /* someone else did */
+        return;
+    }
+    if (ctx->flags & MNL4C_OPEN_STRUCT) {
+        mnl4c_struct_summary(ctx,
+                             bs,
+                             now,
+                             minfo->flevel,
+                             BCDATA(minfo->name),
+                             n,
+                             MAX(now - since, 0));
+        return;
+    }
+    off = mnl4c_bin_text_begin(ctx, bs, minfo->flevel);
+    if (bytestream_nprintf(bs,
+                           ctx->bsbufsz,
+                           "%.06lf [%d] %s %s: suppressed %d in %.06lfs",
+                           MNL4C_NSEC2SEC(now),
+                           ctx->cache.pid,
+                           BCDATA(minfo->name),
+                           level_names[minfo->flevel],
+                           n,
+                           MNL4C_NSEC2SEC(MAX(now - since, 0))) < 0) {
+        bytestream_rewind(bs);
+    } else {
+        SADVANCEPOS(bs, -1);
+        (void)bytestream_cat(bs, 1, "\n");
+        mnl4c_bin_text_end(bs, off);
+    }
+}
+
+
+/*
+ * Runs in the crash handler.  Every logger's pending output goes to its
+ * file as well as into the sidecar: records queued for the writer thread
+ * first, then those still in the threads' buffers.  The crashing thread
+ * may hold any of the locks, so none are taken.
+ */
+void
+mnl4c_crash_flush_all(void)
+{
+    mnl4c_ctx_t **pctx;
+    mnarray_iter_t it;
+
+    for (pctx = array_first(&ctxes, &it);
+         pctx != NULL;
+         pctx = array_next(&ctxes, &it)) {
+        mnl4c_ctx_t *ctx;
+        mnl4c_tls_t *tls;
+
+        if ((ctx = *pctx) == NULL || ctx->writer.flush == NULL) {
+            continue;
+        }
+        mnl4c_crash_sidecar_begin();
+        writer_crash_begin(&ctx->writer);
+        if (ctx->async != NULL) {
+            mnl4c_async_crash(ctx->async, writer_crash_write, &ctx->writer);
+        }
+        for (tls = ctx->tls; tls != NULL; tls = tls->next) {
+            if (SEOD(&tls->bs) > 0) {
+                writer_crash_write(&ctx->writer,
+                                   SDATA(&tls->bs, 0),
+                                   SEOD(&tls->bs));
+            }
+        }
+        writer_crash_end(&ctx->writer);
+        mnl4c_crash_sidecar_end((int)it.iter, ctx->flags);
+    }
+}
+
+
+static mnl4c_ctx_t *
+mnl4c_ctx_new(ssize_t bsbufsz)
+{
+    mnl4c_ctx_t *res;
+
+    if ((res = malloc(sizeof(mnl4c_ctx_t))) == NULL) {
+        FAIL("malloc");
+    }
+    res->nref = 0;
+    if (pthread_key_create(&res->bskey,
+                           (void (*)(void *))tls_thread_exit) != 0) {
+        FAIL("pthread_key_create");
+    }
+    res->tls = NULL;
+    if (pthread_mutex_init(&res->tlsmtx, NULL) != 0) {
+        FAIL("pthread_mutex_init");
+    }
+    res->bsbufsz = bsbufsz;
+    writer_init(&res->writer);
+    if (pthread_mutex_init(&res->mtx, NULL) != 0) {
+        FAIL("pthread_mutex_init");
+    }
+    cache_init(&res->cache);
+    res->async = NULL;
+    array_init(&res->minfos,
+               sizeof(mnl4c_minfo_t),
+               0,
+               (array_initializer_t)minfo_init,
+               (array_finalizer_t)minfo_fini);
+    if (posix_memalign((void **)&res->levels,
+                       MNL4C_CACHELINE,
+                       MNL4C_MAX_MINFOS) != 0) {
+        FAIL("posix_memalign");
+    }
+    memset(res->levels, 0, MNL4C_MAX_MINFOS);
+    if ((res->byname = malloc(sizeof(int) * MNL4C_MAX_MINFOS)) == NULL) {
+        FAIL("malloc");
+    }
+    res->nbyname = 0;
+    res->ty = 0;
+    res->flags = 0;
+    res->clock = MNL4C_CLOCK_REALTIME;
+    res->flush_latency = 0;
+    res->timer = NULL;
+    res->throttling = false;
+    res->throttle_pending = false;
+    res->throttle_open = false;
+    res->sinks = NULL;
+    res->nsinks = 0;
+    res->marking = false;
+    return res;
+}
+
+
+static void
+mnl4c_ctx_destroy(mnl4c_ctx_t **pctx)
+{
+    if (*pctx != NULL) {
+        if ((*pctx)->timer != NULL) {
+            mnl4c_timer_disarm((*pctx)->timer);
+            free((*pctx)->timer);
+            (*pctx)->timer = NULL;
+        }
+        /* drains whatever is still queued */
+        mnl4c_async_destroy(&(*pctx)->async);
+        /* no more destructor calls past this point */
+        (void)pthread_key_delete((*pctx)->bskey);
+        while ((*pctx)->tls != NULL) {
+            mnl4c_tls_t *tls;
+
+            tls = (*pctx)->tls;
+            tls_unlink(tls);
+            tls_destroy(tls);
+        }
+        (void)pthread_mutex_destroy(&(*pctx)->tlsmtx);
+        writer_fini(&(*pctx)->writer);
+        (void)pthread_mutex_destroy(&(*pctx)->mtx);
+        array_fini(&(*pctx)->minfos);
+        free((*pctx)->sinks);
+        free((*pctx)->levels);
+        free((*pctx)->byname);
+        free(*pctx);
+        *pctx = NULL;
+    }
+}
+
+
+bool
+mnl4c_ctx_allowed(mnl4c_ctx_t *ctx, int level, int id)
+{
+    assert(id >= 0 && id < MNL4C_MAX_MINFOS);
+    assert(level >= 0 && (size_t)level < countof(level_names));
+    return mnl4c_ctx_enabled(ctx, level, id);
+}
+
+
+static void
+levels_update(mnl4c_ctx_t *ctx, mnl4c_minfo_t *minfo)
+{
+    int elevel;
+    uint8_t l;
+
+    /* a nibble wide, -1 disables the message */
+    elevel = MIN(MAX(minfo->elevel, -1), 14);
+    l = MNL4C_LEVELS_PACK(minfo->flevel & 0x07, elevel);
+    if (minfo->sample_n > 1) {
+        l |= MNL4C_LEVELS_SAMPLED;
+    }
+    __atomic_store_n(&ctx->levels[minfo->id], l, __ATOMIC_RELAXED);
+}
+
+
+int
+mnl4c_set_bufsz(mnl4c_logger_t ld, ssize_t sz)
+{
+    mnl4c_ctx_t **pctx;
+
+    if ((pctx = array_get(&ctxes, ld)) == NULL) {
+        return -1;
+    }
+    /* buffers created from now on will use sz */
+    (*pctx)->bsbufsz = sz;
+    if ((*pctx)->timer != NULL) {
+        /* housekeeping would flush through the writer being replaced */
+        mnl4c_timer_disarm((*pctx)->timer);
+    }
+    if ((*pctx)->async != NULL) {
+        /* resize the ring to the new buffer size */
+        mnl4c_async_destroy(&(*pctx)->async);
+    }
+    if ((*pctx)->writer.data.file.uring != NULL) {
+        /* buffers of the new size, registered with the same file */
+        mnl4c_uring_destroy(&(*pctx)->writer.data.file.uring);
+        if (((*pctx)->writer.data.file.uring =
+                mnl4c_uring_new(sz * 2)) == NULL) {
+            FAIL("mnl4c_uring_new");
+        }
+        mnl4c_uring_set_fd((*pctx)->writer.data.file.uring,
+                           (*pctx)->writer.data.file.fd);
+    }
+    if ((*pctx)->flags & MNL4C_OPEN_ASYNC) {
+        (*pctx)->async = mnl4c_async_new(&(*pctx)->writer,
+                                         &(*pctx)->mtx,
+                                         sz);
+    }
+    if ((*pctx)->timer != NULL) {
+        mnl4c_ctx_housekeep_arm(*pctx);
+    }
+    return 0;
+}
+
+
+/*
+ * ctx->byname holds the ids of the registered messages sorted by name, so
+ * that the messages sharing a prefix make up a contiguous range.
+ */
+static const char *
+byname_name(mnl4c_ctx_t *ctx, size_t i)
+{
+    mnl4c_minfo_t *minfo;
+
+    if ((minfo = array_get(&ctx->minfos, ctx->byname[i])) == NULL) {
+        FAIL("array_get");
+    }
+    return BCDATA(minfo->name);
+}
+
+
+/*
+ * the first position whose name is not less than key
+ */
+static size_t
+byname_lower_bound(mnl4c_ctx_t *ctx, const char *key, size_t keysz)
+{
+    size_t lo, hi;
+
+    lo = 0;
+    hi = ctx->nbyname;
+    while (lo < hi) {
+        size_t mid;
+
+        mid = lo + (hi - lo) / 2;
+        if (strncmp(byname_name(ctx, mid), key, keysz) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+
+static void
+byname_insert(mnl4c_ctx_t *ctx, mnl4c_minfo_t *minfo)
+{
+    size_t i;
+
+    assert(ctx->nbyname < MNL4C_MAX_MINFOS);
+    i = byname_lower_bound(ctx, BCDATA(minfo->name), BSZ(minfo->name));
+    memmove(&ctx->byname[i + 1],
+            &ctx->byname[i],
+            sizeof(int) * (ctx->nbyname - i));
+    ctx->byname[i] = minfo->id;
+    ++ctx->nbyname;
+}
+
+
+static void
+byname_remove(mnl4c_ctx_t *ctx, mnl4c_minfo_t *minfo)
+{
+    size_t i;
+
+    for (i = byname_lower_bound(ctx,
+                                BCDATA(minfo->name),
+                                BSZ(minfo->name));
+         i < ctx->nbyname;
+         ++i) {
+        if (ctx->byname[i] == minfo->id) {
+            memmove(&ctx->byname[i],
+                    &ctx->byname[i + 1],
+                    sizeof(int) * (ctx->nbyname - i - 1));
+            --ctx->nbyname;
+            break;
+        }
+    }
+}
+
+
+/*
+ * Calls cb on each message whose name matches pat, or on all of them if
+ * pat is NULL, and returns their number.  Only the range of names that
+ * starts with the literal part of pat is visited.
+ */
+static int
+byname_match(mnl4c_ctx_t *ctx,
+             mnbytes_t *pat,
+             int match,
+             void (*cb)(mnl4c_ctx_t *, mnl4c_minfo_t *, void *),
+             void *udata)
+{
+    const char *s;
+    size_t sz, i;
+    int res;
+
+    if (pat == NULL) {
+        s = "";
+        match = MNL4C_MATCH_PREFIX;
+    } else {
+        s = BCDATA(pat);
+    }
+    switch (match) {
+    case MNL4C_MATCH_PREFIX:
+        sz = strlen(s);
+        break;
+
+    case MNL4C_MATCH_EXACT:
+        /* including the terminating zero */
+        sz = strlen(s) + 1;
+        break;
+
+    case MNL4C_MATCH_GLOB:
+        sz = strcspn(s, "*?[\\");
+        break;
+
+    default:
+        return -1;
+    }
+
+    res = 0;
+    for (i = byname_lower_bound(ctx, s, sz); i < ctx->nbyname; ++i) {
+        mnl4c_minfo_t *minfo;
+
+        if ((minfo = array_get(&ctx->minfos, ctx->byname[i])) == NULL) {
+            FAIL("array_get");
+        }
+        if (strncmp(BCDATA(minfo->name), s, sz) != 0) {
+            break;
+        }
+        if (match == MNL4C_MATCH_GLOB &&
+                fnmatch(s, BCDATA(minfo->name), 0) != 0) {
+            continue;
+        }
+        cb(ctx, minfo, udata);
+        ++res;
+    }
+    return res;
+}
+
+
+/*
+ * " [<pid>] <mod> <LEVEL>" for each level, back to back, the constant part
+ * of a text record header, see mnl4c_text_head()
+ */
+static void
+minfo_prefix_init(mnl4c_ctx_t *ctx, mnl4c_minfo_t *minfo, const char *mod)
+{
+    size_t sz, off;
+    unsigned i;
+
+    sz = 0;
+    for (i = 0; i < countof(level_names); ++i) {
+        sz += snprintf(NULL,
+                       0,
+                       " [%d] %s %s",
+                       ctx->cache.pid,
+                       mod,
+                       level_names[i]);
+    }
+    if (sz > UINT16_MAX) {
+        /* formatted at each record */
+        return;
+    }
+    if ((minfo->prefix = malloc(sz + 1)) == NULL) {
+        FAIL("malloc");
+    }
+    off = 0;
+    for (i = 0; i < countof(level_names); ++i) {
+        minfo->prefix_off[i] = (uint16_t)off;
+        off += snprintf(minfo->prefix + off,
+                        sz + 1 - off,
+                        " [%d] %s %s",
+                        ctx->cache.pid,
+                        mod,
+                        level_names[i]);
+    }
+    minfo->prefix_off[i] = (uint16_t)off;
+}
+
+
+void
+mnl4c_register_msg(mnl4c_logger_t ld, int level, int id, const char *name)
+{
+    mnl4c_register_msg_mod(ld, level, id, name, NULL);
+}
+
+
+void
+mnl4c_register_msg_mod(mnl4c_logger_t ld,
+                       int level,
+                       int id,
+                       const char *name,
+                       const char *mod)
+{
+    mnl4c_ctx_t **pctx;
+    mnl4c_minfo_t *minfo;
+
+    if ((pctx = array_get(&ctxes, ld)) == NULL) {
+        FAIL("array_get");
+    }
     assert(id >= 0 && id < MNL4C_MAX_MINFOS);
     if ((minfo = array_get_safe(&(*pctx)->minfos, id)) == NULL) {
         FAIL("array_get_safe");
     }
+    if (minfo->name != NULL) {
+        /* registered again */
+        byname_remove(*pctx, minfo);
+        (void)minfo_fini(minfo);
+    }
     (void)minfo_init(minfo);
     minfo->id = id;
     minfo->flevel = level;
     minfo->elevel = level;
     minfo->name = bytes_new_from_str(name);
     BYTES_INCREF(minfo->name);
+    if (mod != NULL) {
+        minfo_prefix_init(*pctx, minfo, mod);
+    }
+    levels_update(*pctx, minfo);
+    byname_insert(*pctx, minfo);
+}
+
+
+static void
+set_level_cb(mnl4c_ctx_t *ctx, mnl4c_minfo_t *minfo, void *udata)
+{
+    minfo->elevel = *(int *)udata;
+    levels_update(ctx, minfo);
+}
+
+
+int
+mnl4c_set_level_match(mnl4c_logger_t ld,
+                      int level,
+                      mnbytes_t *pat,
+                      int match)
+{
+    mnl4c_ctx_t **pctx;
+
+    if ((pctx = array_get(&ctxes, ld)) == NULL) {
+        FAIL("array_get");
+    }
+    return byname_match(*pctx, pat, match, set_level_cb, &level);
 }
 
 
 int
 mnl4c_set_level(mnl4c_logger_t ld, int level, mnbytes_t *prefix)
+{
+    return mnl4c_set_level_match(ld, level, prefix, MNL4C_MATCH_PREFIX);
+}
+
+
+static void
+set_throttling_cb(UNUSED mnl4c_ctx_t *ctx, mnl4c_minfo_t *minfo, void *udata)
+{
+    int64_t *bucket;
+
+    bucket = udata;
+    minfo->throttle_tolerance = bucket[1];
+    minfo->throttle_tat = 0;
+    __atomic_store_n(&minfo->throttle_interval, bucket[0], __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Lets through rate records of each selected message per second on
+ * average, and up to burst of them at once.  A rate of 0 turns
+ * throttling off.
+ */
+int
+mnl4c_set_throttling_bucket(mnl4c_logger_t ld,
+                            double rate,
+                            unsigned burst,
+                            mnbytes_t *pat,
+                            int match)
 {
     mnl4c_ctx_t **pctx;
+    int64_t bucket[2];
     mnl4c_minfo_t *minfo;
     mnarray_iter_t it;
+    bool throttling;
     int res;
 
     if ((pctx = array_get(&ctxes, ld)) == NULL) {
         FAIL("array_get");
     }
-
-    res = 0;
-    if (prefix == NULL) {
-        for (minfo = array_first(&(*pctx)->minfos, &it);
-             minfo != NULL;
-             minfo = array_next(&(*pctx)->minfos, &it)) {
-            minfo->elevel = level;
-            ++res;
-        }
+    if (rate > 0.0) {
+        bucket[0] = MAX((int64_t)(1000000000.0 / rate), 1);
+        bucket[1] = bucket[0] * (int64_t)(MAX(burst, 1) - 1);
     } else {
-        for (minfo = array_first(&(*pctx)->minfos, &it);
-             minfo != NULL;
-             minfo = array_next(&(*pctx)->minfos, &it)) {
-            if (bytes_startswith(minfo->name, prefix)) {
-                minfo->elevel = level;
-                ++res;
-            }
+        bucket[0] = 0;
+        bucket[1] = 0;
+    }
+    res = byname_match(*pctx, pat, match, set_throttling_cb, bucket);
+
+    throttling = false;
+    for (minfo = array_first(&(*pctx)->minfos, &it);
+         minfo != NULL;
+         minfo = array_next(&(*pctx)->minfos, &it)) {
+        if (minfo->throttle_interval > 0) {
+            throttling = true;
+            break;
         }
     }
+    __atomic_store_n(&(*pctx)->throttling, throttling, __ATOMIC_RELAXED);
+    if (throttling || (*pctx)->timer != NULL) {
+        /* also puts out the summaries of windows left open */
+        mnl4c_ctx_housekeep_arm(*pctx);
+    }
     return res;
 }
 
 
+/*
+ * A record of each selected message per threshold seconds.
+ */
+int
+mnl4c_set_throttling_match(mnl4c_logger_t ld,
+                           double threshold,
+                           mnbytes_t *pat,
+                           int match)
+{
+    return mnl4c_set_throttling_bucket(ld,
+                                       threshold > 0.0 ? 1.0 / threshold : 0.0,
+                                       1,
+                                       pat,
+                                       match);
+}
+
+
 int
 mnl4c_set_throttling(mnl4c_logger_t ld, double threshold, mnbytes_t *prefix)
+{
+    return mnl4c_set_throttling_match(ld,
+                                      threshold,
+                                      prefix,
+                                      MNL4C_MATCH_PREFIX);
+}
+
+
+static void
+set_sampling_cb(mnl4c_ctx_t *ctx, mnl4c_minfo_t *minfo, void *udata)
+{
+    unsigned *sample;
+
+    sample = udata;
+    if (sample[0] > 1) {
+        (void)snprintf(minfo->sample_tag,
+                       sizeof(minfo->sample_tag),
+                       "@%u",
+                       sample[0]);
+        minfo->sample_random = sample[1] == MNL4C_SAMPLE_RANDOM;
+        minfo->sample_cnt = 0;
+    }
+    /* the levels bit follows, mnl4c_ctx_sample() checks n anyway */
+    __atomic_store_n(&minfo->sample_n,
+                     sample[0] > 1 ? sample[0] : 0,
+                     __ATOMIC_RELAXED);
+    levels_update(ctx, minfo);
+}
+
+
+/*
+ * Lets through one record in n of each selected message, either every
+ * n-th (MNL4C_SAMPLE_EVERY) or each with a probability of 1/n
+ * (MNL4C_SAMPLE_RANDOM).  The records that are let through are marked
+ * "@n".  An n of 0 or 1 turns sampling off.
+ */
+int
+mnl4c_set_sampling_match(mnl4c_logger_t ld,
+                         unsigned n,
+                         int mode,
+                         mnbytes_t *pat,
+                         int match)
 {
     mnl4c_ctx_t **pctx;
-    mnl4c_minfo_t *minfo;
-    mnarray_iter_t it;
-    int res;
+    unsigned sample[2];
 
     if ((pctx = array_get(&ctxes, ld)) == NULL) {
         FAIL("array_get");
     }
+    sample[0] = n;
+    sample[1] = (unsigned)mode;
+    return byname_match(*pctx, pat, match, set_sampling_cb, sample);
+}
 
-    res = 0;
-    if (prefix == NULL) {
-        for (minfo = array_first(&(*pctx)->minfos, &it);
-             minfo != NULL;
-             minfo = array_next(&(*pctx)->minfos, &it)) {
-            minfo->throttle_threshold = threshold;
-            ++res;
-        }
-    } else {
-        for (minfo = array_first(&(*pctx)->minfos, &it);
-             minfo != NULL;
-             minfo = array_next(&(*pctx)->minfos, &it)) {
-            if (bytes_startswith(minfo->name, prefix)) {
-                minfo->throttle_threshold = threshold;
-                ++res;
-            }
-        }
-    }
-    return res;
+
+int
+mnl4c_set_sampling(mnl4c_logger_t ld,
+                   unsigned n,
+                   int mode,
+                   mnbytes_t *prefix)
+{
+    return mnl4c_set_sampling_match(ld, n, mode, prefix, MNL4C_MATCH_PREFIX);
 }
 
 
@@ -597,6 +2254,8 @@ mnl4c_open(unsigned ty, ...)
     double maxtm;
     size_t maxfiles;
     int flags;
+    const char *ident;
+    int facility;
     mnl4c_ctx_t **pctx;
     mnarray_iter_t it;
 
@@ -605,6 +2264,8 @@ mnl4c_open(unsigned ty, ...)
     maxtm = 0;
     maxfiles = 0;
     flags = 0;
+    ident = NULL;
+    facility = LOG_USER;
 
     if ((ty & MNL4C_OPEN_FLOCK) &&
         ((ty & MNL4C_OPEN_TY) != MNL4C_OPEN_FILE)) {
@@ -626,17 +2287,69 @@ mnl4c_open(unsigned ty, ...)
         flags = va_arg(ap, int);
         break;
 
+    case MNL4C_OPEN_SYSLOG:
+        fpath = va_arg(ap, const char *);
+        ident = va_arg(ap, const char *);
+        facility = va_arg(ap, int);
+        if (fpath == NULL) {
+            fpath = MNL4C_SYSLOG_PATH;
+        }
+        break;
+
     default:
         FAIL("mnl4c_open");
         break;
     }
     va_end(ap);
 
+    if ((ty & MNL4C_OPEN_MMAP) && maxsz == 0) {
+        TRACE("mmap needs a file with maxsz");
+        return -1;
+    }
+    if ((ty & MNL4C_OPEN_URING) &&
+        (((ty & MNL4C_OPEN_TY) != MNL4C_OPEN_FILE) ||
+         (ty & MNL4C_OPEN_MMAP))) {
+        TRACE("io_uring is for plain file loggers only");
+        return -1;
+    }
+    if ((ty & MNL4C_OPEN_DIRECT) &&
+        (((ty & MNL4C_OPEN_TY) != MNL4C_OPEN_FILE) ||
+         (ty & (MNL4C_OPEN_MMAP | MNL4C_OPEN_URING)))) {
+        TRACE("O_DIRECT is for plain file loggers only");
+        return -1;
+    }
+    if ((ty & MNL4C_OPEN_ZSTD) &&
+        (((ty & MNL4C_OPEN_TY) != MNL4C_OPEN_FILE) ||
+         (ty & (MNL4C_OPEN_MMAP | MNL4C_OPEN_URING | MNL4C_OPEN_DIRECT)))) {
+        TRACE("zstd frames are for plain file loggers only");
+        return -1;
+    }
+    if ((ty & MNL4C_OPEN_NONBLOCK) &&
+        ((ty & MNL4C_OPEN_TY) == MNL4C_OPEN_FILE)) {
+        TRACE("non-blocking mode is not for files");
+        return -1;
+    }
+    if (((ty & MNL4C_OPEN_TY) == MNL4C_OPEN_SYSLOG) &&
+        (ty & (MNL4C_OPEN_ASYNC | MNL4C_OPEN_BINARY))) {
+        TRACE("syslog takes text records, synchronously");
+        return -1;
+    }
+    if (facility & ~LOG_FACMASK) {
+        TRACE("invalid facility: %d", facility);
+        return -1;
+    }
+    if ((ty & MNL4C_OPEN_STRUCT) &&
+        (((ty & MNL4C_OPEN_STRUCT) == MNL4C_OPEN_STRUCT) ||
+         (ty & MNL4C_OPEN_BINARY))) {
+        TRACE("one of JSON, logfmt and binary at a time");
+        return -1;
+    }
+
     for (pctx = array_first(&ctxes, &it);
          pctx != NULL;
          pctx = array_next(&ctxes, &it)) {
         if (*pctx != NULL) {
-            if ((*pctx)->ty == ty) {
+            if ((*pctx)->ty == (ty & MNL4C_OPEN_TY)) {
                 if (fpath != NULL) {
                     if (strcmp(fpath,
                                BCDATA((*pctx)->
@@ -655,6 +2368,14 @@ mnl4c_open(unsigned ty, ...)
         }
     }
 
+    if (pctx != NULL &&
+        (*pctx)->flags != (ty & ~MNL4C_OPEN_TY)) {
+        /* one writer per destination */
+        TRACE("%s is already open with other flags",
+              fpath != NULL ? fpath : "stdout/stderr");
+        return -1;
+    }
+
     if (pctx == NULL) {
         /* first find a free slot */
         for (pctx = array_first(&ctxes, &it);
@@ -671,23 +2392,34 @@ mnl4c_open(unsigned ty, ...)
             if ((pctx = array_incr_iter(&ctxes, &it)) == NULL) {
                 FAIL("array_incr_iter");
             }
-            (*pctx)->ty = ty & MNL4C_OPEN_TY;
         }
+        (*pctx)->ty = ty & MNL4C_OPEN_TY;
+        (*pctx)->flags = ty & ~MNL4C_OPEN_TY;
 
         switch (ty & MNL4C_OPEN_TY) {
         case MNL4C_OPEN_STDOUT:
-            (*pctx)->writer.write = mnl4c_write_stdout;
-            (*pctx)->writer.data.file.curtm = mnl4c_now_posix();
+            (*pctx)->writer.write = mnl4c_write_sync;
+            (*pctx)->writer.flush = writer_std_flush;
+            (*pctx)->writer.flushv = writer_std_flushv;
+            (*pctx)->writer.data.file.stdfd = STDOUT_FILENO;
+            (*pctx)->writer.data.file.flags = ty & MNL4C_OPEN_NONBLOCK;
+            (*pctx)->writer.data.file.curtm = mnl4c_clock_realtime();
             break;
 
         case MNL4C_OPEN_STDERR:
-            (*pctx)->writer.write = mnl4c_write_stderr;
-            (*pctx)->writer.data.file.curtm = mnl4c_now_posix();
+            (*pctx)->writer.write = mnl4c_write_sync;
+            (*pctx)->writer.flush = writer_std_flush;
+            (*pctx)->writer.flushv = writer_std_flushv;
+            (*pctx)->writer.data.file.stdfd = STDERR_FILENO;
+            (*pctx)->writer.data.file.flags = ty & MNL4C_OPEN_NONBLOCK;
+            (*pctx)->writer.data.file.curtm = mnl4c_clock_realtime();
             break;
 
         case MNL4C_OPEN_FILE:
             assert(fpath != NULL);
-            (*pctx)->writer.write = mnl4c_write_file;
+            (*pctx)->writer.write = mnl4c_write_sync;
+            (*pctx)->writer.flush = writer_file_flush;
+            (*pctx)->writer.flushv = writer_file_flushv;
             if (*fpath != '/') {
                 TRACE("fpath is not an absolute path: %s", fpath);
                 goto err;
@@ -695,20 +2427,79 @@ mnl4c_open(unsigned ty, ...)
             (*pctx)->writer.data.file.path = bytes_new_from_str(fpath);
             (*pctx)->writer.data.file.maxsz = maxsz;
             (*pctx)->writer.data.file.maxtm = maxtm;
-            (*pctx)->writer.data.file.starttm = mnl4c_now_posix();
-            (*pctx)->writer.data.file.curtm =
-                (*pctx)->writer.data.file.starttm;
+            (*pctx)->writer.data.file.curtm = mnl4c_clock_realtime();
+            (*pctx)->writer.data.file.starttm =
+                MNL4C_NSEC2SEC((*pctx)->writer.data.file.curtm);
             (*pctx)->writer.data.file.maxfiles = maxfiles;
-            (*pctx)->writer.data.file.flags = flags;
+            (*pctx)->writer.data.file.flags =
+                flags | (ty & (MNL4C_OPEN_MMAP | MNL4C_OPEN_DIRECT));
+            if (ty & MNL4C_OPEN_MMAP) {
+                (*pctx)->writer.flush = writer_file_mmap_flush;
+                (*pctx)->writer.flushv = writer_file_mmap_flushv;
+            }
+            if (ty & MNL4C_OPEN_URING) {
+                if (((*pctx)->writer.data.file.uring =
+                        mnl4c_uring_new((*pctx)->bsbufsz * 2)) == NULL) {
+                    TRACE("io_uring is not available");
+                    goto err;
+                }
+                (*pctx)->writer.flush = writer_file_uring_flush;
+                (*pctx)->writer.flushv = writer_file_uring_flushv;
+            }
+            if (ty & MNL4C_OPEN_DIRECT) {
+                (*pctx)->writer.data.file.direct = mnl4c_direct_new();
+                (*pctx)->writer.flush = writer_file_direct_flush;
+                (*pctx)->writer.flushv = writer_file_direct_flushv;
+            }
+            if (ty & MNL4C_OPEN_ZSTD) {
+                if (((*pctx)->writer.data.file.zframe =
+                        mnl4c_zframe_new(MNL4C_ZFRAME_LEVEL)) == NULL) {
+                    TRACE("zstd is not available");
+                    goto err;
+                }
+                (*pctx)->writer.flush = writer_file_zframe_flush;
+                (*pctx)->writer.flushv = writer_file_zframe_flushv;
+            }
             if (writer_file_open(&(*pctx)->writer) != 0) {
                 goto err;
             }
             break;
 
+        case MNL4C_OPEN_SYSLOG:
+            (*pctx)->writer.write = mnl4c_write_syslog;
+            (*pctx)->writer.flush = writer_syslog_flush;
+            (*pctx)->writer.flushv = writer_syslog_flushv;
+            if (((*pctx)->writer.data.file.syslog =
+                    mnl4c_syslog_new(fpath,
+                                     ident,
+                                     facility,
+                                     ty & MNL4C_OPEN_NONBLOCK)) == NULL) {
+                TRACE("cannot connect to %s", fpath);
+                goto err;
+            }
+            /* to be found again by mnl4c_open() */
+            (*pctx)->writer.data.file.path = bytes_new_from_str(fpath);
+            (*pctx)->writer.data.file.curtm = mnl4c_clock_realtime();
+            (*pctx)->marking = true;
+            break;
+
         default:
             FAIL("mnl4c_open");
             break;
         }
+
+        if (ty & MNL4C_OPEN_ASYNC) {
+            (*pctx)->async = mnl4c_async_new(&(*pctx)->writer,
+                                             &(*pctx)->mtx,
+                                             (*pctx)->bsbufsz);
+            (*pctx)->writer.write = mnl4c_write_async;
+        }
+
+        if ((ty & MNL4C_OPEN_TY) == MNL4C_OPEN_FILE &&
+            (*pctx)->writer.data.file.maxtm > 0.0) {
+            /* roll over on time even when nothing is logged */
+            mnl4c_ctx_housekeep_arm(*pctx);
+        }
     }
 
     ++(*pctx)->nref;
@@ -733,6 +2524,196 @@ mnl4c_get_ctx(mnl4c_logger_t ld)
 }
 
 
+int
+mnl4c_set_clock(mnl4c_logger_t ld, int clock)
+{
+    mnl4c_ctx_t **pctx;
+
+    if ((pctx = array_get(&ctxes, ld)) == NULL) {
+        TRRET(SET_CLOCK + 1);
+    }
+    if (mnl4c_clock_start(clock) != 0) {
+        TRRET(SET_CLOCK + 2);
+    }
+    (*pctx)->clock = clock;
+    return 0;
+}
+
+
+/*
+ * Makes sure nothing stays in a thread's buffer for much longer than
+ * latency seconds, 0 turns that off.
+ */
+int
+mnl4c_set_flush_latency(mnl4c_logger_t ld, double latency)
+{
+    mnl4c_ctx_t **pctx;
+
+    if ((pctx = array_get(&ctxes, ld)) == NULL || *pctx == NULL) {
+        TRRET(SET_FLUSH_LATENCY + 1);
+    }
+    if (latency < 0.0) {
+        TRRET(SET_FLUSH_LATENCY + 2);
+    }
+    (*pctx)->flush_latency = (int64_t)(latency * 1000000000.0);
+    mnl4c_ctx_housekeep_arm(*pctx);
+    return 0;
+}
+
+
+/*
+ * Hands the records of ld at level and above (LOG_ERR takes LOG_EMERG
+ * to LOG_ERR) also to the sink logger, formatted only once, for ld.  The
+ * sink must take the same kind of records, text, JSON, logfmt or binary;
+ * messages need not be registered with it.  Adding a sink again changes
+ * its level.  Sinks are to be added before logging to ld starts, and are
+ * closed along with ld.  A sink cannot have sinks of its own.
+ */
+int
+mnl4c_add_sink(mnl4c_logger_t ld, mnl4c_logger_t sink, int level)
+{
+    mnl4c_ctx_t **pctx, *sctx;
+    mnl4c_sink_t *s;
+    int i;
+
+    if ((pctx = array_get(&ctxes, ld)) == NULL || *pctx == NULL) {
+        TRRET(ADD_SINK + 1);
+    }
+    if ((sctx = mnl4c_get_ctx(sink)) == NULL || sctx == *pctx) {
+        TRRET(ADD_SINK + 2);
+    }
+    if (level < 0 || (size_t)level >= countof(level_names)) {
+        TRRET(ADD_SINK + 3);
+    }
+    if ((sctx->flags & (MNL4C_OPEN_BINARY | MNL4C_OPEN_STRUCT)) !=
+        ((*pctx)->flags & (MNL4C_OPEN_BINARY | MNL4C_OPEN_STRUCT))) {
+        TRRET(ADD_SINK + 4);
+    }
+    if (sctx->nsinks > 0) {
+        TRRET(ADD_SINK + 5);
+    }
+    for (i = 0; i < (*pctx)->nsinks; ++i) {
+        if ((*pctx)->sinks[i].ctx == sctx) {
+            (*pctx)->sinks[i].level = level;
+            return 0;
+        }
+    }
+    if ((s = realloc((*pctx)->sinks,
+                     sizeof(mnl4c_sink_t) * ((*pctx)->nsinks + 1))) == NULL) {
+        FAIL("realloc");
+    }
+    (*pctx)->sinks = s;
+    s += (*pctx)->nsinks;
+    s->ld = mnl4c_incref(sink);
+    s->ctx = sctx;
+    s->level = level;
+    ++(*pctx)->nsinks;
+    (*pctx)->marking = true;
+    return 0;
+}
+
+
+/*
+ * On SIGSEGV, SIGBUS, SIGILL, SIGFPE and SIGABRT, writes out what all
+ * loggers have pending before the process goes down.  Unless sidecar is
+ * NULL, the same output is also kept in a ring of sz bytes mapped from
+ * that file, see l4cdecode --sidecar.  A sidecar left by a crash is
+ * renamed after the time of the crash.
+ */
+int
+mnl4c_set_crash_flush(const char *sidecar, size_t sz)
+{
+    if (sidecar != NULL && sz == 0) {
+        TRRET(SET_CRASH_FLUSH + 1);
+    }
+    if (mnl4c_crash_install(sidecar, sz) != 0) {
+        TRRET(SET_CRASH_FLUSH + 2);
+    }
+    return 0;
+}
+
+
+int
+mnl4c_set_compression(mnl4c_logger_t ld, int compress, int level)
+{
+    mnl4c_ctx_t **pctx;
+
+    if ((pctx = array_get(&ctxes, ld)) == NULL) {
+        TRRET(SET_COMPRESSION + 1);
+    }
+    if ((*pctx)->ty != MNL4C_OPEN_FILE) {
+        TRRET(SET_COMPRESSION + 2);
+    }
+    if (mnl4c_shadow_codec_check(compress) != 0) {
+        TRRET(SET_COMPRESSION + 3);
+    }
+    if ((*pctx)->writer.data.file.zframe != NULL &&
+        compress != MNL4C_COMPRESS_NONE) {
+        /* already compressed as written */
+        TRRET(SET_COMPRESSION + 4);
+    }
+    (*pctx)->writer.data.file.compress = compress;
+    (*pctx)->writer.data.file.compress_level = level;
+    return 0;
+}
+
+
+/*
+ * Keeps at most maxfiles shadows, taking at most maxbytes in total,
+ * 0 stands for no limit.  Sizes are taken after compression.
+ */
+int
+mnl4c_set_retention(mnl4c_logger_t ld, size_t maxfiles, size_t maxbytes)
+{
+    mnl4c_ctx_t **pctx;
+
+    if ((pctx = array_get(&ctxes, ld)) == NULL) {
+        TRRET(SET_RETENTION + 1);
+    }
+    if ((*pctx)->ty != MNL4C_OPEN_FILE ||
+        (*pctx)->writer.data.file.manifest == NULL) {
+        TRRET(SET_RETENTION + 2);
+    }
+    (*pctx)->writer.data.file.maxfiles = maxfiles;
+    mnl4c_manifest_set_retention((*pctx)->writer.data.file.manifest,
+                                 maxfiles,
+                                 maxbytes);
+    mnl4c_shadow_submit((*pctx)->writer.data.file.manifest,
+                        NULL,
+                        0,
+                        MNL4C_COMPRESS_NONE,
+                        0);
+    return 0;
+}
+
+
+/*
+ * Bytes of stdout/stderr output given up under MNL4C_OPEN_NONBLOCK,
+ * syslog messages that were not sent, or bytes that MNL4C_OPEN_URING or
+ * MNL4C_OPEN_DIRECT could not write.
+ */
+size_t
+mnl4c_get_dropped(mnl4c_logger_t ld)
+{
+    mnl4c_ctx_t **pctx;
+
+    if ((pctx = array_get(&ctxes, ld)) == NULL || *pctx == NULL) {
+        return 0;
+    }
+    if ((*pctx)->writer.data.file.syslog != NULL) {
+        return mnl4c_syslog_dropped((*pctx)->writer.data.file.syslog);
+    }
+    if ((*pctx)->writer.data.file.uring != NULL) {
+        return mnl4c_uring_dropped((*pctx)->writer.data.file.uring);
+    }
+    if ((*pctx)->writer.data.file.direct != NULL) {
+        return mnl4c_direct_dropped((*pctx)->writer.data.file.direct);
+    }
+    return __atomic_load_n(&(*pctx)->writer.data.file.ndropped,
+                           __ATOMIC_RELAXED);
+}
+
+
 mnl4c_logger_t
 mnl4c_incref(mnl4c_logger_t ld)
 {
@@ -793,9 +2774,13 @@ mnl4c_close(mnl4c_logger_t ld)
     --(*pctx)->nref;
 
     if ((*pctx)->nref <= 0) {
-        if (SEOD(&(*pctx)->bs) > 0) {
-            assert((*pctx)->writer.write != NULL);
-            (*pctx)->writer.write(*pctx);
+        if ((*pctx)->timer != NULL) {
+            mnl4c_timer_disarm((*pctx)->timer);
+        }
+        mnl4c_ctx_flush_all(*pctx);
+        while ((*pctx)->nsinks > 0) {
+            --(*pctx)->nsinks;
+            (void)mnl4c_close((*pctx)->sinks[(*pctx)->nsinks].ld);
         }
         (void)array_clear_item(&ctxes, ld);
     }
@@ -837,5 +2822,9 @@ mnl4c_init(void)
 void
 mnl4c_fini(void)
 {
+    mnl4c_crash_fini();
     array_fini(&ctxes);
+    mnl4c_housekeep_fini();
+    mnl4c_shadow_fini();
+    mnl4c_clock_fini();
 }
@@ -2,11 +2,17 @@
 #define MNL4C_H_DEFINED
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 #include <syslog.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 
 #include <mncommon/array.h>
 #include <mncommon/bytes.h>
@@ -21,6 +27,12 @@ extern "C" {
 typedef int mnl4c_logger_t;
 
 struct _mnl4c_ctx;
+struct _mnl4c_async;
+struct _mnl4c_tls;
+struct _mnl4c_uring;
+struct _mnl4c_manifest;
+struct _mnl4c_zframe;
+struct _mnl4c_timer;
 
 
 typedef struct _mnl4c_minfo {
@@ -31,15 +43,45 @@ typedef struct _mnl4c_minfo {
     int flevel;
     int elevel;
     mnbytes_t *name;
-    double throttle_threshold;
+    /*
+     * token bucket, nsec, see mnl4c_minfo_admit(); no throttling while
+     * throttle_interval is 0
+     */
+    int64_t throttle_interval;
+    int64_t throttle_tolerance;
+    int64_t throttle_tat;
+    /* the first record suppressed since the last one let through */
+    int64_t throttle_since;
     int nthrottled;
+    /*
+     * one record in sample_n is let through, every sample_n-th or at
+     * random, see mnl4c_ctx_sample()
+     */
+    unsigned sample_n;
+    bool sample_random;
+    unsigned sample_cnt;
+    /* "@<sample_n>" after the level, to weigh the record by */
+    char sample_tag[12];
+    /*
+     * " [<pid>] <mod> <LEVEL>" of each level at prefix_off[level], up to
+     * prefix_off[level + 1], or NULL, see mnl4c_register_msg_mod()
+     */
+    char *prefix;
+    uint16_t prefix_off[LOG_DEBUG + 2];
 } mnl4c_minfo_t;
 
 
 #define MNL4C_FWRITER_DEFAULT_OPEN_FLAGS (O_WRONLY | O_APPEND | O_CREAT)
 #define MNL4C_FWRITER_DEFAULT_OPEN_MODE 0644
 typedef struct _mnl4c_writer {
-    void (*write)(struct _mnl4c_ctx *);
+    void (*write)(struct _mnl4c_ctx *, mnbytestream_t *);
+    /*
+     * back end of write(), runs on the writer thread under
+     * MNL4C_OPEN_ASYNC
+     */
+    void (*flush)(struct _mnl4c_writer *, const char *, size_t);
+    /* gathering flush(), takes up to MNL4C_IOV_MAX records */
+    void (*flushv)(struct _mnl4c_writer *, const struct iovec *, int);
     union {
         struct {
             mnbytes_t *path;
@@ -48,41 +90,602 @@ typedef struct _mnl4c_writer {
             size_t maxsz;
             double maxtm;
             double starttm;
-            double curtm;
+            /* nsec, time of the last message */
+            int64_t curtm;
             size_t maxfiles;
             int fd;
             struct stat sb;
             unsigned flags;
+            /* MNL4C_OPEN_MMAP */
+            char *map;
+            size_t mapsz;
+            /* MNL4C_OPEN_URING */
+            struct _mnl4c_uring *uring;
+            /* MNL4C_OPEN_DIRECT */
+            struct _mnl4c_direct *direct;
+            /* MNL4C_COMPRESS_*, of closed shadows */
+            int compress;
+            int compress_level;
+            /* the shadows, see mnl4c_set_retention() */
+            struct _mnl4c_manifest *manifest;
+            /* MNL4C_OPEN_ZSTD */
+            struct _mnl4c_zframe *zframe;
+            /* MNL4C_OPEN_SYSLOG */
+            struct _mnl4c_syslog *syslog;
+            /* MNL4C_OPEN_STDOUT, MNL4C_OPEN_STDERR */
+            int stdfd;
+            /*
+             * MNL4C_OPEN_NONBLOCK, ovlen bytes at ovbuf + ovoff that
+             * stdfd did not take yet
+             */
+            char *ovbuf;
+            size_t ovsz;
+            size_t ovoff;
+            size_t ovlen;
+            size_t ndropped;
         } file;
     } data;
 } mnl4c_writer_t;
 
 
+/*
+ * "YYYY-MM-DD HH:MM:SS" of the current second, rendered once per second
+ * and guarded by the tsseq sequence counter, odd while being updated.
+ */
+#define MNL4C_TS_LT_SZ 20
+#define MNL4C_TS_BUFSZ 64
 typedef struct _mnl4c_cache {
     pid_t pid;
+    unsigned tsseq;
+    time_t tssec;
+    char tsstr[MNL4C_TS_LT_SZ];
 } mnl4c_cache_t;
 
 
+/*
+ * another logger that takes the records of one at up to level, see
+ * mnl4c_add_sink()
+ */
+typedef struct _mnl4c_sink {
+    mnl4c_logger_t ld;
+    /* strongref */
+    struct _mnl4c_ctx *ctx;
+    int level;
+} mnl4c_sink_t;
+
+
 #define MNL4C_MAX_MINFOS 1024
 typedef struct _mnl4c_ctx {
     ssize_t nref;
-    mnbytestream_t bs;
+    /*
+     * each thread formats into its own buffer, see mnl4c_ctx_bs()
+     */
+    pthread_key_t bskey;
+    struct _mnl4c_tls *tls;
+    pthread_mutex_t tlsmtx;
     ssize_t bsbufsz;
     /* strongref */
     mnl4c_writer_t writer;
+    /* serializes writer.flush() */
+    pthread_mutex_t mtx;
     mnl4c_cache_t cache;
     mnarray_t minfos;
+    /*
+     * MNL4C_MAX_MINFOS bytes indexed by message id, cache line aligned,
+     * see mnl4c_ctx_enabled()
+     */
+    uint8_t *levels;
+    /* ids of the registered messages sorted by name */
+    int *byname;
+    size_t nbyname;
     unsigned ty;
+    /* MNL4C_OPEN_* flags other than the type */
+    unsigned flags;
+    /* MNL4C_CLOCK_* */
+    int clock;
+    /* MNL4C_OPEN_ASYNC */
+    struct _mnl4c_async *async;
+    /* nsec, see mnl4c_set_flush_latency() */
+    int64_t flush_latency;
+    /* flush deadlines, idle rollover and suppression summaries */
+    struct _mnl4c_timer *timer;
+    /* any message has a token bucket */
+    bool throttling;
+    /* a suppression window has been opened, for housekeeping to see */
+    bool throttle_pending;
+    /* housekeeping left a window open, only seen by it */
+    bool throttle_open;
+    /* records are formatted once and also handed to these */
+    mnl4c_sink_t *sinks;
+    int nsinks;
+    /* where records start is kept, for sinks or MNL4C_OPEN_SYSLOG */
+    bool marking;
 } mnl4c_ctx_t;
 
+/*
+ * A levels[] byte holds the registered level of the message in bits 4-6,
+ * and its effective level plus one in the low nibble.  Zero stands for a
+ * message that is not registered, or is disabled.  The top bit is set
+ * while the message is sampled.
+ */
+#define MNL4C_LEVELS_PACK(flevel, elevel) \
+    ((uint8_t)(((flevel) << 4) | ((elevel) + 1)))
+#define MNL4C_LEVELS_SAMPLED 0x80
+
 double mnl4c_now_posix(void);
+mnbytestream_t *mnl4c_ctx_bs(mnl4c_ctx_t *);
+void mnl4c_ctx_bs_release(mnbytestream_t *);
+void mnl4c_tls_mark(mnbytestream_t *, int);
+size_t mnl4c_cache_lt(mnl4c_cache_t *, int64_t, char *);
+size_t mnl4c_cache_lt2(mnl4c_cache_t *, int64_t, char *);
+
+
+/*
+ * writer.data.file.curtm is shared by all threads logging to the ctx
+ */
+static inline int64_t
+mnl4c_ctx_curtm(mnl4c_ctx_t *ctx)
+{
+    return __atomic_load_n(&ctx->writer.data.file.curtm, __ATOMIC_RELAXED);
+}
+
+
+static inline bool
+mnl4c_ctx_enabled(mnl4c_ctx_t *ctx, int level, int id)
+{
+    return level < (__atomic_load_n(&ctx->levels[id], __ATOMIC_RELAXED) &
+                    0x0f);
+}
+
+
+/*
+ * enabled at the level the message was registered with
+ */
+static inline bool
+mnl4c_ctx_fenabled(mnl4c_ctx_t *ctx, int id)
+{
+    uint8_t l;
+
+    l = __atomic_load_n(&ctx->levels[id], __ATOMIC_RELAXED);
+    return ((l >> 4) & 0x07) < (l & 0x0f);
+}
+
+
+extern __thread uint64_t mnl4c_sample_state;
+uint64_t mnl4c_sample_seed(void);
+
+/*
+ * xorshift64* of the calling thread
+ */
+static inline uint32_t
+mnl4c_sample_rand(void)
+{
+    uint64_t x;
+
+    if (MNUNLIKELY((x = mnl4c_sample_state) == 0)) {
+        x = mnl4c_sample_seed();
+    }
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    mnl4c_sample_state = x;
+    return (uint32_t)((x * 0x2545f4914f6cdd1dull) >> 32);
+}
+
+
+/*
+ * Whether an enabled message is to be logged this time.  Decided before
+ * the record takes a buffer or a timestamp.
+ */
+static inline bool
+mnl4c_ctx_sample(mnl4c_ctx_t *ctx, int id)
+{
+    mnl4c_minfo_t *minfo;
+    unsigned n;
+
+    if (MNLIKELY(!(__atomic_load_n(&ctx->levels[id], __ATOMIC_RELAXED) &
+                   MNL4C_LEVELS_SAMPLED))) {
+        return true;
+    }
+    minfo = ARRAY_GET(mnl4c_minfo_t, &ctx->minfos, id);
+    if ((n = __atomic_load_n(&minfo->sample_n, __ATOMIC_RELAXED)) <= 1) {
+        return true;
+    }
+    if (minfo->sample_random) {
+        /* with a probability of 1/n */
+        return (uint64_t)mnl4c_sample_rand() * n < ((uint64_t)1 << 32);
+    }
+    return __atomic_fetch_add(&minfo->sample_cnt,
+                              1,
+                              __ATOMIC_RELAXED) % n == 0;
+}
+
+
+static inline const char *
+mnl4c_ctx_sample_tag(mnl4c_ctx_t *ctx, int id)
+{
+    if (MNLIKELY(!(__atomic_load_n(&ctx->levels[id], __ATOMIC_RELAXED) &
+                   MNL4C_LEVELS_SAMPLED))) {
+        return "";
+    }
+    return ARRAY_GET(mnl4c_minfo_t, &ctx->minfos, id)->sample_tag;
+}
+
+
+static inline unsigned
+mnl4c_ctx_sample_n(mnl4c_ctx_t *ctx, int id)
+{
+    if (MNLIKELY(!(__atomic_load_n(&ctx->levels[id], __ATOMIC_RELAXED) &
+                   MNL4C_LEVELS_SAMPLED))) {
+        return 0;
+    }
+    return ARRAY_GET(mnl4c_minfo_t, &ctx->minfos, id)->sample_n;
+}
+
+
+static inline void
+mnl4c_ctx_set_curtm(mnl4c_ctx_t *ctx, int64_t curtm)
+{
+    __atomic_store_n(&ctx->writer.data.file.curtm, curtm, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * A record of level starts here in bs.  Sinks take the records up to
+ * their levels when bs is written out, and MNL4C_OPEN_SYSLOG sends each
+ * as a message of its own.
+ */
+static inline void
+mnl4c_ctx_mark(mnl4c_ctx_t *ctx, mnbytestream_t *bs, int level)
+{
+    if (MNUNLIKELY(ctx->marking)) {
+        mnl4c_tls_mark(bs, level);
+    }
+}
+
+
+/*
+ * The token bucket of a message, kept as the time the bucket is full again
+ * (GCRA): a record is let through unless that is more than the burst
+ * tolerance ahead of now, and takes one interval worth of tokens.
+ */
+static inline bool
+mnl4c_minfo_admit(mnl4c_minfo_t *minfo, int64_t now)
+{
+    int64_t interval, tat, next;
+
+    if (MNLIKELY((interval = __atomic_load_n(&minfo->throttle_interval,
+                                             __ATOMIC_RELAXED)) <= 0)) {
+        return true;
+    }
+    tat = __atomic_load_n(&minfo->throttle_tat, __ATOMIC_RELAXED);
+    do {
+        if (tat - minfo->throttle_tolerance > now) {
+            return false;
+        }
+        next = (tat > now ? tat : now) + interval;
+    } while (!__atomic_compare_exchange_n(&minfo->throttle_tat,
+                                          &tat,
+                                          next,
+                                          true,
+                                          __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED));
+    return true;
+}
+
+
+void mnl4c_minfo_window_open(mnl4c_ctx_t *, mnl4c_minfo_t *, int64_t);
+void mnl4c_minfo_summary(mnl4c_ctx_t *,
+                         mnbytestream_t *,
+                         mnl4c_minfo_t *,
+                         int64_t);
+
+
+static inline void
+mnl4c_minfo_suppress(mnl4c_ctx_t *ctx, mnl4c_minfo_t *minfo, int64_t now)
+{
+    if (__atomic_fetch_add(&minfo->nthrottled, 1, __ATOMIC_RELAXED) == 0) {
+        mnl4c_minfo_window_open(ctx, minfo, now);
+    }
+}
+
+
+/*
+ * Puts the summary of the suppression window that has just closed ahead
+ * of the record let through.
+ */
+static inline void
+mnl4c_minfo_close(mnl4c_ctx_t *ctx,
+                  mnbytestream_t *bs,
+                  mnl4c_minfo_t *minfo,
+                  int64_t now)
+{
+    if (MNUNLIKELY(__atomic_load_n(&minfo->nthrottled, __ATOMIC_RELAXED))) {
+        mnl4c_minfo_summary(ctx, bs, minfo, now);
+    }
+}
+
+
+/*
+ * Clock sources of message timestamps, see mnl4c_set_clock().  All of
+ * them are nanoseconds since the Epoch.
+ *
+ *  - MNL4C_CLOCK_REALTIME: clock_gettime(CLOCK_REALTIME), the default;
+ *  - MNL4C_CLOCK_COARSE: CLOCK_REALTIME_COARSE, a few milliseconds of
+ *    resolution at a fraction of the cost;
+ *  - MNL4C_CLOCK_TICK: a timestamp refreshed every
+ *    MNL4C_CLOCK_TICK_NSEC by a background thread, just a memory load;
+ *  - MNL4C_CLOCK_TSC: rdtsc scaled by a one-time calibration against
+ *    CLOCK_REALTIME, x86_64 only.  It does not follow clock adjustments.
+ */
+#define MNL4C_CLOCK_REALTIME    0
+#define MNL4C_CLOCK_COARSE      1
+#define MNL4C_CLOCK_TICK        2
+#define MNL4C_CLOCK_TSC         3
+#define MNL4C_CLOCK_TICK_NSEC   1000000
+
+#define MNL4C_NSEC2SEC(ns) ((double)(ns) / 1000000000.0)
+
+typedef struct _mnl4c_tsc {
+    uint64_t tsc;
+    int64_t ns;
+    /* nsec per cycle, 32.32 fixed point */
+    uint64_t mult;
+} mnl4c_tsc_t;
+
+extern int64_t mnl4c_clock_tick_ns;
+extern mnl4c_tsc_t mnl4c_clock_tsc;
+
+int mnl4c_set_clock(mnl4c_logger_t, int);
+
+
+static inline int64_t
+mnl4c_clock_realtime(void)
+{
+    struct timespec ts;
+
+    (void)clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+#if defined(__x86_64__)
+static inline uint64_t
+mnl4c_rdtsc(void)
+{
+    uint32_t lo, hi;
+
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+#endif
+
+
+static inline int64_t
+mnl4c_ctx_now(mnl4c_ctx_t *ctx)
+{
+    switch (ctx->clock) {
+#ifdef CLOCK_REALTIME_COARSE
+    case MNL4C_CLOCK_COARSE:
+        {
+            struct timespec ts;
+
+            (void)clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+            return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+        }
+#endif
+
+    case MNL4C_CLOCK_TICK:
+        return __atomic_load_n(&mnl4c_clock_tick_ns, __ATOMIC_RELAXED);
+
+#if defined(__x86_64__)
+    case MNL4C_CLOCK_TSC:
+        return mnl4c_clock_tsc.ns +
+            (int64_t)(((unsigned __int128)(mnl4c_rdtsc() -
+                                           mnl4c_clock_tsc.tsc) *
+                       mnl4c_clock_tsc.mult) >> 32);
+#endif
+
+    default:
+        return mnl4c_clock_realtime();
+    }
+}
 
 #define MNL4C_OPEN_STDOUT  0x0001
 #define MNL4C_OPEN_STDERR  0x0002
 #define MNL4C_OPEN_FILE    0x0003
+/*
+ * RFC 5424 messages over a local AF_UNIX datagram socket, see
+ * mnl4c_open()
+ */
+#define MNL4C_OPEN_SYSLOG  0x0004
 #define MNL4C_OPEN_TY      0x00ff
 #define MNL4C_OPEN_FLOCK   0x0100
+#define MNL4C_OPEN_ASYNC   0x0200
+#define MNL4C_OPEN_BINARY  0x0400
+/*
+ * file only: the shadow file is preallocated to maxsz and appended to
+ * through a shared mapping, and truncated to its actual size on rollover
+ */
+#define MNL4C_OPEN_MMAP    0x0800
+/*
+ * file only, needs liburing: flushes are queued to an io_uring and
+ * written in the background at their reserved offsets
+ */
+#define MNL4C_OPEN_URING   0x1000
+/*
+ * file only: the shadow file is opened with O_DIRECT and written from
+ * aligned buffers, bypassing the page cache
+ */
+#define MNL4C_OPEN_DIRECT  0x2000
+/*
+ * file only, needs libzstd: each flush is written as a separate zstd
+ * frame, and maxsz counts compressed bytes
+ */
+#define MNL4C_OPEN_ZSTD    0x4000
+/*
+ * stdout/stderr only: when the descriptor is non-blocking, what it does
+ * not take is queued up to MNL4C_OVERFLOW_MAX bytes and retried on the
+ * next flush, instead of waiting for it to become writable; syslog: what
+ * the socket does not take at once is dropped
+ */
+#define MNL4C_OPEN_NONBLOCK 0x8000
+#define MNL4C_OVERFLOW_MAX (1024 * 1024)
+/*
+ * records are written as one JSON object, or one logfmt line, each, with
+ * the argument names given in logdef.txt
+ */
+#define MNL4C_OPEN_JSON    0x10000
+#define MNL4C_OPEN_LOGFMT  0x20000
+#define MNL4C_OPEN_STRUCT  (MNL4C_OPEN_JSON | MNL4C_OPEN_LOGFMT)
+
 
+/*
+ * MNL4C_OPEN_BINARY record, host byte order, followed by len bytes of
+ * payload.  A message record carries the raw arguments of the message as
+ * described by its generated _SIG, and is turned into text by l4cdecode
+ * using the catalog from l4cdefgen.  Records that have no catalog entry,
+ * for example those with a call-site context, are stored as
+ * MNL4C_BIN_ID_TEXT with the formatted line as payload.
+ */
+#define MNL4C_BIN_ID_TEXT       0xffff
+#define MNL4C_BIN_FMAGIC        0xa0
+#define MNL4C_BIN_FMAGIC_MASK   0xf0
+#define MNL4C_BIN_FTS_LT        0x01
+#define MNL4C_BIN_FTS_LT2       0x02
+#define MNL4C_BIN_FTHROTTLED    0x04
+/* the payload starts with the uint32_t sample_n */
+#define MNL4C_BIN_FSAMPLED      0x08
+typedef struct _mnl4c_bin_hdr {
+    uint32_t len;
+    uint16_t id;
+    uint8_t level;
+    uint8_t flags;
+    int32_t pid;
+    uint32_t nthrottled;
+    /* nanoseconds since the Epoch */
+    uint64_t ts;
+} mnl4c_bin_hdr_t;
+
+void mnl4c_bin_write(mnbytestream_t *,
+                     int64_t,
+                     pid_t,
+                     int,
+                     int,
+                     unsigned,
+                     int,
+                     unsigned,
+                     const char *,
+                     ...);
+
+
+static inline off_t
+mnl4c_bin_text_begin(mnl4c_ctx_t *ctx, mnbytestream_t *bs, int level)
+{
+    off_t res;
+    mnl4c_bin_hdr_t hdr;
+
+    mnl4c_ctx_mark(ctx, bs, level);
+    if (MNLIKELY(!(ctx->flags & MNL4C_OPEN_BINARY))) {
+        return -1;
+    }
+    memset(&hdr, '\0', sizeof(hdr));
+    hdr.id = MNL4C_BIN_ID_TEXT;
+    hdr.flags = MNL4C_BIN_FMAGIC;
+    res = SEOD(bs);
+    (void)bytestream_cat(bs, sizeof(hdr), (const char *)&hdr);
+    return res;
+}
+
+
+static inline void
+mnl4c_bin_text_end(mnbytestream_t *bs, off_t off)
+{
+    uint32_t len;
+
+    if (MNLIKELY(off < 0)) {
+        return;
+    }
+    len = SEOD(bs) - off - sizeof(mnl4c_bin_hdr_t);
+    memcpy(SDATA(bs, off), &len, sizeof(len));
+}
+
+
+/*
+ * MNL4C_OPEN_JSON and MNL4C_OPEN_LOGFMT records.  The generated _JSON and
+ * _LOGFMT of a message are its pre-escaped key tables: the module and
+ * message prefix, then a printf conversion and a key for each of its
+ * _FIELDS arguments, all NUL-terminated.  A message without _FIELDS is
+ * rendered by its format into the msg value.
+ */
+#define MNL4C_STRUCT_KEYS(ctx, mod, msg)     \
+    (((ctx)->flags & MNL4C_OPEN_JSON) ?      \
+        mod ## _ ## msg ## _JSON :           \
+        mod ## _ ## msg ## _LOGFMT)          \
+
+off_t mnl4c_struct_begin(mnl4c_ctx_t *,
+                         mnbytestream_t *,
+                         int64_t,
+                         int,
+                         int,
+                         unsigned,
+                         const char *,
+                         bool);
+void mnl4c_struct_fields(mnbytestream_t *,
+                         unsigned,
+                         const char *,
+                         const char *,
+                         ...);
+void mnl4c_struct_end(mnl4c_ctx_t *, mnbytestream_t *, off_t);
+
+
+/*
+ * Building blocks of the <lib>_<MOD>_<MSG>_nprintf() serializers that
+ * l4cdefgen generates in place of bytestream_nprintf() for each message
+ * with a format it can take apart, see <MOD>_<MSG>_NPRINTF.
+ */
+#define MNL4C_SER_LIT(bs, s) (void)bytestream_cat(bs, sizeof(s) - 1, s)
+#define MNL4C_SER_PRINTF(bs, sz, fmt, ...)                        \
+    do {                                                          \
+        if (bytestream_nprintf(bs, sz, fmt, __VA_ARGS__) > 0) {   \
+            SADVANCEPOS(bs, -1);                                  \
+        }                                                         \
+    } while (0)                                                   \
+
+void mnl4c_ser_u64(mnbytestream_t *, uint64_t);
+void mnl4c_ser_i64(mnbytestream_t *, int64_t);
+void mnl4c_ser_x64(mnbytestream_t *, uint64_t, bool);
+void mnl4c_ser_fixed(mnbytestream_t *, double, int);
+void mnl4c_ser_str(mnbytestream_t *, const char *);
+void mnl4c_ser_chr(mnbytestream_t *, int);
+ssize_t mnl4c_ser_end(mnbytestream_t *, off_t, size_t);
+
+
+/*
+ * Sidecar of mnl4c_set_crash_flush(): this header followed by a ring of
+ * sz bytes, head being the number of bytes ever put into it.  At a crash,
+ * the pending output of each logger is put as one chunk, its payload
+ * followed by a trailer, so that the chunks can be walked back from head.
+ */
+#define MNL4C_SIDECAR_MAGIC     "MNL4CSC"
+#define MNL4C_SIDECAR_TMAGIC    0x4d4e4c34
+typedef struct _mnl4c_sidecar_hdr {
+    char magic[8];
+    uint64_t sz;
+    uint64_t head;
+    /* nanoseconds since the Epoch */
+    int64_t ts;
+    int32_t pid;
+    int32_t sig;
+} mnl4c_sidecar_hdr_t;
+
+typedef struct _mnl4c_sidecar_trl {
+    uint32_t len;
+    int32_t ld;
+    /* MNL4C_OPEN_* of the logger */
+    uint32_t ty;
+    uint32_t magic;
+} mnl4c_sidecar_trl_t;
 
 
 mnl4c_logger_t mnl4c_open(unsigned, ...);
@@ -96,16 +699,61 @@ mnl4c_open(                                                    \
     MNTYPECHK(size_t, (maxbkp)),                               \
     MNTYPECHK(int, (flags)))                                   \
 
+#define MNL4C_OPEN_TO_SYSLOG(path, ident, facility, flags)     \
+mnl4c_open(                                                    \
+    MNL4C_OPEN_SYSLOG | (flags),                               \
+    MNTYPECHK(char *, (path)),                                 \
+    MNTYPECHK(char *, (ident)),                                \
+    MNTYPECHK(int, (facility)))                                \
+
 
 int mnl4c_set_bufsz(mnl4c_logger_t, ssize_t);
+/*
+ * Compression of closed shadow files, done in the background along with
+ * retention.  The level is codec specific, 0 is the codec's default.
+ */
+#define MNL4C_COMPRESS_NONE 0
+#define MNL4C_COMPRESS_GZIP 1
+#define MNL4C_COMPRESS_ZSTD 2
+int mnl4c_set_compression(mnl4c_logger_t, int, int);
+int mnl4c_set_retention(mnl4c_logger_t, size_t, size_t);
+size_t mnl4c_get_dropped(mnl4c_logger_t);
+int mnl4c_set_flush_latency(mnl4c_logger_t, double);
+int mnl4c_add_sink(mnl4c_logger_t, mnl4c_logger_t, int);
+int mnl4c_set_crash_flush(const char *, size_t);
 mnl4c_logger_t mnl4c_incref(mnl4c_logger_t);
 mnl4c_ctx_t *mnl4c_get_ctx(mnl4c_logger_t);
 int mnl4c_traverse_minfos(mnl4c_logger_t, array_traverser_t, void *);
 bool mnl4c_ctx_allowed(mnl4c_ctx_t *, int, int);
 int mnl4c_close(mnl4c_logger_t);
 void mnl4c_register_msg(mnl4c_logger_t, int, int, const char *);
+void mnl4c_register_msg_mod(mnl4c_logger_t,
+                            int,
+                            int,
+                            const char *,
+                            const char *);
 int mnl4c_set_level(mnl4c_logger_t, int, mnbytes_t *);
 int mnl4c_set_throttling(mnl4c_logger_t, double, mnbytes_t *);
+/*
+ * how the name argument of mnl4c_set_*_match() selects messages
+ */
+#define MNL4C_MATCH_PREFIX  0
+#define MNL4C_MATCH_EXACT   1
+#define MNL4C_MATCH_GLOB    2
+int mnl4c_set_level_match(mnl4c_logger_t, int, mnbytes_t *, int);
+int mnl4c_set_throttling_match(mnl4c_logger_t, double, mnbytes_t *, int);
+int mnl4c_set_throttling_bucket(mnl4c_logger_t,
+                                double,
+                                unsigned,
+                                mnbytes_t *,
+                                int);
+/*
+ * how mnl4c_set_sampling() picks one record in n
+ */
+#define MNL4C_SAMPLE_EVERY  0
+#define MNL4C_SAMPLE_RANDOM 1
+int mnl4c_set_sampling(mnl4c_logger_t, unsigned, int, mnbytes_t *);
+int mnl4c_set_sampling_match(mnl4c_logger_t, unsigned, int, mnbytes_t *, int);
 void mnl4c_init(void);
 void mnl4c_fini(void);
 
@@ -121,6 +769,91 @@ UNUSED static const char *level_names[] = {
 };
 
 
+/*
+ * "<ts> [<pid>] <mod> <LEVEL>[<nthrottled>]<tag>: " of a text record.  ts
+ * is the local time string, or NULL for seconds since the Epoch of
+ * curtm, nthrottled < 0 is left out.  The part after the timestamp is
+ * copied from the prefix that mnl4c_register_msg_mod() has precomputed.
+ */
+static inline void
+mnl4c_text_head(mnl4c_ctx_t *ctx,
+                mnbytestream_t *bs,
+                int id,
+                const char *mod,
+                int64_t curtm,
+                const char *ts,
+                int level,
+                int nthrottled,
+                bool tagged)
+{
+    mnl4c_minfo_t *minfo;
+
+    if (ts == NULL) {
+        mnl4c_ser_fixed(bs, MNL4C_NSEC2SEC(curtm), 6);
+    } else {
+        mnl4c_ser_str(bs, ts);
+    }
+    minfo = ARRAY_GET(mnl4c_minfo_t, &ctx->minfos, id);
+    if (minfo->prefix != NULL) {
+        (void)bytestream_cat(bs,
+                             minfo->prefix_off[level + 1] -
+                                minfo->prefix_off[level],
+                             minfo->prefix + minfo->prefix_off[level]);
+    } else {
+        MNL4C_SER_LIT(bs, " [");
+        mnl4c_ser_i64(bs, ctx->cache.pid);
+        MNL4C_SER_LIT(bs, "] ");
+        mnl4c_ser_str(bs, mod);
+        MNL4C_SER_LIT(bs, " ");
+        mnl4c_ser_str(bs, level_names[level]);
+    }
+    if (nthrottled >= 0) {
+        MNL4C_SER_LIT(bs, "[");
+        mnl4c_ser_i64(bs, nthrottled);
+        MNL4C_SER_LIT(bs, "]");
+    }
+    if (tagged) {
+        mnl4c_ser_str(bs, mnl4c_ctx_sample_tag(ctx, id));
+    }
+    MNL4C_SER_LIT(bs, ": ");
+}
+
+
+/*
+ * structured record, in a MNL4C_WRITE_*_PRINTFLIKE*() that has
+ * _mnl4c_ctx, _mnl4c_bs and _mnl4c_curtm
+ */
+#define _MNL4C_WRITE_STRUCT(level, nthrottled, fields, fmt, mod, msg, ...)     \
+    do {                                                                       \
+        const char *_mnl4c_keys;                                               \
+        off_t _mnl4c_soff;                                                     \
+        _mnl4c_keys = MNL4C_STRUCT_KEYS(_mnl4c_ctx, mod, msg);                 \
+        _mnl4c_soff = mnl4c_struct_begin(_mnl4c_ctx,                           \
+                                         _mnl4c_bs,                            \
+                                         _mnl4c_curtm,                         \
+                                         level,                                \
+                                         nthrottled,                           \
+                                         mnl4c_ctx_sample_n(                   \
+                                           _mnl4c_ctx,                         \
+                                           mod ## _ ## msg ## _ID),            \
+                                         _mnl4c_keys,                          \
+                                         !(fields));                           \
+        if (fields) {                                                          \
+            mnl4c_struct_fields(_mnl4c_bs,                                     \
+                                _mnl4c_ctx->flags,                             \
+                                _mnl4c_keys,                                   \
+                                mod ## _ ## msg ## _SIG,                       \
+                                ##__VA_ARGS__);                                \
+        } else {                                                               \
+            (void)bytestream_nprintf(_mnl4c_bs,                                \
+                                     _mnl4c_ctx->bsbufsz,                      \
+                                     fmt,                                      \
+                                     ##__VA_ARGS__);                           \
+        }                                                                      \
+        mnl4c_struct_end(_mnl4c_ctx, _mnl4c_bs, _mnl4c_soff);                  \
+    } while (0)                                                                \
+
+
 /*
  * may be flevel
  */
@@ -130,45 +863,98 @@ UNUSED static const char *level_names[] = {
         mnl4c_minfo_t *_mnl4c_minfo;                                                   \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                                \
         assert(_mnl4c_ctx != NULL);                                                    \
-        _mnl4c_minfo = ARRAY_GET(                                                      \
-            mnl4c_minfo_t,                                                             \
-            &_mnl4c_ctx->minfos,                                                       \
-            mod ## _ ## msg ## _ID);                                                   \
-        if (mnl4c_ctx_allowed(_mnl4c_ctx,                                              \
-                               _mnl4c_minfo->flevel,                                   \
-                               mod ## _ ## msg ## _ID)) {                              \
+        if (mnl4c_ctx_fenabled(_mnl4c_ctx, mod ## _ ## msg ## _ID) &&                  \
+                mnl4c_ctx_sample(_mnl4c_ctx, mod ## _ ## msg ## _ID)) {                \
             ssize_t _mnl4c_nwritten;                                                   \
-            double _mnl4c_curtm;                                                       \
+            mnbytestream_t *_mnl4c_bs;                                                 \
+            int64_t _mnl4c_curtm;                                                      \
+            off_t _mnl4c_off;                                                          \
+            _mnl4c_minfo = ARRAY_GET(                                                  \
+                mnl4c_minfo_t,                                                         \
+                &_mnl4c_ctx->minfos,                                                   \
+                mod ## _ ## msg ## _ID);                                               \
+            _mnl4c_bs = mnl4c_ctx_bs(_mnl4c_ctx);                                      \
             assert(_mnl4c_ctx->writer.write != NULL);                                  \
-            _mnl4c_curtm = mnl4c_now_posix();                                          \
-            if (_mnl4c_ctx->writer.data.file.curtm +                                   \
-                    _mnl4c_minfo->throttle_threshold <= _mnl4c_curtm) {                \
-                _mnl4c_ctx->writer.data.file.curtm = _mnl4c_curtm;                     \
-                _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,                  \
-                                              _mnl4c_ctx->bsbufsz,                     \
-                                              "%.06lf [%d] %s %s[%d]: "                \
-                                              mod ## _ ## msg ## _FMT,                 \
-                                              _mnl4c_ctx->                             \
-                                                writer.data.file.curtm,                \
-                                              _mnl4c_ctx->cache.pid,                   \
-                                              mod ## _NAME,                            \
-                                              level_names[_mnl4c_minfo->flevel],       \
-                                              _mnl4c_minfo->                           \
-                                                nthrottled,                            \
-                                              ##__VA_ARGS__);                          \
-                if (_mnl4c_nwritten < 0) {                                             \
-                    bytestream_rewind(&_mnl4c_ctx->bs);                                \
+            _mnl4c_curtm = mnl4c_ctx_now(_mnl4c_ctx);                                  \
+            if (mnl4c_minfo_admit(_mnl4c_minfo, _mnl4c_curtm)) {                       \
+                mnl4c_ctx_set_curtm(_mnl4c_ctx, _mnl4c_curtm);                         \
+                mnl4c_minfo_close(_mnl4c_ctx,                                          \
+                                  _mnl4c_bs,                                           \
+                                  _mnl4c_minfo,                                        \
+                                  _mnl4c_curtm);                                       \
+                if (_mnl4c_ctx->flags & MNL4C_OPEN_STRUCT) {                           \
+                    _MNL4C_WRITE_STRUCT(_mnl4c_minfo->flevel,                          \
+                                        __atomic_exchange_n(                           \
+                                          &_mnl4c_minfo->nthrottled,                   \
+                                          0,                                           \
+                                          __ATOMIC_RELAXED),                           \
+                                        mod ## _ ## msg ## _FIELDS,                    \
+                                        mod ## _ ## msg ## _FMT,                       \
+                                        mod,                                           \
+                                        msg,                                           \
+                                        ##__VA_ARGS__);                                \
+                    if (SEOD(_mnl4c_bs) >= _mnl4c_ctx->bsbufsz) {                      \
+                        _mnl4c_ctx->writer.write(_mnl4c_ctx, _mnl4c_bs);               \
+                    }                                                                  \
+                } else if ((_mnl4c_ctx->flags & MNL4C_OPEN_BINARY) &&                  \
+                        mod ## _ ## msg ## _BIN) {                                     \
+                    mnl4c_ctx_mark(_mnl4c_ctx, _mnl4c_bs, _mnl4c_minfo->flevel);       \
+                    mnl4c_bin_write(_mnl4c_bs,                                         \
+                                    _mnl4c_curtm,                                      \
+                                    _mnl4c_ctx->cache.pid,                             \
+                                    _mnl4c_minfo->flevel,                              \
+                                    mod ## _ ## msg ## _ID,                            \
+                                    MNL4C_BIN_FTHROTTLED,                              \
+                                    __atomic_exchange_n(                               \
+                                      &_mnl4c_minfo->nthrottled,                       \
+                                      0,                                               \
+                                      __ATOMIC_RELAXED),                               \
+                                    mnl4c_ctx_sample_n(                                \
+                                      _mnl4c_ctx,                                      \
+                                      mod ## _ ## msg ## _ID),                         \
+                                    mod ## _ ## msg ## _SIG,                           \
+                                    ##__VA_ARGS__);                                    \
+                    if (SEOD(_mnl4c_bs) >= _mnl4c_ctx->bsbufsz) {                      \
+                        _mnl4c_ctx->writer.write(_mnl4c_ctx, _mnl4c_bs);               \
+                    }                                                                  \
                 } else {                                                               \
-                    SADVANCEPOS(&_mnl4c_ctx->bs, -1);                                  \
-                    (void)bytestream_cat(&_mnl4c_ctx->bs, 1, "\n");                    \
-                    if (SEOD(&_mnl4c_ctx->bs) >= _mnl4c_ctx->bsbufsz) {                \
-                        _mnl4c_ctx->writer.write(_mnl4c_ctx);                          \
+                    _mnl4c_off = mnl4c_bin_text_begin(_mnl4c_ctx,                      \
+                                                      _mnl4c_bs,                       \
+                                                      _mnl4c_minfo->flevel);           \
+                    mnl4c_text_head(_mnl4c_ctx,                                        \
+                                    _mnl4c_bs,                                         \
+                                    mod ## _ ## msg ## _ID,                            \
+                                    mod ## _NAME,                                      \
+                                    _mnl4c_curtm,                                      \
+                                    NULL,                                              \
+                                    _mnl4c_minfo->flevel,                              \
+                                    __atomic_exchange_n(                               \
+                                      &_mnl4c_minfo->nthrottled,                       \
+                                      0,                                               \
+                                      __ATOMIC_RELAXED),                               \
+                                    true);                                             \
+                    _mnl4c_nwritten = mod ## _ ## msg ## _NPRINTF(                     \
+                            _mnl4c_bs,                                                 \
+                            _mnl4c_ctx->bsbufsz,                                       \
+                            mod ## _ ## msg ## _FMT,                                   \
+                            ##__VA_ARGS__);                                            \
+                    if (_mnl4c_nwritten < 0) {                                         \
+                        bytestream_rewind(_mnl4c_bs);                                  \
+                    } else {                                                           \
+                        SADVANCEPOS(_mnl4c_bs, -1);                                    \
+                        (void)bytestream_cat(_mnl4c_bs, 1, "\n");                      \
+                        mnl4c_bin_text_end(_mnl4c_bs, _mnl4c_off);                     \
+                        if (SEOD(_mnl4c_bs) >= _mnl4c_ctx->bsbufsz) {                  \
+                            _mnl4c_ctx->writer.write(_mnl4c_ctx, _mnl4c_bs);           \
+                        }                                                              \
                     }                                                                  \
                 }                                                                      \
-                _mnl4c_minfo->nthrottled = 0;                                          \
             } else {                                                                   \
-                ++_mnl4c_minfo->nthrottled;                                            \
+                mnl4c_minfo_suppress(_mnl4c_ctx,                                       \
+                                     _mnl4c_minfo,                                     \
+                                     _mnl4c_curtm);                                    \
             }                                                                          \
+            mnl4c_ctx_bs_release(_mnl4c_bs);                                           \
         }                                                                              \
     } while (0)                                                                        \
 
@@ -183,47 +969,78 @@ UNUSED static const char *level_names[] = {
         mnl4c_minfo_t *_mnl4c_minfo;                                                   \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                                \
         assert(_mnl4c_ctx != NULL);                                                    \
-        _mnl4c_minfo = ARRAY_GET(                                                      \
-            mnl4c_minfo_t,                                                             \
-            &_mnl4c_ctx->minfos,                                                       \
-            mod ## _ ## msg ## _ID);                                                   \
-        if (mnl4c_ctx_allowed(_mnl4c_ctx,                                              \
-                               _mnl4c_minfo->flevel,                                   \
-                               mod ## _ ## msg ## _ID)) {                              \
+        if (mnl4c_ctx_fenabled(_mnl4c_ctx, mod ## _ ## msg ## _ID) &&                  \
+                mnl4c_ctx_sample(_mnl4c_ctx, mod ## _ ## msg ## _ID)) {                \
             ssize_t _mnl4c_nwritten;                                                   \
-            double _mnl4c_curtm;                                                       \
+            mnbytestream_t *_mnl4c_bs;                                                 \
+            int64_t _mnl4c_curtm;                                                      \
+            off_t _mnl4c_off;                                                          \
+            _mnl4c_minfo = ARRAY_GET(                                                  \
+                mnl4c_minfo_t,                                                         \
+                &_mnl4c_ctx->minfos,                                                   \
+                mod ## _ ## msg ## _ID);                                               \
+            _mnl4c_bs = mnl4c_ctx_bs(_mnl4c_ctx);                                      \
             assert(_mnl4c_ctx->writer.write != NULL);                                  \
-            _mnl4c_curtm = mnl4c_now_posix();                                          \
-            _mnl4c_ctx->writer.data.file.curtm = mnl4c_now_posix();                    \
-            if (_mnl4c_ctx->writer.data.file.curtm +                                   \
-                    _mnl4c_minfo->throttle_threshold <= _mnl4c_curtm) {                \
-                _mnl4c_ctx->writer.data.file.curtm = _mnl4c_curtm;                     \
-                _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,                  \
+            _mnl4c_curtm = mnl4c_ctx_now(_mnl4c_ctx);                                  \
+            if (mnl4c_minfo_admit(_mnl4c_minfo, _mnl4c_curtm)) {                       \
+                mnl4c_ctx_set_curtm(_mnl4c_ctx, _mnl4c_curtm);                         \
+                mnl4c_minfo_close(_mnl4c_ctx,                                          \
+                                  _mnl4c_bs,                                           \
+                                  _mnl4c_minfo,                                        \
+                                  _mnl4c_curtm);                                       \
+                if (_mnl4c_ctx->flags & MNL4C_OPEN_STRUCT) {                           \
+                    _MNL4C_WRITE_STRUCT(_mnl4c_minfo->flevel,                          \
+                                        __atomic_exchange_n(                           \
+                                          &_mnl4c_minfo->nthrottled,                   \
+                                          0,                                           \
+                                          __ATOMIC_RELAXED),                           \
+                                        0,                                             \
+                                        context                                        \
+                                        mod ## _ ## msg ## _FMT,                       \
+                                        mod,                                           \
+                                        msg,                                           \
+                                        ##__VA_ARGS__);                                \
+                    if (SEOD(_mnl4c_bs) >= _mnl4c_ctx->bsbufsz) {                      \
+                        _mnl4c_ctx->writer.write(_mnl4c_ctx, _mnl4c_bs);               \
+                    }                                                                  \
+                } else {                                                               \
+                    _mnl4c_off = mnl4c_bin_text_begin(_mnl4c_ctx,                      \
+                                                      _mnl4c_bs,                       \
+                                                      _mnl4c_minfo->flevel);           \
+                    mnl4c_text_head(_mnl4c_ctx,                                        \
+                                    _mnl4c_bs,                                         \
+                                    mod ## _ ## msg ## _ID,                            \
+                                    mod ## _NAME,                                      \
+                                    _mnl4c_curtm,                                      \
+                                    NULL,                                              \
+                                    _mnl4c_minfo->flevel,                              \
+                                    __atomic_exchange_n(                               \
+                                      &_mnl4c_minfo->nthrottled,                       \
+                                      0,                                               \
+                                      __ATOMIC_RELAXED),                               \
+                                    true);                                             \
+                    _mnl4c_nwritten = bytestream_nprintf(_mnl4c_bs,                    \
                                               _mnl4c_ctx->bsbufsz,                     \
-                                              "%.06lf [%d] %s %s[%d]: "                \
                                               context                                  \
                                               mod ## _ ## msg ## _FMT,                 \
-                                              _mnl4c_ctx->                             \
-                                                writer.data.file.curtm,                \
-                                              _mnl4c_ctx->cache.pid,                   \
-                                              mod ## _NAME,                            \
-                                              level_names[_mnl4c_minfo->flevel],       \
-                                              _mnl4c_minfo->                           \
-                                                nthrottled,                            \
                                               ##__VA_ARGS__);                          \
-                if (_mnl4c_nwritten < 0) {                                             \
-                    bytestream_rewind(&_mnl4c_ctx->bs);                                \
-                } else {                                                               \
-                    SADVANCEPOS(&_mnl4c_ctx->bs, -1);                                  \
-                    (void)bytestream_cat(&_mnl4c_ctx->bs, 1, "\n");                    \
-                    if (SEOD(&_mnl4c_ctx->bs) >= _mnl4c_ctx->bsbufsz) {                \
-                        _mnl4c_ctx->writer.write(_mnl4c_ctx);                          \
+                    if (_mnl4c_nwritten < 0) {                                         \
+                        bytestream_rewind(_mnl4c_bs);                                  \
+                    } else {                                                           \
+                        SADVANCEPOS(_mnl4c_bs, -1);                                    \
+                        (void)bytestream_cat(_mnl4c_bs, 1, "\n");                      \
+                        mnl4c_bin_text_end(_mnl4c_bs, _mnl4c_off);                     \
+                        if (SEOD(_mnl4c_bs) >= _mnl4c_ctx->bsbufsz) {                  \
+                            _mnl4c_ctx->writer.write(_mnl4c_ctx, _mnl4c_bs);           \
+                        }                                                              \
                     }                                                                  \
                 }                                                                      \
-                _mnl4c_minfo->nthrottled = 0;                                          \
             } else {                                                                   \
-                ++_mnl4c_minfo->nthrottled;                                            \
+                mnl4c_minfo_suppress(_mnl4c_ctx,                                       \
+                                     _mnl4c_minfo,                                     \
+                                     _mnl4c_curtm);                                    \
             }                                                                          \
+            mnl4c_ctx_bs_release(_mnl4c_bs);                                           \
         }                                                                              \
     } while (0)                                                                        \
 
@@ -236,44 +1053,99 @@ UNUSED static const char *level_names[] = {
         mnl4c_ctx_t *_mnl4c_ctx;                                               \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         assert(_mnl4c_ctx != NULL);                                            \
-        if (mnl4c_ctx_allowed(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {    \
+        if (mnl4c_ctx_enabled(_mnl4c_ctx, level, mod ## _ ## msg ## _ID) &&    \
+                mnl4c_ctx_sample(_mnl4c_ctx, mod ## _ ## msg ## _ID)) {        \
             ssize_t _mnl4c_nwritten;                                           \
-            double _mnl4c_curtm;                                               \
+            mnbytestream_t *_mnl4c_bs;                                         \
+            int64_t _mnl4c_curtm;                                              \
+            off_t _mnl4c_off;                                                  \
             mnl4c_minfo_t *_mnl4c_minfo;                                       \
+            _mnl4c_bs = mnl4c_ctx_bs(_mnl4c_ctx);                              \
             assert(_mnl4c_ctx->writer.write != NULL);                          \
-            _mnl4c_curtm = mnl4c_now_posix();                                  \
+            _mnl4c_curtm = mnl4c_ctx_now(_mnl4c_ctx);                          \
             _mnl4c_minfo = ARRAY_GET(                                          \
                 mnl4c_minfo_t,                                                 \
                 &_mnl4c_ctx->minfos,                                           \
                 mod ## _ ## msg ## _ID);                                       \
-            if (_mnl4c_ctx->writer.data.file.curtm +                           \
-                    _mnl4c_minfo->throttle_threshold <= _mnl4c_curtm) {        \
-                _mnl4c_ctx->writer.data.file.curtm = _mnl4c_curtm;             \
-                _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,          \
-                                              _mnl4c_ctx->bsbufsz,             \
-                                              "%.06lf [%d] %s %s[%d]: "        \
-                                              mod ## _ ## msg ## _FMT,         \
-                                              _mnl4c_ctx->                     \
-                                                writer.data.file.curtm,        \
-                                              _mnl4c_ctx->cache.pid,           \
-                                              mod ## _NAME,                    \
-                                              level_names[level],              \
-                                              _mnl4c_minfo->                   \
-                                                nthrottled,                    \
-                                              ##__VA_ARGS__);                  \
-                if (_mnl4c_nwritten < 0) {                                     \
-                    bytestream_rewind(&_mnl4c_ctx->bs);                        \
+            if (mnl4c_minfo_admit(_mnl4c_minfo, _mnl4c_curtm)) {               \
+                mnl4c_ctx_set_curtm(_mnl4c_ctx, _mnl4c_curtm);                 \
+                mnl4c_minfo_close(_mnl4c_ctx,                                  \
+                                  _mnl4c_bs,                                   \
+                                  _mnl4c_minfo,                                \
+                                  _mnl4c_curtm);                               \
+                if (_mnl4c_ctx->flags & MNL4C_OPEN_STRUCT) {                   \
+                    _MNL4C_WRITE_STRUCT(level,                                 \
+                                        __atomic_exchange_n(                   \
+                                          &_mnl4c_minfo->nthrottled,           \
+                                          0,                                   \
+                                          __ATOMIC_RELAXED),                   \
+                                        mod ## _ ## msg ## _FIELDS,            \
+                                        mod ## _ ## msg ## _FMT,               \
+                                        mod,                                   \
+                                        msg,                                   \
+                                        ##__VA_ARGS__);                        \
+                    if (SEOD(_mnl4c_bs) >= _mnl4c_ctx->bsbufsz) {              \
+                        _mnl4c_ctx->writer.write(_mnl4c_ctx, _mnl4c_bs);       \
+                    }                                                          \
+                } else if ((_mnl4c_ctx->flags & MNL4C_OPEN_BINARY) &&          \
+                        mod ## _ ## msg ## _BIN) {                             \
+                    mnl4c_ctx_mark(_mnl4c_ctx, _mnl4c_bs, level);              \
+                    mnl4c_bin_write(_mnl4c_bs,                                 \
+                                    _mnl4c_curtm,                              \
+                                    _mnl4c_ctx->cache.pid,                     \
+                                    level,                                     \
+                                    mod ## _ ## msg ## _ID,                    \
+                                    MNL4C_BIN_FTHROTTLED,                      \
+                                    __atomic_exchange_n(                       \
+                                      &_mnl4c_minfo->nthrottled,               \
+                                      0,                                       \
+                                      __ATOMIC_RELAXED),                       \
+                                    mnl4c_ctx_sample_n(                        \
+                                      _mnl4c_ctx,                              \
+                                      mod ## _ ## msg ## _ID),                 \
+                                    mod ## _ ## msg ## _SIG,                   \
+                                    ##__VA_ARGS__);                            \
+                    if (SEOD(_mnl4c_bs) >= _mnl4c_ctx->bsbufsz) {              \
+                        _mnl4c_ctx->writer.write(_mnl4c_ctx, _mnl4c_bs);       \
+                    }                                                          \
                 } else {                                                       \
-                    SADVANCEPOS(&_mnl4c_ctx->bs, -1);                          \
-                    (void)bytestream_cat(&_mnl4c_ctx->bs, 1, "\n");            \
-                    if (SEOD(&_mnl4c_ctx->bs) >= _mnl4c_ctx->bsbufsz) {        \
-                        _mnl4c_ctx->writer.write(_mnl4c_ctx);                  \
+                    _mnl4c_off = mnl4c_bin_text_begin(_mnl4c_ctx,              \
+                                                      _mnl4c_bs,               \
+                                                      level);                  \
+                    mnl4c_text_head(_mnl4c_ctx,                                \
+                                    _mnl4c_bs,                                 \
+                                    mod ## _ ## msg ## _ID,                    \
+                                    mod ## _NAME,                              \
+                                    _mnl4c_curtm,                              \
+                                    NULL,                                      \
+                                    level,                                     \
+                                    __atomic_exchange_n(                       \
+                                      &_mnl4c_minfo->nthrottled,               \
+                                      0,                                       \
+                                      __ATOMIC_RELAXED),                       \
+                                    true);                                     \
+                    _mnl4c_nwritten = mod ## _ ## msg ## _NPRINTF(             \
+                            _mnl4c_bs,                                         \
+                            _mnl4c_ctx->bsbufsz,                               \
+                            mod ## _ ## msg ## _FMT,                           \
+                            ##__VA_ARGS__);                                    \
+                    if (_mnl4c_nwritten < 0) {                                 \
+                        bytestream_rewind(_mnl4c_bs);                          \
+                    } else {                                                   \
+                        SADVANCEPOS(_mnl4c_bs, -1);                            \
+                        (void)bytestream_cat(_mnl4c_bs, 1, "\n");              \
+                        mnl4c_bin_text_end(_mnl4c_bs, _mnl4c_off);             \
+                        if (SEOD(_mnl4c_bs) >= _mnl4c_ctx->bsbufsz) {          \
+                            _mnl4c_ctx->writer.write(_mnl4c_ctx, _mnl4c_bs);   \
+                        }                                                      \
                     }                                                          \
                 }                                                              \
-                _mnl4c_minfo->nthrottled = 0;                                  \
             } else {                                                           \
-                ++_mnl4c_minfo->nthrottled;                                    \
+                mnl4c_minfo_suppress(_mnl4c_ctx,                               \
+                                     _mnl4c_minfo,                             \
+                                     _mnl4c_curtm);                            \
             }                                                                  \
+            mnl4c_ctx_bs_release(_mnl4c_bs);                                   \
         }                                                                      \
     } while (0)                                                                \
 
@@ -287,46 +1159,79 @@ UNUSED static const char *level_names[] = {
         mnl4c_ctx_t *_mnl4c_ctx;                                               \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         assert(_mnl4c_ctx != NULL);                                            \
-        if (mnl4c_ctx_allowed(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {    \
+        if (mnl4c_ctx_enabled(_mnl4c_ctx, level, mod ## _ ## msg ## _ID) &&    \
+                mnl4c_ctx_sample(_mnl4c_ctx, mod ## _ ## msg ## _ID)) {        \
             ssize_t _mnl4c_nwritten;                                           \
-            double _mnl4c_curtm;                                               \
+            mnbytestream_t *_mnl4c_bs;                                         \
+            int64_t _mnl4c_curtm;                                              \
+            off_t _mnl4c_off;                                                  \
             mnl4c_minfo_t *_mnl4c_minfo;                                       \
+            _mnl4c_bs = mnl4c_ctx_bs(_mnl4c_ctx);                              \
             assert(_mnl4c_ctx->writer.write != NULL);                          \
-            _mnl4c_curtm = mnl4c_now_posix();                                  \
+            _mnl4c_curtm = mnl4c_ctx_now(_mnl4c_ctx);                          \
             _mnl4c_minfo = ARRAY_GET(                                          \
                 mnl4c_minfo_t,                                                 \
                 &_mnl4c_ctx->minfos,                                           \
                 mod ## _ ## msg ## _ID);                                       \
-            _mnl4c_ctx->writer.data.file.curtm = mnl4c_now_posix();            \
-            if (_mnl4c_ctx->writer.data.file.curtm +                           \
-                    _mnl4c_minfo->throttle_threshold <= _mnl4c_curtm) {        \
-                _mnl4c_ctx->writer.data.file.curtm = _mnl4c_curtm;             \
-                _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,          \
+            if (mnl4c_minfo_admit(_mnl4c_minfo, _mnl4c_curtm)) {               \
+                mnl4c_ctx_set_curtm(_mnl4c_ctx, _mnl4c_curtm);                 \
+                mnl4c_minfo_close(_mnl4c_ctx,                                  \
+                                  _mnl4c_bs,                                   \
+                                  _mnl4c_minfo,                                \
+                                  _mnl4c_curtm);                               \
+                if (_mnl4c_ctx->flags & MNL4C_OPEN_STRUCT) {                   \
+                    _MNL4C_WRITE_STRUCT(level,                                 \
+                                        __atomic_exchange_n(                   \
+                                          &_mnl4c_minfo->nthrottled,           \
+                                          0,                                   \
+                                          __ATOMIC_RELAXED),                   \
+                                        0,                                     \
+                                        context                                \
+                                        mod ## _ ## msg ## _FMT,               \
+                                        mod,                                   \
+                                        msg,                                   \
+                                        ##__VA_ARGS__);                        \
+                    if (SEOD(_mnl4c_bs) >= _mnl4c_ctx->bsbufsz) {              \
+                        _mnl4c_ctx->writer.write(_mnl4c_ctx, _mnl4c_bs);       \
+                    }                                                          \
+                } else {                                                       \
+                    _mnl4c_off = mnl4c_bin_text_begin(_mnl4c_ctx,              \
+                                                      _mnl4c_bs,               \
+                                                      level);                  \
+                    mnl4c_text_head(_mnl4c_ctx,                                \
+                                    _mnl4c_bs,                                 \
+                                    mod ## _ ## msg ## _ID,                    \
+                                    mod ## _NAME,                              \
+                                    _mnl4c_curtm,                              \
+                                    NULL,                                      \
+                                    level,                                     \
+                                    __atomic_exchange_n(                       \
+                                      &_mnl4c_minfo->nthrottled,               \
+                                      0,                                       \
+                                      __ATOMIC_RELAXED),                       \
+                                    true);                                     \
+                    _mnl4c_nwritten = bytestream_nprintf(_mnl4c_bs,            \
                                               _mnl4c_ctx->bsbufsz,             \
-                                              "%.06lf [%d] %s %s[%d]: "        \
                                               context                          \
                                               mod ## _ ## msg ## _FMT,         \
-                                              _mnl4c_ctx->                     \
-                                                writer.data.file.curtm,        \
-                                              _mnl4c_ctx->cache.pid,           \
-                                              mod ## _NAME,                    \
-                                              level_names[level],              \
-                                              _mnl4c_minfo->                   \
-                                                nthrottled,                    \
                                               ##__VA_ARGS__);                  \
-                if (_mnl4c_nwritten < 0) {                                     \
-                    bytestream_rewind(&_mnl4c_ctx->bs);                        \
-                } else {                                                       \
-                    SADVANCEPOS(&_mnl4c_ctx->bs, -1);                          \
-                    (void)bytestream_cat(&_mnl4c_ctx->bs, 1, "\n");            \
-                    if (SEOD(&_mnl4c_ctx->bs) >= _mnl4c_ctx->bsbufsz) {        \
-                        _mnl4c_ctx->writer.write(_mnl4c_ctx);                  \
+                    if (_mnl4c_nwritten < 0) {                                 \
+                        bytestream_rewind(_mnl4c_bs);                          \
+                    } else {                                                   \
+                        SADVANCEPOS(_mnl4c_bs, -1);                            \
+                        (void)bytestream_cat(_mnl4c_bs, 1, "\n");              \
+                        mnl4c_bin_text_end(_mnl4c_bs, _mnl4c_off);             \
+                        if (SEOD(_mnl4c_bs) >= _mnl4c_ctx->bsbufsz) {          \
+                            _mnl4c_ctx->writer.write(_mnl4c_ctx, _mnl4c_bs);   \
+                        }                                                      \
                     }                                                          \
                 }                                                              \
-                _mnl4c_minfo->nthrottled = 0;                                  \
             } else {                                                           \
-                ++_mnl4c_minfo->nthrottled;                                    \
+                mnl4c_minfo_suppress(_mnl4c_ctx,                               \
+                                     _mnl4c_minfo,                             \
+                                     _mnl4c_curtm);                            \
             }                                                                  \
+            mnl4c_ctx_bs_release(_mnl4c_bs);                                   \
         }                                                                      \
     } while (0)                                                                \
 
@@ -340,33 +1245,73 @@ UNUSED static const char *level_names[] = {
         mnl4c_minfo_t *_mnl4c_minfo;                                           \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         assert(_mnl4c_ctx != NULL);                                            \
-        _mnl4c_minfo = ARRAY_GET(                                              \
-            mnl4c_minfo_t,                                                     \
-            &_mnl4c_ctx->minfos,                                               \
-            mod ## _ ## msg ## _ID);                                           \
-        if (mnl4c_ctx_allowed(_mnl4c_ctx,                                      \
-                               _mnl4c_minfo->flevel,                           \
-                               mod ## _ ## msg ## _ID)) {                      \
+        if (mnl4c_ctx_fenabled(_mnl4c_ctx, mod ## _ ## msg ## _ID) &&          \
+                mnl4c_ctx_sample(_mnl4c_ctx, mod ## _ ## msg ## _ID)) {        \
             ssize_t _mnl4c_nwritten;                                           \
+            mnbytestream_t *_mnl4c_bs;                                         \
+            int64_t _mnl4c_curtm;                                              \
+            off_t _mnl4c_off;                                                  \
+            _mnl4c_minfo = ARRAY_GET(                                          \
+                mnl4c_minfo_t,                                                 \
+                &_mnl4c_ctx->minfos,                                           \
+                mod ## _ ## msg ## _ID);                                       \
+            _mnl4c_bs = mnl4c_ctx_bs(_mnl4c_ctx);                              \
             assert(_mnl4c_ctx->writer.write != NULL);                          \
-            _mnl4c_ctx->writer.data.file.curtm = mnl4c_now_posix();            \
-            _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,              \
-                                          _mnl4c_ctx->bsbufsz,                 \
-                                          "%.06lf [%d] %s %s: "                \
-                                          mod ## _ ## msg ## _FMT,             \
-                                          _mnl4c_ctx->                         \
-                                            writer.data.file.curtm,            \
-                                          _mnl4c_ctx->cache.pid,               \
-                                          mod ## _NAME,                        \
-                                          level_names[_mnl4c_minfo->flevel],   \
-                                          ##__VA_ARGS__);                      \
-            if (_mnl4c_nwritten < 0) {                                         \
-                bytestream_rewind(&_mnl4c_ctx->bs);                            \
+            _mnl4c_curtm = mnl4c_ctx_now(_mnl4c_ctx);                          \
+            mnl4c_ctx_set_curtm(_mnl4c_ctx, _mnl4c_curtm);                     \
+            if (_mnl4c_ctx->flags & MNL4C_OPEN_STRUCT) {                       \
+                _MNL4C_WRITE_STRUCT(_mnl4c_minfo->flevel,                      \
+                                    0,                                         \
+                                    mod ## _ ## msg ## _FIELDS,                \
+                                    mod ## _ ## msg ## _FMT,                   \
+                                    mod,                                       \
+                                    msg,                                       \
+                                    ##__VA_ARGS__);                            \
+                _mnl4c_ctx->writer.write(_mnl4c_ctx, _mnl4c_bs);               \
+            } else if ((_mnl4c_ctx->flags & MNL4C_OPEN_BINARY) &&              \
+                    mod ## _ ## msg ## _BIN) {                                 \
+                mnl4c_ctx_mark(_mnl4c_ctx, _mnl4c_bs, _mnl4c_minfo->flevel);   \
+                mnl4c_bin_write(_mnl4c_bs,                                     \
+                                _mnl4c_curtm,                                  \
+                                _mnl4c_ctx->cache.pid,                         \
+                                _mnl4c_minfo->flevel,                          \
+                                mod ## _ ## msg ## _ID,                        \
+                                0,                                             \
+                                0,                                             \
+                                mnl4c_ctx_sample_n(                            \
+                                  _mnl4c_ctx,                                  \
+                                  mod ## _ ## msg ## _ID),                     \
+                                mod ## _ ## msg ## _SIG,                       \
+                                ##__VA_ARGS__);                                \
+                _mnl4c_ctx->writer.write(_mnl4c_ctx, _mnl4c_bs);               \
             } else {                                                           \
-                SADVANCEPOS(&_mnl4c_ctx->bs, -1);                              \
-                (void)bytestream_cat(&_mnl4c_ctx->bs, 1, "\n");                \
-                _mnl4c_ctx->writer.write(_mnl4c_ctx);                          \
+                _mnl4c_off = mnl4c_bin_text_begin(_mnl4c_ctx,                  \
+                                                  _mnl4c_bs,                   \
+                                                  _mnl4c_minfo->flevel);       \
+                mnl4c_text_head(_mnl4c_ctx,                                    \
+                                _mnl4c_bs,                                     \
+                                mod ## _ ## msg ## _ID,                        \
+                                mod ## _NAME,                                  \
+                                _mnl4c_curtm,                                  \
+                                NULL,                                          \
+                                _mnl4c_minfo->flevel,                          \
+                                -1,                                            \
+                                true);                                         \
+                _mnl4c_nwritten = mod ## _ ## msg ## _NPRINTF(                 \
+                        _mnl4c_bs,                                             \
+                        _mnl4c_ctx->bsbufsz,                                   \
+                        mod ## _ ## msg ## _FMT,                               \
+                        ##__VA_ARGS__);                                        \
+                if (_mnl4c_nwritten < 0) {                                     \
+                    bytestream_rewind(_mnl4c_bs);                              \
+                } else {                                                       \
+                    SADVANCEPOS(_mnl4c_bs, -1);                                \
+                    (void)bytestream_cat(_mnl4c_bs, 1, "\n");                  \
+                    mnl4c_bin_text_end(_mnl4c_bs, _mnl4c_off);                 \
+                    _mnl4c_ctx->writer.write(_mnl4c_ctx, _mnl4c_bs);           \
+                }                                                              \
             }                                                                  \
+            mnl4c_ctx_bs_release(_mnl4c_bs);                                   \
         }                                                                      \
     } while (0)                                                                \
 
@@ -380,34 +1325,58 @@ UNUSED static const char *level_names[] = {
         mnl4c_minfo_t *_mnl4c_minfo;                                           \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         assert(_mnl4c_ctx != NULL);                                            \
-        _mnl4c_minfo = ARRAY_GET(                                              \
-            mnl4c_minfo_t,                                                     \
-            &_mnl4c_ctx->minfos,                                               \
-            mod ## _ ## msg ## _ID);                                           \
-        if (mnl4c_ctx_allowed(_mnl4c_ctx,                                      \
-                               _mnlc3_minfo->flevel,                           \
-                               mod ## _ ## msg ## _ID)) {                      \
+        if (mnl4c_ctx_fenabled(_mnl4c_ctx, mod ## _ ## msg ## _ID) &&          \
+                mnl4c_ctx_sample(_mnl4c_ctx, mod ## _ ## msg ## _ID)) {        \
             ssize_t _mnl4c_nwritten;                                           \
+            mnbytestream_t *_mnl4c_bs;                                         \
+            int64_t _mnl4c_curtm;                                              \
+            off_t _mnl4c_off;                                                  \
+            _mnl4c_minfo = ARRAY_GET(                                          \
+                mnl4c_minfo_t,                                                 \
+                &_mnl4c_ctx->minfos,                                           \
+                mod ## _ ## msg ## _ID);                                       \
+            _mnl4c_bs = mnl4c_ctx_bs(_mnl4c_ctx);                              \
             assert(_mnl4c_ctx->writer.write != NULL);                          \
-            _mnl4c_ctx->writer.data.file.curtm = mnl4c_now_posix();            \
-            _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,              \
+            _mnl4c_curtm = mnl4c_ctx_now(_mnl4c_ctx);                          \
+            mnl4c_ctx_set_curtm(_mnl4c_ctx, _mnl4c_curtm);                     \
+            if (_mnl4c_ctx->flags & MNL4C_OPEN_STRUCT) {                       \
+                _MNL4C_WRITE_STRUCT(_mnl4c_minfo->flevel,                      \
+                                    0,                                         \
+                                    0,                                         \
+                                    context                                    \
+                                    mod ## _ ## msg ## _FMT,                   \
+                                    mod,                                       \
+                                    msg,                                       \
+                                    ##__VA_ARGS__);                            \
+                _mnl4c_ctx->writer.write(_mnl4c_ctx, _mnl4c_bs);               \
+            } else {                                                           \
+                _mnl4c_off = mnl4c_bin_text_begin(_mnl4c_ctx,                  \
+                                                  _mnl4c_bs,                   \
+                                                  _mnl4c_minfo->flevel);       \
+                mnl4c_text_head(_mnl4c_ctx,                                    \
+                                _mnl4c_bs,                                     \
+                                mod ## _ ## msg ## _ID,                        \
+                                mod ## _NAME,                                  \
+                                _mnl4c_curtm,                                  \
+                                NULL,                                          \
+                                _mnl4c_minfo->flevel,                          \
+                                -1,                                            \
+                                true);                                         \
+                _mnl4c_nwritten = bytestream_nprintf(_mnl4c_bs,                \
                                           _mnl4c_ctx->bsbufsz,                 \
-                                          "%.06lf [%d] %s %s: "                \
                                           context                              \
                                           mod ## _ ## msg ## _FMT,             \
-                                          _mnl4c_ctx->                         \
-                                            writer.data.file.curtm,            \
-                                          _mnl4c_ctx->cache.pid,               \
-                                          mod ## _NAME,                        \
-                                          level_names[_mnl4c_minfo->flevel],   \
                                           ##__VA_ARGS__);                      \
-            if (_mnl4c_nwritten < 0) {                                         \
-                bytestream_rewind(&_mnl4c_ctx->bs);                            \
-            } else {                                                           \
-                SADVANCEPOS(&_mnl4c_ctx->bs, -1);                              \
-                (void)bytestream_cat(&_mnl4c_ctx->bs, 1, "\n");                \
-                _mnl4c_ctx->writer.write(_mnl4c_ctx);                          \
+                if (_mnl4c_nwritten < 0) {                                     \
+                    bytestream_rewind(_mnl4c_bs);                              \
+                } else {                                                       \
+                    SADVANCEPOS(_mnl4c_bs, -1);                                \
+                    (void)bytestream_cat(_mnl4c_bs, 1, "\n");                  \
+                    mnl4c_bin_text_end(_mnl4c_bs, _mnl4c_off);                 \
+                    _mnl4c_ctx->writer.write(_mnl4c_ctx, _mnl4c_bs);           \
+                }                                                              \
             }                                                                  \
+            mnl4c_ctx_bs_release(_mnl4c_bs);                                   \
         }                                                                      \
     } while (0)                                                                \
 
@@ -420,27 +1389,69 @@ UNUSED static const char *level_names[] = {
         mnl4c_ctx_t *_mnl4c_ctx;                                               \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         assert(_mnl4c_ctx != NULL);                                            \
-        if (mnl4c_ctx_allowed(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {    \
+        if (mnl4c_ctx_enabled(_mnl4c_ctx, level, mod ## _ ## msg ## _ID) &&    \
+                mnl4c_ctx_sample(_mnl4c_ctx, mod ## _ ## msg ## _ID)) {        \
             ssize_t _mnl4c_nwritten;                                           \
+            mnbytestream_t *_mnl4c_bs;                                         \
+            int64_t _mnl4c_curtm;                                              \
+            off_t _mnl4c_off;                                                  \
+            _mnl4c_bs = mnl4c_ctx_bs(_mnl4c_ctx);                              \
             assert(_mnl4c_ctx->writer.write != NULL);                          \
-            _mnl4c_ctx->writer.data.file.curtm = mnl4c_now_posix();            \
-            _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,              \
-                                          _mnl4c_ctx->bsbufsz,                 \
-                                          "%.06lf [%d] %s %s: "                \
-                                          mod ## _ ## msg ## _FMT,             \
-                                          _mnl4c_ctx->                         \
-                                            writer.data.file.curtm,            \
-                                          _mnl4c_ctx->cache.pid,               \
-                                          mod ## _NAME,                        \
-                                          level_names[level],                  \
-                                          ##__VA_ARGS__);                      \
-            if (_mnl4c_nwritten < 0) {                                         \
-                bytestream_rewind(&_mnl4c_ctx->bs);                            \
+            _mnl4c_curtm = mnl4c_ctx_now(_mnl4c_ctx);                          \
+            mnl4c_ctx_set_curtm(_mnl4c_ctx, _mnl4c_curtm);                     \
+            if (_mnl4c_ctx->flags & MNL4C_OPEN_STRUCT) {                       \
+                _MNL4C_WRITE_STRUCT(level,                                     \
+                                    0,                                         \
+                                    mod ## _ ## msg ## _FIELDS,                \
+                                    mod ## _ ## msg ## _FMT,                   \
+                                    mod,                                       \
+                                    msg,                                       \
+                                    ##__VA_ARGS__);                            \
+                _mnl4c_ctx->writer.write(_mnl4c_ctx, _mnl4c_bs);               \
+            } else if ((_mnl4c_ctx->flags & MNL4C_OPEN_BINARY) &&              \
+                    mod ## _ ## msg ## _BIN) {                                 \
+                mnl4c_ctx_mark(_mnl4c_ctx, _mnl4c_bs, level);                  \
+                mnl4c_bin_write(_mnl4c_bs,                                     \
+                                _mnl4c_curtm,                                  \
+                                _mnl4c_ctx->cache.pid,                         \
+                                level,                                         \
+                                mod ## _ ## msg ## _ID,                        \
+                                0,                                             \
+                                0,                                             \
+                                mnl4c_ctx_sample_n(                            \
+                                  _mnl4c_ctx,                                  \
+                                  mod ## _ ## msg ## _ID),                     \
+                                mod ## _ ## msg ## _SIG,                       \
+                                ##__VA_ARGS__);                                \
+                _mnl4c_ctx->writer.write(_mnl4c_ctx, _mnl4c_bs);               \
             } else {                                                           \
-                SADVANCEPOS(&_mnl4c_ctx->bs, -1);                              \
-                (void)bytestream_cat(&_mnl4c_ctx->bs, 1, "\n");                \
-                _mnl4c_ctx->writer.write(_mnl4c_ctx);                          \
+                _mnl4c_off = mnl4c_bin_text_begin(_mnl4c_ctx,                  \
+                                                  _mnl4c_bs,                   \
+                                                  level);                      \
+                mnl4c_text_head(_mnl4c_ctx,                                    \
+                                _mnl4c_bs,                                     \
+                                mod ## _ ## msg ## _ID,                        \
+                                mod ## _NAME,                                  \
+                                _mnl4c_curtm,                                  \
+                                NULL,                                          \
+                                level,                                         \
+                                -1,                                            \
+                                true);                                         \
+                _mnl4c_nwritten = mod ## _ ## msg ## _NPRINTF(                 \
+                        _mnl4c_bs,                                             \
+                        _mnl4c_ctx->bsbufsz,                                   \
+                        mod ## _ ## msg ## _FMT,                               \
+                        ##__VA_ARGS__);                                        \
+                if (_mnl4c_nwritten < 0) {                                     \
+                    bytestream_rewind(_mnl4c_bs);                              \
+                } else {                                                       \
+                    SADVANCEPOS(_mnl4c_bs, -1);                                \
+                    (void)bytestream_cat(_mnl4c_bs, 1, "\n");                  \
+                    mnl4c_bin_text_end(_mnl4c_bs, _mnl4c_off);                 \
+                    _mnl4c_ctx->writer.write(_mnl4c_ctx, _mnl4c_bs);           \
+                }                                                              \
             }                                                                  \
+            mnl4c_ctx_bs_release(_mnl4c_bs);                                   \
         }                                                                      \
     } while (0)                                                                \
 
@@ -453,28 +1464,54 @@ UNUSED static const char *level_names[] = {
         mnl4c_ctx_t *_mnl4c_ctx;                                               \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         assert(_mnl4c_ctx != NULL);                                            \
-        if (mnl4c_ctx_allowed(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {    \
+        if (mnl4c_ctx_enabled(_mnl4c_ctx, level, mod ## _ ## msg ## _ID) &&    \
+                mnl4c_ctx_sample(_mnl4c_ctx, mod ## _ ## msg ## _ID)) {        \
             ssize_t _mnl4c_nwritten;                                           \
+            mnbytestream_t *_mnl4c_bs;                                         \
+            int64_t _mnl4c_curtm;                                              \
+            off_t _mnl4c_off;                                                  \
+            _mnl4c_bs = mnl4c_ctx_bs(_mnl4c_ctx);                              \
             assert(_mnl4c_ctx->writer.write != NULL);                          \
-            _mnl4c_ctx->writer.data.file.curtm = mnl4c_now_posix();            \
-            _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,              \
+            _mnl4c_curtm = mnl4c_ctx_now(_mnl4c_ctx);                          \
+            mnl4c_ctx_set_curtm(_mnl4c_ctx, _mnl4c_curtm);                     \
+            if (_mnl4c_ctx->flags & MNL4C_OPEN_STRUCT) {                       \
+                _MNL4C_WRITE_STRUCT(level,                                     \
+                                    0,                                         \
+                                    0,                                         \
+                                    context                                    \
+                                    mod ## _ ## msg ## _FMT,                   \
+                                    mod,                                       \
+                                    msg,                                       \
+                                    ##__VA_ARGS__);                            \
+                _mnl4c_ctx->writer.write(_mnl4c_ctx, _mnl4c_bs);               \
+            } else {                                                           \
+                _mnl4c_off = mnl4c_bin_text_begin(_mnl4c_ctx,                  \
+                                                  _mnl4c_bs,                   \
+                                                  level);                      \
+                mnl4c_text_head(_mnl4c_ctx,                                    \
+                                _mnl4c_bs,                                     \
+                                mod ## _ ## msg ## _ID,                        \
+                                mod ## _NAME,                                  \
+                                _mnl4c_curtm,                                  \
+                                NULL,                                          \
+                                level,                                         \
+                                -1,                                            \
+                                true);                                         \
+                _mnl4c_nwritten = bytestream_nprintf(_mnl4c_bs,                \
                                           _mnl4c_ctx->bsbufsz,                 \
-                                          "%.06lf [%d] %s %s: "                \
                                           context                              \
                                           mod ## _ ## msg ## _FMT,             \
-                                          _mnl4c_ctx->                         \
-                                            writer.data.file.curtm,            \
-                                          _mnl4c_ctx->cache.pid,               \
-                                          mod ## _NAME,                        \
-                                          level_names[level],                  \
                                           ##__VA_ARGS__);                      \
-            if (_mnl4c_nwritten < 0) {                                         \
-                bytestream_rewind(&_mnl4c_ctx->bs);                            \
-            } else {                                                           \
-                SADVANCEPOS(&_mnl4c_ctx->bs, -1);                              \
-                (void)bytestream_cat(&_mnl4c_ctx->bs, 1, "\n");                \
-                _mnl4c_ctx->writer.write(_mnl4c_ctx);                          \
+                if (_mnl4c_nwritten < 0) {                                     \
+                    bytestream_rewind(_mnl4c_bs);                              \
+                } else {                                                       \
+                    SADVANCEPOS(_mnl4c_bs, -1);                                \
+                    (void)bytestream_cat(_mnl4c_bs, 1, "\n");                  \
+                    mnl4c_bin_text_end(_mnl4c_bs, _mnl4c_off);                 \
+                    _mnl4c_ctx->writer.write(_mnl4c_ctx, _mnl4c_bs);           \
+                }                                                              \
             }                                                                  \
+            mnl4c_ctx_bs_release(_mnl4c_bs);                                   \
         }                                                                      \
     } while (0)                                                                \
 
@@ -487,35 +1524,73 @@ UNUSED static const char *level_names[] = {
         mnl4c_ctx_t *_mnl4c_ctx;                                               \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         assert(_mnl4c_ctx != NULL);                                            \
-        if (mnl4c_ctx_allowed(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {    \
+        if (mnl4c_ctx_enabled(_mnl4c_ctx, level, mod ## _ ## msg ## _ID) &&    \
+                mnl4c_ctx_sample(_mnl4c_ctx, mod ## _ ## msg ## _ID)) {        \
             ssize_t _mnl4c_nwritten;                                           \
-            struct tm *_mnl4c_tm;                                              \
-            time_t _mtkl4c_now;                                                \
-            char _mnl4c_now_str[32];                                           \
+            mnbytestream_t *_mnl4c_bs;                                         \
+            int64_t _mnl4c_curtm;                                              \
+            off_t _mnl4c_off;                                                  \
+            char _mnl4c_now_str[MNL4C_TS_BUFSZ];                               \
+            _mnl4c_bs = mnl4c_ctx_bs(_mnl4c_ctx);                              \
             assert(_mnl4c_ctx->writer.write != NULL);                          \
-            _mnl4c_ctx->writer.data.file.curtm = mnl4c_now_posix();            \
-            _mtkl4c_now = (time_t)_mnl4c_ctx->writer.data.file.curtm;          \
-            _mnl4c_tm = localtime(&_mtkl4c_now);                               \
-            (void)strftime(_mnl4c_now_str,                                     \
-                           sizeof(_mnl4c_now_str),                             \
-                           "%Y-%m-%d %H:%M:%S",                                \
-                           _mnl4c_tm);                                         \
-            _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,              \
-                                          _mnl4c_ctx->bsbufsz,                 \
-                                          "%s [%d] %s %s: "                    \
-                                          mod ## _ ## msg ## _FMT,             \
-                                          _mnl4c_now_str,                      \
-                                          _mnl4c_ctx->cache.pid,               \
-                                          mod ## _NAME,                        \
-                                          level_names[level],                  \
-                                          ##__VA_ARGS__);                      \
-            if (_mnl4c_nwritten < 0) {                                         \
-                bytestream_rewind(&_mnl4c_ctx->bs);                            \
+            _mnl4c_curtm = mnl4c_ctx_now(_mnl4c_ctx);                          \
+            mnl4c_ctx_set_curtm(_mnl4c_ctx, _mnl4c_curtm);                     \
+            if (_mnl4c_ctx->flags & MNL4C_OPEN_STRUCT) {                       \
+                _MNL4C_WRITE_STRUCT(level,                                     \
+                                    0,                                         \
+                                    mod ## _ ## msg ## _FIELDS,                \
+                                    mod ## _ ## msg ## _FMT,                   \
+                                    mod,                                       \
+                                    msg,                                       \
+                                    ##__VA_ARGS__);                            \
+                _mnl4c_ctx->writer.write(_mnl4c_ctx, _mnl4c_bs);               \
+            } else if ((_mnl4c_ctx->flags & MNL4C_OPEN_BINARY) &&              \
+                    mod ## _ ## msg ## _BIN) {                                 \
+                mnl4c_ctx_mark(_mnl4c_ctx, _mnl4c_bs, level);                  \
+                mnl4c_bin_write(_mnl4c_bs,                                     \
+                                _mnl4c_curtm,                                  \
+                                _mnl4c_ctx->cache.pid,                         \
+                                level,                                         \
+                                mod ## _ ## msg ## _ID,                        \
+                                MNL4C_BIN_FTS_LT,                              \
+                                0,                                             \
+                                mnl4c_ctx_sample_n(                            \
+                                  _mnl4c_ctx,                                  \
+                                  mod ## _ ## msg ## _ID),                     \
+                                mod ## _ ## msg ## _SIG,                       \
+                                ##__VA_ARGS__);                                \
+                _mnl4c_ctx->writer.write(_mnl4c_ctx, _mnl4c_bs);               \
             } else {                                                           \
-                SADVANCEPOS(&_mnl4c_ctx->bs, -1);                              \
-                (void)bytestream_cat(&_mnl4c_ctx->bs, 1, "\n");                \
-                _mnl4c_ctx->writer.write(_mnl4c_ctx);                          \
+                (void)mnl4c_cache_lt(&_mnl4c_ctx->cache,                       \
+                                     _mnl4c_curtm,                             \
+                                     _mnl4c_now_str);                          \
+                _mnl4c_off = mnl4c_bin_text_begin(_mnl4c_ctx,                  \
+                                                  _mnl4c_bs,                   \
+                                                  level);                      \
+                mnl4c_text_head(_mnl4c_ctx,                                    \
+                                _mnl4c_bs,                                     \
+                                mod ## _ ## msg ## _ID,                        \
+                                mod ## _NAME,                                  \
+                                _mnl4c_curtm,                                  \
+                                _mnl4c_now_str,                                \
+                                level,                                         \
+                                -1,                                            \
+                                true);                                         \
+                _mnl4c_nwritten = mod ## _ ## msg ## _NPRINTF(                 \
+                        _mnl4c_bs,                                             \
+                        _mnl4c_ctx->bsbufsz,                                   \
+                        mod ## _ ## msg ## _FMT,                               \
+                        ##__VA_ARGS__);                                        \
+                if (_mnl4c_nwritten < 0) {                                     \
+                    bytestream_rewind(_mnl4c_bs);                              \
+                } else {                                                       \
+                    SADVANCEPOS(_mnl4c_bs, -1);                                \
+                    (void)bytestream_cat(_mnl4c_bs, 1, "\n");                  \
+                    mnl4c_bin_text_end(_mnl4c_bs, _mnl4c_off);                 \
+                    _mnl4c_ctx->writer.write(_mnl4c_ctx, _mnl4c_bs);           \
+                }                                                              \
             }                                                                  \
+            mnl4c_ctx_bs_release(_mnl4c_bs);                                   \
         }                                                                      \
     } while (0)                                                                \
 
@@ -529,36 +1604,58 @@ UNUSED static const char *level_names[] = {
         mnl4c_ctx_t *_mnl4c_ctx;                                               \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         assert(_mnl4c_ctx != NULL);                                            \
-        if (mnl4c_ctx_allowed(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {    \
+        if (mnl4c_ctx_enabled(_mnl4c_ctx, level, mod ## _ ## msg ## _ID) &&    \
+                mnl4c_ctx_sample(_mnl4c_ctx, mod ## _ ## msg ## _ID)) {        \
             ssize_t _mnl4c_nwritten;                                           \
-            struct tm *_mnl4c_tm;                                              \
-            time_t _mtkl4c_now;                                                \
-            char _mnl4c_now_str[32];                                           \
+            mnbytestream_t *_mnl4c_bs;                                         \
+            int64_t _mnl4c_curtm;                                              \
+            off_t _mnl4c_off;                                                  \
+            char _mnl4c_now_str[MNL4C_TS_BUFSZ];                               \
+            _mnl4c_bs = mnl4c_ctx_bs(_mnl4c_ctx);                              \
             assert(_mnl4c_ctx->writer.write != NULL);                          \
-            _mnl4c_ctx->writer.data.file.curtm = mnl4c_now_posix();            \
-            _mtkl4c_now = (time_t)_mnl4c_ctx->writer.data.file.curtm;          \
-            _mnl4c_tm = localtime(&_mtkl4c_now);                               \
-            (void)strftime(_mnl4c_now_str,                                     \
-                           sizeof(_mnl4c_now_str),                             \
-                           "%Y-%m-%d %H:%M:%S",                                \
-                           _mnl4c_tm);                                         \
-            _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,              \
+            _mnl4c_curtm = mnl4c_ctx_now(_mnl4c_ctx);                          \
+            mnl4c_ctx_set_curtm(_mnl4c_ctx, _mnl4c_curtm);                     \
+            if (_mnl4c_ctx->flags & MNL4C_OPEN_STRUCT) {                       \
+                _MNL4C_WRITE_STRUCT(level,                                     \
+                                    0,                                         \
+                                    0,                                         \
+                                    context                                    \
+                                    mod ## _ ## msg ## _FMT,                   \
+                                    mod,                                       \
+                                    msg,                                       \
+                                    ##__VA_ARGS__);                            \
+                _mnl4c_ctx->writer.write(_mnl4c_ctx, _mnl4c_bs);               \
+            } else {                                                           \
+                (void)mnl4c_cache_lt(&_mnl4c_ctx->cache,                       \
+                                     _mnl4c_curtm,                             \
+                                     _mnl4c_now_str);                          \
+                _mnl4c_off = mnl4c_bin_text_begin(_mnl4c_ctx,                  \
+                                                  _mnl4c_bs,                   \
+                                                  level);                      \
+                mnl4c_text_head(_mnl4c_ctx,                                    \
+                                _mnl4c_bs,                                     \
+                                mod ## _ ## msg ## _ID,                        \
+                                mod ## _NAME,                                  \
+                                _mnl4c_curtm,                                  \
+                                _mnl4c_now_str,                                \
+                                level,                                         \
+                                -1,                                            \
+                                true);                                         \
+                _mnl4c_nwritten = bytestream_nprintf(_mnl4c_bs,                \
                                           _mnl4c_ctx->bsbufsz,                 \
-                                          "%s [%d] %s %s: "                    \
                                           context                              \
                                           mod ## _ ## msg ## _FMT,             \
-                                          _mnl4c_now_str,                      \
-                                          _mnl4c_ctx->cache.pid,               \
-                                          mod ## _NAME,                        \
-                                          level_names[level],                  \
                                           ##__VA_ARGS__);                      \
-            if (_mnl4c_nwritten < 0) {                                         \
-                bytestream_rewind(&_mnl4c_ctx->bs);                            \
-            } else {                                                           \
-                SADVANCEPOS(&_mnl4c_ctx->bs, -1);                              \
-                (void)bytestream_cat(&_mnl4c_ctx->bs, 1, "\n");                \
-                _mnl4c_ctx->writer.write(_mnl4c_ctx);                          \
+                if (_mnl4c_nwritten < 0) {                                     \
+                    bytestream_rewind(_mnl4c_bs);                              \
+                } else {                                                       \
+                    SADVANCEPOS(_mnl4c_bs, -1);                                \
+                    (void)bytestream_cat(_mnl4c_bs, 1, "\n");                  \
+                    mnl4c_bin_text_end(_mnl4c_bs, _mnl4c_off);                 \
+                    _mnl4c_ctx->writer.write(_mnl4c_ctx, _mnl4c_bs);           \
+                }                                                              \
             }                                                                  \
+            mnl4c_ctx_bs_release(_mnl4c_bs);                                   \
         }                                                                      \
     } while (0)                                                                \
 
@@ -571,36 +1668,73 @@ UNUSED static const char *level_names[] = {
         mnl4c_ctx_t *_mnl4c_ctx;                                               \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         assert(_mnl4c_ctx != NULL);                                            \
-        if (mnl4c_ctx_allowed(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {    \
+        if (mnl4c_ctx_enabled(_mnl4c_ctx, level, mod ## _ ## msg ## _ID) &&    \
+                mnl4c_ctx_sample(_mnl4c_ctx, mod ## _ ## msg ## _ID)) {        \
             ssize_t _mnl4c_nwritten;                                           \
-            struct tm *_mnl4c_tm;                                              \
-            time_t _mtkl4c_now;                                                \
-            char _mnl4c_now_str[32];                                           \
+            mnbytestream_t *_mnl4c_bs;                                         \
+            int64_t _mnl4c_curtm;                                              \
+            off_t _mnl4c_off;                                                  \
+            char _mnl4c_now_str[MNL4C_TS_BUFSZ];                               \
+            _mnl4c_bs = mnl4c_ctx_bs(_mnl4c_ctx);                              \
             assert(_mnl4c_ctx->writer.write != NULL);                          \
-            _mnl4c_ctx->writer.data.file.curtm = mnl4c_now_posix();            \
-            _mtkl4c_now = (time_t)_mnl4c_ctx->writer.data.file.curtm;          \
-            _mnl4c_tm = localtime(&_mtkl4c_now);                               \
-            (void)strftime(_mnl4c_now_str,                                     \
-                           sizeof(_mnl4c_now_str),                             \
-                           "%Y-%m-%d %H:%M:%S",                                \
-                           _mnl4c_tm);                                         \
-            _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,              \
-                                          _mnl4c_ctx->bsbufsz,                 \
-                                          "%lf %s [%d] %s %s: "                \
-                                          mod ## _ ## msg ## _FMT,             \
-                                          _mnl4c_ctx->writer.data.file.curtm,  \
-                                          _mnl4c_now_str,                      \
-                                          _mnl4c_ctx->cache.pid,               \
-                                          mod ## _NAME,                        \
-                                          level_names[level],                  \
-                                          ##__VA_ARGS__);                      \
-            if (_mnl4c_nwritten < 0) {                                         \
-                bytestream_rewind(&_mnl4c_ctx->bs);                            \
+            _mnl4c_curtm = mnl4c_ctx_now(_mnl4c_ctx);                          \
+            mnl4c_ctx_set_curtm(_mnl4c_ctx, _mnl4c_curtm);                     \
+            if (_mnl4c_ctx->flags & MNL4C_OPEN_STRUCT) {                       \
+                _MNL4C_WRITE_STRUCT(level,                                     \
+                                    0,                                         \
+                                    mod ## _ ## msg ## _FIELDS,                \
+                                    mod ## _ ## msg ## _FMT,                   \
+                                    mod,                                       \
+                                    msg,                                       \
+                                    ##__VA_ARGS__);                            \
+                _mnl4c_ctx->writer.write(_mnl4c_ctx, _mnl4c_bs);               \
+            } else if ((_mnl4c_ctx->flags & MNL4C_OPEN_BINARY) &&              \
+                    mod ## _ ## msg ## _BIN) {                                 \
+                mnl4c_ctx_mark(_mnl4c_ctx, _mnl4c_bs, level);                  \
+                mnl4c_bin_write(_mnl4c_bs,                                     \
+                                _mnl4c_curtm,                                  \
+                                _mnl4c_ctx->cache.pid,                         \
+                                level,                                         \
+                                mod ## _ ## msg ## _ID,                        \
+                                MNL4C_BIN_FTS_LT2,                             \
+                                0,                                             \
+                                mnl4c_ctx_sample_n(                            \
+                                  _mnl4c_ctx,                                  \
+                                  mod ## _ ## msg ## _ID),                     \
+                                mod ## _ ## msg ## _SIG,                       \
+                                ##__VA_ARGS__);                                \
+                _mnl4c_ctx->writer.write(_mnl4c_ctx, _mnl4c_bs);               \
             } else {                                                           \
-                SADVANCEPOS(&_mnl4c_ctx->bs, -1);                              \
-                (void)bytestream_cat(&_mnl4c_ctx->bs, 1, "\n");                \
-                _mnl4c_ctx->writer.write(_mnl4c_ctx);                          \
+                (void)mnl4c_cache_lt2(&_mnl4c_ctx->cache,                      \
+                                      _mnl4c_curtm,                            \
+                                      _mnl4c_now_str);                         \
+                _mnl4c_off = mnl4c_bin_text_begin(_mnl4c_ctx,                  \
+                                                  _mnl4c_bs,                   \
+                                                  level);                      \
+                mnl4c_text_head(_mnl4c_ctx,                                    \
+                                _mnl4c_bs,                                     \
+                                mod ## _ ## msg ## _ID,                        \
+                                mod ## _NAME,                                  \
+                                _mnl4c_curtm,                                  \
+                                _mnl4c_now_str,                                \
+                                level,                                         \
+                                -1,                                            \
+                                true);                                         \
+                _mnl4c_nwritten = mod ## _ ## msg ## _NPRINTF(                 \
+                        _mnl4c_bs,                                             \
+                        _mnl4c_ctx->bsbufsz,                                   \
+                        mod ## _ ## msg ## _FMT,                               \
+                        ##__VA_ARGS__);                                        \
+                if (_mnl4c_nwritten < 0) {                                     \
+                    bytestream_rewind(_mnl4c_bs);                              \
+                } else {                                                       \
+                    SADVANCEPOS(_mnl4c_bs, -1);                                \
+                    (void)bytestream_cat(_mnl4c_bs, 1, "\n");                  \
+                    mnl4c_bin_text_end(_mnl4c_bs, _mnl4c_off);                 \
+                    _mnl4c_ctx->writer.write(_mnl4c_ctx, _mnl4c_bs);           \
+                }                                                              \
             }                                                                  \
+            mnl4c_ctx_bs_release(_mnl4c_bs);                                   \
         }                                                                      \
     } while (0)                                                                \
 
@@ -614,37 +1748,58 @@ UNUSED static const char *level_names[] = {
         mnl4c_ctx_t *_mnl4c_ctx;                                               \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         assert(_mnl4c_ctx != NULL);                                            \
-        if (mnl4c_ctx_allowed(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {    \
+        if (mnl4c_ctx_enabled(_mnl4c_ctx, level, mod ## _ ## msg ## _ID) &&    \
+                mnl4c_ctx_sample(_mnl4c_ctx, mod ## _ ## msg ## _ID)) {        \
             ssize_t _mnl4c_nwritten;                                           \
-            struct tm *_mnl4c_tm;                                              \
-            time_t _mtkl4c_now;                                                \
-            char _mnl4c_now_str[32];                                           \
+            mnbytestream_t *_mnl4c_bs;                                         \
+            int64_t _mnl4c_curtm;                                              \
+            off_t _mnl4c_off;                                                  \
+            char _mnl4c_now_str[MNL4C_TS_BUFSZ];                               \
+            _mnl4c_bs = mnl4c_ctx_bs(_mnl4c_ctx);                              \
             assert(_mnl4c_ctx->writer.write != NULL);                          \
-            _mnl4c_ctx->writer.data.file.curtm = mnl4c_now_posix();            \
-            _mtkl4c_now = (time_t)_mnl4c_ctx->writer.data.file.curtm;          \
-            _mnl4c_tm = localtime(&_mtkl4c_now);                               \
-            (void)strftime(_mnl4c_now_str,                                     \
-                           sizeof(_mnl4c_now_str),                             \
-                           "%Y-%m-%d %H:%M:%S",                                \
-                           _mnl4c_tm);                                         \
-            _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,              \
+            _mnl4c_curtm = mnl4c_ctx_now(_mnl4c_ctx);                          \
+            mnl4c_ctx_set_curtm(_mnl4c_ctx, _mnl4c_curtm);                     \
+            if (_mnl4c_ctx->flags & MNL4C_OPEN_STRUCT) {                       \
+                _MNL4C_WRITE_STRUCT(level,                                     \
+                                    0,                                         \
+                                    0,                                         \
+                                    context                                    \
+                                    mod ## _ ## msg ## _FMT,                   \
+                                    mod,                                       \
+                                    msg,                                       \
+                                    ##__VA_ARGS__);                            \
+                _mnl4c_ctx->writer.write(_mnl4c_ctx, _mnl4c_bs);               \
+            } else {                                                           \
+                (void)mnl4c_cache_lt2(&_mnl4c_ctx->cache,                      \
+                                      _mnl4c_curtm,                            \
+                                      _mnl4c_now_str);                         \
+                _mnl4c_off = mnl4c_bin_text_begin(_mnl4c_ctx,                  \
+                                                  _mnl4c_bs,                   \
+                                                  level);                      \
+                mnl4c_text_head(_mnl4c_ctx,                                    \
+                                _mnl4c_bs,                                     \
+                                mod ## _ ## msg ## _ID,                        \
+                                mod ## _NAME,                                  \
+                                _mnl4c_curtm,                                  \
+                                _mnl4c_now_str,                                \
+                                level,                                         \
+                                -1,                                            \
+                                true);                                         \
+                _mnl4c_nwritten = bytestream_nprintf(_mnl4c_bs,                \
                                           _mnl4c_ctx->bsbufsz,                 \
-                                          "%lf %s [%d] %s %s: "                \
                                           context                              \
                                           mod ## _ ## msg ## _FMT,             \
-                                          _mnl4c_ctx->writer.data.file.curtm,  \
-                                          _mnl4c_now_str,                      \
-                                          _mnl4c_ctx->cache.pid,               \
-                                          mod ## _NAME,                        \
-                                          level_names[level],                  \
                                           ##__VA_ARGS__);                      \
-            if (_mnl4c_nwritten < 0) {                                         \
-                bytestream_rewind(&_mnl4c_ctx->bs);                            \
-            } else {                                                           \
-                SADVANCEPOS(&_mnl4c_ctx->bs, -1);                              \
-                (void)bytestream_cat(&_mnl4c_ctx->bs, 1, "\n");                \
-                _mnl4c_ctx->writer.write(_mnl4c_ctx);                          \
+                if (_mnl4c_nwritten < 0) {                                     \
+                    bytestream_rewind(_mnl4c_bs);                              \
+                } else {                                                       \
+                    SADVANCEPOS(_mnl4c_bs, -1);                                \
+                    (void)bytestream_cat(_mnl4c_bs, 1, "\n");                  \
+                    mnl4c_bin_text_end(_mnl4c_bs, _mnl4c_off);                 \
+                    _mnl4c_ctx->writer.write(_mnl4c_ctx, _mnl4c_bs);           \
+                }                                                              \
             }                                                                  \
+            mnl4c_ctx_bs_release(_mnl4c_bs);                                   \
         }                                                                      \
     } while (0)                                                                \
 
@@ -657,19 +1812,48 @@ UNUSED static const char *level_names[] = {
         mnl4c_ctx_t *_mnl4c_ctx;                                               \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         assert(_mnl4c_ctx != NULL);                                            \
-        if (mnl4c_ctx_allowed(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {    \
+        if (mnl4c_ctx_enabled(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {    \
             ssize_t _mnl4c_nwritten;                                           \
-            _mnl4c_ctx->writer.data.file.curtm = mnl4c_now_posix();            \
-            _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,              \
-                                          _mnl4c_ctx->bsbufsz,                 \
-                                          "%.06lf [%d] %s %s: "                \
-                                          mod ## _ ## msg ## _FMT,             \
-                                          _mnl4c_ctx->                         \
-                                            writer.data.file.curtm,            \
-                                          _mnl4c_ctx->cache.pid,               \
-                                          mod ## _NAME,                        \
-                                          level_names[level],                  \
-                                          ##__VA_ARGS__);                      \
+            mnbytestream_t *_mnl4c_bs;                                         \
+            int64_t _mnl4c_curtm;                                              \
+            off_t _mnl4c_off;                                                  \
+            _mnl4c_bs = mnl4c_ctx_bs(_mnl4c_ctx);                              \
+            _mnl4c_curtm = mnl4c_ctx_now(_mnl4c_ctx);                          \
+            mnl4c_ctx_set_curtm(_mnl4c_ctx, _mnl4c_curtm);                     \
+            if (_mnl4c_ctx->flags & MNL4C_OPEN_STRUCT) {                       \
+                _mnl4c_off = mnl4c_struct_begin(                               \
+                    _mnl4c_ctx,                                                \
+                    _mnl4c_bs,                                                 \
+                    _mnl4c_curtm,                                              \
+                    level,                                                     \
+                    0,                                                         \
+                    0,                                                         \
+                    MNL4C_STRUCT_KEYS(_mnl4c_ctx, mod, msg),                   \
+                    true);                                                     \
+                _mnl4c_nwritten = mod ## _ ## msg ## _NPRINTF(                 \
+                        _mnl4c_bs,                                             \
+                        _mnl4c_ctx->bsbufsz,                                   \
+                        mod ## _ ## msg ## _FMT,                               \
+                        ##__VA_ARGS__);                                        \
+            } else {                                                           \
+                _mnl4c_off = mnl4c_bin_text_begin(_mnl4c_ctx,                  \
+                                                  _mnl4c_bs,                   \
+                                                  level);                      \
+                mnl4c_text_head(_mnl4c_ctx,                                    \
+                                _mnl4c_bs,                                     \
+                                mod ## _ ## msg ## _ID,                        \
+                                mod ## _NAME,                                  \
+                                _mnl4c_curtm,                                  \
+                                NULL,                                          \
+                                level,                                         \
+                                -1,                                            \
+                                false);                                        \
+                _mnl4c_nwritten = mod ## _ ## msg ## _NPRINTF(                 \
+                        _mnl4c_bs,                                             \
+                        _mnl4c_ctx->bsbufsz,                                   \
+                        mod ## _ ## msg ## _FMT,                               \
+                        ##__VA_ARGS__);                                        \
+            }                                                                  \
 
 
 /*
@@ -681,20 +1865,48 @@ UNUSED static const char *level_names[] = {
         mnl4c_ctx_t *_mnl4c_ctx;                                               \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         assert(_mnl4c_ctx != NULL);                                            \
-        if (mnl4c_ctx_allowed(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {    \
+        if (mnl4c_ctx_enabled(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {    \
             ssize_t _mnl4c_nwritten;                                           \
-            _mnl4c_ctx->writer.data.file.curtm = mnl4c_now_posix();            \
-            _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,              \
+            mnbytestream_t *_mnl4c_bs;                                         \
+            int64_t _mnl4c_curtm;                                              \
+            off_t _mnl4c_off;                                                  \
+            _mnl4c_bs = mnl4c_ctx_bs(_mnl4c_ctx);                              \
+            _mnl4c_curtm = mnl4c_ctx_now(_mnl4c_ctx);                          \
+            mnl4c_ctx_set_curtm(_mnl4c_ctx, _mnl4c_curtm);                     \
+            if (_mnl4c_ctx->flags & MNL4C_OPEN_STRUCT) {                       \
+                _mnl4c_off = mnl4c_struct_begin(                               \
+                    _mnl4c_ctx,                                                \
+                    _mnl4c_bs,                                                 \
+                    _mnl4c_curtm,                                              \
+                    level,                                                     \
+                    0,                                                         \
+                    0,                                                         \
+                    MNL4C_STRUCT_KEYS(_mnl4c_ctx, mod, msg),                   \
+                    true);                                                     \
+                _mnl4c_nwritten = bytestream_nprintf(_mnl4c_bs,                \
+                                          _mnl4c_ctx->bsbufsz,                 \
+                                          context                              \
+                                          mod ## _ ## msg ## _FMT,             \
+                                          ##__VA_ARGS__);                      \
+            } else {                                                           \
+                _mnl4c_off = mnl4c_bin_text_begin(_mnl4c_ctx,                  \
+                                                  _mnl4c_bs,                   \
+                                                  level);                      \
+                mnl4c_text_head(_mnl4c_ctx,                                    \
+                                _mnl4c_bs,                                     \
+                                mod ## _ ## msg ## _ID,                        \
+                                mod ## _NAME,                                  \
+                                _mnl4c_curtm,                                  \
+                                NULL,                                          \
+                                level,                                         \
+                                -1,                                            \
+                                false);                                        \
+                _mnl4c_nwritten = bytestream_nprintf(_mnl4c_bs,                \
                                           _mnl4c_ctx->bsbufsz,                 \
-                                          "%.06lf [%d] %s %s: "                \
                                           context                              \
                                           mod ## _ ## msg ## _FMT,             \
-                                          _mnl4c_ctx->                         \
-                                            writer.data.file.curtm,            \
-                                          _mnl4c_ctx->cache.pid,               \
-                                          mod ## _NAME,                        \
-                                          level_names[level],                  \
                                           ##__VA_ARGS__);                      \
+            }                                                                  \
 
 
 /*
@@ -705,27 +1917,52 @@ UNUSED static const char *level_names[] = {
         mnl4c_ctx_t *_mnl4c_ctx;                                               \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         assert(_mnl4c_ctx != NULL);                                            \
-        if (mnl4c_ctx_allowed(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {    \
+        if (mnl4c_ctx_enabled(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {    \
             ssize_t _mnl4c_nwritten;                                           \
-            struct tm *_mnl4c_tm;                                              \
-            time_t _mtkl4c_now;                                                \
-            char _mnl4c_now_str[32];                                           \
-            _mnl4c_ctx->writer.data.file.curtm = mnl4c_now_posix();            \
-            _mtkl4c_now = (time_t)_mnl4c_ctx->writer.data.file.curtm;          \
-            _mnl4c_tm = localtime(&_mtkl4c_now);                               \
-            (void)strftime(_mnl4c_now_str,                                     \
-                           sizeof(_mnl4c_now_str),                             \
-                           "%Y-%m-%d %H:%M:%S",                                \
-                           _mnl4c_tm);                                         \
-            _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,              \
-                                          _mnl4c_ctx->bsbufsz,                 \
-                                          "%s [%d] %s %s: "                    \
-                                          mod ## _ ## msg ## _FMT,             \
-                                          _mnl4c_now_str,                      \
-                                          _mnl4c_ctx->cache.pid,               \
-                                          mod ## _NAME,                        \
-                                          level_names[level],                  \
-                                          ##__VA_ARGS__);                      \
+            mnbytestream_t *_mnl4c_bs;                                         \
+            int64_t _mnl4c_curtm;                                              \
+            off_t _mnl4c_off;                                                  \
+            char _mnl4c_now_str[MNL4C_TS_BUFSZ];                               \
+            _mnl4c_bs = mnl4c_ctx_bs(_mnl4c_ctx);                              \
+            _mnl4c_curtm = mnl4c_ctx_now(_mnl4c_ctx);                          \
+            mnl4c_ctx_set_curtm(_mnl4c_ctx, _mnl4c_curtm);                     \
+            if (_mnl4c_ctx->flags & MNL4C_OPEN_STRUCT) {                       \
+                _mnl4c_off = mnl4c_struct_begin(                               \
+                    _mnl4c_ctx,                                                \
+                    _mnl4c_bs,                                                 \
+                    _mnl4c_curtm,                                              \
+                    level,                                                     \
+                    0,                                                         \
+                    0,                                                         \
+                    MNL4C_STRUCT_KEYS(_mnl4c_ctx, mod, msg),                   \
+                    true);                                                     \
+                _mnl4c_nwritten = mod ## _ ## msg ## _NPRINTF(                 \
+                        _mnl4c_bs,                                             \
+                        _mnl4c_ctx->bsbufsz,                                   \
+                        mod ## _ ## msg ## _FMT,                               \
+                        ##__VA_ARGS__);                                        \
+            } else {                                                           \
+                (void)mnl4c_cache_lt(&_mnl4c_ctx->cache,                       \
+                                     _mnl4c_curtm,                             \
+                                     _mnl4c_now_str);                          \
+                _mnl4c_off = mnl4c_bin_text_begin(_mnl4c_ctx,                  \
+                                                  _mnl4c_bs,                   \
+                                                  level);                      \
+                mnl4c_text_head(_mnl4c_ctx,                                    \
+                                _mnl4c_bs,                                     \
+                                mod ## _ ## msg ## _ID,                        \
+                                mod ## _NAME,                                  \
+                                _mnl4c_curtm,                                  \
+                                _mnl4c_now_str,                                \
+                                level,                                         \
+                                -1,                                            \
+                                false);                                        \
+                _mnl4c_nwritten = mod ## _ ## msg ## _NPRINTF(                 \
+                        _mnl4c_bs,                                             \
+                        _mnl4c_ctx->bsbufsz,                                   \
+                        mod ## _ ## msg ## _FMT,                               \
+                        ##__VA_ARGS__);                                        \
+            }                                                                  \
 
 
 /*
@@ -737,28 +1974,52 @@ UNUSED static const char *level_names[] = {
         mnl4c_ctx_t *_mnl4c_ctx;                                               \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         assert(_mnl4c_ctx != NULL);                                            \
-        if (mnl4c_ctx_allowed(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {    \
+        if (mnl4c_ctx_enabled(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {    \
             ssize_t _mnl4c_nwritten;                                           \
-            struct tm *_mnl4c_tm;                                              \
-            time_t _mtkl4c_now;                                                \
-            char _mnl4c_now_str[32];                                           \
-            _mnl4c_ctx->writer.data.file.curtm = mnl4c_now_posix();            \
-            _mtkl4c_now = (time_t)_mnl4c_ctx->writer.data.file.curtm;          \
-            _mnl4c_tm = localtime(&_mtkl4c_now);                               \
-            (void)strftime(_mnl4c_now_str,                                     \
-                           sizeof(_mnl4c_now_str),                             \
-                           "%Y-%m-%d %H:%M:%S",                                \
-                           _mnl4c_tm);                                         \
-            _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,              \
+            mnbytestream_t *_mnl4c_bs;                                         \
+            int64_t _mnl4c_curtm;                                              \
+            off_t _mnl4c_off;                                                  \
+            char _mnl4c_now_str[MNL4C_TS_BUFSZ];                               \
+            _mnl4c_bs = mnl4c_ctx_bs(_mnl4c_ctx);                              \
+            _mnl4c_curtm = mnl4c_ctx_now(_mnl4c_ctx);                          \
+            mnl4c_ctx_set_curtm(_mnl4c_ctx, _mnl4c_curtm);                     \
+            if (_mnl4c_ctx->flags & MNL4C_OPEN_STRUCT) {                       \
+                _mnl4c_off = mnl4c_struct_begin(                               \
+                    _mnl4c_ctx,                                                \
+                    _mnl4c_bs,                                                 \
+                    _mnl4c_curtm,                                              \
+                    level,                                                     \
+                    0,                                                         \
+                    0,                                                         \
+                    MNL4C_STRUCT_KEYS(_mnl4c_ctx, mod, msg),                   \
+                    true);                                                     \
+                _mnl4c_nwritten = bytestream_nprintf(_mnl4c_bs,                \
                                           _mnl4c_ctx->bsbufsz,                 \
-                                          "%s [%d] %s %s: "                    \
                                           context                              \
                                           mod ## _ ## msg ## _FMT,             \
-                                          _mnl4c_now_str,                      \
-                                          _mnl4c_ctx->cache.pid,               \
-                                          mod ## _NAME,                        \
-                                          level_names[level],                  \
                                           ##__VA_ARGS__);                      \
+            } else {                                                           \
+                (void)mnl4c_cache_lt(&_mnl4c_ctx->cache,                       \
+                                     _mnl4c_curtm,                             \
+                                     _mnl4c_now_str);                          \
+                _mnl4c_off = mnl4c_bin_text_begin(_mnl4c_ctx,                  \
+                                                  _mnl4c_bs,                   \
+                                                  level);                      \
+                mnl4c_text_head(_mnl4c_ctx,                                    \
+                                _mnl4c_bs,                                     \
+                                mod ## _ ## msg ## _ID,                        \
+                                mod ## _NAME,                                  \
+                                _mnl4c_curtm,                                  \
+                                _mnl4c_now_str,                                \
+                                level,                                         \
+                                -1,                                            \
+                                false);                                        \
+                _mnl4c_nwritten = bytestream_nprintf(_mnl4c_bs,                \
+                                          _mnl4c_ctx->bsbufsz,                 \
+                                          context                              \
+                                          mod ## _ ## msg ## _FMT,             \
+                                          ##__VA_ARGS__);                      \
+            }                                                                  \
 
 
 /*
@@ -769,28 +2030,52 @@ UNUSED static const char *level_names[] = {
         mnl4c_ctx_t *_mnl4c_ctx;                                               \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         assert(_mnl4c_ctx != NULL);                                            \
-        if (mnl4c_ctx_allowed(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {    \
+        if (mnl4c_ctx_enabled(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {    \
             ssize_t _mnl4c_nwritten;                                           \
-            struct tm *_mnl4c_tm;                                              \
-            time_t _mtkl4c_now;                                                \
-            char _mnl4c_now_str[32];                                           \
-            _mnl4c_ctx->writer.data.file.curtm = mnl4c_now_posix();            \
-            _mtkl4c_now = (time_t)_mnl4c_ctx->writer.data.file.curtm;          \
-            _mnl4c_tm = localtime(&_mtkl4c_now);                               \
-            (void)strftime(_mnl4c_now_str,                                     \
-                           sizeof(_mnl4c_now_str),                             \
-                           "%Y-%m-%d %H:%M:%S",                                \
-                           _mnl4c_tm);                                         \
-            _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,              \
-                                          _mnl4c_ctx->bsbufsz,                 \
-                                          "%lf %s [%d] %s %s: "                \
-                                          mod ## _ ## msg ## _FMT,             \
-                                          _mnl4c_ctx->writer.data.file.curtm,  \
-                                          _mnl4c_now_str,                      \
-                                          _mnl4c_ctx->cache.pid,               \
-                                          mod ## _NAME,                        \
-                                          level_names[level],                  \
-                                          ##__VA_ARGS__);                      \
+            mnbytestream_t *_mnl4c_bs;                                         \
+            int64_t _mnl4c_curtm;                                              \
+            off_t _mnl4c_off;                                                  \
+            char _mnl4c_now_str[MNL4C_TS_BUFSZ];                               \
+            _mnl4c_bs = mnl4c_ctx_bs(_mnl4c_ctx);                              \
+            _mnl4c_curtm = mnl4c_ctx_now(_mnl4c_ctx);                          \
+            mnl4c_ctx_set_curtm(_mnl4c_ctx, _mnl4c_curtm);                     \
+            if (_mnl4c_ctx->flags & MNL4C_OPEN_STRUCT) {                       \
+                _mnl4c_off = mnl4c_struct_begin(                               \
+                    _mnl4c_ctx,                                                \
+                    _mnl4c_bs,                                                 \
+                    _mnl4c_curtm,                                              \
+                    level,                                                     \
+                    0,                                                         \
+                    0,                                                         \
+                    MNL4C_STRUCT_KEYS(_mnl4c_ctx, mod, msg),                   \
+                    true);                                                     \
+                _mnl4c_nwritten = mod ## _ ## msg ## _NPRINTF(                 \
+                        _mnl4c_bs,                                             \
+                        _mnl4c_ctx->bsbufsz,                                   \
+                        mod ## _ ## msg ## _FMT,                               \
+                        ##__VA_ARGS__);                                        \
+            } else {                                                           \
+                (void)mnl4c_cache_lt2(&_mnl4c_ctx->cache,                      \
+                                      _mnl4c_curtm,                            \
+                                      _mnl4c_now_str);                         \
+                _mnl4c_off = mnl4c_bin_text_begin(_mnl4c_ctx,                  \
+                                                  _mnl4c_bs,                   \
+                                                  level);                      \
+                mnl4c_text_head(_mnl4c_ctx,                                    \
+                                _mnl4c_bs,                                     \
+                                mod ## _ ## msg ## _ID,                        \
+                                mod ## _NAME,                                  \
+                                _mnl4c_curtm,                                  \
+                                _mnl4c_now_str,                                \
+                                level,                                         \
+                                -1,                                            \
+                                false);                                        \
+                _mnl4c_nwritten = mod ## _ ## msg ## _NPRINTF(                 \
+                        _mnl4c_bs,                                             \
+                        _mnl4c_ctx->bsbufsz,                                   \
+                        mod ## _ ## msg ## _FMT,                               \
+                        ##__VA_ARGS__);                                        \
+            }                                                                  \
 
 
 /*
@@ -802,36 +2087,59 @@ UNUSED static const char *level_names[] = {
         mnl4c_ctx_t *_mnl4c_ctx;                                               \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         assert(_mnl4c_ctx != NULL);                                            \
-        if (mnl4c_ctx_allowed(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {    \
+        if (mnl4c_ctx_enabled(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {    \
             ssize_t _mnl4c_nwritten;                                           \
-            struct tm *_mnl4c_tm;                                              \
-            time_t _mtkl4c_now;                                                \
-            char _mnl4c_now_str[32];                                           \
-            _mnl4c_ctx->writer.data.file.curtm = mnl4c_now_posix();            \
-            _mtkl4c_now = (time_t)_mnl4c_ctx->writer.data.file.curtm;          \
-            _mnl4c_tm = localtime(&_mtkl4c_now);                               \
-            (void)strftime(_mnl4c_now_str,                                     \
-                           sizeof(_mnl4c_now_str),                             \
-                           "%Y-%m-%d %H:%M:%S",                                \
-                           _mnl4c_tm);                                         \
-            _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,              \
+            mnbytestream_t *_mnl4c_bs;                                         \
+            int64_t _mnl4c_curtm;                                              \
+            off_t _mnl4c_off;                                                  \
+            char _mnl4c_now_str[MNL4C_TS_BUFSZ];                               \
+            _mnl4c_bs = mnl4c_ctx_bs(_mnl4c_ctx);                              \
+            _mnl4c_curtm = mnl4c_ctx_now(_mnl4c_ctx);                          \
+            mnl4c_ctx_set_curtm(_mnl4c_ctx, _mnl4c_curtm);                     \
+            if (_mnl4c_ctx->flags & MNL4C_OPEN_STRUCT) {                       \
+                _mnl4c_off = mnl4c_struct_begin(                               \
+                    _mnl4c_ctx,                                                \
+                    _mnl4c_bs,                                                 \
+                    _mnl4c_curtm,                                              \
+                    level,                                                     \
+                    0,                                                         \
+                    0,                                                         \
+                    MNL4C_STRUCT_KEYS(_mnl4c_ctx, mod, msg),                   \
+                    true);                                                     \
+                _mnl4c_nwritten = bytestream_nprintf(_mnl4c_bs,                \
                                           _mnl4c_ctx->bsbufsz,                 \
-                                          "%lf %s [%d] %s %s: "                \
                                           context                              \
                                           mod ## _ ## msg ## _FMT,             \
-                                          _mnl4c_ctx->writer.data.file.curtm,  \
-                                          _mnl4c_now_str,                      \
-                                          _mnl4c_ctx->cache.pid,               \
-                                          mod ## _NAME,                        \
-                                          level_names[level],                  \
                                           ##__VA_ARGS__);                      \
+            } else {                                                           \
+                (void)mnl4c_cache_lt2(&_mnl4c_ctx->cache,                      \
+                                      _mnl4c_curtm,                            \
+                                      _mnl4c_now_str);                         \
+                _mnl4c_off = mnl4c_bin_text_begin(_mnl4c_ctx,                  \
+                                                  _mnl4c_bs,                   \
+                                                  level);                      \
+                mnl4c_text_head(_mnl4c_ctx,                                    \
+                                _mnl4c_bs,                                     \
+                                mod ## _ ## msg ## _ID,                        \
+                                mod ## _NAME,                                  \
+                                _mnl4c_curtm,                                  \
+                                _mnl4c_now_str,                                \
+                                level,                                         \
+                                -1,                                            \
+                                false);                                        \
+                _mnl4c_nwritten = bytestream_nprintf(_mnl4c_bs,                \
+                                          _mnl4c_ctx->bsbufsz,                 \
+                                          context                              \
+                                          mod ## _ ## msg ## _FMT,             \
+                                          ##__VA_ARGS__);                      \
+            }                                                                  \
 
 
 /*
  * next
  */
 #define MNL4C_WRITE_NEXT_PRINTFLIKE(ld, level, mod, msg, fmt, ...)     \
-            _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,      \
+            _mnl4c_nwritten = bytestream_nprintf(_mnl4c_bs,            \
                                      _mnl4c_ctx->bsbufsz,              \
                                      fmt,                              \
                                      ##__VA_ARGS__)                    \
@@ -842,7 +2150,7 @@ UNUSED static const char *level_names[] = {
  */
 #define MNL4C_WRITE_NEXT_PRINTFLIKE_CONTEXT(                           \
         ld, level, context, mod, msg, fmt, ...)                        \
-            _mnl4c_nwritten = bytestream_nprintf(&_mnl4c_ctx->bs,      \
+            _mnl4c_nwritten = bytestream_nprintf(_mnl4c_bs,            \
                                      _mnl4c_ctx->bsbufsz,              \
                                      context                           \
                                      fmt,                              \
@@ -854,16 +2162,25 @@ UNUSED static const char *level_names[] = {
  */
 #define MNL4C_WRITE_STOP_PRINTFLIKE(ld, level, mod, msg, ...)          \
             if (_mnl4c_nwritten < 0) {                                 \
-                bytestream_rewind(&_mnl4c_ctx->bs);                    \
+                bytestream_rewind(_mnl4c_bs);                          \
             } else {                                                   \
-                SADVANCEPOS(&_mnl4c_ctx->bs, -1);                      \
-                (void)bytestream_nprintf(&_mnl4c_ctx->bs,              \
-                                         _mnl4c_ctx->bsbufsz,          \
-                                         mod ## _ ## msg ## _FMT,      \
-                                         ##__VA_ARGS__);               \
-                (void)bytestream_cat(&_mnl4c_ctx->bs, 1, "\n");        \
-                _mnl4c_ctx->writer.write(_mnl4c_ctx);                  \
+                SADVANCEPOS(_mnl4c_bs, -1);                            \
+                (void)mod ## _ ## msg ## _NPRINTF(                     \
+                        _mnl4c_bs,                                     \
+                        _mnl4c_ctx->bsbufsz,                           \
+                        mod ## _ ## msg ## _FMT,                       \
+                        ##__VA_ARGS__);                                \
+                if (_mnl4c_ctx->flags & MNL4C_OPEN_STRUCT) {           \
+                    mnl4c_struct_end(_mnl4c_ctx,                       \
+                                     _mnl4c_bs,                        \
+                                     _mnl4c_off);                      \
+                } else {                                               \
+                    (void)bytestream_cat(_mnl4c_bs, 1, "\n");          \
+                    mnl4c_bin_text_end(_mnl4c_bs, _mnl4c_off);         \
+                }                                                      \
+                _mnl4c_ctx->writer.write(_mnl4c_ctx, _mnl4c_bs);       \
             }                                                          \
+            mnl4c_ctx_bs_release(_mnl4c_bs);                           \
         }                                                              \
     } while (0)                                                        \
 
@@ -875,17 +2192,25 @@ UNUSED static const char *level_names[] = {
 #define MNL4C_WRITE_STOP_PRINTFLIKE_CONTEXT(                           \
         ld, level, context, mod, msg, ...)                             \
             if (_mnl4c_nwritten < 0) {                                 \
-                bytestream_rewind(&_mnl4c_ctx->bs);                    \
+                bytestream_rewind(_mnl4c_bs);                          \
             } else {                                                   \
-                SADVANCEPOS(&_mnl4c_ctx->bs, -1);                      \
-                (void)bytestream_nprintf(&_mnl4c_ctx->bs,              \
+                SADVANCEPOS(_mnl4c_bs, -1);                            \
+                (void)bytestream_nprintf(_mnl4c_bs,                    \
                                          _mnl4c_ctx->bsbufsz,          \
                                          context                       \
                                          mod ## _ ## msg ## _FMT,      \
                                          ##__VA_ARGS__);               \
-                (void)bytestream_cat(&_mnl4c_ctx->bs, 1, "\n");        \
-                _mnl4c_ctx->writer.write(_mnl4c_ctx);                  \
+                if (_mnl4c_ctx->flags & MNL4C_OPEN_STRUCT) {           \
+                    mnl4c_struct_end(_mnl4c_ctx,                       \
+                                     _mnl4c_bs,                        \
+                                     _mnl4c_off);                      \
+                } else {                                               \
+                    (void)bytestream_cat(_mnl4c_bs, 1, "\n");          \
+                    mnl4c_bin_text_end(_mnl4c_bs, _mnl4c_off);         \
+                }                                                      \
+                _mnl4c_ctx->writer.write(_mnl4c_ctx, _mnl4c_bs);       \
             }                                                          \
+            mnl4c_ctx_bs_release(_mnl4c_bs);                           \
         }                                                              \
     } while (0)                                                        \
 
@@ -899,13 +2224,57 @@ UNUSED static const char *level_names[] = {
         mnl4c_ctx_t *_mnl4c_ctx;                                               \
         _mnl4c_ctx = mnl4c_get_ctx(ld);                                        \
         assert(_mnl4c_ctx != NULL);                                            \
-        if (mnl4c_ctx_allowed(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {    \
+        if (mnl4c_ctx_enabled(_mnl4c_ctx, level, mod ## _ ## msg ## _ID)) {    \
             __a1                                                               \
         }                                                                      \
     } while (0)                                                                \
 
 
 
+/*
+ * Messages less severe than MNL4C_COMPILE_MIN_LEVEL, or than the module's
+ * <MOD>_COMPILE_MIN_LEVEL, are compiled out of the generated
+ * <MOD>_LERROR .. <MOD>_LDEBUG macros.  Their arguments are still checked
+ * against the format, but never evaluated.
+ */
+#ifndef MNL4C_COMPILE_MIN_LEVEL
+#   define MNL4C_COMPILE_MIN_LEVEL LOG_DEBUG
+#endif
+
+static inline void
+mnl4c_fmtcheck(const char *, ...) __attribute__((format(printf, 1, 2)));
+
+static inline void
+mnl4c_fmtcheck(UNUSED const char *fmt, ...)
+{
+}
+
+
+/*
+ * elided
+ */
+#define MNL4C_WRITE_ELIDED_PRINTFLIKE(ld, mod, msg, ...)                       \
+    do {                                                                       \
+        if (0) {                                                               \
+            (void)(ld);                                                        \
+            mnl4c_fmtcheck(mod ## _ ## msg ## _FMT, ##__VA_ARGS__);            \
+        }                                                                      \
+    } while (0)                                                                \
+
+
+/*
+ * elided context
+ */
+#define MNL4C_WRITE_ELIDED_PRINTFLIKE_CONTEXT(ld, context, mod, msg, ...)      \
+    do {                                                                       \
+        if (0) {                                                               \
+            (void)(ld);                                                        \
+            mnl4c_fmtcheck(context mod ## _ ## msg ## _FMT, ##__VA_ARGS__);    \
+        }                                                                      \
+    } while (0)                                                                \
+
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,344 @@
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <mncommon/bytestream.h>
+#include <mncommon/dumpm.h>
+#include <mncommon/util.h>
+
+#include <mnl4c.h>
+#include "mnl4c_private.h"
+
+
+#define RING_ALIGN(n) (((n) + 7) & ~((size_t)7))
+#define ASYNC_IDLE_NSEC (100l * 1000l * 1000l)
+
+
+static void
+ring_init(mnl4c_ring_t *ring, size_t sz)
+{
+    ring->head = 0;
+    ring->tail = 0;
+    if ((ring->data = calloc(1, sz)) == NULL) {
+        FAIL("calloc");
+    }
+    ring->sz = sz;
+}
+
+
+static void
+ring_fini(mnl4c_ring_t *ring)
+{
+    free(ring->data);
+    ring->data = NULL;
+    ring->sz = 0;
+}
+
+
+/*
+ * Returns a header followed by sz bytes of room, or NULL if the ring is
+ * full.  If the record does not fit before the end of the ring, the rest
+ * of the ring is reserved as padding and the record goes at offset 0.
+ */
+static mnl4c_ring_hdr_t *
+ring_reserve(mnl4c_ring_t *ring, size_t sz)
+{
+    uint64_t head, tail;
+    size_t need, off, pad;
+    mnl4c_ring_hdr_t *hdr;
+
+    need = RING_ALIGN(sizeof(mnl4c_ring_hdr_t) + sz);
+    head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    do {
+        tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        off = head & (ring->sz - 1);
+        pad = (off + need > ring->sz) ? ring->sz - off : 0;
+        if (head + pad + need - tail > ring->sz) {
+            return NULL;
+        }
+    } while (!__atomic_compare_exchange_n(&ring->head,
+                                          &head,
+                                          head + pad + need,
+                                          true,
+                                          __ATOMIC_ACQ_REL,
+                                          __ATOMIC_RELAXED));
+
+    if (pad > 0) {
+        hdr = (mnl4c_ring_hdr_t *)(ring->data + off);
+        hdr->len = pad;
+        __atomic_store_n(&hdr->flags, MNL4C_RING_PAD, __ATOMIC_RELEASE);
+        off = 0;
+    }
+    return (mnl4c_ring_hdr_t *)(ring->data + off);
+}
+
+
+static bool
+ring_pending(mnl4c_ring_t *ring)
+{
+    mnl4c_ring_hdr_t *hdr;
+
+    hdr = (mnl4c_ring_hdr_t *)(ring->data + (ring->tail & (ring->sz - 1)));
+    return __atomic_load_n(&hdr->flags, __ATOMIC_SEQ_CST) != 0;
+}
+
+
+static void
+async_wakeup(mnl4c_async_t *async)
+{
+    (void)pthread_mutex_lock(&async->mtx);
+    (void)pthread_cond_signal(&async->cond);
+    (void)pthread_mutex_unlock(&async->mtx);
+}
+
+
+/*
+ * Consumer side.  Gathers up to MNL4C_IOV_MAX committed records straight
+ * from the ring into one flushv(), then zeroes the consumed space so that
+ * stale bytes are never mistaken for a header, and hands it back to
+ * producers.
+ */
+static size_t
+async_drain(mnl4c_async_t *async)
+{
+    mnl4c_ring_t *ring;
+    uint64_t start, tail;
+    size_t nrecs, nbytes;
+
+    ring = &async->ring;
+    nrecs = 0;
+    nbytes = 0;
+    start = tail = ring->tail;
+
+    while (nrecs < MNL4C_IOV_MAX && nbytes < ring->sz / 2) {
+        size_t off;
+        mnl4c_ring_hdr_t *hdr;
+        uint32_t flags;
+
+        off = tail & (ring->sz - 1);
+        hdr = (mnl4c_ring_hdr_t *)(ring->data + off);
+        if ((flags = __atomic_load_n(&hdr->flags, __ATOMIC_ACQUIRE)) == 0) {
+            break;
+        }
+        if (flags & MNL4C_RING_PAD) {
+            tail += ring->sz - off;
+        } else {
+            async->iov[nrecs].iov_base = hdr + 1;
+            async->iov[nrecs].iov_len = hdr->len;
+            nbytes += hdr->len;
+            tail += RING_ALIGN(sizeof(mnl4c_ring_hdr_t) + hdr->len);
+            ++nrecs;
+        }
+    }
+
+    if (nrecs > 0) {
+        (void)pthread_mutex_lock(async->wmtx);
+        async->writer->flushv(async->writer, async->iov, (int)nrecs);
+        (void)pthread_mutex_unlock(async->wmtx);
+    }
+
+    if (tail != start) {
+        uint64_t t;
+
+        /* the consumed space may wrap around the end of the ring */
+        for (t = start; t != tail;) {
+            size_t off, sz;
+
+            off = t & (ring->sz - 1);
+            sz = MIN(tail - t, ring->sz - off);
+            memset(ring->data + off, '\0', sz);
+            t += sz;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+
+    return nrecs;
+}
+
+
+static void *
+async_worker(void *udata)
+{
+    mnl4c_async_t *async;
+
+    async = udata;
+
+    while (true) {
+        struct timespec ts;
+
+        if (async_drain(async) > 0) {
+            continue;
+        }
+
+        (void)pthread_mutex_lock(&async->mtx);
+        if (async->shutdown) {
+            (void)pthread_mutex_unlock(&async->mtx);
+            break;
+        }
+        __atomic_store_n(&async->sleeping, 1, __ATOMIC_SEQ_CST);
+        if (!ring_pending(&async->ring)) {
+            (void)clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += ASYNC_IDLE_NSEC;
+            if (ts.tv_nsec >= 1000000000l) {
+                ++ts.tv_sec;
+                ts.tv_nsec -= 1000000000l;
+            }
+            (void)pthread_cond_timedwait(&async->cond, &async->mtx, &ts);
+        }
+        __atomic_store_n(&async->sleeping, 0, __ATOMIC_RELAXED);
+        (void)pthread_mutex_unlock(&async->mtx);
+    }
+
+    while (async_drain(async) > 0) {
+        ;
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Producer side, safe to call from any number of threads.  Never blocks
+ * on I/O.  When the ring is full, it waits for the writer thread to free
+ * up space rather than dropping records.
+ *
+ * A buffer too large for the ring is not split, a binary or zstd framed
+ * record has no line to split it at.  Once the records queued ahead of
+ * it are written, it is written right away, under the writer's lock.
+ */
+void
+mnl4c_async_put(mnl4c_async_t *async, const char *buf, size_t sz)
+{
+    mnl4c_ring_hdr_t *hdr;
+
+    if (sz == 0) {
+        return;
+    }
+    if (MNUNLIKELY(sz > async->ring.sz / 4)) {
+        uint64_t head;
+        struct iovec iov;
+
+        head = __atomic_load_n(&async->ring.head, __ATOMIC_ACQUIRE);
+        while ((int64_t)(__atomic_load_n(&async->ring.tail,
+                                         __ATOMIC_ACQUIRE) - head) < 0) {
+            async_wakeup(async);
+            (void)sched_yield();
+        }
+        iov.iov_base = (void *)buf;
+        iov.iov_len = sz;
+        (void)pthread_mutex_lock(async->wmtx);
+        async->writer->flushv(async->writer, &iov, 1);
+        (void)pthread_mutex_unlock(async->wmtx);
+        return;
+    }
+
+    while ((hdr = ring_reserve(&async->ring, sz)) == NULL) {
+        async_wakeup(async);
+        (void)sched_yield();
+    }
+    hdr->len = sz;
+    memcpy(hdr + 1, buf, sz);
+    __atomic_store_n(&hdr->flags, MNL4C_RING_COMMITTED, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&async->sleeping, __ATOMIC_SEQ_CST)) {
+        async_wakeup(async);
+    }
+}
+
+
+/*
+ * Crash time, from a signal handler: hands the committed records over to
+ * cb without taking them off the ring.  Records that the writer thread
+ * was in the middle of writing may come out twice.
+ */
+void
+mnl4c_async_crash(mnl4c_async_t *async,
+                  void (*cb)(void *, const char *, size_t),
+                  void *udata)
+{
+    mnl4c_ring_t *ring;
+    uint64_t tail, end;
+
+    ring = &async->ring;
+    tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    for (end = tail + ring->sz; tail < end;) {
+        size_t off;
+        mnl4c_ring_hdr_t *hdr;
+        uint32_t flags;
+
+        off = tail & (ring->sz - 1);
+        hdr = (mnl4c_ring_hdr_t *)(ring->data + off);
+        if ((flags = __atomic_load_n(&hdr->flags, __ATOMIC_ACQUIRE)) == 0) {
+            break;
+        }
+        if (flags & MNL4C_RING_PAD) {
+            tail += ring->sz - off;
+        } else {
+            cb(udata, (const char *)(hdr + 1), hdr->len);
+            tail += RING_ALIGN(sizeof(mnl4c_ring_hdr_t) + hdr->len);
+        }
+    }
+}
+
+
+mnl4c_async_t *
+mnl4c_async_new(mnl4c_writer_t *writer,
+                pthread_mutex_t *wmtx,
+                ssize_t bsbufsz)
+{
+    mnl4c_async_t *res;
+    size_t sz;
+
+    assert(writer->flushv != NULL);
+
+    if (posix_memalign((void **)&res,
+                       MNL4C_CACHELINE,
+                       sizeof(mnl4c_async_t)) != 0) {
+        FAIL("posix_memalign");
+    }
+
+    /* leave room for a few full buffers in flight */
+    for (sz = MNL4C_RING_MIN_SZ; sz < (size_t)bsbufsz * 8; sz <<= 1) {
+        ;
+    }
+    ring_init(&res->ring, sz);
+    res->writer = writer;
+    res->wmtx = wmtx;
+    if ((res->iov = malloc(sizeof(struct iovec) * MNL4C_IOV_MAX)) == NULL) {
+        FAIL("malloc");
+    }
+    if (pthread_mutex_init(&res->mtx, NULL) != 0) {
+        FAIL("pthread_mutex_init");
+    }
+    if (pthread_cond_init(&res->cond, NULL) != 0) {
+        FAIL("pthread_cond_init");
+    }
+    res->sleeping = 0;
+    res->shutdown = 0;
+    if (pthread_create(&res->thread, NULL, async_worker, res) != 0) {
+        FAIL("pthread_create");
+    }
+    return res;
+}
+
+
+void
+mnl4c_async_destroy(mnl4c_async_t **pasync)
+{
+    if (*pasync != NULL) {
+        (void)pthread_mutex_lock(&(*pasync)->mtx);
+        (*pasync)->shutdown = 1;
+        (void)pthread_cond_signal(&(*pasync)->cond);
+        (void)pthread_mutex_unlock(&(*pasync)->mtx);
+        (void)pthread_join((*pasync)->thread, NULL);
+
+        ring_fini(&(*pasync)->ring);
+        free((*pasync)->iov);
+        (void)pthread_cond_destroy(&(*pasync)->cond);
+        (void)pthread_mutex_destroy(&(*pasync)->mtx);
+        free(*pasync);
+        *pasync = NULL;
+    }
+}
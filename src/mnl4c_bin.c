@@ -0,0 +1,121 @@
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <mncommon/bytestream.h>
+#include <mncommon/dumpm.h>
+#include <mncommon/util.h>
+
+#include <mnl4c.h>
+#include "l4cfmt.h"
+
+
+#define BIN_PUT(bs, ty, v)                                     \
+    do {                                                       \
+        ty _bin_v = (ty)(v);                                   \
+        (void)bytestream_cat(bs, sizeof(ty), (char *)&_bin_v); \
+    } while (0)                                                \
+
+
+/*
+ * Appends a binary record to bs.  The arguments are taken as described
+ * by sig, one l4cfmt signature code per va_arg(), and stored in their
+ * native width.  Strings are stored as a uint32_t length followed by the
+ * bytes, UINT32_MAX stands for NULL.  A sampled record, sample_n over 1,
+ * has it stored ahead of the arguments.
+ */
+void
+mnl4c_bin_write(mnbytestream_t *bs,
+                int64_t curtm,
+                pid_t pid,
+                int level,
+                int id,
+                unsigned flags,
+                int nthrottled,
+                unsigned sample_n,
+                const char *sig,
+                ...)
+{
+    va_list ap;
+    off_t off;
+    mnl4c_bin_hdr_t hdr;
+
+    off = SEOD(bs);
+    hdr.id = id;
+    hdr.level = level;
+    hdr.flags = MNL4C_BIN_FMAGIC | flags;
+    if (sample_n > 1) {
+        hdr.flags |= MNL4C_BIN_FSAMPLED;
+    }
+    hdr.pid = pid;
+    hdr.nthrottled = nthrottled;
+    hdr.ts = curtm;
+    (void)bytestream_cat(bs, sizeof(hdr), (char *)&hdr);
+    if (sample_n > 1) {
+        BIN_PUT(bs, uint32_t, sample_n);
+    }
+
+    va_start(ap, sig);
+    for (; *sig != '\0'; ++sig) {
+        switch (*sig) {
+        case L4CFMT_SIG_INT:
+            BIN_PUT(bs, int32_t, va_arg(ap, int));
+            break;
+
+        case L4CFMT_SIG_LONG:
+            BIN_PUT(bs, int64_t, va_arg(ap, long));
+            break;
+
+        case L4CFMT_SIG_LLONG:
+            BIN_PUT(bs, int64_t, va_arg(ap, long long));
+            break;
+
+        case L4CFMT_SIG_INTMAX:
+            BIN_PUT(bs, int64_t, va_arg(ap, intmax_t));
+            break;
+
+        case L4CFMT_SIG_SIZE:
+            BIN_PUT(bs, int64_t, va_arg(ap, size_t));
+            break;
+
+        case L4CFMT_SIG_PTRDIFF:
+            BIN_PUT(bs, int64_t, va_arg(ap, ptrdiff_t));
+            break;
+
+        case L4CFMT_SIG_DOUBLE:
+            BIN_PUT(bs, double, va_arg(ap, double));
+            break;
+
+        case L4CFMT_SIG_LDOUBLE:
+            BIN_PUT(bs, long double, va_arg(ap, long double));
+            break;
+
+        case L4CFMT_SIG_PTR:
+            BIN_PUT(bs, uint64_t, (uintptr_t)va_arg(ap, void *));
+            break;
+
+        case L4CFMT_SIG_STR:
+            {
+                const char *s;
+
+                if ((s = va_arg(ap, const char *)) == NULL) {
+                    BIN_PUT(bs, uint32_t, UINT32_MAX);
+                } else {
+                    size_t sz;
+
+                    sz = strlen(s);
+                    BIN_PUT(bs, uint32_t, sz);
+                    (void)bytestream_cat(bs, sz, s);
+                }
+            }
+            break;
+
+        default:
+            FAIL("mnl4c_bin_write");
+        }
+    }
+    va_end(ap);
+
+    hdr.len = SEOD(bs) - off - sizeof(hdr);
+    memcpy(SDATA(bs, off), &hdr.len, sizeof(hdr.len));
+}
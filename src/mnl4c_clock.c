@@ -0,0 +1,135 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <mncommon/dumpm.h>
+#include <mncommon/util.h>
+
+#include <mnl4c.h>
+#include "mnl4c_private.h"
+
+
+#define TSC_CALIBRATION_NSEC (20l * 1000l * 1000l)
+
+int64_t mnl4c_clock_tick_ns;
+mnl4c_tsc_t mnl4c_clock_tsc;
+
+#if defined(__x86_64__)
+static pthread_once_t tsc_once = PTHREAD_ONCE_INIT;
+#endif
+static pthread_mutex_t tick_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tick_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t tick_thread;
+static bool tick_running;
+static bool tick_shutdown;
+
+
+#if defined(__x86_64__)
+static void
+tsc_calibrate(void)
+{
+    struct timespec ts;
+    uint64_t tsc0, tsc1;
+    int64_t ns0, ns1;
+    unsigned __int128 mult;
+
+    ns0 = mnl4c_clock_realtime();
+    tsc0 = mnl4c_rdtsc();
+    ts.tv_sec = 0;
+    ts.tv_nsec = TSC_CALIBRATION_NSEC;
+    (void)nanosleep(&ts, NULL);
+    tsc1 = mnl4c_rdtsc();
+    ns1 = mnl4c_clock_realtime();
+
+    mult = (unsigned __int128)(ns1 - ns0) << 32;
+    mnl4c_clock_tsc.mult = (uint64_t)(mult / (tsc1 - tsc0));
+    mnl4c_clock_tsc.tsc = tsc1;
+    mnl4c_clock_tsc.ns = ns1;
+}
+#endif
+
+
+static void *
+tick_worker(UNUSED void *udata)
+{
+    (void)pthread_mutex_lock(&tick_mtx);
+    while (!tick_shutdown) {
+        struct timespec ts;
+
+        __atomic_store_n(&mnl4c_clock_tick_ns,
+                         mnl4c_clock_realtime(),
+                         __ATOMIC_RELAXED);
+        (void)clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += MNL4C_CLOCK_TICK_NSEC;
+        if (ts.tv_nsec >= 1000000000l) {
+            ++ts.tv_sec;
+            ts.tv_nsec -= 1000000000l;
+        }
+        (void)pthread_cond_timedwait(&tick_cond, &tick_mtx, &ts);
+    }
+    (void)pthread_mutex_unlock(&tick_mtx);
+    return NULL;
+}
+
+
+/*
+ * Gets clock ready for use by loggers: calibrates the TSC once, or
+ * starts the shared tick thread.
+ */
+int
+mnl4c_clock_start(int clock)
+{
+    switch (clock) {
+    case MNL4C_CLOCK_REALTIME:
+        break;
+
+    case MNL4C_CLOCK_COARSE:
+#ifndef CLOCK_REALTIME_COARSE
+        return -1;
+#endif
+        break;
+
+    case MNL4C_CLOCK_TICK:
+        (void)pthread_mutex_lock(&tick_mtx);
+        if (!tick_running) {
+            /* never hand out a zero timestamp */
+            mnl4c_clock_tick_ns = mnl4c_clock_realtime();
+            tick_shutdown = false;
+            if (pthread_create(&tick_thread, NULL, tick_worker, NULL) != 0) {
+                FAIL("pthread_create");
+            }
+            tick_running = true;
+        }
+        (void)pthread_mutex_unlock(&tick_mtx);
+        break;
+
+    case MNL4C_CLOCK_TSC:
+#if defined(__x86_64__)
+        (void)pthread_once(&tsc_once, tsc_calibrate);
+        break;
+#else
+        return -1;
+#endif
+
+    default:
+        return -1;
+    }
+
+    return 0;
+}
+
+
+void
+mnl4c_clock_fini(void)
+{
+    (void)pthread_mutex_lock(&tick_mtx);
+    if (tick_running) {
+        tick_shutdown = true;
+        (void)pthread_cond_signal(&tick_cond);
+        (void)pthread_mutex_unlock(&tick_mtx);
+        (void)pthread_join(tick_thread, NULL);
+        tick_running = false;
+    } else {
+        (void)pthread_mutex_unlock(&tick_mtx);
+    }
+}
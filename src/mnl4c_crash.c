@@ -0,0 +1,328 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <mncommon/dumpm.h>
+#include <mncommon/util.h>
+
+#include <mnl4c.h>
+#include "mnl4c_private.h"
+
+/*
+ * The handlers write out what loggers have pending, and then hand the
+ * signal over to whatever handled it before.  Nothing in here takes a
+ * lock or allocates memory.
+ */
+static const int crash_signals[] = {
+    SIGSEGV,
+    SIGBUS,
+    SIGILL,
+    SIGFPE,
+    SIGABRT,
+};
+static struct sigaction crash_oldact[countof(crash_signals)];
+static bool crash_installed;
+/* 0, 1 while flushing, 2 once done */
+static int crash_state;
+static void *crash_stack;
+
+static int crash_sidecar_fd = -1;
+static mnl4c_sidecar_hdr_t *crash_sidecar;
+static size_t crash_sidecar_mapsz;
+static uint64_t crash_sidecar_start;
+
+
+/*
+ * write(2), or pwrite(2) when off is not negative, of all of buf.  A
+ * descriptor that would block is given MNL4C_CRASH_WAIT_MSEC.
+ */
+ssize_t
+mnl4c_crash_write(int fd, const char *buf, size_t sz, off_t off)
+{
+    size_t total;
+
+    total = 0;
+    while (total < sz) {
+        ssize_t n;
+
+        if (off < 0) {
+            n = write(fd, buf + total, sz - total);
+        } else {
+            n = pwrite(fd, buf + total, sz - total, off + (off_t)total);
+        }
+        if (n > 0) {
+            total += n;
+
+        } else if (n < 0 && errno == EINTR) {
+            /* continue */
+
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct pollfd pfd;
+
+            pfd.fd = fd;
+            pfd.events = POLLOUT;
+            if (poll(&pfd, 1, MNL4C_CRASH_WAIT_MSEC) <= 0) {
+                break;
+            }
+
+        } else {
+            break;
+        }
+    }
+    return (ssize_t)total;
+}
+
+
+void
+mnl4c_crash_sidecar_begin(void)
+{
+    if (crash_sidecar != NULL) {
+        crash_sidecar_start = crash_sidecar->head;
+    }
+}
+
+
+void
+mnl4c_crash_sidecar_put(const char *buf, size_t sz)
+{
+    char *ring;
+
+    if (crash_sidecar == NULL) {
+        return;
+    }
+    ring = (char *)(crash_sidecar + 1);
+    if (sz > crash_sidecar->sz) {
+        /* only the tail survives anyway */
+        crash_sidecar->head += sz - crash_sidecar->sz;
+        buf += sz - crash_sidecar->sz;
+        sz = crash_sidecar->sz;
+    }
+    while (sz > 0) {
+        size_t off, n;
+
+        off = crash_sidecar->head % crash_sidecar->sz;
+        n = MIN(sz, crash_sidecar->sz - off);
+        memcpy(ring + off, buf, n);
+        crash_sidecar->head += n;
+        buf += n;
+        sz -= n;
+    }
+}
+
+
+void
+mnl4c_crash_sidecar_end(int ld, unsigned ty)
+{
+    mnl4c_sidecar_trl_t trl;
+
+    if (crash_sidecar == NULL ||
+        crash_sidecar->head == crash_sidecar_start) {
+        return;
+    }
+    trl.len = (uint32_t)(crash_sidecar->head - crash_sidecar_start);
+    trl.ld = ld;
+    trl.ty = ty;
+    trl.magic = MNL4C_SIDECAR_TMAGIC;
+    mnl4c_crash_sidecar_put((const char *)&trl, sizeof(trl));
+}
+
+
+static void
+crash_handler(int sig, siginfo_t *info, UNUSED void *uctx)
+{
+    int state;
+    unsigned i;
+
+    state = 0;
+    if (__atomic_compare_exchange_n(&crash_state,
+                                    &state,
+                                    1,
+                                    false,
+                                    __ATOMIC_ACQ_REL,
+                                    __ATOMIC_ACQUIRE)) {
+        if (crash_sidecar != NULL) {
+            struct timespec ts;
+
+            (void)clock_gettime(CLOCK_REALTIME, &ts);
+            crash_sidecar->ts = (int64_t)ts.tv_sec * 1000000000l + ts.tv_nsec;
+            crash_sidecar->pid = (int32_t)getpid();
+            crash_sidecar->sig = sig;
+        }
+        mnl4c_crash_flush_all();
+        __atomic_store_n(&crash_state, 2, __ATOMIC_RELEASE);
+
+    } else {
+        struct timespec ts;
+
+        /* another thread crashed first, let it finish */
+        ts.tv_sec = 0;
+        ts.tv_nsec = 10l * 1000l * 1000l;
+        for (i = 0;
+             i < MNL4C_CRASH_WAIT_MSEC / 10 &&
+             __atomic_load_n(&crash_state, __ATOMIC_ACQUIRE) != 2;
+             ++i) {
+            (void)nanosleep(&ts, NULL);
+        }
+    }
+
+    for (i = 0; i < countof(crash_signals); ++i) {
+        if (crash_signals[i] == sig) {
+            (void)sigaction(sig, &crash_oldact[i], NULL);
+            break;
+        }
+    }
+    /*
+     * A fault comes back as soon as the handler returns, a signal that was
+     * sent has to be sent again.
+     */
+    if (info == NULL || info->si_code <= 0) {
+        (void)raise(sig);
+    }
+}
+
+
+static int
+crash_sidecar_open(const char *path, size_t sz)
+{
+    mnl4c_sidecar_hdr_t hdr;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) >= 0) {
+        /* keep what the last crash left */
+        if (read(fd, &hdr, sizeof(hdr)) == (ssize_t)sizeof(hdr) &&
+            memcmp(hdr.magic, MNL4C_SIDECAR_MAGIC, sizeof(hdr.magic)) == 0 &&
+            hdr.head > 0) {
+            char buf[PATH_MAX];
+            int n;
+
+            n = snprintf(buf,
+                         sizeof(buf),
+                         "%s.%ld",
+                         path,
+                         (long)(hdr.ts / 1000000000l));
+            if (n > 0 && (size_t)n < sizeof(buf)) {
+                (void)rename(path, buf);
+            }
+        }
+        (void)close(fd);
+    }
+
+    if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+        return -1;
+    }
+    crash_sidecar_mapsz = sizeof(mnl4c_sidecar_hdr_t) + sz;
+    if (ftruncate(fd, (off_t)crash_sidecar_mapsz) != 0) {
+        (void)close(fd);
+        return -1;
+    }
+    if ((crash_sidecar = mmap(NULL,
+                              crash_sidecar_mapsz,
+                              PROT_READ | PROT_WRITE,
+                              MAP_SHARED,
+                              fd,
+                              0)) == MAP_FAILED) {
+        crash_sidecar = NULL;
+        (void)close(fd);
+        return -1;
+    }
+    memcpy(crash_sidecar->magic,
+           MNL4C_SIDECAR_MAGIC,
+           sizeof(crash_sidecar->magic));
+    crash_sidecar->sz = sz;
+    crash_sidecar->head = 0;
+    crash_sidecar->ts = 0;
+    crash_sidecar->pid = (int32_t)getpid();
+    crash_sidecar->sig = 0;
+    crash_sidecar_fd = fd;
+    return 0;
+}
+
+
+static void
+crash_sidecar_close(void)
+{
+    if (crash_sidecar != NULL) {
+        (void)munmap(crash_sidecar, crash_sidecar_mapsz);
+        crash_sidecar = NULL;
+        crash_sidecar_mapsz = 0;
+    }
+    if (crash_sidecar_fd >= 0) {
+        (void)close(crash_sidecar_fd);
+        crash_sidecar_fd = -1;
+    }
+}
+
+
+/*
+ * Installs the handlers, or replaces the sidecar if they are already in
+ * place.  The calling thread gets an alternate stack, so that a stack
+ * overflow can be handled there.
+ */
+int
+mnl4c_crash_install(const char *sidecar, size_t sz)
+{
+    struct sigaction act;
+    unsigned i;
+
+    crash_sidecar_close();
+    if (sidecar != NULL && crash_sidecar_open(sidecar, sz) != 0) {
+        return -1;
+    }
+
+    if (crash_installed) {
+        return 0;
+    }
+
+    if ((crash_stack = malloc(MNL4C_CRASH_STACK_SZ)) == NULL) {
+        FAIL("malloc");
+    } else {
+        stack_t ss;
+
+        ss.ss_sp = crash_stack;
+        ss.ss_size = MNL4C_CRASH_STACK_SZ;
+        ss.ss_flags = 0;
+        (void)sigaltstack(&ss, NULL);
+    }
+
+    memset(&act, 0, sizeof(act));
+    act.sa_sigaction = crash_handler;
+    act.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    (void)sigemptyset(&act.sa_mask);
+    for (i = 0; i < countof(crash_signals); ++i) {
+        if (sigaction(crash_signals[i], &act, &crash_oldact[i]) != 0) {
+            return -1;
+        }
+    }
+    crash_installed = true;
+    return 0;
+}
+
+
+void
+mnl4c_crash_fini(void)
+{
+    if (crash_installed) {
+        stack_t ss;
+        unsigned i;
+
+        for (i = 0; i < countof(crash_signals); ++i) {
+            (void)sigaction(crash_signals[i], &crash_oldact[i], NULL);
+        }
+        memset(&ss, 0, sizeof(ss));
+        ss.ss_flags = SS_DISABLE;
+        (void)sigaltstack(&ss, NULL);
+        free(crash_stack);
+        crash_stack = NULL;
+        crash_installed = false;
+    }
+    crash_sidecar_close();
+}
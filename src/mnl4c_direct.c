@@ -0,0 +1,354 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mncommon/dumpm.h>
+#include <mncommon/util.h>
+
+#include <mnl4c.h>
+#include "mnl4c_private.h"
+
+/*
+ * MNL4C_OPEN_DIRECT.  Records are gathered in buf[cur], which starts at
+ * the aligned file offset off.  Whole blocks of it are handed to a
+ * thread of its own, one write at a time, and once it is full the other
+ * buffer is filled while it is being written.  The unaligned tail is
+ * only written, padded, when the file is left, and the padding is cut
+ * off then.
+ */
+#define DIRECT_ALIGN_DOWN(n) ((n) & ~((size_t)MNL4C_DIRECT_ALIGN - 1))
+#define DIRECT_ALIGN_UP(n) DIRECT_ALIGN_DOWN((n) + MNL4C_DIRECT_ALIGN - 1)
+
+typedef struct _mnl4c_direct_job {
+    int fd;
+    const char *buf;
+    size_t sz;
+    off_t off;
+} mnl4c_direct_job_t;
+
+struct _mnl4c_direct {
+    pthread_t thread;
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+    /* under mtx */
+    mnl4c_direct_job_t job;
+    bool busy;
+    bool shutdown;
+    int fd;
+    char *buf[2];
+    int cur;
+    off_t off;
+    size_t fill;
+    /* bytes of buf[cur] already handed to the thread */
+    size_t sent;
+    /* bytes that could not be written */
+    size_t ndropped;
+};
+
+
+/*
+ * Returns the number of bytes written before an error.
+ */
+static size_t
+direct_pwrite(int fd, const char *buf, size_t sz, off_t off)
+{
+    size_t done;
+
+    done = 0;
+    while (done < sz) {
+        ssize_t nwritten;
+
+        if ((nwritten = pwrite(fd,
+                               buf + done,
+                               sz - done,
+                               off + (off_t)done)) <= 0) {
+            if (nwritten < 0 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        done += (size_t)nwritten;
+    }
+    return done;
+}
+
+
+static void
+direct_dropped(mnl4c_direct_t *direct, size_t sz, off_t off)
+{
+    TRACE("lost %zu bytes at %ld", sz, (long)off);
+    (void)__atomic_add_fetch(&direct->ndropped, sz, __ATOMIC_RELAXED);
+}
+
+
+static void *
+direct_worker(void *udata)
+{
+    mnl4c_direct_t *direct;
+
+    direct = udata;
+    (void)pthread_mutex_lock(&direct->mtx);
+    while (true) {
+        mnl4c_direct_job_t job;
+        size_t done;
+
+        while (!direct->busy && !direct->shutdown) {
+            (void)pthread_cond_wait(&direct->cond, &direct->mtx);
+        }
+        if (!direct->busy) {
+            break;
+        }
+        job = direct->job;
+        (void)pthread_mutex_unlock(&direct->mtx);
+
+        if ((done = direct_pwrite(job.fd,
+                                  job.buf,
+                                  job.sz,
+                                  job.off)) < job.sz) {
+            direct_dropped(direct, job.sz - done, job.off + (off_t)done);
+        }
+
+        (void)pthread_mutex_lock(&direct->mtx);
+        direct->busy = false;
+        (void)pthread_cond_broadcast(&direct->cond);
+    }
+    (void)pthread_mutex_unlock(&direct->mtx);
+    return NULL;
+}
+
+
+static void
+direct_wait(mnl4c_direct_t *direct)
+{
+    (void)pthread_mutex_lock(&direct->mtx);
+    while (direct->busy) {
+        (void)pthread_cond_wait(&direct->cond, &direct->mtx);
+    }
+    (void)pthread_mutex_unlock(&direct->mtx);
+}
+
+
+/*
+ * Hands buf[cur] from sent to end over to the thread, once it is done
+ * with the previous write.
+ */
+static void
+direct_submit(mnl4c_direct_t *direct, size_t end)
+{
+    (void)pthread_mutex_lock(&direct->mtx);
+    while (direct->busy) {
+        (void)pthread_cond_wait(&direct->cond, &direct->mtx);
+    }
+    direct->job.fd = direct->fd;
+    direct->job.buf = direct->buf[direct->cur] + direct->sent;
+    direct->job.sz = end - direct->sent;
+    direct->job.off = direct->off + (off_t)direct->sent;
+    direct->busy = true;
+    (void)pthread_cond_broadcast(&direct->cond);
+    (void)pthread_mutex_unlock(&direct->mtx);
+    direct->sent = end;
+}
+
+
+/*
+ * Writes the tail padded to a whole block, and cuts the padding off.
+ */
+static void
+direct_finish(mnl4c_direct_t *direct)
+{
+    direct_wait(direct);
+    if (direct->fill > direct->sent) {
+        size_t padded, done;
+        char *buf;
+
+        buf = direct->buf[direct->cur];
+        padded = DIRECT_ALIGN_UP(direct->fill);
+        memset(buf + direct->fill, '\0', padded - direct->fill);
+        done = direct_pwrite(direct->fd,
+                             buf + direct->sent,
+                             padded - direct->sent,
+                             direct->off + (off_t)direct->sent);
+        if (done < direct->fill - direct->sent) {
+            direct_dropped(direct,
+                           direct->fill - direct->sent - done,
+                           direct->off + (off_t)(direct->sent + done));
+        }
+        if (ftruncate(direct->fd,
+                      direct->off + (off_t)direct->fill) != 0) {
+            TRACE("ftruncate failed");
+        }
+    }
+    direct->fd = -1;
+    direct->off = 0;
+    direct->fill = 0;
+    direct->sent = 0;
+}
+
+
+mnl4c_direct_t *
+mnl4c_direct_new(void)
+{
+    mnl4c_direct_t *res;
+    int i;
+
+    if ((res = malloc(sizeof(mnl4c_direct_t))) == NULL) {
+        FAIL("malloc");
+    }
+    for (i = 0; i < 2; ++i) {
+        if (posix_memalign((void **)&res->buf[i],
+                           MNL4C_DIRECT_ALIGN,
+                           MNL4C_DIRECT_BUFSZ) != 0) {
+            FAIL("posix_memalign");
+        }
+    }
+    res->cur = 0;
+    res->fd = -1;
+    res->off = 0;
+    res->fill = 0;
+    res->sent = 0;
+    res->ndropped = 0;
+    res->busy = false;
+    res->shutdown = false;
+    if (pthread_mutex_init(&res->mtx, NULL) != 0) {
+        FAIL("pthread_mutex_init");
+    }
+    if (pthread_cond_init(&res->cond, NULL) != 0) {
+        FAIL("pthread_cond_init");
+    }
+    if (pthread_create(&res->thread, NULL, direct_worker, res) != 0) {
+        FAIL("pthread_create");
+    }
+    return res;
+}
+
+
+/*
+ * Leaves the current file, if any, and goes on with fd, or with nothing
+ * if fd is -1.  The unaligned tail of the cursz bytes in fd is read
+ * back, it is written again along with the block it belongs to.
+ */
+int
+mnl4c_direct_set_fd(mnl4c_direct_t *direct, int fd, size_t cursz)
+{
+    if (direct->fd >= 0) {
+        direct_finish(direct);
+    }
+    if (fd < 0) {
+        return 0;
+    }
+    direct->fd = fd;
+    direct->off = (off_t)DIRECT_ALIGN_DOWN(cursz);
+    direct->fill = cursz - (size_t)direct->off;
+    direct->sent = 0;
+    if (direct->fill > 0) {
+        if (pread(fd,
+                  direct->buf[direct->cur],
+                  MNL4C_DIRECT_ALIGN,
+                  direct->off) != (ssize_t)direct->fill) {
+            direct->fd = -1;
+            direct->fill = 0;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+void
+mnl4c_direct_append(mnl4c_direct_t *direct, const char *buf, size_t sz)
+{
+    while (sz > 0) {
+        size_t n;
+
+        n = MIN(sz, MNL4C_DIRECT_BUFSZ - direct->fill);
+        memcpy(direct->buf[direct->cur] + direct->fill, buf, n);
+        direct->fill += n;
+        buf += n;
+        sz -= n;
+        if (direct->fill == MNL4C_DIRECT_BUFSZ) {
+            /* written while the other one is being filled */
+            direct_submit(direct, MNL4C_DIRECT_BUFSZ);
+            direct->cur ^= 1;
+            direct->off += MNL4C_DIRECT_BUFSZ;
+            direct->fill = 0;
+            direct->sent = 0;
+        }
+    }
+}
+
+
+/*
+ * At the end of a flush, the whole blocks gathered so far go to the file.
+ */
+void
+mnl4c_direct_sync(mnl4c_direct_t *direct)
+{
+    size_t head;
+
+    head = DIRECT_ALIGN_DOWN(direct->fill);
+    if (head > direct->sent) {
+        direct_submit(direct, head);
+    }
+}
+
+
+size_t
+mnl4c_direct_dropped(mnl4c_direct_t *direct)
+{
+    return __atomic_load_n(&direct->ndropped, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Runs in the crash handler: the write in flight, and buf[cur] as it is,
+ * are written once more without O_DIRECT, the same bytes at the same
+ * offsets.  The file then ends at the last record, and unaligned writes
+ * may follow.
+ */
+void
+mnl4c_direct_crash(mnl4c_direct_t *direct)
+{
+    int flags;
+
+    if (direct->fd < 0) {
+        return;
+    }
+    if ((flags = fcntl(direct->fd, F_GETFL)) != -1) {
+        (void)fcntl(direct->fd, F_SETFL, flags & ~O_DIRECT);
+    }
+    if (direct->busy) {
+        (void)mnl4c_crash_write(direct->job.fd,
+                                direct->job.buf,
+                                direct->job.sz,
+                                direct->job.off);
+    }
+    if (direct->fill > 0) {
+        (void)mnl4c_crash_write(direct->fd,
+                                direct->buf[direct->cur],
+                                direct->fill,
+                                direct->off);
+    }
+}
+
+
+void
+mnl4c_direct_destroy(mnl4c_direct_t **pdirect)
+{
+    if (*pdirect != NULL) {
+        (void)mnl4c_direct_set_fd(*pdirect, -1, 0);
+        (void)pthread_mutex_lock(&(*pdirect)->mtx);
+        (*pdirect)->shutdown = true;
+        (void)pthread_cond_broadcast(&(*pdirect)->cond);
+        (void)pthread_mutex_unlock(&(*pdirect)->mtx);
+        (void)pthread_join((*pdirect)->thread, NULL);
+        (void)pthread_cond_destroy(&(*pdirect)->cond);
+        (void)pthread_mutex_destroy(&(*pdirect)->mtx);
+        free((*pdirect)->buf[0]);
+        free((*pdirect)->buf[1]);
+        free(*pdirect);
+        *pdirect = NULL;
+    }
+}
@@ -0,0 +1,204 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <mncommon/dumpm.h>
+#include <mncommon/util.h>
+
+#include <mnl4c.h>
+#include "mnl4c_private.h"
+
+/*
+ * A hashed timer wheel run by a single housekeeping thread.  A timer sits
+ * in the slot of its deadline tick, possibly a few rounds ahead.  The
+ * thread sleeps until the next slot that has timers, and fires those of
+ * them that are due in that tick.  A timer is taken off the wheel and
+ * fired with hk_mtx released, so arming a timer never waits for whatever
+ * I/O a callback does.
+ */
+#define WHEEL_MASK (MNL4C_WHEEL_SLOTS - 1)
+
+static pthread_mutex_t hk_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hk_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t hk_thread;
+static bool hk_running;
+static bool hk_shutdown;
+static mnl4c_timer_t *wheel[MNL4C_WHEEL_SLOTS];
+/* the last tick that was run */
+static int64_t wheel_tick;
+/* the timer being fired, off the wheel */
+static mnl4c_timer_t *hk_firing;
+static pthread_cond_t hk_fired_cond = PTHREAD_COND_INITIALIZER;
+
+
+static void
+wheel_insert(mnl4c_timer_t *timer)
+{
+    int64_t tick;
+    mnl4c_timer_t **slot;
+
+    /* an overdue timer goes to the next tick, not a round later */
+    tick = MAX(timer->deadline / MNL4C_WHEEL_TICK_NSEC, wheel_tick + 1);
+    timer->slot = (int)(tick & WHEEL_MASK);
+    slot = &wheel[timer->slot];
+    timer->prev = NULL;
+    if ((timer->next = *slot) != NULL) {
+        timer->next->prev = timer;
+    }
+    *slot = timer;
+}
+
+
+static void
+wheel_remove(mnl4c_timer_t *timer)
+{
+    if (timer->prev != NULL) {
+        timer->prev->next = timer->next;
+    } else {
+        wheel[timer->slot] = timer->next;
+    }
+    if (timer->next != NULL) {
+        timer->next->prev = timer->prev;
+    }
+    timer->next = NULL;
+    timer->prev = NULL;
+}
+
+
+static void
+wheel_run_slot(int64_t tick, int64_t now)
+{
+    while (true) {
+        mnl4c_timer_t *timer;
+        int64_t deadline;
+
+        for (timer = wheel[tick & WHEEL_MASK];
+             timer != NULL;
+             timer = timer->next) {
+            if (timer->deadline / MNL4C_WHEEL_TICK_NSEC <= tick) {
+                break;
+            }
+            /* a later round */
+        }
+        if (timer == NULL) {
+            break;
+        }
+        wheel_remove(timer);
+        timer->armed = false;
+        hk_firing = timer;
+        (void)pthread_mutex_unlock(&hk_mtx);
+        deadline = timer->fire(timer, now);
+        (void)pthread_mutex_lock(&hk_mtx);
+        hk_firing = NULL;
+        if (deadline >= 0) {
+            if (!timer->armed) {
+                timer->deadline = deadline;
+                timer->armed = true;
+                wheel_insert(timer);
+            } else if (deadline < timer->deadline) {
+                /* armed again meanwhile, the earlier of the two wins */
+                wheel_remove(timer);
+                timer->deadline = deadline;
+                wheel_insert(timer);
+            }
+        }
+        (void)pthread_cond_broadcast(&hk_fired_cond);
+    }
+}
+
+
+static void *
+hk_worker(UNUSED void *udata)
+{
+    (void)pthread_mutex_lock(&hk_mtx);
+    while (!hk_shutdown) {
+        int64_t now, tick, t;
+
+        now = mnl4c_clock_realtime();
+        tick = now / MNL4C_WHEEL_TICK_NSEC;
+        /* no more than a round to catch up on, it visits every slot */
+        for (t = MAX(wheel_tick + 1, tick - WHEEL_MASK); t <= tick; ++t) {
+            wheel_tick = t;
+            wheel_run_slot(t, now);
+        }
+
+        for (t = tick + 1; t <= tick + MNL4C_WHEEL_SLOTS; ++t) {
+            if (wheel[t & WHEEL_MASK] != NULL) {
+                break;
+            }
+        }
+        if (t > tick + MNL4C_WHEEL_SLOTS) {
+            (void)pthread_cond_wait(&hk_cond, &hk_mtx);
+        } else {
+            struct timespec ts;
+
+            ts.tv_sec = (t * MNL4C_WHEEL_TICK_NSEC) / 1000000000l;
+            ts.tv_nsec = (t * MNL4C_WHEEL_TICK_NSEC) % 1000000000l;
+            (void)pthread_cond_timedwait(&hk_cond, &hk_mtx, &ts);
+        }
+    }
+    (void)pthread_mutex_unlock(&hk_mtx);
+    return NULL;
+}
+
+
+/*
+ * (Re)schedules timer to fire at deadline, nsec since the Epoch.  Starts
+ * the housekeeping thread on first use.
+ */
+void
+mnl4c_timer_arm(mnl4c_timer_t *timer, int64_t deadline)
+{
+    (void)pthread_mutex_lock(&hk_mtx);
+    if (!hk_running) {
+        wheel_tick = mnl4c_clock_realtime() / MNL4C_WHEEL_TICK_NSEC - 1;
+        hk_shutdown = false;
+        if (pthread_create(&hk_thread, NULL, hk_worker, NULL) != 0) {
+            FAIL("pthread_create");
+        }
+        hk_running = true;
+    }
+    if (timer->armed) {
+        wheel_remove(timer);
+    }
+    timer->deadline = deadline;
+    timer->armed = true;
+    wheel_insert(timer);
+    (void)pthread_cond_signal(&hk_cond);
+    (void)pthread_mutex_unlock(&hk_mtx);
+}
+
+
+/*
+ * The timer does not fire after this returns, nor is it still firing.
+ * Not to be called from a callback.
+ */
+void
+mnl4c_timer_disarm(mnl4c_timer_t *timer)
+{
+    (void)pthread_mutex_lock(&hk_mtx);
+    while (hk_firing == timer) {
+        (void)pthread_cond_wait(&hk_fired_cond, &hk_mtx);
+    }
+    if (timer->armed) {
+        wheel_remove(timer);
+        timer->armed = false;
+    }
+    (void)pthread_mutex_unlock(&hk_mtx);
+}
+
+
+void
+mnl4c_housekeep_fini(void)
+{
+    (void)pthread_mutex_lock(&hk_mtx);
+    if (hk_running) {
+        hk_shutdown = true;
+        (void)pthread_cond_signal(&hk_cond);
+        (void)pthread_mutex_unlock(&hk_mtx);
+        (void)pthread_join(hk_thread, NULL);
+        hk_running = false;
+    } else {
+        (void)pthread_mutex_unlock(&hk_mtx);
+    }
+}
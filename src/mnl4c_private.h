@@ -1,10 +1,251 @@
 #ifndef MNL4C_PRIVATE_H_DEFINED
 #define MNL4C_PRIVATE_H_DEFINED
 
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include <mncommon/bytestream.h>
+
+#include <mnl4c.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+#define MNL4C_CACHELINE 64
+
+#ifdef IOV_MAX
+#   define MNL4C_IOV_MAX IOV_MAX
+#else
+#   define MNL4C_IOV_MAX 1024
+#endif
+
+/* iovecs at a time to hand the records of a buffer to a sink */
+#define MNL4C_SINK_IOV 64
+
+/*
+ * Multi-producer/single-consumer byte ring.  Producers reserve space by
+ * advancing head, copy their record behind a header and publish it by
+ * setting the header flags.  The only consumer walks from tail, and
+ * clears headers before it releases the space back to producers.
+ */
+#define MNL4C_RING_MIN_SZ (1024 * 1024)
+typedef struct _mnl4c_ring_hdr {
+    uint32_t len;
+#define MNL4C_RING_COMMITTED    0x01
+#define MNL4C_RING_PAD          0x02
+    uint32_t flags;
+} mnl4c_ring_hdr_t;
+
+typedef struct _mnl4c_ring {
+    uint64_t head __attribute__((aligned(MNL4C_CACHELINE)));
+    uint64_t tail __attribute__((aligned(MNL4C_CACHELINE)));
+    char *data __attribute__((aligned(MNL4C_CACHELINE)));
+    size_t sz;
+} mnl4c_ring_t;
+
+
+/*
+ * where a record starts in a thread's buffer, its level, and the time of
+ * the ctx in nsec
+ */
+typedef struct _mnl4c_mark {
+    off_t off;
+    int level;
+    int64_t ts;
+} mnl4c_mark_t;
+
+
+/*
+ * A thread's formatting buffer for one ctx, kept under ctx->bskey.
+ */
+typedef struct _mnl4c_tls {
+    mnbytestream_t bs;
+    /*
+     * the owner's nesting depth while it uses bs, or MNL4C_TLS_HK while
+     * the housekeeping thread flushes it, see mnl4c_ctx_bs()
+     */
+    unsigned busy;
+    /* the records in bs, while ctx->marking, see mnl4c_ctx_mark() */
+    mnl4c_mark_t *marks;
+    size_t nmarks;
+    size_t szmarks;
+    /* weakref */
+    mnl4c_ctx_t *ctx;
+    struct _mnl4c_tls *next;
+    struct _mnl4c_tls *prev;
+} mnl4c_tls_t;
+
+
+typedef struct _mnl4c_async {
+    mnl4c_ring_t ring;
+    /* weakref */
+    mnl4c_writer_t *writer;
+    /* weakref, serializes writer flushes with housekeeping */
+    pthread_mutex_t *wmtx;
+    /* owned by the writer thread */
+    struct iovec *iov;
+    pthread_t thread;
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+    int sleeping;
+    int shutdown;
+} mnl4c_async_t;
+
+/*
+ * MNL4C_OPEN_URING
+ */
+#define MNL4C_URING_NBUFS 4
+typedef struct _mnl4c_uring mnl4c_uring_t;
+
+mnl4c_uring_t *mnl4c_uring_new(size_t);
+void mnl4c_uring_set_fd(mnl4c_uring_t *, int);
+ssize_t mnl4c_uring_writev(mnl4c_uring_t *,
+                           const struct iovec *,
+                           int,
+                           off_t);
+size_t mnl4c_uring_dropped(mnl4c_uring_t *);
+void mnl4c_uring_destroy(mnl4c_uring_t **);
+
+/*
+ * MNL4C_OPEN_DIRECT
+ */
+#define MNL4C_DIRECT_ALIGN 4096
+#define MNL4C_DIRECT_BUFSZ (1024 * 1024)
+#ifndef O_DIRECT
+/* still aligned writes, through the page cache */
+#define O_DIRECT 0
+#endif
+typedef struct _mnl4c_direct mnl4c_direct_t;
+
+mnl4c_direct_t *mnl4c_direct_new(void);
+int mnl4c_direct_set_fd(mnl4c_direct_t *, int, size_t);
+void mnl4c_direct_append(mnl4c_direct_t *, const char *, size_t);
+void mnl4c_direct_sync(mnl4c_direct_t *);
+size_t mnl4c_direct_dropped(mnl4c_direct_t *);
+void mnl4c_direct_crash(mnl4c_direct_t *);
+void mnl4c_direct_destroy(mnl4c_direct_t **);
+
+/*
+ * MNL4C_OPEN_NONBLOCK, msec to wait for the overflow queue on close
+ */
+#define MNL4C_OVERFLOW_DRAIN_TIMEOUT 1000
+
+/*
+ * background work on closed shadow files
+ */
+#define MNL4C_SHADOW_MAXWORKERS 4
+#define MNL4C_MANIFEST_SUFFIX ".manifest"
+typedef struct _mnl4c_manifest mnl4c_manifest_t;
+
+mnl4c_manifest_t *mnl4c_manifest_new(const char *, size_t);
+void mnl4c_manifest_add(mnl4c_manifest_t *, const char *);
+void mnl4c_manifest_set_retention(mnl4c_manifest_t *, size_t, size_t);
+void mnl4c_manifest_decref(mnl4c_manifest_t **);
+int mnl4c_shadow_codec_check(int);
+void mnl4c_shadow_submit(mnl4c_manifest_t *, const char *, size_t, int, int);
+void mnl4c_shadow_fini(void);
+
+/*
+ * MNL4C_OPEN_ZSTD, the level is low since it runs on the flushing thread
+ */
+#define MNL4C_ZFRAME_LEVEL 1
+typedef struct _mnl4c_zframe mnl4c_zframe_t;
+
+mnl4c_zframe_t *mnl4c_zframe_new(int);
+ssize_t mnl4c_zframe_encode(mnl4c_zframe_t *,
+                            const struct iovec *,
+                            int,
+                            const char **);
+void mnl4c_zframe_destroy(mnl4c_zframe_t **);
+
+/*
+ * MNL4C_OPEN_SYSLOG, messages to a sendmmsg(), and the level of those
+ * that were not marked
+ */
+#define MNL4C_SYSLOG_PATH "/dev/log"
+#define MNL4C_SYSLOG_BATCH 64
+#define MNL4C_SYSLOG_LEVEL LOG_INFO
+typedef struct _mnl4c_syslog mnl4c_syslog_t;
+
+mnl4c_syslog_t *mnl4c_syslog_new(const char *, const char *, int, bool);
+void mnl4c_syslog_send(mnl4c_syslog_t *,
+                       const char *,
+                       size_t,
+                       const mnl4c_mark_t *,
+                       size_t,
+                       int);
+void mnl4c_syslog_crash(mnl4c_syslog_t *, const char *, size_t);
+size_t mnl4c_syslog_dropped(mnl4c_syslog_t *);
+void mnl4c_syslog_destroy(mnl4c_syslog_t **);
+
+/*
+ * MNL4C_OPEN_JSON, MNL4C_OPEN_LOGFMT
+ */
+void mnl4c_struct_summary(mnl4c_ctx_t *,
+                          mnbytestream_t *,
+                          int64_t,
+                          int,
+                          const char *,
+                          int,
+                          int64_t);
+
+/*
+ * generated serializers, buf takes 20 bytes
+ */
+size_t mnl4c_ser_utoa(char *, uint64_t);
+
+/*
+ * housekeeping timers, nsec since the Epoch
+ */
+#define MNL4C_TLS_HK 0x80000000u
+#define MNL4C_WHEEL_SLOTS 256
+#define MNL4C_WHEEL_TICK_NSEC (10l * 1000l * 1000l)
+/* how often housekeeping looks for suppression windows while throttling */
+#define MNL4C_THROTTLE_POLL_NSEC (100l * 1000l * 1000l)
+typedef struct _mnl4c_timer {
+    struct _mnl4c_timer *next;
+    struct _mnl4c_timer *prev;
+    int slot;
+    bool armed;
+    int64_t deadline;
+    /* runs on the housekeeping thread, returns the next deadline or -1 */
+    int64_t (*fire)(struct _mnl4c_timer *, int64_t);
+    void *udata;
+} mnl4c_timer_t;
+
+void mnl4c_timer_arm(mnl4c_timer_t *, int64_t);
+void mnl4c_timer_disarm(mnl4c_timer_t *);
+void mnl4c_housekeep_fini(void);
+
+/*
+ * crash time flush, everything here is async-signal-safe
+ */
+#define MNL4C_CRASH_WAIT_MSEC 1000
+#define MNL4C_CRASH_STACK_SZ (64 * 1024)
+int mnl4c_crash_install(const char *, size_t);
+void mnl4c_crash_fini(void);
+ssize_t mnl4c_crash_write(int, const char *, size_t, off_t);
+void mnl4c_crash_sidecar_begin(void);
+void mnl4c_crash_sidecar_put(const char *, size_t);
+void mnl4c_crash_sidecar_end(int, unsigned);
+void mnl4c_crash_flush_all(void);
+void mnl4c_zframe_crash(int, const char *, size_t);
+void mnl4c_async_crash(mnl4c_async_t *,
+                       void (*)(void *, const char *, size_t),
+                       void *);
+
+int mnl4c_clock_start(int);
+void mnl4c_clock_fini(void);
+
+mnl4c_async_t *mnl4c_async_new(mnl4c_writer_t *,
+                                pthread_mutex_t *,
+                                ssize_t);
+void mnl4c_async_destroy(mnl4c_async_t **);
+void mnl4c_async_put(mnl4c_async_t *, const char *, size_t);
+
 #ifdef __cplusplus
 }
 #endif
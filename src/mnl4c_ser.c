@@ -0,0 +1,213 @@
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <mncommon/bytestream.h>
+#include <mncommon/dumpm.h>
+#include <mncommon/util.h>
+
+#include <mnl4c.h>
+#include "mnl4c_private.h"
+
+/*
+ * Conversions of the per-message serializers generated by l4cdefgen, see
+ * <lib>_<MOD>_<MSG>_nprintf() in <lib>-logdef.c.  The output is the same
+ * as printf() would produce for the specifications they stand for.
+ */
+static const char ser_digits[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const uint64_t ser_pow10[] = {
+    1ul,
+    10ul,
+    100ul,
+    1000ul,
+    10000ul,
+    100000ul,
+    1000000ul,
+    10000000ul,
+    100000000ul,
+    1000000000ul,
+};
+
+
+/*
+ * Renders v backwards from end, two digits at a time, and returns the
+ * position of its first digit.
+ */
+static char *
+ser_utoa_r(char *end, uint64_t v)
+{
+    while (v >= 100) {
+        unsigned i;
+
+        i = (unsigned)(v % 100) * 2;
+        v /= 100;
+        end -= 2;
+        end[0] = ser_digits[i];
+        end[1] = ser_digits[i + 1];
+    }
+    if (v >= 10) {
+        end -= 2;
+        end[0] = ser_digits[v * 2];
+        end[1] = ser_digits[v * 2 + 1];
+    } else {
+        *--end = (char)('0' + v);
+    }
+    return end;
+}
+
+
+/*
+ * buf must hold 20 bytes
+ */
+size_t
+mnl4c_ser_utoa(char *buf, uint64_t v)
+{
+    char tmp[20], *p;
+    size_t sz;
+
+    p = ser_utoa_r(tmp + sizeof(tmp), v);
+    sz = tmp + sizeof(tmp) - p;
+    memcpy(buf, p, sz);
+    return sz;
+}
+
+
+void
+mnl4c_ser_u64(mnbytestream_t *bs, uint64_t v)
+{
+    char buf[20], *p;
+
+    p = ser_utoa_r(buf + sizeof(buf), v);
+    (void)bytestream_cat(bs, buf + sizeof(buf) - p, p);
+}
+
+
+void
+mnl4c_ser_i64(mnbytestream_t *bs, int64_t v)
+{
+    char buf[21], *p;
+
+    if (v < 0) {
+        p = ser_utoa_r(buf + sizeof(buf), -(uint64_t)v);
+        *--p = '-';
+    } else {
+        p = ser_utoa_r(buf + sizeof(buf), (uint64_t)v);
+    }
+    (void)bytestream_cat(bs, buf + sizeof(buf) - p, p);
+}
+
+
+void
+mnl4c_ser_x64(mnbytestream_t *bs, uint64_t v, bool upper)
+{
+    const char *xdigits;
+    char buf[16], *p;
+
+    xdigits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    p = buf + sizeof(buf);
+    do {
+        *--p = xdigits[v & 0x0f];
+        v >>= 4;
+    } while (v != 0);
+    (void)bytestream_cat(bs, buf + sizeof(buf) - p, p);
+}
+
+
+/*
+ * %.<prec>f for prec up to 9.  The integral and the fractional parts are
+ * converted as integers, which is exact as long as the value is well
+ * within 2^53.  A fraction that lies too close to a rounding tie to tell,
+ * a larger or a non-finite value goes to printf().
+ */
+void
+mnl4c_ser_fixed(mnbytestream_t *bs, double v, int prec)
+{
+    char buf[40], *end, *p;
+    double a, scaled, rem;
+    uint64_t ip, fp;
+
+    a = fabs(v);
+    if (prec < 0 || prec >= (int)countof(ser_pow10) || !(a < 1e15)) {
+        goto fallback;
+    }
+    ip = (uint64_t)a;
+    /* exact */
+    scaled = (a - (double)ip) * (double)ser_pow10[prec];
+    fp = (uint64_t)scaled;
+    rem = scaled - (double)fp;
+    if (fabs(rem - 0.5) < 1e-6) {
+        goto fallback;
+    }
+    if (rem > 0.5 && ++fp == ser_pow10[prec]) {
+        fp = 0;
+        ++ip;
+    }
+
+    end = buf + sizeof(buf);
+    p = end;
+    if (prec > 0) {
+        p = ser_utoa_r(p, fp);
+        while (end - p < prec) {
+            *--p = '0';
+        }
+        *--p = '.';
+    }
+    p = ser_utoa_r(p, ip);
+    if (signbit(v)) {
+        *--p = '-';
+    }
+    (void)bytestream_cat(bs, end - p, p);
+    return;
+
+fallback:
+    MNL4C_SER_PRINTF(bs, 512, "%.*f", prec, v);
+}
+
+
+void
+mnl4c_ser_str(mnbytestream_t *bs, const char *s)
+{
+    if (s == NULL) {
+        /* as glibc does */
+        MNL4C_SER_LIT(bs, "(null)");
+    } else {
+        (void)bytestream_cat(bs, strlen(s), s);
+    }
+}
+
+
+void
+mnl4c_ser_chr(mnbytestream_t *bs, int c)
+{
+    char ch;
+
+    ch = (char)c;
+    (void)bytestream_cat(bs, 1, &ch);
+}
+
+
+/*
+ * Ends a serialized message that started at off the way
+ * bytestream_nprintf() does: cut at sz - 1 bytes, terminated with a NUL
+ * that eod is past.  Returns the number of bytes including the NUL.
+ */
+ssize_t
+mnl4c_ser_end(mnbytestream_t *bs, off_t off, size_t sz)
+{
+    if (sz > 0 && (size_t)(SEOD(bs) - off) >= sz) {
+        SADVANCEEOD(bs, off + (off_t)sz - 1 - SEOD(bs));
+    }
+    (void)bytestream_cat(bs, 1, "");
+    return SEOD(bs) - off;
+}
@@ -0,0 +1,778 @@
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <libgen.h> //dirname
+#include <limits.h> //PATH_MAX
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <mncommon/dumpm.h>
+#include <mncommon/traversedir.h>
+#include <mncommon/util.h>
+
+#include <mnl4c.h>
+#include "mnl4c_private.h"
+
+#include "config.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+
+#define SHADOW_IOBUFSZ (128 * 1024)
+#define SHADOW_TMP_SUFFIX ".tmp"
+
+/*
+ * Closed shadow files are compressed, and old ones removed, by a small
+ * pool of worker threads, so that rollover on the logging thread does
+ * not go beyond the open/symlink swap.  One worker is started with the
+ * first job, more are added while jobs queue up.
+ */
+typedef struct _shadow_job {
+    struct _shadow_job *next;
+    mnl4c_manifest_t *manifest;
+    /* a closed shadow file, or NULL */
+    char *shadow;
+    size_t shadowsz;
+    int compress;
+    int level;
+} shadow_job_t;
+
+/*
+ * The shadows of a logger, oldest first, with their sizes.  It is built
+ * by a directory scan only if <path>.manifest is not there, and is then
+ * kept up to date as shadows are created, closed, compressed and
+ * removed.  Retention works off it alone.
+ */
+typedef struct _mnl4c_manifest_entry {
+    char *name;
+    size_t sz;
+} mnl4c_manifest_entry_t;
+
+struct _mnl4c_manifest {
+    pthread_mutex_t mtx;
+    char *path;
+    char *mpath;
+    mnl4c_manifest_entry_t *entries;
+    size_t nentries;
+    size_t nalloc;
+    size_t totalsz;
+    size_t maxfiles;
+    size_t maxbytes;
+    int nref;
+    bool dirty;
+};
+
+static pthread_mutex_t shadow_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t shadow_cond = PTHREAD_COND_INITIALIZER;
+static shadow_job_t *shadow_head;
+static shadow_job_t *shadow_tail;
+static size_t shadow_nqueued;
+static int shadow_nidle;
+static int shadow_nworkers;
+static pthread_t shadow_workers[MNL4C_SHADOW_MAXWORKERS];
+static bool shadow_shutdown;
+
+
+static bool
+shadow_is_tmp(const char *name)
+{
+    size_t sz;
+
+    sz = strlen(name);
+    return sz > sizeof(SHADOW_TMP_SUFFIX) - 1 &&
+           strcmp(name + sz - (sizeof(SHADOW_TMP_SUFFIX) - 1),
+                  SHADOW_TMP_SUFFIX) == 0;
+}
+
+
+static void
+manifest_append(mnl4c_manifest_t *m, char *name, size_t sz)
+{
+    if (m->nentries == m->nalloc) {
+        size_t nalloc;
+
+        nalloc = m->nalloc > 0 ? m->nalloc * 2 : 16;
+        if ((m->entries = realloc(
+                m->entries,
+                sizeof(mnl4c_manifest_entry_t) * nalloc)) == NULL) {
+            FAIL("realloc");
+        }
+        m->nalloc = nalloc;
+    }
+    m->entries[m->nentries].name = name;
+    m->entries[m->nentries].sz = sz;
+    ++m->nentries;
+    m->totalsz += sz;
+    m->dirty = true;
+}
+
+
+static ssize_t
+manifest_find(mnl4c_manifest_t *m, const char *name)
+{
+    ssize_t i;
+
+    /* recent shadows are looked up most */
+    for (i = (ssize_t)m->nentries - 1; i >= 0; --i) {
+        if (strcmp(m->entries[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+static int
+manifest_load(mnl4c_manifest_t *m)
+{
+    FILE *f;
+    char buf[PATH_MAX + 32];
+    char tmp[PATH_MAX];
+    const char *dir;
+
+    if ((f = fopen(m->mpath, "r")) == NULL) {
+        return -1;
+    }
+    snprintf(tmp, sizeof(tmp), "%s", m->path);
+    dir = dirname(tmp);
+    while (fgets(buf, sizeof(buf), f) != NULL) {
+        char *name, *end;
+        size_t sz;
+
+        sz = (size_t)strtoull(buf, &name, 10);
+        if (*name != ' ' || (end = strchr(++name, '\n')) == NULL) {
+            TRACE("invalid manifest entry in %s", m->mpath);
+            continue;
+        }
+        *end = '\0';
+        if ((name = path_join(dir, name)) == NULL) {
+            FAIL("path_join");
+        }
+        manifest_append(m, name, sz);
+    }
+    (void)fclose(f);
+    m->dirty = false;
+    return 0;
+}
+
+
+static int
+_manifest_scan_cb(const char *path, struct dirent *de, void *udata)
+{
+    struct {
+        char pat[PATH_MAX];
+        mnl4c_manifest_t *m;
+    } *params = udata;
+
+    if (de != NULL) {
+        char *probe;
+
+        if ((probe = path_join(path, de->d_name)) == NULL) {
+            return 1;
+        }
+        if (fnmatch(params->pat, probe, FNM_PATHNAME | FNM_PERIOD) == 0 &&
+            !shadow_is_tmp(probe)) {
+            struct stat sb;
+
+            manifest_append(params->m,
+                            probe,
+                            stat(probe, &sb) == 0 ? (size_t)sb.st_size : 0);
+        } else {
+            free(probe);
+        }
+    }
+    return 0;
+}
+
+
+static int
+_manifest_scan_cmp(const void *a, const void *b)
+{
+    return strcmp(((const mnl4c_manifest_entry_t *)a)->name,
+                  ((const mnl4c_manifest_entry_t *)b)->name);
+}
+
+
+/*
+ * The one directory scan, for a logger that has no manifest yet.
+ */
+static void
+manifest_scan(mnl4c_manifest_t *m)
+{
+    char dir[PATH_MAX];
+    struct {
+        char pat[PATH_MAX];
+        mnl4c_manifest_t *m;
+    } params;
+
+    snprintf(dir, sizeof(dir), "%s", m->path);
+    snprintf(params.pat, sizeof(params.pat), "%s.[0-9][0-9]*", m->path);
+    params.m = m;
+    if (traverse_dir(dirname(dir), _manifest_scan_cb, &params) != 0) {
+        TRACE("traverse_dir() failed, could not scan shadows");
+    }
+    qsort(m->entries,
+          m->nentries,
+          sizeof(mnl4c_manifest_entry_t),
+          _manifest_scan_cmp);
+    m->dirty = true;
+}
+
+
+/*
+ * Rewrites <path>.manifest, entries are "<size> <basename>" lines.
+ */
+static void
+manifest_save(mnl4c_manifest_t *m)
+{
+    char tmp[PATH_MAX];
+    FILE *f;
+    size_t i;
+
+    if (snprintf(tmp, sizeof(tmp), "%s%s", m->mpath, SHADOW_TMP_SUFFIX) >=
+            (int)sizeof(tmp)) {
+        return;
+    }
+    if ((f = fopen(tmp, "w")) == NULL) {
+        TRACE("failed to create %s", tmp);
+        return;
+    }
+    for (i = 0; i < m->nentries; ++i) {
+        const char *base;
+
+        if ((base = strrchr(m->entries[i].name, '/')) == NULL) {
+            base = m->entries[i].name;
+        } else {
+            ++base;
+        }
+        fprintf(f, "%zu %s\n", m->entries[i].sz, base);
+    }
+    if (fclose(f) != 0 || rename(tmp, m->mpath) != 0) {
+        TRACE("failed to write %s", m->mpath);
+        (void)unlink(tmp);
+        return;
+    }
+    m->dirty = false;
+}
+
+
+mnl4c_manifest_t *
+mnl4c_manifest_new(const char *path, size_t maxfiles)
+{
+    mnl4c_manifest_t *res;
+
+    if ((res = malloc(sizeof(mnl4c_manifest_t))) == NULL) {
+        FAIL("malloc");
+    }
+    (void)pthread_mutex_init(&res->mtx, NULL);
+    if ((res->path = strdup(path)) == NULL) {
+        FAIL("strdup");
+    }
+    if ((res->mpath = malloc(strlen(path) + sizeof(MNL4C_MANIFEST_SUFFIX))) ==
+            NULL) {
+        FAIL("malloc");
+    }
+    strcpy(res->mpath, path);
+    strcat(res->mpath, MNL4C_MANIFEST_SUFFIX);
+    res->entries = NULL;
+    res->nentries = 0;
+    res->nalloc = 0;
+    res->totalsz = 0;
+    res->maxfiles = maxfiles;
+    res->maxbytes = 0;
+    res->nref = 1;
+    res->dirty = false;
+    if (manifest_load(res) != 0) {
+        manifest_scan(res);
+    }
+    return res;
+}
+
+
+/*
+ * Records a newly opened shadow, unless it is already the newest one.
+ * In memory only, the next job writes the manifest out.
+ */
+void
+mnl4c_manifest_add(mnl4c_manifest_t *m, const char *shadow)
+{
+    (void)pthread_mutex_lock(&m->mtx);
+    if (m->nentries == 0 ||
+        strcmp(m->entries[m->nentries - 1].name, shadow) != 0) {
+        char *name;
+
+        if ((name = strdup(shadow)) == NULL) {
+            FAIL("strdup");
+        }
+        manifest_append(m, name, 0);
+    }
+    (void)pthread_mutex_unlock(&m->mtx);
+}
+
+
+/*
+ * 0 means no limit
+ */
+void
+mnl4c_manifest_set_retention(mnl4c_manifest_t *m,
+                             size_t maxfiles,
+                             size_t maxbytes)
+{
+    (void)pthread_mutex_lock(&m->mtx);
+    m->maxfiles = maxfiles;
+    m->maxbytes = maxbytes;
+    (void)pthread_mutex_unlock(&m->mtx);
+}
+
+
+void
+mnl4c_manifest_decref(mnl4c_manifest_t **pm)
+{
+    if (*pm != NULL) {
+        if (__atomic_sub_fetch(&(*pm)->nref, 1, __ATOMIC_ACQ_REL) == 0) {
+            size_t i;
+
+            for (i = 0; i < (*pm)->nentries; ++i) {
+                free((*pm)->entries[i].name);
+            }
+            free((*pm)->entries);
+            free((*pm)->mpath);
+            free((*pm)->path);
+            (void)pthread_mutex_destroy(&(*pm)->mtx);
+            free(*pm);
+        }
+        *pm = NULL;
+    }
+}
+
+
+static void
+manifest_set_size(mnl4c_manifest_t *m, const char *shadow, size_t sz)
+{
+    ssize_t i;
+
+    (void)pthread_mutex_lock(&m->mtx);
+    if ((i = manifest_find(m, shadow)) >= 0) {
+        m->totalsz += sz - m->entries[i].sz;
+        m->entries[i].sz = sz;
+        m->dirty = true;
+    }
+    (void)pthread_mutex_unlock(&m->mtx);
+}
+
+
+/*
+ * Drops the oldest shadows while there are more than maxfiles of them,
+ * or they take more than maxbytes.  The newest one, open for writing,
+ * is always kept.
+ */
+static void
+shadow_retain(mnl4c_manifest_t *m)
+{
+    mnl4c_manifest_entry_t *victims;
+    size_t i, nvictims;
+
+    victims = NULL;
+    nvictims = 0;
+
+    (void)pthread_mutex_lock(&m->mtx);
+    while (nvictims + 1 < m->nentries &&
+           ((m->maxfiles > 0 && m->nentries - nvictims > m->maxfiles) ||
+            (m->maxbytes > 0 && m->totalsz > m->maxbytes))) {
+        m->totalsz -= m->entries[nvictims].sz;
+        ++nvictims;
+    }
+    if (nvictims > 0) {
+        if ((victims = malloc(sizeof(mnl4c_manifest_entry_t) * nvictims)) ==
+                NULL) {
+            FAIL("malloc");
+        }
+        memcpy(victims,
+               m->entries,
+               sizeof(mnl4c_manifest_entry_t) * nvictims);
+        memmove(m->entries,
+                m->entries + nvictims,
+                sizeof(mnl4c_manifest_entry_t) * (m->nentries - nvictims));
+        m->nentries -= nvictims;
+        m->dirty = true;
+    }
+    if (m->dirty) {
+        manifest_save(m);
+    }
+    (void)pthread_mutex_unlock(&m->mtx);
+
+    for (i = 0; i < nvictims; ++i) {
+        if (unlink(victims[i].name) != 0) {
+            TRACE("Failed to unlink %s while cleaninng up shadwos",
+                  victims[i].name);
+        }
+        free(victims[i].name);
+    }
+    free(victims);
+}
+
+
+#ifdef HAVE_ZSTD
+static int
+shadow_write_all(int fd, const char *buf, size_t sz)
+{
+    while (sz > 0) {
+        ssize_t nwritten;
+
+        if ((nwritten = write(fd, buf, sz)) <= 0) {
+            return -1;
+        }
+        buf += nwritten;
+        sz -= nwritten;
+    }
+    return 0;
+}
+#endif
+
+
+#ifdef HAVE_ZLIB
+static int
+shadow_gzip(int in, int out, int level, char *buf)
+{
+    gzFile gz;
+    char mode[8];
+    ssize_t nread;
+    int res;
+
+    snprintf(mode, sizeof(mode), "wb%d", level > 0 ? MIN(level, 9) : 6);
+    if ((gz = gzdopen(out, mode)) == NULL) {
+        (void)close(out);
+        return -1;
+    }
+    res = 0;
+    while ((nread = read(in, buf, SHADOW_IOBUFSZ)) > 0) {
+        if (gzwrite(gz, buf, (unsigned)nread) != (int)nread) {
+            res = -1;
+            break;
+        }
+    }
+    if (nread < 0) {
+        res = -1;
+    }
+    /* closes out */
+    if (gzclose(gz) != Z_OK) {
+        res = -1;
+    }
+    return res;
+}
+#endif
+
+
+#ifdef HAVE_ZSTD
+static int
+shadow_zstd(int in, int out, int level, char *buf)
+{
+    ZSTD_CCtx *cctx;
+    char *obuf;
+    size_t obufsz;
+    ssize_t nread;
+    int res;
+
+    if ((cctx = ZSTD_createCCtx()) == NULL) {
+        FAIL("ZSTD_createCCtx");
+    }
+    (void)ZSTD_CCtx_setParameter(cctx,
+                                 ZSTD_c_compressionLevel,
+                                 level > 0 ? level : 3);
+    obufsz = ZSTD_CStreamOutSize();
+    if ((obuf = malloc(obufsz)) == NULL) {
+        FAIL("malloc");
+    }
+
+    res = 0;
+    do {
+        ZSTD_inBuffer ib;
+        ZSTD_EndDirective mode;
+        size_t rem;
+
+        if ((nread = read(in, buf, SHADOW_IOBUFSZ)) < 0) {
+            res = -1;
+            break;
+        }
+        mode = nread == 0 ? ZSTD_e_end : ZSTD_e_continue;
+        ib.src = buf;
+        ib.size = (size_t)nread;
+        ib.pos = 0;
+        do {
+            ZSTD_outBuffer ob;
+
+            ob.dst = obuf;
+            ob.size = obufsz;
+            ob.pos = 0;
+            rem = ZSTD_compressStream2(cctx, &ob, &ib, mode);
+            if (ZSTD_isError(rem)) {
+                TRACE("zstd: %s", ZSTD_getErrorName(rem));
+                res = -1;
+                break;
+            }
+            if (shadow_write_all(out, obuf, ob.pos) != 0) {
+                res = -1;
+                break;
+            }
+        } while (mode == ZSTD_e_end ? rem != 0 : ib.pos < ib.size);
+    } while (res == 0 && nread > 0);
+
+    free(obuf);
+    (void)ZSTD_freeCCtx(cctx);
+    if (close(out) != 0) {
+        res = -1;
+    }
+    return res;
+}
+#endif
+
+
+static void
+shadow_compress(shadow_job_t *job)
+{
+    char dst[PATH_MAX];
+    char tmp[PATH_MAX];
+    struct stat sb;
+    char *buf;
+    const char *suffix;
+    int (*codec)(int, int, int, char *);
+    int in, out, res;
+    ssize_t i;
+
+    switch (job->compress) {
+#ifdef HAVE_ZLIB
+    case MNL4C_COMPRESS_GZIP:
+        suffix = ".gz";
+        codec = shadow_gzip;
+        break;
+#endif
+
+#ifdef HAVE_ZSTD
+    case MNL4C_COMPRESS_ZSTD:
+        suffix = ".zst";
+        codec = shadow_zstd;
+        break;
+#endif
+
+    default:
+        return;
+    }
+
+    if (snprintf(dst, sizeof(dst), "%s%s", job->shadow, suffix) >=
+            (int)sizeof(dst) ||
+        snprintf(tmp, sizeof(tmp), "%s%s", dst, SHADOW_TMP_SUFFIX) >=
+            (int)sizeof(tmp)) {
+        TRACE("path too long: %s", job->shadow);
+        return;
+    }
+    if ((in = open(job->shadow, O_RDONLY)) < 0) {
+        /* removed by retention meanwhile */
+        return;
+    }
+    if ((out = open(tmp,
+                    O_WRONLY | O_CREAT | O_TRUNC,
+                    MNL4C_FWRITER_DEFAULT_OPEN_MODE)) < 0) {
+        TRACE("failed to create %s", tmp);
+        (void)close(in);
+        return;
+    }
+    (void)posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+    if ((buf = malloc(SHADOW_IOBUFSZ)) == NULL) {
+        FAIL("malloc");
+    }
+    /* closes out */
+    res = codec(in, out, job->level, buf);
+    free(buf);
+    (void)close(in);
+
+    if (res != 0) {
+        TRACE("failed to compress %s", job->shadow);
+        (void)unlink(tmp);
+        return;
+    }
+    if (stat(tmp, &sb) != 0) {
+        sb.st_size = 0;
+    }
+    /* atomically for retention */
+    (void)pthread_mutex_lock(&job->manifest->mtx);
+    if ((i = manifest_find(job->manifest, job->shadow)) < 0) {
+        /* removed by retention meanwhile */
+        (void)unlink(tmp);
+
+    } else if (rename(tmp, dst) != 0) {
+        TRACE("failed to rename %s", tmp);
+        (void)unlink(tmp);
+
+    } else {
+        mnl4c_manifest_entry_t *e;
+
+        (void)unlink(job->shadow);
+        e = &job->manifest->entries[i];
+        free(e->name);
+        if ((e->name = strdup(dst)) == NULL) {
+            FAIL("strdup");
+        }
+        job->manifest->totalsz += (size_t)sb.st_size - e->sz;
+        e->sz = (size_t)sb.st_size;
+        job->manifest->dirty = true;
+    }
+    (void)pthread_mutex_unlock(&job->manifest->mtx);
+}
+
+
+static void
+shadow_job_destroy(shadow_job_t **job)
+{
+    free((*job)->shadow);
+    mnl4c_manifest_decref(&(*job)->manifest);
+    free(*job);
+    *job = NULL;
+}
+
+
+static void *
+shadow_worker(UNUSED void *udata)
+{
+    (void)pthread_mutex_lock(&shadow_mtx);
+    while (true) {
+        shadow_job_t *job;
+
+        while (shadow_head == NULL && !shadow_shutdown) {
+            ++shadow_nidle;
+            (void)pthread_cond_wait(&shadow_cond, &shadow_mtx);
+            --shadow_nidle;
+        }
+        if ((job = shadow_head) == NULL) {
+            /* shut down, and nothing is left */
+            break;
+        }
+        if ((shadow_head = job->next) == NULL) {
+            shadow_tail = NULL;
+        }
+        --shadow_nqueued;
+        (void)pthread_mutex_unlock(&shadow_mtx);
+
+        if (job->shadow != NULL) {
+            manifest_set_size(job->manifest, job->shadow, job->shadowsz);
+            if (job->compress != MNL4C_COMPRESS_NONE) {
+                shadow_compress(job);
+            }
+        }
+        /* also writes the manifest out */
+        shadow_retain(job->manifest);
+        shadow_job_destroy(&job);
+
+        (void)pthread_mutex_lock(&shadow_mtx);
+    }
+    (void)pthread_mutex_unlock(&shadow_mtx);
+    return NULL;
+}
+
+
+int
+mnl4c_shadow_codec_check(int compress)
+{
+    switch (compress) {
+    case MNL4C_COMPRESS_NONE:
+        return 0;
+
+#ifdef HAVE_ZLIB
+    case MNL4C_COMPRESS_GZIP:
+        return 0;
+#endif
+
+#ifdef HAVE_ZSTD
+    case MNL4C_COMPRESS_ZSTD:
+        return 0;
+#endif
+
+    default:
+        return -1;
+    }
+}
+
+
+/*
+ * Queues a job on the shadows of m: recording the final size of a
+ * closed shadow and compressing it (if shadow is not NULL), then
+ * retention.
+ */
+void
+mnl4c_shadow_submit(mnl4c_manifest_t *m,
+                    const char *shadow,
+                    size_t shadowsz,
+                    int compress,
+                    int level)
+{
+    shadow_job_t *job;
+
+    if ((job = malloc(sizeof(shadow_job_t))) == NULL) {
+        FAIL("malloc");
+    }
+    job->next = NULL;
+    (void)__atomic_add_fetch(&m->nref, 1, __ATOMIC_RELAXED);
+    job->manifest = m;
+    job->shadow = NULL;
+    if (shadow != NULL && (job->shadow = strdup(shadow)) == NULL) {
+        FAIL("strdup");
+    }
+    job->shadowsz = shadowsz;
+    job->compress = compress;
+    job->level = level;
+
+    (void)pthread_mutex_lock(&shadow_mtx);
+    if (shadow_tail == NULL) {
+        shadow_head = job;
+    } else {
+        shadow_tail->next = job;
+    }
+    shadow_tail = job;
+    ++shadow_nqueued;
+    if (shadow_nqueued > (size_t)shadow_nidle &&
+        shadow_nworkers < MNL4C_SHADOW_MAXWORKERS) {
+        /* a backlog, or no worker yet */
+        if (pthread_create(&shadow_workers[shadow_nworkers],
+                           NULL,
+                           shadow_worker,
+                           NULL) != 0) {
+            FAIL("pthread_create");
+        }
+        ++shadow_nworkers;
+    } else {
+        (void)pthread_cond_signal(&shadow_cond);
+    }
+    (void)pthread_mutex_unlock(&shadow_mtx);
+}
+
+
+/*
+ * Finishes all queued jobs and stops the workers.
+ */
+void
+mnl4c_shadow_fini(void)
+{
+    int i, nworkers;
+
+    (void)pthread_mutex_lock(&shadow_mtx);
+    shadow_shutdown = true;
+    (void)pthread_cond_broadcast(&shadow_cond);
+    nworkers = shadow_nworkers;
+    (void)pthread_mutex_unlock(&shadow_mtx);
+
+    for (i = 0; i < nworkers; ++i) {
+        (void)pthread_join(shadow_workers[i], NULL);
+    }
+
+    (void)pthread_mutex_lock(&shadow_mtx);
+    shadow_nworkers = 0;
+    shadow_shutdown = false;
+    (void)pthread_mutex_unlock(&shadow_mtx);
+}
@@ -0,0 +1,496 @@
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <mncommon/bytestream.h>
+#include <mncommon/dumpm.h>
+#include <mncommon/util.h>
+
+#include <mnl4c.h>
+#include "mnl4c_private.h"
+#include "l4cfmt.h"
+
+/*
+ * MNL4C_OPEN_JSON and MNL4C_OPEN_LOGFMT records.  Keys come ready-made:
+ * the level ones below, and the module, message and argument ones from
+ * the generated _JSON and _LOGFMT tables, so that only the values are
+ * rendered and escaped here.
+ */
+static const char *json_levels[] = {
+    ",\"level\":\"EMERG\"",
+    ",\"level\":\"ALERT\"",
+    ",\"level\":\"CRIT\"",
+    ",\"level\":\"ERROR\"",
+    ",\"level\":\"WARNING\"",
+    ",\"level\":\"NOTICE\"",
+    ",\"level\":\"INFO\"",
+    ",\"level\":\"DEBUG\"",
+};
+
+static const char *logfmt_levels[] = {
+    " level=EMERG",
+    " level=ALERT",
+    " level=CRIT",
+    " level=ERROR",
+    " level=WARNING",
+    " level=NOTICE",
+    " level=INFO",
+    " level=DEBUG",
+};
+
+
+#define STRUCT_CAT(bs, s) (void)bytestream_cat(bs, sizeof(s) - 1, s)
+
+
+/*
+ * Returns the offset of the first byte in s that cannot go into a value
+ * as it is: a control character, '"' or '\\', and for logfmt also ' '
+ * and '='.  Sixteen bytes at a time where SSE2 is available.
+ */
+static size_t
+struct_scan(const char *s, size_t sz, bool logfmt)
+{
+    size_t i;
+
+    i = 0;
+#ifdef __SSE2__
+    {
+        __m128i quote, bslash, ctl, eq;
+
+        quote = _mm_set1_epi8('"');
+        bslash = _mm_set1_epi8('\\');
+        /* ' ' is right above the control characters */
+        ctl = _mm_set1_epi8(logfmt ? ' ' : 0x1f);
+        eq = _mm_set1_epi8(logfmt ? '=' : '"');
+        for (; i + 16 <= sz; i += 16) {
+            __m128i v, m;
+            int mask;
+
+            v = _mm_loadu_si128((const __m128i *)(s + i));
+            m = _mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                                 _mm_cmpeq_epi8(v, bslash)),
+                    _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(v, ctl), v),
+                                 _mm_cmpeq_epi8(v, eq)));
+            if ((mask = _mm_movemask_epi8(m)) != 0) {
+                return i + __builtin_ctz(mask);
+            }
+        }
+    }
+#endif
+    for (; i < sz; ++i) {
+        unsigned char c;
+
+        c = (unsigned char)s[i];
+        if (c < 0x20 || c == '"' || c == '\\' ||
+            (logfmt && (c == ' ' || c == '='))) {
+            break;
+        }
+    }
+    return i;
+}
+
+
+/*
+ * Appends s escaped as the inside of a JSON string, which is also what
+ * goes between the quotes of a logfmt value.  NUL bytes are left out,
+ * bytestream_nprintf() leaves them behind in multi-part records.
+ */
+static void
+struct_escape(mnbytestream_t *bs, const char *s, size_t sz)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    while (sz > 0) {
+        size_t n;
+        char esc[6];
+
+        if ((n = struct_scan(s, sz, false)) > 0) {
+            (void)bytestream_cat(bs, n, s);
+        }
+        if (n == sz) {
+            break;
+        }
+        switch (s[n]) {
+        case '"':
+        case '\\':
+            esc[0] = '\\';
+            esc[1] = s[n];
+            (void)bytestream_cat(bs, 2, esc);
+            break;
+
+        case '\n':
+            STRUCT_CAT(bs, "\\n");
+            break;
+
+        case '\r':
+            STRUCT_CAT(bs, "\\r");
+            break;
+
+        case '\t':
+            STRUCT_CAT(bs, "\\t");
+            break;
+
+        case '\0':
+            break;
+
+        default:
+            esc[0] = '\\';
+            esc[1] = 'u';
+            esc[2] = '0';
+            esc[3] = '0';
+            esc[4] = hex[((unsigned char)s[n] >> 4) & 0x0f];
+            esc[5] = hex[(unsigned char)s[n] & 0x0f];
+            (void)bytestream_cat(bs, sizeof(esc), esc);
+            break;
+        }
+        s += n + 1;
+        sz -= n + 1;
+    }
+}
+
+
+static void
+struct_put_str(mnbytestream_t *bs, unsigned flags, const char *s, size_t sz)
+{
+    if ((flags & MNL4C_OPEN_LOGFMT) &&
+        sz > 0 &&
+        struct_scan(s, sz, true) == sz) {
+        (void)bytestream_cat(bs, sz, s);
+    } else {
+        STRUCT_CAT(bs, "\"");
+        struct_escape(bs, s, sz);
+        STRUCT_CAT(bs, "\"");
+    }
+}
+
+
+static void
+struct_put_int(mnbytestream_t *bs, int64_t v, bool sign)
+{
+    if (sign) {
+        mnl4c_ser_i64(bs, v);
+    } else {
+        mnl4c_ser_u64(bs, (uint64_t)v);
+    }
+}
+
+
+/*
+ * Non-finite numbers have no place in JSON.  A value too long for buf
+ * is given in %g instead.
+ */
+static void
+struct_put_double(mnbytestream_t *bs,
+                  unsigned flags,
+                  const char *spec,
+                  long double v,
+                  bool ld)
+{
+    char buf[128];
+    int n;
+
+    if ((flags & MNL4C_OPEN_JSON) && !isfinite(v)) {
+        STRUCT_CAT(bs, "null");
+        return;
+    }
+    n = ld ?
+        snprintf(buf, sizeof(buf), spec, v) :
+        snprintf(buf, sizeof(buf), spec, (double)v);
+    if (n < 0 || (size_t)n >= sizeof(buf)) {
+        n = ld ?
+            snprintf(buf, sizeof(buf), "%.21Lg", v) :
+            snprintf(buf, sizeof(buf), "%.17g", (double)v);
+    }
+    (void)bytestream_cat(bs, n, buf);
+}
+
+
+static void
+struct_put_kv(mnbytestream_t *bs, unsigned flags, const char *key, int64_t v)
+{
+    if (flags & MNL4C_OPEN_JSON) {
+        STRUCT_CAT(bs, ",\"");
+        (void)bytestream_cat(bs, strlen(key), key);
+        STRUCT_CAT(bs, "\":");
+    } else {
+        STRUCT_CAT(bs, " ");
+        (void)bytestream_cat(bs, strlen(key), key);
+        STRUCT_CAT(bs, "=");
+    }
+    struct_put_int(bs, v, true);
+}
+
+
+/*
+ * Starts a record with its timestamp, pid, level, the prefix of keys,
+ * and the throttling and sampling counts where there are any.  A text
+ * record is followed by an open msg value, and the offset of the text
+ * is returned for mnl4c_struct_end(), otherwise -1.
+ */
+off_t
+mnl4c_struct_begin(mnl4c_ctx_t *ctx,
+                   mnbytestream_t *bs,
+                   int64_t curtm,
+                   int level,
+                   int nthrottled,
+                   unsigned sample_n,
+                   const char *keys,
+                   bool text)
+{
+    char buf[64];
+    const char *l;
+    size_t sz;
+    unsigned usec;
+    int i;
+    bool json;
+
+    mnl4c_ctx_mark(ctx, bs, level);
+    json = ctx->flags & MNL4C_OPEN_JSON;
+    if (json) {
+        memcpy(buf, "{\"ts\":", 6);
+        sz = 6;
+    } else {
+        memcpy(buf, "ts=", 3);
+        sz = 3;
+    }
+    sz += mnl4c_ser_utoa(buf + sz, (uint64_t)(curtm / 1000000000l));
+    buf[sz++] = '.';
+    /* microseconds, as %.06lf has them */
+    usec = (unsigned)((curtm % 1000000000l) / 1000);
+    for (i = 6; i > 0; --i) {
+        buf[sz + i - 1] = (char)('0' + usec % 10);
+        usec /= 10;
+    }
+    sz += 6;
+    (void)bytestream_cat(bs, sz, buf);
+    struct_put_kv(bs, ctx->flags, "pid", ctx->cache.pid);
+
+    level = MIN(MAX(level, 0), (int)countof(json_levels) - 1);
+    l = json ? json_levels[level] : logfmt_levels[level];
+    (void)bytestream_cat(bs, strlen(l), l);
+    (void)bytestream_cat(bs, strlen(keys), keys);
+
+    if (nthrottled > 0) {
+        struct_put_kv(bs, ctx->flags, "throttled", nthrottled);
+    }
+    if (sample_n > 1) {
+        struct_put_kv(bs, ctx->flags, "sample", sample_n);
+    }
+    if (!text) {
+        return -1;
+    }
+    if (json) {
+        STRUCT_CAT(bs, ",\"msg\":\"");
+    } else {
+        STRUCT_CAT(bs, " msg=\"");
+    }
+    return SEOD(bs);
+}
+
+
+/*
+ * Appends the arguments as described by sig, each one after its key from
+ * the table.  Integers go in decimal whatever their conversion, floating
+ * point ones in theirs.
+ */
+void
+mnl4c_struct_fields(mnbytestream_t *bs,
+                    unsigned flags,
+                    const char *keys,
+                    const char *sig,
+                    ...)
+{
+    va_list ap;
+
+    /* skip the prefix */
+    keys += strlen(keys) + 1;
+
+    va_start(ap, sig);
+    for (; *sig != '\0' && *keys != '\0'; ++sig) {
+        const char *spec;
+        size_t sz;
+        bool sign;
+
+        spec = keys;
+        keys += strlen(keys) + 1;
+        sz = strlen(keys);
+        (void)bytestream_cat(bs, sz, keys);
+        keys += sz + 1;
+        sign = spec[1] == 'd' || spec[1] == 'i';
+
+        switch (*sig) {
+        case L4CFMT_SIG_INT:
+            if (spec[1] == 'c') {
+                char c;
+
+                c = (char)va_arg(ap, int);
+                struct_put_str(bs, flags, &c, 1);
+            } else if (sign) {
+                struct_put_int(bs, va_arg(ap, int), true);
+            } else {
+                struct_put_int(bs, va_arg(ap, unsigned), false);
+            }
+            break;
+
+        case L4CFMT_SIG_LONG:
+            if (sign) {
+                struct_put_int(bs, va_arg(ap, long), true);
+            } else {
+                struct_put_int(bs, va_arg(ap, unsigned long), false);
+            }
+            break;
+
+        case L4CFMT_SIG_LLONG:
+            if (sign) {
+                struct_put_int(bs, va_arg(ap, long long), true);
+            } else {
+                struct_put_int(bs, va_arg(ap, unsigned long long), false);
+            }
+            break;
+
+        case L4CFMT_SIG_INTMAX:
+            if (sign) {
+                struct_put_int(bs, va_arg(ap, intmax_t), true);
+            } else {
+                struct_put_int(bs, va_arg(ap, uintmax_t), false);
+            }
+            break;
+
+        case L4CFMT_SIG_SIZE:
+            if (sign) {
+                struct_put_int(bs, va_arg(ap, ssize_t), true);
+            } else {
+                struct_put_int(bs, va_arg(ap, size_t), false);
+            }
+            break;
+
+        case L4CFMT_SIG_PTRDIFF:
+            struct_put_int(bs, va_arg(ap, ptrdiff_t), sign);
+            break;
+
+        case L4CFMT_SIG_DOUBLE:
+            struct_put_double(bs, flags, spec, va_arg(ap, double), false);
+            break;
+
+        case L4CFMT_SIG_LDOUBLE:
+            struct_put_double(bs, flags, spec, va_arg(ap, long double), true);
+            break;
+
+        case L4CFMT_SIG_PTR:
+            {
+                char buf[32];
+                int n;
+
+                n = snprintf(buf, sizeof(buf), "%p", va_arg(ap, void *));
+                struct_put_str(bs, flags, buf, MAX(n, 0));
+            }
+            break;
+
+        case L4CFMT_SIG_STR:
+            {
+                const char *s;
+
+                if ((s = va_arg(ap, const char *)) != NULL) {
+                    struct_put_str(bs, flags, s, strlen(s));
+                } else if (flags & MNL4C_OPEN_JSON) {
+                    STRUCT_CAT(bs, "null");
+                }
+            }
+            break;
+
+        default:
+            FAIL("mnl4c_struct_fields");
+        }
+    }
+    va_end(ap);
+}
+
+
+/*
+ * Ends the record.  The text of a text record is escaped in place, which
+ * moves nothing unless there is something to escape.
+ */
+void
+mnl4c_struct_end(mnl4c_ctx_t *ctx, mnbytestream_t *bs, off_t off)
+{
+    if (off >= 0) {
+        size_t sz, n;
+
+        if (SEOD(bs) > off && *SDATA(bs, SEOD(bs) - 1) == '\0') {
+            SADVANCEPOS(bs, -1);
+        }
+        sz = SEOD(bs) - off;
+        if ((n = struct_scan(SDATA(bs, off), sz, false)) < sz) {
+            char buf[256], *tmp;
+
+            sz -= n;
+            if (sz <= sizeof(buf)) {
+                tmp = buf;
+            } else if ((tmp = malloc(sz)) == NULL) {
+                FAIL("malloc");
+            }
+            memcpy(tmp, SDATA(bs, off + n), sz);
+            SADVANCEPOS(bs, -(off_t)sz);
+            struct_escape(bs, tmp, sz);
+            if (tmp != buf) {
+                free(tmp);
+            }
+        }
+        if (ctx->flags & MNL4C_OPEN_JSON) {
+            STRUCT_CAT(bs, "\"}\n");
+        } else {
+            STRUCT_CAT(bs, "\"\n");
+        }
+    } else {
+        if (ctx->flags & MNL4C_OPEN_JSON) {
+            STRUCT_CAT(bs, "}\n");
+        } else {
+            STRUCT_CAT(bs, "\n");
+        }
+    }
+}
+
+
+/*
+ * The record of mnl4c_minfo_summary().  Only the message name is known
+ * here, its generated table is not.
+ */
+void
+mnl4c_struct_summary(mnl4c_ctx_t *ctx,
+                     mnbytestream_t *bs,
+                     int64_t now,
+                     int level,
+                     const char *name,
+                     int n,
+                     int64_t elapsed)
+{
+    char prefix[128];
+    char buf[32];
+    int sz;
+
+    if (ctx->flags & MNL4C_OPEN_JSON) {
+        sz = snprintf(prefix, sizeof(prefix), ",\"id\":\"%s\"", name);
+    } else {
+        sz = snprintf(prefix, sizeof(prefix), " id=%s", name);
+    }
+    if (sz < 0 || (size_t)sz >= sizeof(prefix)) {
+        prefix[0] = '\0';
+    }
+    (void)mnl4c_struct_begin(ctx, bs, now, level, 0, 0, prefix, false);
+    struct_put_kv(bs, ctx->flags, "suppressed", n);
+    sz = snprintf(buf,
+                  sizeof(buf),
+                  (ctx->flags & MNL4C_OPEN_JSON) ?
+                    ",\"window\":%.06lf" :
+                    " window=%.06lf",
+                  MNL4C_NSEC2SEC(elapsed));
+    (void)bytestream_cat(bs, MAX(sz, 0), buf);
+    mnl4c_struct_end(ctx, bs, -1);
+}
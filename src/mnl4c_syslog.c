@@ -0,0 +1,365 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <mncommon/dumpm.h>
+#include <mncommon/util.h>
+
+#include <mnl4c.h>
+#include "mnl4c_private.h"
+
+/*
+ * MNL4C_OPEN_SYSLOG.  Each record becomes one RFC 5424 message,
+ *
+ *      <PRI>1 TIMESTAMP HOSTNAME APP-NAME PROCID - - MSG
+ *
+ * sent over a connected AF_UNIX datagram socket, MNL4C_SYSLOG_BATCH of
+ * them to a sendmmsg().  Only the header is rendered, into hdr, the
+ * record is sent from the buffer it was formatted into.
+ */
+#define SYSLOG_HDR_SZ 384
+#define SYSLOG_HOSTNAME_MAX 255
+#define SYSLOG_APPNAME_MAX 48
+
+struct _mnl4c_syslog {
+    struct sockaddr_un addr;
+    int fd;
+    int facility;
+    bool nonblock;
+    /* " HOSTNAME APP-NAME PROCID - - " */
+    char tail[SYSLOG_HOSTNAME_MAX + SYSLOG_APPNAME_MAX + 32];
+    size_t tailsz;
+    /* "YYYY-MM-DDTHH:MM:SS" of tssec */
+    time_t tssec;
+    char tsstr[20];
+    unsigned n;
+    struct mmsghdr msgs[MNL4C_SYSLOG_BATCH];
+    struct iovec iov[MNL4C_SYSLOG_BATCH][2];
+    char hdr[MNL4C_SYSLOG_BATCH][SYSLOG_HDR_SZ];
+    size_t ndropped;
+};
+
+
+/*
+ * PRINTUSASCII without the space, at most sz bytes, "-" for nothing
+ */
+static size_t
+syslog_field(char *dst, const char *src, size_t sz)
+{
+    size_t i;
+
+    for (i = 0; src != NULL && src[i] != '\0' && i < sz; ++i) {
+        dst[i] = (src[i] > ' ' && src[i] < 127) ? src[i] : '_';
+    }
+    if (i == 0) {
+        dst[i++] = '-';
+    }
+    return i;
+}
+
+
+static int
+syslog_connect(mnl4c_syslog_t *sl)
+{
+    return connect(sl->fd,
+                   (struct sockaddr *)&sl->addr,
+                   sizeof(struct sockaddr_un));
+}
+
+
+mnl4c_syslog_t *
+mnl4c_syslog_new(const char *path,
+                 const char *ident,
+                 int facility,
+                 bool nonblock)
+{
+    mnl4c_syslog_t *res;
+    char host[SYSLOG_HOSTNAME_MAX + 1];
+    char *p;
+    unsigned i;
+
+    if (strlen(path) >= sizeof(res->addr.sun_path)) {
+        return NULL;
+    }
+    if ((res = malloc(sizeof(mnl4c_syslog_t))) == NULL) {
+        FAIL("malloc");
+    }
+    memset(&res->addr, '\0', sizeof(res->addr));
+    res->addr.sun_family = AF_UNIX;
+    strcpy(res->addr.sun_path, path);
+    if ((res->fd = socket(AF_UNIX,
+                          SOCK_DGRAM | SOCK_CLOEXEC |
+                            (nonblock ? SOCK_NONBLOCK : 0),
+                          0)) < 0) {
+        free(res);
+        return NULL;
+    }
+    if (syslog_connect(res) != 0) {
+        (void)close(res->fd);
+        free(res);
+        return NULL;
+    }
+    res->facility = facility;
+    res->nonblock = nonblock;
+
+    if (gethostname(host, sizeof(host)) != 0) {
+        host[0] = '\0';
+    }
+    host[sizeof(host) - 1] = '\0';
+    p = res->tail;
+    *p++ = ' ';
+    p += syslog_field(p, host, SYSLOG_HOSTNAME_MAX);
+    *p++ = ' ';
+    p += syslog_field(p, ident, SYSLOG_APPNAME_MAX);
+    *p++ = ' ';
+    p += mnl4c_ser_utoa(p, (uint64_t)getpid());
+    memcpy(p, " - - ", 5);
+    p += 5;
+    res->tailsz = p - res->tail;
+
+    res->tssec = (time_t)-1;
+    res->n = 0;
+    for (i = 0; i < MNL4C_SYSLOG_BATCH; ++i) {
+        memset(&res->msgs[i], '\0', sizeof(struct mmsghdr));
+        res->msgs[i].msg_hdr.msg_iov = res->iov[i];
+        res->msgs[i].msg_hdr.msg_iovlen = 2;
+        res->iov[i][0].iov_base = res->hdr[i];
+    }
+    res->ndropped = 0;
+    return res;
+}
+
+
+static void
+syslog_dropped(mnl4c_syslog_t *sl, size_t n)
+{
+    (void)__atomic_add_fetch(&sl->ndropped, n, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Sends what is batched.  A receiver that has gone away is connected to
+ * once more.  Messages the socket does not take are dropped.
+ */
+static void
+syslog_flush(mnl4c_syslog_t *sl)
+{
+    unsigned sent;
+    bool reconnected;
+
+    sent = 0;
+    reconnected = false;
+    while (sent < sl->n) {
+        int nsent;
+
+        if ((nsent = sendmmsg(sl->fd,
+                              sl->msgs + sent,
+                              sl->n - sent,
+                              sl->nonblock ? MSG_DONTWAIT : 0)) > 0) {
+            sent += (unsigned)nsent;
+            continue;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EMSGSIZE) {
+            /* this one alone */
+            syslog_dropped(sl, 1);
+            ++sent;
+            continue;
+        }
+        if (!reconnected &&
+            (errno == ECONNREFUSED ||
+             errno == ENOTCONN ||
+             errno == ECONNRESET)) {
+            reconnected = true;
+            if (syslog_connect(sl) == 0) {
+                continue;
+            }
+        }
+        /* EAGAIN under MNL4C_OPEN_NONBLOCK, or no receiver */
+        syslog_dropped(sl, sl->n - sent);
+        break;
+    }
+    sl->n = 0;
+}
+
+
+/*
+ * ts is in nsec since the Epoch, 0 for NILVALUE
+ */
+static void
+syslog_add(mnl4c_syslog_t *sl,
+           int level,
+           int64_t ts,
+           const char *msg,
+           size_t sz)
+{
+    char *p;
+
+    if (sz > 0 && msg[sz - 1] == '\n') {
+        --sz;
+    }
+    if (sz == 0) {
+        return;
+    }
+    if (sl->n == MNL4C_SYSLOG_BATCH) {
+        syslog_flush(sl);
+    }
+
+    p = sl->hdr[sl->n];
+    *p++ = '<';
+    p += mnl4c_ser_utoa(p, (uint64_t)(sl->facility | LOG_PRI(level)));
+    memcpy(p, ">1 ", 3);
+    p += 3;
+    if (ts > 0) {
+        time_t sec;
+        unsigned usec;
+        int i;
+
+        sec = (time_t)(ts / 1000000000l);
+        usec = (unsigned)((ts % 1000000000l) / 1000);
+        if (sec != sl->tssec) {
+            struct tm tm;
+
+            (void)gmtime_r(&sec, &tm);
+            (void)strftime(sl->tsstr,
+                           sizeof(sl->tsstr),
+                           "%Y-%m-%dT%H:%M:%S",
+                           &tm);
+            sl->tssec = sec;
+        }
+        memcpy(p, sl->tsstr, sizeof(sl->tsstr) - 1);
+        p += sizeof(sl->tsstr) - 1;
+        *p++ = '.';
+        for (i = 5; i >= 0; --i) {
+            p[i] = (char)('0' + usec % 10);
+            usec /= 10;
+        }
+        p += 6;
+        *p++ = 'Z';
+    } else {
+        *p++ = '-';
+    }
+    memcpy(p, sl->tail, sl->tailsz);
+    p += sl->tailsz;
+
+    sl->iov[sl->n][0].iov_len = p - sl->hdr[sl->n];
+    sl->iov[sl->n][1].iov_base = (void *)msg;
+    sl->iov[sl->n][1].iov_len = sz;
+    ++sl->n;
+}
+
+
+static void
+syslog_add_lines(mnl4c_syslog_t *sl, const char *buf, size_t sz)
+{
+    while (sz > 0) {
+        const char *nl;
+        size_t len;
+
+        len = (nl = memchr(buf, '\n', sz)) != NULL ? (size_t)(nl - buf) + 1 : sz;
+        syslog_add(sl, MNL4C_SYSLOG_LEVEL, 0, buf, len);
+        buf += len;
+        sz -= len;
+    }
+}
+
+
+/*
+ * The records of buf up to maxlevel, one message each, as told by marks.
+ * Without marks, each line goes at MNL4C_SYSLOG_LEVEL.
+ */
+void
+mnl4c_syslog_send(mnl4c_syslog_t *sl,
+                  const char *buf,
+                  size_t sz,
+                  const mnl4c_mark_t *marks,
+                  size_t nmarks,
+                  int maxlevel)
+{
+    size_t i;
+
+    if (nmarks == 0) {
+        syslog_add_lines(sl, buf, sz);
+    } else {
+        /* before the first record that has been marked */
+        syslog_add_lines(sl, buf, MIN((size_t)marks[0].off, sz));
+    }
+    for (i = 0; i < nmarks; ++i) {
+        size_t start, end;
+
+        start = (size_t)marks[i].off;
+        end = i + 1 < nmarks ? (size_t)marks[i + 1].off : sz;
+        end = MIN(end, sz);
+        if (marks[i].level > maxlevel || start >= end) {
+            continue;
+        }
+        syslog_add(sl, marks[i].level, marks[i].ts, buf + start, end - start);
+    }
+    syslog_flush(sl);
+}
+
+
+/*
+ * Runs in the crash handler, a message per line, one send() each.
+ */
+void
+mnl4c_syslog_crash(mnl4c_syslog_t *sl, const char *buf, size_t sz)
+{
+    char hdr[SYSLOG_HDR_SZ], *p;
+
+    p = hdr;
+    *p++ = '<';
+    p += mnl4c_ser_utoa(p,
+                        (uint64_t)(sl->facility |
+                                   LOG_PRI(MNL4C_SYSLOG_LEVEL)));
+    memcpy(p, ">1 -", 4);
+    p += 4;
+    memcpy(p, sl->tail, sl->tailsz);
+    p += sl->tailsz;
+
+    while (sz > 0) {
+        struct iovec iov[2];
+        struct msghdr msg;
+        const char *nl;
+        size_t len;
+
+        len = (nl = memchr(buf, '\n', sz)) != NULL ? (size_t)(nl - buf) : sz;
+        iov[0].iov_base = hdr;
+        iov[0].iov_len = p - hdr;
+        iov[1].iov_base = (void *)buf;
+        iov[1].iov_len = len;
+        memset(&msg, '\0', sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 2;
+        if (len > 0) {
+            (void)sendmsg(sl->fd, &msg, MSG_DONTWAIT);
+        }
+        len += nl != NULL;
+        buf += len;
+        sz -= len;
+    }
+}
+
+
+size_t
+mnl4c_syslog_dropped(mnl4c_syslog_t *sl)
+{
+    return __atomic_load_n(&sl->ndropped, __ATOMIC_RELAXED);
+}
+
+
+void
+mnl4c_syslog_destroy(mnl4c_syslog_t **psl)
+{
+    if (*psl != NULL) {
+        (void)close((*psl)->fd);
+        free(*psl);
+        *psl = NULL;
+    }
+}
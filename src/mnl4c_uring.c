@@ -0,0 +1,409 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mncommon/dumpm.h>
+#include <mncommon/util.h>
+
+#include <mnl4c.h>
+#include "mnl4c_private.h"
+
+#include "config.h"
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+
+/*
+ * The records of a flush are packed into the MNL4C_URING_NBUFS buffers
+ * registered with the ring, one write per buffer at the offset it was
+ * given, and submitted at once, so the caller can go on formatting while
+ * the writes are in flight.
+ */
+struct _mnl4c_uring {
+    struct io_uring ring;
+    struct iovec bufs[MNL4C_URING_NBUFS];
+    /* where, and how much of, bufs[i] is being written */
+    off_t off[MNL4C_URING_NBUFS];
+    size_t len[MNL4C_URING_NBUFS];
+    int free[MNL4C_URING_NBUFS];
+    int nfree;
+    /* submitted and not reaped yet */
+    int ninflight;
+    int fd;
+    bool fixed_bufs;
+    bool fixed_file;
+    /* io_uring_submit() failed, from then on it is plain pwrite() */
+    bool broken;
+    /* bytes that could not be written */
+    size_t ndropped;
+};
+
+
+/*
+ * Returns the number of bytes written before an error.
+ */
+static size_t
+uring_pwrite(int fd, const char *buf, size_t sz, off_t off)
+{
+    size_t done;
+
+    done = 0;
+    while (done < sz) {
+        ssize_t nwritten;
+
+        if ((nwritten = pwrite(fd,
+                               buf + done,
+                               sz - done,
+                               off + (off_t)done)) <= 0) {
+            if (nwritten < 0 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        done += (size_t)nwritten;
+    }
+    return done;
+}
+
+
+static void
+uring_dropped(mnl4c_uring_t *uring, size_t sz, off_t off)
+{
+    TRACE("lost %zu bytes at %ld", sz, (long)off);
+    (void)__atomic_add_fetch(&uring->ndropped, sz, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * A write that failed or came up short is finished with pwrite() from
+ * its buffer, which is left intact until then.
+ */
+static void
+uring_complete(mnl4c_uring_t *uring, int i, int res)
+{
+    size_t done;
+
+    done = res > 0 ? (size_t)res : 0;
+    if (MNUNLIKELY(done < uring->len[i])) {
+        if (res < 0) {
+            TRACE("io_uring write failed: %s", strerror(-res));
+        }
+        done += uring_pwrite(uring->fd,
+                             (char *)uring->bufs[i].iov_base + done,
+                             uring->len[i] - done,
+                             uring->off[i] + (off_t)done);
+        if (done < uring->len[i]) {
+            uring_dropped(uring,
+                          uring->len[i] - done,
+                          uring->off[i] + (off_t)done);
+        }
+    }
+    uring->free[uring->nfree++] = i;
+}
+
+
+static void
+uring_reap(mnl4c_uring_t *uring, bool wait)
+{
+    struct io_uring_cqe *cqe;
+
+    while (uring->ninflight > 0) {
+        int res;
+
+        if (wait) {
+            res = io_uring_wait_cqe(&uring->ring, &cqe);
+        } else {
+            res = io_uring_peek_cqe(&uring->ring, &cqe);
+        }
+        if (res != 0) {
+            break;
+        }
+        --uring->ninflight;
+        uring_complete(uring,
+                       (int)(uintptr_t)io_uring_cqe_get_data(cqe),
+                       cqe->res);
+        io_uring_cqe_seen(&uring->ring, cqe);
+        /* one completion is enough to go on */
+        wait = false;
+    }
+}
+
+
+static void
+uring_drain(mnl4c_uring_t *uring)
+{
+    while (uring->ninflight > 0) {
+        uring_reap(uring, true);
+    }
+}
+
+
+/*
+ * The n buffers in queued go with one io_uring_enter().  Should that
+ * fail, nothing has been taken by the kernel, and they are written with
+ * pwrite() here, as is everything after them.
+ */
+static void
+uring_submit(mnl4c_uring_t *uring, const int *queued, int n)
+{
+    int res;
+    int i;
+
+    while ((res = io_uring_submit(&uring->ring)) < 0) {
+        if (res == -EINTR) {
+            continue;
+        }
+        if ((res == -EAGAIN || res == -EBUSY) && uring->ninflight > 0) {
+            /* completions to be reaped first */
+            uring_reap(uring, true);
+            continue;
+        }
+        break;
+    }
+    if (MNLIKELY(res >= 0)) {
+        uring->ninflight += n;
+        return;
+    }
+
+    TRACE("io_uring_submit failed: %s", strerror(-res));
+    uring->broken = true;
+    for (i = 0; i < n; ++i) {
+        uring_complete(uring, queued[i], 0);
+    }
+}
+
+
+static void
+uring_prep(mnl4c_uring_t *uring, int i)
+{
+    struct io_uring_sqe *sqe;
+
+    if ((sqe = io_uring_get_sqe(&uring->ring)) == NULL) {
+        /* cannot happen, there are more sqes than buffers */
+        FAIL("io_uring_get_sqe");
+    }
+    if (uring->fixed_bufs) {
+        io_uring_prep_write_fixed(sqe,
+                                  uring->fixed_file ? 0 : uring->fd,
+                                  uring->bufs[i].iov_base,
+                                  uring->len[i],
+                                  uring->off[i],
+                                  i);
+    } else {
+        io_uring_prep_write(sqe,
+                            uring->fixed_file ? 0 : uring->fd,
+                            uring->bufs[i].iov_base,
+                            uring->len[i],
+                            uring->off[i]);
+    }
+    if (uring->fixed_file) {
+        io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+    }
+    io_uring_sqe_set_data(sqe, (void *)(uintptr_t)i);
+}
+
+
+mnl4c_uring_t *
+mnl4c_uring_new(size_t bufsz)
+{
+    mnl4c_uring_t *res;
+    int i;
+
+    if ((res = malloc(sizeof(mnl4c_uring_t))) == NULL) {
+        FAIL("malloc");
+    }
+    if (io_uring_queue_init(MNL4C_URING_NBUFS * 2, &res->ring, 0) != 0) {
+        free(res);
+        return NULL;
+    }
+    for (i = 0; i < MNL4C_URING_NBUFS; ++i) {
+        if ((res->bufs[i].iov_base = malloc(bufsz)) == NULL) {
+            FAIL("malloc");
+        }
+        res->bufs[i].iov_len = bufsz;
+        res->off[i] = 0;
+        res->len[i] = 0;
+        res->free[i] = i;
+    }
+    res->nfree = MNL4C_URING_NBUFS;
+    res->ninflight = 0;
+    res->fd = -1;
+    /* may fail under a low RLIMIT_MEMLOCK, plain writes will do then */
+    res->fixed_bufs = (io_uring_register_buffers(&res->ring,
+                                                 res->bufs,
+                                                 MNL4C_URING_NBUFS) == 0);
+    res->fixed_file = false;
+    res->broken = false;
+    res->ndropped = 0;
+    return res;
+}
+
+
+/*
+ * Waits for everything in flight, and switches to fd, or to nothing if
+ * fd is -1.  Called around closing the file on rollover.
+ */
+void
+mnl4c_uring_set_fd(mnl4c_uring_t *uring, int fd)
+{
+    uring_drain(uring);
+    if (uring->fixed_file) {
+        (void)io_uring_unregister_files(&uring->ring);
+        uring->fixed_file = false;
+    }
+    uring->fd = fd;
+    if (fd >= 0 && !uring->broken) {
+        uring->fixed_file = (io_uring_register_files(&uring->ring,
+                                                     &fd,
+                                                     1) == 0);
+    }
+}
+
+
+/*
+ * Writes the iovecs one after another from off on, returns the number of
+ * bytes taken, all of them unless they were counted as dropped.
+ */
+ssize_t
+mnl4c_uring_writev(mnl4c_uring_t *uring,
+                   const struct iovec *iov,
+                   int iovcnt,
+                   off_t off)
+{
+    int queued[MNL4C_URING_NBUFS];
+    int nqueued;
+    size_t total, iovoff;
+    int j;
+
+    uring_reap(uring, false);
+
+    nqueued = 0;
+    total = 0;
+    iovoff = 0;
+    j = 0;
+    while (j < iovcnt) {
+        size_t fill;
+        int i;
+
+        if (MNUNLIKELY(uring->broken)) {
+            size_t sz, done;
+
+            sz = iov[j].iov_len - iovoff;
+            done = uring_pwrite(uring->fd,
+                                (char *)iov[j].iov_base + iovoff,
+                                sz,
+                                off + (off_t)total);
+            if (done < sz) {
+                uring_dropped(uring, sz - done, off + (off_t)(total + done));
+            }
+            total += sz;
+            iovoff = 0;
+            ++j;
+            continue;
+        }
+
+        if (uring->nfree == 0) {
+            /* all buffers are taken, what has been packed goes now */
+            if (nqueued > 0) {
+                uring_submit(uring, queued, nqueued);
+                nqueued = 0;
+            }
+            uring_reap(uring, true);
+            continue;
+        }
+
+        i = uring->free[--uring->nfree];
+        fill = 0;
+        while (j < iovcnt && fill < uring->bufs[i].iov_len) {
+            size_t n;
+
+            n = MIN(iov[j].iov_len - iovoff, uring->bufs[i].iov_len - fill);
+            memcpy((char *)uring->bufs[i].iov_base + fill,
+                   (char *)iov[j].iov_base + iovoff,
+                   n);
+            fill += n;
+            iovoff += n;
+            if (iovoff == iov[j].iov_len) {
+                iovoff = 0;
+                ++j;
+            }
+        }
+        if (fill == 0) {
+            uring->free[uring->nfree++] = i;
+            break;
+        }
+        uring->off[i] = off + (off_t)total;
+        uring->len[i] = fill;
+        uring_prep(uring, i);
+        queued[nqueued++] = i;
+        total += fill;
+    }
+    if (nqueued > 0) {
+        uring_submit(uring, queued, nqueued);
+    }
+    return (ssize_t)total;
+}
+
+
+size_t
+mnl4c_uring_dropped(mnl4c_uring_t *uring)
+{
+    return __atomic_load_n(&uring->ndropped, __ATOMIC_RELAXED);
+}
+
+
+void
+mnl4c_uring_destroy(mnl4c_uring_t **puring)
+{
+    if (*puring != NULL) {
+        int i;
+
+        mnl4c_uring_set_fd(*puring, -1);
+        io_uring_queue_exit(&(*puring)->ring);
+        for (i = 0; i < MNL4C_URING_NBUFS; ++i) {
+            free((*puring)->bufs[i].iov_base);
+        }
+        free(*puring);
+        *puring = NULL;
+    }
+}
+
+#else
+
+mnl4c_uring_t *
+mnl4c_uring_new(UNUSED size_t bufsz)
+{
+    return NULL;
+}
+
+
+void
+mnl4c_uring_set_fd(UNUSED mnl4c_uring_t *uring, UNUSED int fd)
+{
+}
+
+
+ssize_t
+mnl4c_uring_writev(UNUSED mnl4c_uring_t *uring,
+                   UNUSED const struct iovec *iov,
+                   UNUSED int iovcnt,
+                   UNUSED off_t off)
+{
+    return -1;
+}
+
+
+size_t
+mnl4c_uring_dropped(UNUSED mnl4c_uring_t *uring)
+{
+    return 0;
+}
+
+
+void
+mnl4c_uring_destroy(UNUSED mnl4c_uring_t **puring)
+{
+}
+
+#endif
@@ -0,0 +1,192 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <mncommon/dumpm.h>
+#include <mncommon/util.h>
+
+#include <mnl4c.h>
+#include "mnl4c_private.h"
+
+#include "config.h"
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+
+/*
+ * Each flush becomes one complete zstd frame.  Concatenated frames are a
+ * valid zstd stream, so the file can be decoded while it is written, and
+ * whatever frame was last written in full is readable after a crash.
+ */
+struct _mnl4c_zframe {
+    ZSTD_CCtx *cctx;
+    char *buf;
+    size_t bufsz;
+};
+
+
+mnl4c_zframe_t *
+mnl4c_zframe_new(int level)
+{
+    mnl4c_zframe_t *res;
+
+    if ((res = malloc(sizeof(mnl4c_zframe_t))) == NULL) {
+        FAIL("malloc");
+    }
+    if ((res->cctx = ZSTD_createCCtx()) == NULL) {
+        free(res);
+        return NULL;
+    }
+    (void)ZSTD_CCtx_setParameter(res->cctx, ZSTD_c_compressionLevel, level);
+    res->buf = NULL;
+    res->bufsz = 0;
+    return res;
+}
+
+
+static void
+zframe_grow(mnl4c_zframe_t *zframe, size_t sz)
+{
+    if (sz > zframe->bufsz) {
+        if ((zframe->buf = realloc(zframe->buf, sz)) == NULL) {
+            FAIL("realloc");
+        }
+        zframe->bufsz = sz;
+    }
+}
+
+
+/*
+ * Compresses iov into a single frame, and points *frame at it.  Returns
+ * the frame size, or -1.
+ */
+ssize_t
+mnl4c_zframe_encode(mnl4c_zframe_t *zframe,
+                    const struct iovec *iov,
+                    int iovcnt,
+                    const char **frame)
+{
+    ZSTD_outBuffer ob;
+    size_t total, rem;
+    int i;
+
+    for (i = 0, total = 0; i < iovcnt; ++i) {
+        total += iov[i].iov_len;
+    }
+    zframe_grow(zframe, ZSTD_compressBound(total));
+    ob.dst = zframe->buf;
+    ob.size = zframe->bufsz;
+    ob.pos = 0;
+
+    i = 0;
+    do {
+        ZSTD_inBuffer ib;
+        ZSTD_EndDirective mode;
+
+        if (i < iovcnt) {
+            ib.src = iov[i].iov_base;
+            ib.size = iov[i].iov_len;
+            mode = ZSTD_e_continue;
+        } else {
+            ib.src = NULL;
+            ib.size = 0;
+            mode = ZSTD_e_end;
+        }
+        ib.pos = 0;
+        do {
+            if (ob.pos == ob.size) {
+                zframe_grow(zframe, zframe->bufsz * 2);
+                ob.dst = zframe->buf;
+                ob.size = zframe->bufsz;
+            }
+            rem = ZSTD_compressStream2(zframe->cctx, &ob, &ib, mode);
+            if (ZSTD_isError(rem)) {
+                TRACE("zstd: %s", ZSTD_getErrorName(rem));
+                (void)ZSTD_CCtx_reset(zframe->cctx,
+                                      ZSTD_reset_session_only);
+                return -1;
+            }
+        } while (mode == ZSTD_e_end ? rem != 0 : ib.pos < ib.size);
+    } while (i++ < iovcnt);
+
+    *frame = zframe->buf;
+    return (ssize_t)ob.pos;
+}
+
+
+void
+mnl4c_zframe_destroy(mnl4c_zframe_t **pzframe)
+{
+    if (*pzframe != NULL) {
+        (void)ZSTD_freeCCtx((*pzframe)->cctx);
+        free((*pzframe)->buf);
+        free(*pzframe);
+        *pzframe = NULL;
+    }
+}
+
+#else
+
+mnl4c_zframe_t *
+mnl4c_zframe_new(UNUSED int level)
+{
+    return NULL;
+}
+
+
+ssize_t
+mnl4c_zframe_encode(UNUSED mnl4c_zframe_t *zframe,
+                    UNUSED const struct iovec *iov,
+                    UNUSED int iovcnt,
+                    UNUSED const char **frame)
+{
+    return -1;
+}
+
+
+void
+mnl4c_zframe_destroy(UNUSED mnl4c_zframe_t **pzframe)
+{
+}
+
+#endif
+
+
+/*
+ * Crash time, from a signal handler: buf goes out as a zstd frame of raw
+ * (stored) blocks, which needs neither libzstd nor memory.  The window
+ * descriptor announces 128KB, the largest block there is.
+ */
+#define ZFRAME_RAW_BLOCK (128 * 1024)
+void
+mnl4c_zframe_crash(int fd, const char *buf, size_t sz)
+{
+    static const char fhdr[] = {
+        /* magic */
+        '\x28', '\xb5', '\x2f', '\xfd',
+        /* no checksum, no content size, windowed */
+        '\x00',
+        /* window log 17 */
+        '\x38',
+    };
+
+    if (sz == 0) {
+        return;
+    }
+    (void)mnl4c_crash_write(fd, fhdr, sizeof(fhdr), -1);
+    while (sz > 0) {
+        size_t n;
+        uint32_t bhdr;
+        char b[3];
+
+        n = MIN(sz, ZFRAME_RAW_BLOCK);
+        /* last block flag, raw block type 0, size */
+        bhdr = ((uint32_t)n << 3) | (n == sz ? 1 : 0);
+        b[0] = (char)(bhdr & 0xff);
+        b[1] = (char)((bhdr >> 8) & 0xff);
+        b[2] = (char)((bhdr >> 16) & 0xff);
+        (void)mnl4c_crash_write(fd, b, sizeof(b), -1);
+        (void)mnl4c_crash_write(fd, buf, n, -1);
+        buf += n;
+        sz -= n;
+    }
+}
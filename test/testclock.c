@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <sys/time.h>
+
+#include <mncommon/dumpm.h>
+#include <mncommon/util.h>
+
+#include <mnl4c.h>
+
+#define NCALLS (10 * 1000 * 1000)
+
+static const char *clocks[] = {
+    "realtime",
+    "coarse",
+    "tick",
+    "tsc",
+};
+
+
+static double
+elapsed(struct timeval *t0, struct timeval *t1)
+{
+    return (double)(t1->tv_sec - t0->tv_sec) +
+           (double)(t1->tv_usec - t0->tv_usec) / 1000000.0;
+}
+
+
+int
+main(void)
+{
+    mnl4c_logger_t logger;
+    mnl4c_ctx_t *ctx;
+    struct timeval t0, t1;
+    volatile double dsink;
+    volatile int64_t sink;
+    unsigned i;
+    int clock;
+
+    mnl4c_init();
+
+    logger = mnl4c_open(MNL4C_OPEN_STDOUT);
+    ctx = mnl4c_get_ctx(logger);
+
+    (void)gettimeofday(&t0, NULL);
+    for (i = 0; i < NCALLS; ++i) {
+        dsink = mnl4c_now_posix();
+    }
+    (void)gettimeofday(&t1, NULL);
+    (void)dsink;
+    printf("%-10s %6.2lf ns/call\n",
+           "posix",
+           elapsed(&t0, &t1) * 1000000000.0 / NCALLS);
+
+    for (clock = 0; clock < (int)countof(clocks); ++clock) {
+        if (mnl4c_set_clock(logger, clock) != 0) {
+            printf("%-10s unsupported\n", clocks[clock]);
+            continue;
+        }
+        (void)gettimeofday(&t0, NULL);
+        for (i = 0; i < NCALLS; ++i) {
+            sink = mnl4c_ctx_now(ctx);
+        }
+        (void)gettimeofday(&t1, NULL);
+        printf("%-10s %6.2lf ns/call (now %ld, realtime %ld)\n",
+               clocks[clock],
+               elapsed(&t0, &t1) * 1000000000.0 / NCALLS,
+               (long)sink,
+               (long)mnl4c_clock_realtime());
+    }
+
+    (void)mnl4c_close(logger);
+    mnl4c_fini();
+    return 0;
+}
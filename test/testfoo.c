@@ -1,5 +1,14 @@
 #include <assert.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <stdio.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 #include <mncommon/dumpm.h>
 #include <mnl4c.h>
@@ -12,6 +21,8 @@ const char *_malloc_options = "AJ";
 #endif
 
 static mnbytes_t _FOO = BYTES_INITIALIZER("FOO");
+static mnbytes_t _FOO_QWE = BYTES_INITIALIZER("FOO_QWE");
+static mnbytes_t _FOO_X1 = BYTES_INITIALIZER("FOO_*1");
 static int _my_number = 1;
 static mnbytes_t _lz = BYTES_INITIALIZER("L0");
 
@@ -67,6 +78,14 @@ test0(void)
 
     /* complex */
     res = mnl4c_set_level(logger1, LOG_DEBUG, &_FOO);
+    assert(res == 5);
+    res = mnl4c_set_level_match(logger1,
+                                LOG_DEBUG,
+                                &_FOO_QWE,
+                                MNL4C_MATCH_EXACT);
+    assert(res == 1);
+    res = mnl4c_set_level_match(logger1, LOG_DEBUG, &_FOO_X1, MNL4C_MATCH_GLOB);
+    assert(res == 2);
     FOO_LOG_START(logger0, LOG_DEBUG, ASD, "start:");
     for (i = 0; i < 12; ++i) {
         FOO_LOG_NEXT(logger0, LOG_DEBUG, ASD, " %d", i);
@@ -96,9 +115,892 @@ test0(void)
     mnl4c_fini();
 }
 
+/*
+ * the generated serializer of a message renders what printf() does
+ */
+static void
+test1(void)
+{
+    mnbytestream_t bs;
+    char buf[1024];
+    ssize_t nwritten;
+
+    if (bytestream_init(&bs, 1024) != 0) {
+        FAIL("bytestream_init");
+    }
+#define TEST1_ARGS                                                     \
+    42, "ab", 3.14159, 255u, 255u, 123456789ul, 1.5e-7, 'z',           \
+    (void *)&_my_number, 300, 2.005, "abcdef", (size_t)7, -1ll, -0.0   \
+
+    nwritten = BAR_MIX_NPRINTF(&bs, sizeof(buf), BAR_MIX_FMT, TEST1_ARGS);
+    (void)snprintf(buf, sizeof(buf), BAR_MIX_FMT, TEST1_ARGS);
+    assert(nwritten == (ssize_t)strlen(buf) + 1);
+    assert(memcmp(SDATA(&bs, 0), buf, nwritten) == 0);
+    bytestream_rewind(&bs);
+
+    /* cut as bytestream_nprintf() does */
+    nwritten = BAR_MIX_NPRINTF(&bs, 10, BAR_MIX_FMT, TEST1_ARGS);
+    assert(nwritten == 10);
+    assert(memcmp(SDATA(&bs, 0), buf, 9) == 0);
+    assert(*SDATA(&bs, 9) == '\0');
+#undef TEST1_ARGS
+    bytestream_fini(&bs);
+}
+
+/*
+ * below #compile-min-level the arguments are not even evaluated
+ */
+#if CMIN_COMPILE_MIN_LEVEL != LOG_INFO
+#   error "#compile-min-level is not applied"
+#endif
+static void
+test2(void)
+{
+    mnl4c_logger_t logger;
+    static mnbytes_t _CMIN = BYTES_INITIALIZER("CMIN");
+    int n;
+
+    mnl4c_init();
+    if ((logger = mnl4c_open(MNL4C_OPEN_STDERR)) == MNL4C_LOGGER_INVALID) {
+        FAIL("mnl4c_open");
+    }
+    foo_init_logdef(logger);
+    (void)mnl4c_set_level(logger, LOG_DEBUG, &_CMIN);
+    n = 0;
+    CMIN_LINFO(logger, SHOWN, ++n);
+    assert(n == 1);
+    CMIN_LDEBUG(logger, ELIDED, ++n);
+    assert(n == 1);
+    (void)mnl4c_close(logger);
+    mnl4c_fini();
+}
+
+/*
+ * A fresh directory for the files of a test, removed by test_rmdir().
+ */
+static char *
+test_mkdir(void)
+{
+    char *dir;
+
+    if ((dir = strdup("/tmp/mnl4c-testfoo.XXXXXX")) == NULL) {
+        FAIL("strdup");
+    }
+    if (mkdtemp(dir) == NULL) {
+        FAIL("mkdtemp");
+    }
+    return dir;
+}
+
+
+static void
+test_rmdir(char *dir)
+{
+    DIR *d;
+    struct dirent *de;
+
+    if ((d = opendir(dir)) == NULL) {
+        FAIL("opendir");
+    }
+    while ((de = readdir(d)) != NULL) {
+        char path[PATH_MAX];
+
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) {
+            continue;
+        }
+        (void)snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        (void)unlink(path);
+    }
+    (void)closedir(d);
+    (void)rmdir(dir);
+    free(dir);
+}
+
+
+/*
+ * The contents of fp, zero-terminated, *psz bytes without the zero.
+ */
+static char *
+test_read(FILE *fp, size_t *psz)
+{
+    char *buf;
+    size_t sz, nread;
+
+    sz = 0;
+    if ((buf = malloc(4096)) == NULL) {
+        FAIL("malloc");
+    }
+    while ((nread = fread(buf + sz, 1, 4095, fp)) > 0) {
+        sz += nread;
+        if ((buf = realloc(buf, sz + 4096)) == NULL) {
+            FAIL("realloc");
+        }
+    }
+    buf[sz] = '\0';
+    if (psz != NULL) {
+        *psz = sz;
+    }
+    return buf;
+}
+
+
+static char *
+test_slurp(const char *path, size_t *psz)
+{
+    FILE *fp;
+    char *buf;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+        FAIL("fopen");
+    }
+    buf = test_read(fp, psz);
+    (void)fclose(fp);
+    return buf;
+}
+
+
+/*
+ * Drops the timestamp, everything up to " [<pid>]", from each line of
+ * buf.  Returns the new size.
+ */
+static size_t
+test_strip_ts(char *buf, size_t sz)
+{
+    char *src, *dst, *end;
+
+    end = buf + sz;
+    for (src = dst = buf; src < end;) {
+        char *nl, *pid;
+        size_t len;
+
+        len = (nl = memchr(src, '\n', end - src)) != NULL ?
+            (size_t)(nl - src) + 1 : (size_t)(end - src);
+        if ((pid = memmem(src, len, " [", 2)) != NULL) {
+            len -= pid - src;
+            src = pid;
+        }
+        memmove(dst, src, len);
+        dst += len;
+        src += len;
+    }
+    *dst = '\0';
+    return dst - buf;
+}
+
+
+static int
+test_count(const char *buf, const char *needle)
+{
+    int n;
+
+    for (n = 0; (buf = strstr(buf, needle)) != NULL; ++n) {
+        buf += strlen(needle);
+    }
+    return n;
+}
+
+
+/*
+ * Records logged the same way come out of an MNL4C_OPEN_ASYNC logger as
+ * they do out of a synchronous one, and a logger is found again by its
+ * path only with the same flags.
+ */
+static void
+test3_log(mnl4c_logger_t logger)
+{
+    int i;
+    char name[300];
+
+    (void)mnl4c_set_level(logger, LOG_DEBUG, &_FOO);
+    for (i = 0; i < 2000; ++i) {
+        size_t sz;
+
+        /* some longer than the buffer */
+        sz = (size_t)(i * 7) % (sizeof(name) - 1);
+        memset(name, 'a' + i % 26, sz);
+        name[sz] = '\0';
+        FOO_LDEBUG(logger, QWE1, i, (double)i / 4.0, name);
+        FOO_LINFO(logger, ZXC);
+    }
+}
+
+
+static void
+test3(void)
+{
+    char *dir, path[PATH_MAX], *sync, *async;
+    size_t syncsz, asyncsz;
+    mnl4c_logger_t logger, again;
+    unsigned flags[2] = {0, MNL4C_OPEN_ASYNC};
+    char *out[2];
+    size_t outsz[2];
+    int i;
+
+    mnl4c_init();
+    dir = test_mkdir();
+    for (i = 0; i < 2; ++i) {
+        (void)snprintf(path, sizeof(path), "%s/%d.log", dir, i);
+        logger = mnl4c_open(MNL4C_OPEN_FILE | flags[i], path, 0, 0.0, 0, 0);
+        assert(logger != MNL4C_LOGGER_INVALID);
+        (void)mnl4c_set_bufsz(logger, 256);
+        foo_init_logdef(logger);
+
+        again = mnl4c_open(MNL4C_OPEN_FILE | flags[i], path, 0, 0.0, 0, 0);
+        assert(again == logger);
+        again = mnl4c_open(MNL4C_OPEN_FILE | flags[i ^ 1], path, 0, 0.0, 0, 0);
+        assert(again == MNL4C_LOGGER_INVALID);
+        (void)mnl4c_close(logger);
+
+        test3_log(logger);
+        (void)mnl4c_close(logger);
+        out[i] = test_slurp(path, &outsz[i]);
+    }
+    sync = out[0];
+    async = out[1];
+    syncsz = test_strip_ts(sync, outsz[0]);
+    asyncsz = test_strip_ts(async, outsz[1]);
+    assert(test_count(sync, "\n") == 4000);
+    assert(syncsz == asyncsz);
+    assert(memcmp(sync, async, syncsz) == 0);
+    free(sync);
+    free(async);
+    test_rmdir(dir);
+    mnl4c_fini();
+}
+
+
+/*
+ * Renders the binary log at path with l4cdecode, $L4CDECODE if set.
+ */
+static char *
+test_decode(const char *path, size_t *psz)
+{
+    char cmd[PATH_MAX * 2];
+    const char *l4cdecode;
+    FILE *fp;
+    char *buf;
+
+    if ((l4cdecode = getenv("L4CDECODE")) == NULL) {
+        l4cdecode = "../src/l4cdecode";
+    }
+    (void)snprintf(cmd,
+                   sizeof(cmd),
+                   "%s --catalog=my-logdef.cat %s",
+                   l4cdecode,
+                   path);
+    if ((fp = popen(cmd, "r")) == NULL) {
+        FAIL("popen");
+    }
+    buf = test_read(fp, psz);
+    if (pclose(fp) != 0) {
+        FAIL("l4cdecode");
+    }
+    return buf;
+}
+
+
+/*
+ * A binary sink with MNL4C_OPEN_ASYNC is handed buffers much larger than
+ * a quarter of its ring by two threads at once, none of their records
+ * may be torn.
+ */
+#define TEST4_NAMESZ 60000
+#define TEST4_NRECS 50
+static mnl4c_logger_t test4_logger;
+
+static void *
+test4_worker(void *udata)
+{
+    char *name;
+    int i;
+
+    if ((name = malloc(TEST4_NAMESZ + 1)) == NULL) {
+        FAIL("malloc");
+    }
+    memset(name, *(char *)udata, TEST4_NAMESZ);
+    name[TEST4_NAMESZ] = '\0';
+    for (i = 0; i < TEST4_NRECS; ++i) {
+        FOO_LDEBUG(test4_logger, QWE1, i, 0.5, name);
+    }
+    free(name);
+    return NULL;
+}
+
+
+static void
+test4(void)
+{
+    char *dir, path[PATH_MAX], *out, *p;
+    mnl4c_logger_t sink;
+    pthread_t threads[2];
+    char c[2] = {'x', 'y'};
+    int i, n;
+
+    mnl4c_init();
+    dir = test_mkdir();
+    (void)snprintf(path, sizeof(path), "%s/a.log", dir);
+    test4_logger = mnl4c_open(MNL4C_OPEN_FILE | MNL4C_OPEN_BINARY,
+                              path, 0, 0.0, 0, 0);
+    assert(test4_logger != MNL4C_LOGGER_INVALID);
+    (void)mnl4c_set_bufsz(test4_logger, 1024 * 1024);
+    foo_init_logdef(test4_logger);
+    (void)mnl4c_set_level(test4_logger, LOG_DEBUG, &_FOO);
+
+    (void)snprintf(path, sizeof(path), "%s/b.log", dir);
+    sink = mnl4c_open(MNL4C_OPEN_FILE | MNL4C_OPEN_BINARY | MNL4C_OPEN_ASYNC,
+                      path, 0, 0.0, 0, 0);
+    assert(sink != MNL4C_LOGGER_INVALID);
+    (void)mnl4c_set_bufsz(sink, 4096);
+    assert(mnl4c_add_sink(test4_logger, sink, LOG_DEBUG) == 0);
+    (void)mnl4c_close(sink);
+
+    for (i = 0; i < 2; ++i) {
+        if (pthread_create(&threads[i], NULL, test4_worker, &c[i]) != 0) {
+            FAIL("pthread_create");
+        }
+    }
+    for (i = 0; i < 2; ++i) {
+        (void)pthread_join(threads[i], NULL);
+    }
+    (void)mnl4c_close(test4_logger);
+
+    out = test_decode(path, NULL);
+    n = 0;
+    for (p = out; (p = strstr(p, " name ")) != NULL; p += TEST4_NAMESZ) {
+        p += strlen(" name ");
+        assert(*p == 'x' || *p == 'y');
+        assert(strspn(p, *p == 'x' ? "x" : "y") == TEST4_NAMESZ);
+        assert(p[TEST4_NAMESZ] == '\n');
+        ++n;
+    }
+    assert(n == 2 * TEST4_NRECS);
+    assert(test_count(out, "\n") == n);
+    free(out);
+    test_rmdir(dir);
+    mnl4c_fini();
+}
+
+
+/*
+ * A string with a precision need not be zero-terminated.  In binary mode
+ * such a message is stored as text, and in JSON and logfmt it has no
+ * fields, nothing past the precision is read.
+ */
+#if TB_PREC_BIN != 0
+#   error "%.*s must not be deferred"
+#endif
+#if TB_PREC4_FIELDS != 0
+#   error "%.4s must not be a field"
+#endif
+static void
+test5(void)
+{
+    char *dir, path[PATH_MAX], *out;
+    mnl4c_logger_t logger;
+    static mnbytes_t _TB = BYTES_INITIALIZER("TB");
+    struct {
+        char s[4];
+        char secret[8];
+    } buf = {{'a', 'b', 'c', 'd'}, "SECRET!"};
+    unsigned flags[2] = {MNL4C_OPEN_JSON, MNL4C_OPEN_LOGFMT};
+    int i;
+
+    mnl4c_init();
+    dir = test_mkdir();
+    (void)snprintf(path, sizeof(path), "%s/bin.log", dir);
+    logger = mnl4c_open(MNL4C_OPEN_FILE | MNL4C_OPEN_BINARY,
+                        path, 0, 0.0, 0, 0);
+    assert(logger != MNL4C_LOGGER_INVALID);
+    foo_init_logdef(logger);
+    (void)mnl4c_set_level(logger, LOG_DEBUG, &_TB);
+    TB_LDEBUG(logger, PREC, (int)sizeof(buf.s), buf.s, buf.s);
+    (void)mnl4c_close(logger);
+
+    out = test_decode(path, NULL);
+    assert(test_count(out, "tbin DEBUG[0]: Prec: abcd|abcd\n") == 1);
+    assert(strstr(out, "SECRET") == NULL);
+    free(out);
+
+    for (i = 0; i < 2; ++i) {
+        (void)snprintf(path, sizeof(path), "%s/%d.log", dir, i);
+        logger = mnl4c_open(MNL4C_OPEN_FILE | flags[i], path, 0, 0.0, 0, 0);
+        assert(logger != MNL4C_LOGGER_INVALID);
+        foo_init_logdef(logger);
+        (void)mnl4c_set_level(logger, LOG_DEBUG, &_TB);
+        TB_LDEBUG(logger, PREC4, buf.s);
+        (void)mnl4c_close(logger);
+
+        out = test_slurp(path, NULL);
+        assert(test_count(out, i == 0 ?
+                               "\"msg\":\"Prec4: abcd\"}\n" :
+                               " msg=\"Prec4: abcd\"\n") == 1);
+        assert(strstr(out, "SECRET") == NULL);
+        free(out);
+    }
+    test_rmdir(dir);
+    mnl4c_fini();
+}
+
+
+/*
+ * Retention by count and by bytes.  Each round waits for the next second,
+ * shadows are named after it, and logs until the file rolls over.  The
+ * shadows left, and the manifest entries, must be the newest ones that
+ * fit: the shadow being written counts as 0 bytes.
+ */
+#define TEST6_NROUNDS 5
+#define TEST6_MAXFILES 3
+#define TEST6_MAXBYTES 2500
+typedef struct _test6_log {
+    mnl4c_logger_t logger;
+    char path[PATH_MAX];
+    char shadows[TEST6_NROUNDS + 1][PATH_MAX];
+    size_t sizes[TEST6_NROUNDS + 1];
+    int nshadows;
+} test6_log_t;
+
+
+static void
+test6_current(test6_log_t *log, char *buf)
+{
+    ssize_t nread;
+
+    if ((nread = readlink(log->path, buf, PATH_MAX - 1)) < 0) {
+        FAIL("readlink");
+    }
+    buf[nread] = '\0';
+}
+
+
+static void
+test6_round(test6_log_t *log)
+{
+    char cur[PATH_MAX];
+    struct stat sb;
+
+    do {
+        FOO_LINFO(log->logger, ZXC);
+        test6_current(log, cur);
+    } while (strcmp(cur, log->shadows[log->nshadows - 1]) == 0);
+    if (stat(log->shadows[log->nshadows - 1], &sb) != 0) {
+        FAIL("stat");
+    }
+    log->sizes[log->nshadows - 1] = (size_t)sb.st_size;
+    strcpy(log->shadows[log->nshadows], cur);
+    log->sizes[log->nshadows] = 0;
+    ++log->nshadows;
+}
+
+
+/*
+ * The shadows from first on are there, each listed in the manifest with
+ * its size, and no others.
+ */
+static void
+test6_check(test6_log_t *log, int first)
+{
+    char mpath[PATH_MAX + 16], *manifest, *line, *last;
+    char *dir, *base;
+    DIR *d;
+    struct dirent *de;
+    int i, n;
+
+    (void)snprintf(mpath, sizeof(mpath), "%s.manifest", log->path);
+    manifest = test_slurp(mpath, NULL);
+    i = first;
+    for (line = strtok_r(manifest, "\n", &last);
+         line != NULL;
+         line = strtok_r(NULL, "\n", &last)) {
+        char expected[PATH_MAX + 32];
+
+        assert(i < log->nshadows);
+        (void)snprintf(expected,
+                       sizeof(expected),
+                       "%zu %s",
+                       log->sizes[i],
+                       strrchr(log->shadows[i], '/') + 1);
+        assert(strcmp(line, expected) == 0);
+        ++i;
+    }
+    assert(i == log->nshadows);
+    free(manifest);
+
+    if ((dir = strdup(log->path)) == NULL) {
+        FAIL("strdup");
+    }
+    base = strrchr(dir, '/');
+    *base++ = '\0';
+    if ((d = opendir(dir)) == NULL) {
+        FAIL("opendir");
+    }
+    n = 0;
+    while ((de = readdir(d)) != NULL) {
+        if (strncmp(de->d_name, base, strlen(base)) != 0 ||
+            de->d_name[strlen(base)] != '.' ||
+            strchr("0123456789", de->d_name[strlen(base) + 1]) == NULL) {
+            continue;
+        }
+        for (i = first; i < log->nshadows; ++i) {
+            if (strcmp(strrchr(log->shadows[i], '/') + 1, de->d_name) == 0) {
+                break;
+            }
+        }
+        assert(i < log->nshadows);
+        ++n;
+    }
+    assert(n == log->nshadows - first);
+    (void)closedir(d);
+    free(dir);
+}
+
+
+static void
+test6(void)
+{
+    char *dir;
+    test6_log_t logs[2];
+    size_t total;
+    int i, first;
+
+    mnl4c_init();
+    dir = test_mkdir();
+    for (i = 0; i < 2; ++i) {
+        (void)snprintf(logs[i].path, sizeof(logs[i].path), "%s/%d.log", dir, i);
+        logs[i].logger = mnl4c_open(MNL4C_OPEN_FILE,
+                                    logs[i].path,
+                                    1000,
+                                    0.0,
+                                    0,
+                                    0);
+        assert(logs[i].logger != MNL4C_LOGGER_INVALID);
+        (void)mnl4c_set_bufsz(logs[i].logger, 256);
+        foo_init_logdef(logs[i].logger);
+        test6_current(&logs[i], logs[i].shadows[0]);
+        logs[i].sizes[0] = 0;
+        logs[i].nshadows = 1;
+    }
+    assert(mnl4c_set_retention(logs[0].logger, TEST6_MAXFILES, 0) == 0);
+    assert(mnl4c_set_retention(logs[1].logger, 0, TEST6_MAXBYTES) == 0);
+
+    for (i = 0; i < TEST6_NROUNDS; ++i) {
+        sleep(1);
+        test6_round(&logs[0]);
+        test6_round(&logs[1]);
+    }
+    (void)mnl4c_close(logs[0].logger);
+    (void)mnl4c_close(logs[1].logger);
+    /* waits for the retention jobs */
+    mnl4c_fini();
+
+    test6_check(&logs[0], logs[0].nshadows - TEST6_MAXFILES);
+
+    /* the newest closed shadows that fit */
+    total = 0;
+    for (first = logs[1].nshadows - 1; first > 0; --first) {
+        if (total + logs[1].sizes[first - 1] > TEST6_MAXBYTES) {
+            break;
+        }
+        total += logs[1].sizes[first - 1];
+    }
+    assert(first > 0 && first < logs[1].nshadows - 1);
+    test6_check(&logs[1], first);
+
+    test_rmdir(dir);
+}
+
+
+/*
+ * A token bucket of 2 records a second and a burst of 3: of a quick run
+ * of 10, the first 3 are let through, and once the bucket has room again
+ * one "suppressed 7" record tells about the rest.
+ */
+static void
+test7(void)
+{
+    char *dir, path[PATH_MAX], *out;
+    mnl4c_logger_t logger;
+    static mnbytes_t _FOO_QWE1 = BYTES_INITIALIZER("FOO_QWE1");
+    int i;
+
+    mnl4c_init();
+    dir = test_mkdir();
+    (void)snprintf(path, sizeof(path), "%s/t.log", dir);
+    logger = mnl4c_open(MNL4C_OPEN_FILE, path, 0, 0.0, 0, 0);
+    assert(logger != MNL4C_LOGGER_INVALID);
+    foo_init_logdef(logger);
+    (void)mnl4c_set_level(logger, LOG_DEBUG, &_FOO);
+    assert(mnl4c_set_throttling_bucket(logger,
+                                       2.0,
+                                       3,
+                                       &_FOO_QWE1,
+                                       MNL4C_MATCH_EXACT) == 1);
+    for (i = 0; i < 10; ++i) {
+        FOO_LDEBUG(logger, QWE1, i, 0.5, "x");
+    }
+    /* the window closes after 0.5s, housekeeping puts out the summary */
+    sleep(1);
+    FOO_LDEBUG(logger, QWE1, i, 0.5, "x");
+    (void)mnl4c_close(logger);
+
+    out = test_slurp(path, NULL);
+    assert(test_count(out, "Foo 1: Number ") == 4);
+    for (i = 0; i < 3; ++i) {
+        char rec[64];
+
+        (void)snprintf(rec, sizeof(rec), "DEBUG[0]: Foo 1: Number %d,", i);
+        assert(test_count(out, rec) == 1);
+    }
+    assert(test_count(out, "DEBUG[0]: Foo 1: Number 10,") == 1);
+    assert(test_count(out, "suppressed") == 1);
+    assert(test_count(out, "] FOO_QWE1 INFO: suppressed 7 in ") == 1);
+    free(out);
+    test_rmdir(dir);
+    mnl4c_fini();
+}
+
+
+/*
+ * Sampled every 4th, a run of 10 records keeps the 0th, 4th and 8th,
+ * each tagged "@4", in text as well as in binary.
+ */
+#define TEST8_N 4
+#define TEST8_NRECS 10
+static void
+test8(void)
+{
+    char *dir, path[PATH_MAX], *out;
+    mnl4c_logger_t logger;
+    unsigned flags[2] = {0, MNL4C_OPEN_BINARY};
+    int i, j;
+
+    mnl4c_init();
+    dir = test_mkdir();
+    for (i = 0; i < 2; ++i) {
+        (void)snprintf(path, sizeof(path), "%s/%d.log", dir, i);
+        logger = mnl4c_open(MNL4C_OPEN_FILE | flags[i], path, 0, 0.0, 0, 0);
+        assert(logger != MNL4C_LOGGER_INVALID);
+        foo_init_logdef(logger);
+        (void)mnl4c_set_level(logger, LOG_DEBUG, &_FOO);
+        assert(mnl4c_set_sampling(logger,
+                                  TEST8_N,
+                                  MNL4C_SAMPLE_EVERY,
+                                  &_FOO_QWE) > 0);
+        for (j = 0; j < TEST8_NRECS; ++j) {
+            FOO_LDEBUG(logger, QWE1, j, 0.5, "x");
+        }
+        (void)mnl4c_close(logger);
+
+        out = flags[i] & MNL4C_OPEN_BINARY ?
+            test_decode(path, NULL) : test_slurp(path, NULL);
+        assert(test_count(out, "Foo 1: Number ") ==
+               (TEST8_NRECS + TEST8_N - 1) / TEST8_N);
+        for (j = 0; j < TEST8_NRECS; ++j) {
+            char rec[64];
+
+            (void)snprintf(rec,
+                           sizeof(rec),
+                           "DEBUG[0]@%d: Foo 1: Number %d,",
+                           TEST8_N,
+                           j);
+            assert(test_count(out, rec) == (j % TEST8_N == 0));
+        }
+        free(out);
+    }
+    test_rmdir(dir);
+    mnl4c_fini();
+}
+
+
+/*
+ * A sink at LOG_INFO takes none of the debug records of its logger, and
+ * each of the others just as the logger writes it.
+ */
+static void
+test9(void)
+{
+    char *dir, path[PATH_MAX], *all, *some, *p, *q;
+    size_t allsz, somesz;
+    mnl4c_logger_t logger, sink;
+    int i;
+
+    mnl4c_init();
+    dir = test_mkdir();
+    (void)snprintf(path, sizeof(path), "%s/all.log", dir);
+    logger = mnl4c_open(MNL4C_OPEN_FILE, path, 0, 0.0, 0, 0);
+    assert(logger != MNL4C_LOGGER_INVALID);
+    foo_init_logdef(logger);
+    (void)mnl4c_set_level(logger, LOG_DEBUG, &_FOO);
+    (void)snprintf(path, sizeof(path), "%s/some.log", dir);
+    sink = mnl4c_open(MNL4C_OPEN_FILE, path, 0, 0.0, 0, 0);
+    assert(sink != MNL4C_LOGGER_INVALID);
+    assert(mnl4c_add_sink(logger, sink, LOG_INFO) == 0);
+    (void)mnl4c_close(sink);
+
+    for (i = 0; i < 100; ++i) {
+        FOO_LDEBUG(logger, QWE1, i, 0.5, "debug");
+        FOO_LINFO(logger, QWE1, i, 0.25, "info");
+        FOO_LDEBUG(logger, ZXC);
+        FOO_LINFO(logger, ZXC);
+    }
+    (void)mnl4c_close(logger);
+
+    all = test_slurp(path, &somesz);
+    some = all;
+    (void)snprintf(path, sizeof(path), "%s/all.log", dir);
+    all = test_slurp(path, &allsz);
+    assert(test_count(all, "\n") == 400);
+    assert(test_count(some, "\n") == 200);
+    assert(strstr(some, "DEBUG") == NULL);
+    /* all without its debug records */
+    for (p = q = all; *p != '\0';) {
+        char *nl;
+        size_t len;
+
+        nl = strchr(p, '\n');
+        len = nl - p + 1;
+        if (memmem(p, len, " DEBUG", 6) == NULL) {
+            memmove(q, p, len);
+            q += len;
+        }
+        p += len;
+    }
+    assert((size_t)(q - all) == somesz);
+    assert(memcmp(all, some, somesz) == 0);
+    free(all);
+    free(some);
+    mnl4c_fini();
+    test_rmdir(dir);
+}
+
+
+/*
+ * An MNL4C_OPEN_SYSLOG sink sends each record as an RFC 5424 message,
+ * "<PRI>1 TIMESTAMP HOSTNAME APP-NAME PROCID - - MSG", to a local
+ * stand-in for syslogd.  MSG is the record as the logger writes it, less
+ * the newline.
+ */
+#define TEST10_NRECS 8
+#define TEST10_TS "0000-00-00T00:00:00.000000Z"
+static void
+test10(void)
+{
+    char *dir, path[PATH_MAX], *out, *rec;
+    struct sockaddr_un addr;
+    mnl4c_logger_t logger, sink;
+    char host[256], tail[512];
+    time_t start, end;
+    int fd, i;
+
+    mnl4c_init();
+    dir = test_mkdir();
+    memset(&addr, '\0', sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    (void)snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/log", dir);
+    if ((fd = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0) {
+        FAIL("socket");
+    }
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        FAIL("bind");
+    }
+    if (gethostname(host, sizeof(host)) != 0) {
+        FAIL("gethostname");
+    }
+    host[sizeof(host) - 1] = '\0';
+    (void)snprintf(tail,
+                   sizeof(tail),
+                   " %s testfoo %d - - ",
+                   host,
+                   (int)getpid());
+
+    (void)snprintf(path, sizeof(path), "%s/all.log", dir);
+    logger = mnl4c_open(MNL4C_OPEN_FILE, path, 0, 0.0, 0, 0);
+    assert(logger != MNL4C_LOGGER_INVALID);
+    foo_init_logdef(logger);
+    (void)mnl4c_set_level(logger, LOG_DEBUG, &_FOO);
+    sink = MNL4C_OPEN_TO_SYSLOG(addr.sun_path, "testfoo", LOG_LOCAL0, 0);
+    assert(sink != MNL4C_LOGGER_INVALID);
+    assert(mnl4c_add_sink(logger, sink, LOG_DEBUG) == 0);
+    (void)mnl4c_close(sink);
+
+    start = time(NULL);
+    /* no more than the socket queues, nothing reads it yet */
+    for (i = 0; i < TEST10_NRECS / 2; ++i) {
+        FOO_LDEBUG(logger, QWE1, i, 0.5, "x");
+        FOO_LINFO(logger, ZXC);
+    }
+    (void)mnl4c_close(logger);
+    mnl4c_fini();
+    end = time(NULL);
+
+    out = test_slurp(path, NULL);
+    assert(test_count(out, "\n") == TEST10_NRECS);
+    rec = out;
+    for (i = 0; i < TEST10_NRECS; ++i) {
+        char buf[1024], pri[16], *p, *nl;
+        ssize_t nread;
+        struct tm tm;
+        time_t sec;
+        size_t j;
+
+        nread = recv(fd, buf, sizeof(buf) - 1, MSG_DONTWAIT);
+        assert(nread > 0);
+        buf[nread] = '\0';
+
+        (void)snprintf(pri,
+                       sizeof(pri),
+                       "<%d>1 ",
+                       LOG_LOCAL0 | (i % 2 == 0 ? LOG_DEBUG : LOG_INFO));
+        assert(strncmp(buf, pri, strlen(pri)) == 0);
+        p = buf + strlen(pri);
+
+        /* YYYY-MM-DDTHH:MM:SS.uuuuuuZ, UTC */
+        for (j = 0; j < sizeof(TEST10_TS) - 1; ++j) {
+            assert(TEST10_TS[j] == '0' ?
+                   (p[j] >= '0' && p[j] <= '9') : p[j] == TEST10_TS[j]);
+        }
+        memset(&tm, '\0', sizeof(tm));
+        assert(sscanf(p,
+                      "%d-%d-%dT%d:%d:%d",
+                      &tm.tm_year,
+                      &tm.tm_mon,
+                      &tm.tm_mday,
+                      &tm.tm_hour,
+                      &tm.tm_min,
+                      &tm.tm_sec) == 6);
+        tm.tm_year -= 1900;
+        tm.tm_mon -= 1;
+        sec = timegm(&tm);
+        assert(sec >= start && sec <= end);
+        p += j;
+
+        assert(strncmp(p, tail, strlen(tail)) == 0);
+        p += strlen(tail);
+
+        nl = strchr(rec, '\n');
+        assert((size_t)(buf + nread - p) == (size_t)(nl - rec));
+        assert(memcmp(p, rec, nl - rec) == 0);
+        rec = nl + 1;
+    }
+    assert(recv(fd, tail, sizeof(tail), MSG_DONTWAIT) < 0);
+    free(out);
+    (void)close(fd);
+    test_rmdir(dir);
+}
+
+
 int
 main(void)
 {
+    test1();
+    test2();
+    test3();
+    test4();
+    test5();
+    test6();
+    test7();
+    test8();
+    test9();
+    test10();
     test0();
     return 0;
 }
@@ -1,4 +1,14 @@
 #include <assert.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
 
 #include <mncommon/dumpm.h>
 #include <mncommon/bytes.h>
@@ -10,6 +20,7 @@
 #include "my-logdef.h"
 
 mnl4c_logger_t logger;
+static bool lt;
 
 #define WLEN 50
 static int
@@ -50,12 +61,274 @@ randline(UNUSED unsigned n)
 static void
 dosomething(int d, float f, mnbytes_t *s)
 {
-    //FOO_LINFO(logger, QWE1, d, f, BDATA(s));
-    FOO_LDEBUG(logger, QWE1, d, f, BDATA(s));
+    if (lt) {
+        FOO_LINFO(logger, QWE1, d, f, BDATA(s));
+    } else {
+        FOO_LDEBUG(logger, QWE1, d, f, BDATA(s));
+    }
+}
+
+static void *
+worker(UNUSED void *udata)
+{
+    unsigned n;
+
+    n = 2230;
+    while (n--) {
+        mnbytes_t *s;
+
+        s = randline(n);
+        dosomething(n, (float)(n * 2), s);
+        BYTES_DECREF(&s);
+    }
+    return NULL;
+}
+
+
+/*
+ * the cost of a call that is turned off at run time
+ */
+static void
+disabled(void)
+{
+    struct timeval t0, t1;
+    unsigned n;
+    BYTES_ALLOCA(_foo, "FOO");
+
+    (void)mnl4c_set_level(logger, LOG_INFO, _foo);
+    (void)gettimeofday(&t0, NULL);
+    for (n = 0; n < 100000000; ++n) {
+        FOO_LDEBUG(logger, ASD1, "disabled");
+    }
+    (void)gettimeofday(&t1, NULL);
+    printf("disabled %.2lf ns/call\n",
+           ((double)(t1.tv_sec - t0.tv_sec) * 1000000000.0 +
+            (double)(t1.tv_usec - t0.tv_usec) * 1000.0) / n);
+}
+
+
+/*
+ * the cost of an enabled QWE1 record, formatting included, and that of
+ * its message alone through bytestream_nprintf() and through the
+ * generated serializer
+ */
+static double
+elapsed_ns(struct timeval *t0, struct timeval *t1, unsigned n)
+{
+    return ((double)(t1->tv_sec - t0->tv_sec) * 1000000000.0 +
+            (double)(t1->tv_usec - t0->tv_usec) * 1000.0) / n;
+}
+
+
+static void
+enabled(void)
+{
+    struct timeval t0, t1;
+    mnbytestream_t bs;
+    mnbytes_t *s;
+    unsigned n;
+    BYTES_ALLOCA(_foo, "FOO");
+
+    (void)mnl4c_set_throttling(logger, 0.0, _foo);
+    s = randline(8);
+    (void)gettimeofday(&t0, NULL);
+    for (n = 0; n < 1000000; ++n) {
+        FOO_LDEBUG(logger, QWE1, n, (float)(n * 2), BDATA(s));
+    }
+    (void)gettimeofday(&t1, NULL);
+    /* stdout may be taking the records, see -p */
+    fprintf(stderr, "enabled %.2lf ns/call\n", elapsed_ns(&t0, &t1, n));
+
+    if (bytestream_init(&bs, 4096) != 0) {
+        FAIL("bytestream_init");
+    }
+    (void)gettimeofday(&t0, NULL);
+    for (n = 0; n < 1000000; ++n) {
+        (void)bytestream_nprintf(&bs,
+                                 4096,
+                                 FOO_QWE1_FMT,
+                                 n,
+                                 (float)(n * 2),
+                                 BDATA(s));
+        bytestream_rewind(&bs);
+    }
+    (void)gettimeofday(&t1, NULL);
+    fprintf(stderr, "nprintf %.2lf ns/call\n", elapsed_ns(&t0, &t1, n));
+    (void)gettimeofday(&t0, NULL);
+    for (n = 0; n < 1000000; ++n) {
+        (void)FOO_QWE1_NPRINTF(&bs,
+                               4096,
+                               FOO_QWE1_FMT,
+                               n,
+                               (float)(n * 2),
+                               BDATA(s));
+        bytestream_rewind(&bs);
+    }
+    (void)gettimeofday(&t1, NULL);
+    fprintf(stderr, "serializer %.2lf ns/call\n", elapsed_ns(&t0, &t1, n));
+    bytestream_fini(&bs);
+    BYTES_DECREF(&s);
+}
+
+
+/*
+ * page cache footprint of the log files, by mincore(2)
+ */
+static void
+cached(void)
+{
+    glob_t g;
+    size_t pgsz, npages, nresident;
+    unsigned i;
+
+    if (glob("/tmp/mnl4c-perf.log.*", 0, NULL, &g) != 0) {
+        return;
+    }
+    pgsz = (size_t)sysconf(_SC_PAGESIZE);
+    npages = 0;
+    nresident = 0;
+    for (i = 0; i < g.gl_pathc; ++i) {
+        struct stat sb;
+        unsigned char *vec;
+        void *map;
+        size_t n, j;
+        int fd;
+
+        if ((fd = open(g.gl_pathv[i], O_RDONLY)) < 0) {
+            continue;
+        }
+        if (fstat(fd, &sb) != 0 || sb.st_size == 0) {
+            (void)close(fd);
+            continue;
+        }
+        n = ((size_t)sb.st_size + pgsz - 1) / pgsz;
+        if ((map = mmap(NULL,
+                        (size_t)sb.st_size,
+                        PROT_READ,
+                        MAP_SHARED,
+                        fd,
+                        0)) == MAP_FAILED) {
+            FAIL("mmap");
+        }
+        if ((vec = malloc(n)) == NULL) {
+            FAIL("malloc");
+        }
+        if (mincore(map, (size_t)sb.st_size, vec) == 0) {
+            for (j = 0; j < n; ++j) {
+                nresident += vec[j] & 1;
+            }
+        }
+        npages += n;
+        free(vec);
+        (void)munmap(map, (size_t)sb.st_size);
+        (void)close(fd);
+    }
+    globfree(&g);
+    printf("cached %zu of %zu pages\n", nresident, npages);
+}
+
+
+/*
+ * What the housekeeping thread writes out of the idle main thread's
+ * buffer within the flush latency.
+ */
+static void
+housekept(double latency)
+{
+    struct stat sb0, sb1;
+
+    if (stat("/tmp/mnl4c-perf.log", &sb0) != 0) {
+        FAIL("stat");
+    }
+    (void)usleep((useconds_t)(latency * 2000000.0) + 20000);
+    if (stat("/tmp/mnl4c-perf.log", &sb1) != 0) {
+        FAIL("stat");
+    }
+    printf("housekept %ld bytes\n", (long)(sb1.st_size - sb0.st_size));
+}
+
+
+/*
+ * A local stand-in for syslogd: checks the header of each message and
+ * writes its MSG part to /tmp/mnl4c-perf-syslog.log.
+ */
+#define SYSLOG_SOCK "/tmp/mnl4c-perf.sock"
+static int syslog_fd = -1;
+static bool syslog_done;
+
+static void *
+syslog_recv(UNUSED void *udata)
+{
+    FILE *f;
+    char buf[8192];
+    size_t nrecv, nbad;
+
+    if ((f = fopen("/tmp/mnl4c-perf-syslog.log", "w")) == NULL) {
+        FAIL("fopen");
+    }
+    nrecv = 0;
+    nbad = 0;
+    while (true) {
+        struct pollfd pfd;
+        ssize_t nread;
+        char *p;
+        int nsp;
+
+        pfd.fd = syslog_fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 200) == 0) {
+            if (__atomic_load_n(&syslog_done, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+            continue;
+        }
+        if ((nread = recv(syslog_fd, buf, sizeof(buf), 0)) <= 0) {
+            continue;
+        }
+        ++nrecv;
+        /* <PRI>1 TIMESTAMP HOSTNAME APP-NAME PROCID - - MSG */
+        if (buf[0] != '<' ||
+            (p = memchr(buf, '>', nread)) == NULL ||
+            strncmp(p, ">1 ", 3) != 0) {
+            ++nbad;
+            continue;
+        }
+        for (nsp = 0; p < buf + nread && nsp < 7; ++p) {
+            nsp += *p == ' ';
+        }
+        if (nsp < 7) {
+            ++nbad;
+            continue;
+        }
+        (void)fwrite(p, 1, buf + nread - p, f);
+        (void)fputc('\n', f);
+    }
+    (void)fclose(f);
+    printf("syslog received %zu bad %zu\n", nrecv, nbad);
+    return NULL;
+}
+
+
+static void
+syslog_listen(void)
+{
+    struct sockaddr_un addr;
+
+    memset(&addr, '\0', sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, SYSLOG_SOCK);
+    (void)unlink(SYSLOG_SOCK);
+    if ((syslog_fd = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0) {
+        FAIL("socket");
+    }
+    if (bind(syslog_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        FAIL("bind");
+    }
 }
 
+
 int
-main(int argc, UNUSED char *argv[static argc])
+main(int argc, char *argv[static argc])
 {
     struct {
         int rnd;
@@ -63,28 +336,273 @@ main(int argc, UNUSED char *argv[static argc])
         {0,},
     };
     UNITTEST_PROLOG_RAND;
-    unsigned n;
+    unsigned flags;
+    int ch;
+    int nthreads;
+    bool throttle;
+    bool dis;
+    bool ena;
+    bool footprint;
+    bool tostdout;
+    double latency;
+    const char *sidecar;
+    unsigned sample;
+    int compress;
+    size_t maxbytes;
+    int sinklevel;
+    mnl4c_logger_t sink;
+    bool tosyslog;
+    bool tofile;
+    pthread_t syslog_thread;
     BYTES_ALLOCA(_foo, "FOO");
 
+    flags = 0;
+    nthreads = 0;
+    throttle = true;
+    dis = false;
+    ena = false;
+    footprint = false;
+    tostdout = false;
+    latency = 0.0;
+    sidecar = NULL;
+    sample = 0;
+    compress = MNL4C_COMPRESS_NONE;
+    maxbytes = 0;
+    sinklevel = -1;
+    tosyslog = false;
+    tofile = true;
+    while ((ch = getopt(argc, argv, "abcdef:Jjk:lmnopS:rs:t:ux:yZz:")) != -1) {
+        switch (ch) {
+        case 'a':
+            flags |= MNL4C_OPEN_ASYNC;
+            break;
+
+        case 'b':
+            flags |= MNL4C_OPEN_BINARY;
+            break;
+
+        case 'c':
+            footprint = true;
+            break;
+
+        case 'd':
+            dis = true;
+            break;
+
+        case 'e':
+            ena = true;
+            break;
+
+        case 'f':
+            latency = strtod(optarg, NULL);
+            break;
+
+        case 'J':
+            flags |= MNL4C_OPEN_LOGFMT;
+            break;
+
+        case 'j':
+            flags |= MNL4C_OPEN_JSON;
+            break;
+
+        case 'k':
+            sidecar = optarg;
+            break;
+
+        case 'l':
+            lt = true;
+            break;
+
+        case 'm':
+            flags |= MNL4C_OPEN_MMAP;
+            break;
+
+        case 'n':
+            flags |= MNL4C_OPEN_NONBLOCK;
+            break;
+
+        case 'o':
+            flags |= MNL4C_OPEN_DIRECT;
+            break;
+
+        case 'p':
+            tostdout = true;
+            break;
+
+        case 'S':
+            sample = strtoul(optarg, NULL, 10);
+            break;
+
+        case 'r':
+            flags |= MNL4C_OPEN_URING;
+            break;
+
+        case 's':
+            maxbytes = strtoul(optarg, NULL, 10);
+            break;
+
+        case 't':
+            nthreads = strtol(optarg, NULL, 10);
+            break;
+
+        case 'u':
+            throttle = false;
+            break;
+
+        case 'x':
+            sinklevel = strtol(optarg, NULL, 10);
+            break;
+
+        case 'y':
+            tosyslog = true;
+            break;
+
+        case 'Z':
+            flags |= MNL4C_OPEN_ZSTD;
+            break;
+
+        case 'z':
+            compress = strtol(optarg, NULL, 10);
+            break;
+
+        default:
+            fprintf(stderr, "Usage: %s [-a] [-b] [-c] [-d] [-e] [-f LATENCY] [-J] [-j] [-k SIDECAR] [-l] [-m] [-n] [-o] [-p] [-S SAMPLE] [-r] [-s MAXBYTES] [-t NTHREADS] [-u] [-x SINKLEVEL] [-y] [-Z] [-z COMPRESS]\n", argv[0]);
+            return 1;
+        }
+    }
+
     mnl4c_init();
 
-    logger = mnl4c_open(MNL4C_OPEN_FILE, "/tmp/mnl4c-perf.log", 1024*1024*16, 0.0, 10, 0);
+    if (tosyslog) {
+        syslog_listen();
+        if (pthread_create(&syslog_thread, NULL, syslog_recv, NULL) != 0) {
+            FAIL("pthread_create");
+        }
+    }
+
+    if (tosyslog && sinklevel < 0) {
+        logger = MNL4C_OPEN_TO_SYSLOG(SYSLOG_SOCK,
+                                      "testperf",
+                                      LOG_LOCAL0,
+                                      flags);
+        tofile = false;
+    } else if (tostdout) {
+        if (flags & MNL4C_OPEN_NONBLOCK) {
+            (void)fcntl(STDOUT_FILENO,
+                        F_SETFL,
+                        fcntl(STDOUT_FILENO, F_GETFL) | O_NONBLOCK);
+        }
+        logger = mnl4c_open(MNL4C_OPEN_STDOUT | flags);
+        tofile = false;
+    } else {
+        logger = mnl4c_open(MNL4C_OPEN_FILE | flags, "/tmp/mnl4c-perf.log", 1024*1024*16, 0.0, 10, 0);
+    }
+    if (logger == MNL4C_LOGGER_INVALID) {
+        FAIL("mnl4c_open");
+    }
     (void)mnl4c_set_bufsz(logger, 1024*1024*4);
+    if (tofile && mnl4c_set_compression(logger, compress, 0) != 0) {
+        FAIL("mnl4c_set_compression");
+    }
+    if (maxbytes > 0 && mnl4c_set_retention(logger, 10, maxbytes) != 0) {
+        FAIL("mnl4c_set_retention");
+    }
+    if (latency > 0.0 && mnl4c_set_flush_latency(logger, latency) != 0) {
+        FAIL("mnl4c_set_flush_latency");
+    }
+    if (sidecar != NULL &&
+        mnl4c_set_crash_flush(sidecar, 1024*1024*8) != 0) {
+        FAIL("mnl4c_set_crash_flush");
+    }
+    if (sinklevel >= 0) {
+        /* the same records once more, formatted once */
+        if (tosyslog) {
+            sink = MNL4C_OPEN_TO_SYSLOG(SYSLOG_SOCK,
+                                        "testperf",
+                                        LOG_LOCAL0,
+                                        flags & ~MNL4C_OPEN_ASYNC);
+        } else {
+            sink = mnl4c_open(MNL4C_OPEN_FILE | flags,
+                              "/tmp/mnl4c-perf-sink.log",
+                              1024*1024*16,
+                              0.0,
+                              10,
+                              0);
+        }
+        if (sink == MNL4C_LOGGER_INVALID) {
+            FAIL("mnl4c_open");
+        }
+        if (mnl4c_add_sink(logger, sink, sinklevel) != 0) {
+            FAIL("mnl4c_add_sink");
+        }
+        /* closed along with logger */
+        (void)mnl4c_close(sink);
+    }
     foo_init_logdef(logger);
     (void)mnl4c_set_level(logger, LOG_DEBUG, _foo);
-    (void)mnl4c_set_throttling(logger, 0.1, _foo);
+    if (throttle) {
+        (void)mnl4c_set_throttling(logger, 0.1, _foo);
+    }
+    if (sample > 1) {
+        (void)mnl4c_set_sampling(logger, sample, MNL4C_SAMPLE_EVERY, _foo);
+    }
 
-    n = 2230;
-    while (n--) {
-        mnbytes_t *s;
+    if (dis) {
+        disabled();
 
-        s = randline(n);
-        dosomething(n, (float)(n * 2), s);
-        BYTES_DECREF(&s);
-    }
+    } else if (ena) {
+        enabled();
 
+    } else if (nthreads <= 0) {
+        (void)worker(NULL);
 
+    } else {
+        pthread_t *threads;
+        struct timeval t0, t1;
+
+        if ((threads = malloc(sizeof(pthread_t) * nthreads)) == NULL) {
+            FAIL("malloc");
+        }
+        (void)gettimeofday(&t0, NULL);
+        for (i = 0; i < (unsigned)nthreads; ++i) {
+            if (pthread_create(&threads[i], NULL, worker, NULL) != 0) {
+                FAIL("pthread_create");
+            }
+        }
+        for (i = 0; i < (unsigned)nthreads; ++i) {
+            (void)pthread_join(threads[i], NULL);
+        }
+        (void)gettimeofday(&t1, NULL);
+        printf("threads=%d elapsed=%lf\n",
+               nthreads,
+               (double)(t1.tv_sec - t0.tv_sec) +
+               (double)(t1.tv_usec - t0.tv_usec) / 1000000.0);
+        free(threads);
+    }
+
+    if (latency > 0.0 && tofile) {
+        housekept(latency);
+    }
+    if (flags & MNL4C_OPEN_NONBLOCK) {
+        fprintf(stderr,
+                "dropped %zu %s\n",
+                mnl4c_get_dropped(logger),
+                tostdout ? "bytes" : "messages");
+    }
+    if (sidecar != NULL) {
+        /* whatever is pending is left to the crash handler */
+        abort();
+    }
     (void)mnl4c_close(logger);
     mnl4c_fini();
+    if (tosyslog) {
+        __atomic_store_n(&syslog_done, true, __ATOMIC_RELEASE);
+        (void)pthread_join(syslog_thread, NULL);
+        (void)close(syslog_fd);
+        (void)unlink(SYSLOG_SOCK);
+    }
+    if (footprint) {
+        cached();
+    }
     return 0;
 }